@@ -0,0 +1,311 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Batching of formatted events for handlers.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include "cdiagp.h"
+
+/*++
+	Routine Description:
+		Background flush, called on a thread pool thread whenever
+		the flush interval has elapsed or FlushEvent is signalled.
+--*/
+static VOID CALLBACK CdiagsFlushBatchBufferCallback(
+	__in PVOID Context,
+	__in BOOLEAN TimerOrWaitFired
+	)
+{
+	PCDIAGP_BATCH_BUFFER Batch = ( PCDIAGP_BATCH_BUFFER ) Context;
+	HRESULT Hr;
+
+	UNREFERENCED_PARAMETER( TimerOrWaitFired );
+
+	Hr = CdiagpFlushBatchBuffer( Batch );
+	if ( FAILED( Hr ) )
+	{
+		InterlockedExchange( &Batch->FlushResult, Hr );
+	}
+}
+
+/*++
+	Routine Description:
+		Copy text to the active buffer, converting it to UTF-8 if
+		necessary. If the buffer is full, it is flushed 
+		synchronously.
+--*/
+static HRESULT CdiagsAppendBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch,
+	__in PCWSTR Text,
+	__in ULONG TextCch
+	)
+{
+	ULONG Appended = 0;
+	BOOL HalfFull = FALSE;
+	HRESULT Hr;
+
+	_ASSERTE( ( Batch->Utf8 
+		? CDIAGP_MAX_UTF8_CB( TextCch ) 
+		: TextCch * sizeof( WCHAR ) ) <= Batch->Size );
+
+	while ( TextCch > 0 )
+	{
+		ULONG Available;
+		HRESULT ConvertHr = S_OK;
+
+		EnterCriticalSection( &Batch->Lock );
+
+		Available = Batch->Size - Batch->Used;
+		if ( Batch->Utf8 )
+		{
+			SIZE_T Converted;
+
+			//
+			// Convert in place, fails if buffer is too small.
+			//
+			ConvertHr = CdiagpConvertUtf16ToUtf8(
+				Text,
+				TextCch,
+				( PSTR ) Batch->Active + Batch->Used,
+				Available,
+				&Converted );
+			Appended = ( ULONG ) Converted;
+		}
+		else if ( TextCch * sizeof( WCHAR ) <= Available )
+		{
+			Appended = ( ULONG ) ( TextCch * sizeof( WCHAR ) );
+			CopyMemory(
+				Batch->Active + Batch->Used,
+				Text,
+				Appended );
+		}
+
+		Batch->Used += Appended;
+		HalfFull = Batch->Used >= Batch->Size / 2;
+
+		LeaveCriticalSection( &Batch->Lock );
+
+		if ( Appended > 0 )
+		{
+			break;
+		}
+		else if ( FAILED( ConvertHr ) && ConvertHr != CDIAG_E_BUFFER_TOO_SMALL )
+		{
+			return ConvertHr;
+		}
+
+		//
+		// Buffer full - make room and retry. As the buffer can hold
+		// at least one event, this eventually succeeds.
+		//
+		Hr = CdiagpFlushBatchBuffer( Batch );
+		if ( FAILED( Hr ) )
+		{
+			return Hr;
+		}
+	}
+
+	if ( HalfFull && Batch->FlushEvent )
+	{
+		//
+		// Have the background flush write the batch before it
+		// runs full.
+		//
+		_VERIFY( SetEvent( Batch->FlushEvent ) );
+	}
+
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Internals.
+ *
+ */
+
+HRESULT CdiagpInitializeBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch,
+	__in ULONG Size,
+	__in ULONG FlushInterval,
+	__in BOOL Utf8,
+	__in PCRITICAL_SECTION OutputLock,
+	__in CDIAGP_BATCH_FLUSH_ROUTINE FlushRoutine,
+	__in_opt PVOID Context
+	)
+{
+	_ASSERTE( Batch );
+	_ASSERTE( Size > 0 );
+	_ASSERTE( OutputLock );
+	_ASSERTE( FlushRoutine );
+
+	Batch->OutputLock	= OutputLock;
+	Batch->FlushRoutine	= FlushRoutine;
+	Batch->Context		= Context;
+	Batch->Utf8			= Utf8;
+	InitializeCriticalSection( &Batch->Lock );
+
+	//
+	// Leave room for the terminator.
+	//
+	Batch->Active	= CdiagpMalloc( Size + sizeof( WCHAR ), FALSE );
+	Batch->Pending	= CdiagpMalloc( Size + sizeof( WCHAR ), FALSE );
+	if ( ! Batch->Active || ! Batch->Pending )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	Batch->Size = Size;
+
+	if ( FlushInterval > 0 )
+	{
+		//
+		// Note: event is auto-reset.
+		//
+		Batch->FlushEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+		if ( ! Batch->FlushEvent )
+		{
+			return HRESULT_FROM_WIN32( GetLastError() );
+		}
+
+		//
+		// The callback is invoked both when the event is signalled 
+		// and when the interval has elapsed.
+		//
+		if ( ! RegisterWaitForSingleObject(
+			&Batch->WaitHandle,
+			Batch->FlushEvent,
+			CdiagsFlushBatchBufferCallback,
+			Batch,
+			FlushInterval,
+			WT_EXECUTEDEFAULT ) )
+		{
+			Batch->WaitHandle = NULL;
+			return HRESULT_FROM_WIN32( GetLastError() );
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT CdiagpFlushBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch
+	)
+{
+	PUCHAR Data;
+	ULONG DataSize;
+	HRESULT Hr = S_OK;
+
+	EnterCriticalSection( Batch->OutputLock );
+
+	//
+	// Swap buffers.
+	//
+	EnterCriticalSection( &Batch->Lock );
+
+	Data			= Batch->Active;
+	DataSize		= Batch->Used;
+	Batch->Active	= Batch->Pending;
+	Batch->Pending	= Data;
+	Batch->Used		= 0;
+
+	LeaveCriticalSection( &Batch->Lock );
+
+	if ( DataSize > 0 )
+	{
+		Hr = ( Batch->FlushRoutine )( Batch->Context, Data, DataSize );
+	}
+
+	LeaveCriticalSection( Batch->OutputLock );
+
+	return Hr;
+}
+
+HRESULT CdiagpAppendBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch,
+	__in UCHAR Severity,
+	__in_ecount( TextCch ) PCWSTR Text,
+	__in ULONG TextCch
+	)
+{
+	HRESULT Hr;
+
+	_ASSERTE( Batch->Active );
+
+	Hr = CdiagsAppendBatchBuffer( Batch, Text, TextCch );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+	else if ( Severity >= CdiagFatalSeverity )
+	{
+		return CdiagpFlushBatchBuffer( Batch );
+	}
+	else
+	{
+		return ( HRESULT ) InterlockedExchange( &Batch->FlushResult, S_OK );
+	}
+}
+
+VOID CdiagpDeleteBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch
+	)
+{
+	if ( ! Batch->OutputLock )
+	{
+		//
+		// Never initialized.
+		//
+		return;
+	}
+
+	if ( Batch->WaitHandle )
+	{
+		//
+		// Wait for the background flush to finish.
+		//
+		_VERIFY( UnregisterWaitEx( 
+			Batch->WaitHandle, 
+			INVALID_HANDLE_VALUE ) );
+	}
+
+	if ( Batch->FlushEvent )
+	{
+		_VERIFY( CloseHandle( Batch->FlushEvent ) );
+	}
+
+	if ( Batch->Active && Batch->Pending )
+	{
+		( VOID ) CdiagpFlushBatchBuffer( Batch );
+	}
+
+	if ( Batch->Active )
+	{
+		CdiagpFree( Batch->Active );
+	}
+
+	if ( Batch->Pending )
+	{
+		CdiagpFree( Batch->Pending );
+	}
+
+	DeleteCriticalSection( &Batch->Lock );
+}
@@ -0,0 +1,747 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Handler that writes raw event packets to a memory-mapped,
+ *		circular file.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include "cdiagp.h"
+
+//
+// File layout:
+//
+//   +----------------------------+
+//   |   CDIAGS_BINFILE_HEADER    |
+//   +----------------------------+ <-- HeaderSize
+//   |          Block 0           |
+//   +----------------------------+ <-- HeaderSize + BlockSize
+//   |            ...             |
+//   +----------------------------+ <-- HeaderSize + DataSize
+//
+// The data area is a ring buffer addressed by logical positions
+// that grow monotonically. Each block holds a sequence of records,
+// each record consisting of a CDIAGS_BINFILE_RECORD header,
+// followed by the self-relative event packet. Records never
+// cross block boundaries - if a record does not fit into the
+// remainder of a block, the remainder is filled by a padding
+// record. A reader can therefore start at any block boundary.
+//
+#define CDIAGS_BINFILE_SIGNATURE		'FBDC'
+#define CDIAGS_BINFILE_VERSION			1
+
+#define CDIAGS_BINFILE_HEADER_SIZE		4096
+#define CDIAGS_BINFILE_BLOCK_SIZE		( 128 * 1024 )
+#define CDIAGS_BINFILE_MIN_DATA_SIZE	( 2 * CDIAGS_BINFILE_BLOCK_SIZE )
+
+#define CDIAGS_BINFILE_ALIGNMENT_SHIFT	3
+#define CDIAGS_BINFILE_ALIGNMENT		( 1 << CDIAGS_BINFILE_ALIGNMENT_SHIFT )
+
+#define CDIAGS_BINFILE_RECORD_PADDING	0x80000000
+
+#define CDIAGS_ALIGN_UP( Value, Alignment ) \
+	( ( ( Value ) + ( Alignment ) - 1 ) & ~( ( Alignment ) - 1 ) )
+
+typedef struct _CDIAGS_BINFILE_HEADER
+{
+	ULONG Signature;
+	ULONG Version;
+	ULONG HeaderSize;
+	ULONG BlockSize;
+
+	//
+	// Size of the data area, a power of two.
+	//
+	ULONGLONG DataSize;
+
+	//
+	// Logical position up to which space has been reserved.
+	//
+	volatile LONGLONG Head;
+} CDIAGS_BINFILE_HEADER, *PCDIAGS_BINFILE_HEADER;
+
+typedef struct _CDIAGS_BINFILE_RECORD
+{
+	//
+	// Tag derived from the logical position of the record, see
+	// CdiagsRecordTag. Written last - a record whose tag does not
+	// match its position has not been completely written or
+	// belongs to an earlier cycle.
+	//
+	volatile ULONG Tag;
+
+	//
+	// Size of record including this header, aligned to
+	// CDIAGS_BINFILE_ALIGNMENT. May include
+	// CDIAGS_BINFILE_RECORD_PADDING.
+	//
+	ULONG Size;
+} CDIAGS_BINFILE_RECORD, *PCDIAGS_BINFILE_RECORD;
+
+C_ASSERT( sizeof( CDIAGS_BINFILE_HEADER ) <= CDIAGS_BINFILE_HEADER_SIZE );
+C_ASSERT( ( sizeof( CDIAGS_BINFILE_RECORD ) % CDIAGS_BINFILE_ALIGNMENT ) == 0 );
+
+//
+// Any packet fits into a block.
+//
+C_ASSERT( sizeof( CDIAGS_BINFILE_RECORD ) + MAXUSHORT < CDIAGS_BINFILE_BLOCK_SIZE );
+
+typedef struct _CDIAGP_BINARYFILE_HANDLER
+{
+	CDIAG_HANDLER Base;
+
+	volatile LONG ReferenceCount;
+
+	HANDLE File;
+	HANDLE Mapping;
+
+	PCDIAGS_BINFILE_HEADER Header;
+	PUCHAR Data;
+	ULONGLONG DataMask;
+} CDIAGP_BINARYFILE_HANDLER, *PCDIAGP_BINARYFILE_HANDLER;
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static ULONG CdiagsRecordTag(
+	__in LONGLONG Position
+	)
+{
+	//
+	// Complemented s.t. zeroed data never yields a valid record.
+	//
+	return ~( ULONG ) ( Position >> CDIAGS_BINFILE_ALIGNMENT_SHIFT );
+}
+
+static BOOL CdiagsIsValidBinaryFileHeader(
+	__in PCDIAGS_BINFILE_HEADER Header,
+	__in ULONGLONG FileSize
+	)
+{
+	return Header->Signature == CDIAGS_BINFILE_SIGNATURE &&
+		   Header->Version == CDIAGS_BINFILE_VERSION &&
+		   Header->HeaderSize == CDIAGS_BINFILE_HEADER_SIZE &&
+		   Header->BlockSize == CDIAGS_BINFILE_BLOCK_SIZE &&
+		   Header->DataSize >= CDIAGS_BINFILE_MIN_DATA_SIZE &&
+		   ( Header->DataSize & ( Header->DataSize - 1 ) ) == 0 &&
+		   Header->HeaderSize + Header->DataSize <= FileSize &&
+		   Header->Head >= 0;
+}
+
+/*++
+	Routine Description:
+		Check that Offset refers to a string that lies within 
+		[MinOffset, Limit) of Base and is terminated before Limit.
+--*/
+static BOOL CdiagsIsValidStringOffset(
+	__in CONST UCHAR *Base,
+	__in ULONG MinOffset,
+	__in ULONG Limit,
+	__in DWORD Offset
+	)
+{
+	if ( Offset < MinOffset ||
+		 Offset >= Limit ||
+		 ( Offset % sizeof( WCHAR ) ) != 0 )
+	{
+		return FALSE;
+	}
+
+	return SUCCEEDED( StringCchLength(
+		( PCWSTR ) ( Base + Offset ),
+		( Limit - Offset ) / sizeof( WCHAR ),
+		NULL ) );
+}
+
+/*++
+	Routine Description:
+		Check that all offsets of a packet read from a file refer 
+		to data within the packet. The file may contain torn or
+		corrupt records, so nothing beyond the header may be 
+		trusted before this check has passed.
+--*/
+static BOOL CdiagsIsWellFormedEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	CONST UCHAR *Base = ( CONST UCHAR* ) Packet;
+	ULONG TotalSize = Packet->TotalSize;
+	ULONG Index;
+
+	_ASSERTE( CdiagsIsValidEventPacket( Packet ) );
+
+	if ( Packet->MessageInsertionStrings.Count > 
+			CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS ||
+		 FIELD_OFFSET( 
+			CDIAG_EVENT_PACKET, 
+			MessageInsertionStrings.Offset ) +
+			Packet->MessageInsertionStrings.Count * sizeof( DWORD ) > 
+			TotalSize )
+	{
+		return FALSE;
+	}
+
+	for ( Index = 0; Index < Packet->MessageInsertionStrings.Count; Index++ )
+	{
+		if ( ! CdiagsIsValidStringOffset(
+			Base,
+			Packet->Size,
+			TotalSize,
+			Packet->MessageInsertionStrings.Offset[ Index ] ) )
+		{
+			return FALSE;
+		}
+	}
+
+	if ( ( Packet->MachineOffset != 0 &&
+		   ! CdiagsIsValidStringOffset( 
+				Base, Packet->Size, TotalSize, Packet->MachineOffset ) ) ||
+		 ( Packet->MessageOffset != 0 &&
+		   ! CdiagsIsValidStringOffset( 
+				Base, Packet->Size, TotalSize, Packet->MessageOffset ) ) )
+	{
+		return FALSE;
+	}
+
+	if ( Packet->CustomData.Length != 0 &&
+		 ( Packet->CustomData.Offset < Packet->Size ||
+		   Packet->CustomData.Offset > TotalSize ||
+		   Packet->CustomData.Length > TotalSize - Packet->CustomData.Offset ) )
+	{
+		return FALSE;
+	}
+
+	if ( Packet->DebugInfoOffset != 0 )
+	{
+		PCDIAG_DEBUG_INFO DebugInfo;
+		ULONG DebugInfoSize;
+
+		if ( Packet->DebugInfoOffset < Packet->Size ||
+			 Packet->DebugInfoOffset > TotalSize - sizeof( CDIAG_DEBUG_INFO ) ||
+			 ( Packet->DebugInfoOffset % sizeof( DWORD ) ) != 0 )
+		{
+			return FALSE;
+		}
+
+		DebugInfo = ( PCDIAG_DEBUG_INFO ) ( Base + Packet->DebugInfoOffset );
+		DebugInfoSize = DebugInfo->TotalSize;
+
+		if ( DebugInfo->Size != sizeof( CDIAG_DEBUG_INFO ) ||
+			 DebugInfoSize < DebugInfo->Size ||
+			 DebugInfoSize > TotalSize - Packet->DebugInfoOffset )
+		{
+			return FALSE;
+		}
+
+		if ( ( DebugInfo->ModuleOffset != 0 &&
+			   ! CdiagsIsValidStringOffset( 
+					( CONST UCHAR* ) DebugInfo, 
+					DebugInfo->Size, 
+					DebugInfoSize, 
+					DebugInfo->ModuleOffset ) ) ||
+			 ( DebugInfo->FunctionNameOffset != 0 &&
+			   ! CdiagsIsValidStringOffset( 
+					( CONST UCHAR* ) DebugInfo, 
+					DebugInfo->Size, 
+					DebugInfoSize, 
+					DebugInfo->FunctionNameOffset ) ) ||
+			 ( DebugInfo->SourceFileOffset != 0 &&
+			   ! CdiagsIsValidStringOffset( 
+					( CONST UCHAR* ) DebugInfo, 
+					DebugInfo->Size, 
+					DebugInfoSize, 
+					DebugInfo->SourceFileOffset ) ) )
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*++
+	Routine Description:
+		Open and map a binary file.
+
+	Parameters:
+		DataSize	Size of data area to use when creating or
+					reinitializing the file, 0 to open an
+					existing file read-only.
+--*/
+static HRESULT CdiagsMapBinaryFile(
+	__in PCWSTR FilePath,
+	__in ULONG DataSize,
+	__out PHANDLE File,
+	__out PHANDLE Mapping,
+	__out PCDIAGS_BINFILE_HEADER *Header
+	)
+{
+	BOOL ReadOnly = ( DataSize == 0 );
+	PCDIAGS_BINFILE_HEADER MappedHeader = NULL;
+	CDIAGS_BINFILE_HEADER ExistingHeader;
+	LARGE_INTEGER FileSize;
+	HANDLE MappedFile;
+	HANDLE FileMapping = NULL;
+	DWORD Read;
+	HRESULT Hr;
+
+	MappedFile = CreateFile(
+		FilePath,
+		ReadOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+		ReadOnly ? FILE_SHARE_READ | FILE_SHARE_WRITE : FILE_SHARE_READ,
+		NULL,
+		ReadOnly ? OPEN_EXISTING : OPEN_ALWAYS,
+		0,
+		NULL );
+	if ( MappedFile == INVALID_HANDLE_VALUE )
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	if ( ! GetFileSizeEx( MappedFile, &FileSize ) ||
+		 ! ReadFile(
+			MappedFile,
+			&ExistingHeader,
+			sizeof( ExistingHeader ),
+			&Read,
+			NULL ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+
+	if ( Read < sizeof( ExistingHeader ) ||
+		 ! CdiagsIsValidBinaryFileHeader(
+			&ExistingHeader,
+			( ULONGLONG ) FileSize.QuadPart ) ||
+		 ( ! ReadOnly && ExistingHeader.DataSize != DataSize ) )
+	{
+		if ( ReadOnly )
+		{
+			Hr = CDIAG_E_INVALID_BINARY_FILE;
+			goto Cleanup;
+		}
+
+		//
+		// New file or different geometry - (re-)initialize. Truncate
+		// first s.t. the data area is zeroed.
+		//
+		FileSize.QuadPart = 0;
+		if ( ! SetFilePointerEx( MappedFile, FileSize, NULL, FILE_BEGIN ) ||
+			 ! SetEndOfFile( MappedFile ) )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+
+		FileSize.QuadPart = CDIAGS_BINFILE_HEADER_SIZE + DataSize;
+		if ( ! SetFilePointerEx( MappedFile, FileSize, NULL, FILE_BEGIN ) ||
+			 ! SetEndOfFile( MappedFile ) )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+
+		ExistingHeader.Signature	= 0;
+	}
+
+	FileMapping = CreateFileMapping(
+		MappedFile,
+		NULL,
+		ReadOnly ? PAGE_READONLY : PAGE_READWRITE,
+		0,
+		0,
+		NULL );
+	if ( ! FileMapping )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+
+	MappedHeader = ( PCDIAGS_BINFILE_HEADER ) MapViewOfFile(
+		FileMapping,
+		ReadOnly ? FILE_MAP_READ : FILE_MAP_WRITE,
+		0,
+		0,
+		0 );
+	if ( ! MappedHeader )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+
+	if ( ! ReadOnly )
+	{
+		if ( ExistingHeader.Signature == 0 )
+		{
+			MappedHeader->Version		= CDIAGS_BINFILE_VERSION;
+			MappedHeader->HeaderSize	= CDIAGS_BINFILE_HEADER_SIZE;
+			MappedHeader->BlockSize		= CDIAGS_BINFILE_BLOCK_SIZE;
+			MappedHeader->DataSize		= DataSize;
+			MappedHeader->Head			= 0;
+			MappedHeader->Signature		= CDIAGS_BINFILE_SIGNATURE;
+		}
+		else
+		{
+			//
+			// Continue after the records of the previous writer. As
+			// it may have stopped midway, start a new block.
+			//
+			MappedHeader->Head = CDIAGS_ALIGN_UP(
+				MappedHeader->Head,
+				( LONGLONG ) CDIAGS_BINFILE_BLOCK_SIZE );
+		}
+	}
+
+	*File		= MappedFile;
+	*Mapping	= FileMapping;
+	*Header		= MappedHeader;
+
+	return S_OK;
+
+Cleanup:
+	if ( FileMapping )
+	{
+		_VERIFY( CloseHandle( FileMapping ) );
+	}
+
+	_VERIFY( CloseHandle( MappedFile ) );
+
+	return Hr;
+}
+
+/*++
+	Routine Description:
+		Write a record and publish it by writing its tag.
+--*/
+static VOID CdiagsWriteRecord(
+	__in PCDIAGP_BINARYFILE_HANDLER FileHandler,
+	__in LONGLONG Position,
+	__in ULONG Size,
+	__in_opt PCDIAG_EVENT_PACKET Packet
+	)
+{
+	PCDIAGS_BINFILE_RECORD Record = ( PCDIAGS_BINFILE_RECORD )
+		( FileHandler->Data + ( ( ULONGLONG ) Position & FileHandler->DataMask ) );
+
+	Record->Size = Size;
+
+	if ( Packet )
+	{
+		CopyMemory( Record + 1, Packet, Packet->TotalSize );
+	}
+
+	//
+	// Volatile write, ordered after the writes above.
+	//
+	Record->Tag = CdiagsRecordTag( Position );
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Methods.
+ *
+ */
+
+static HRESULT CdiagsBinaryFileHandle(
+	__in PCDIAG_HANDLER This,
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	PCDIAGP_BINARYFILE_HANDLER FileHandler = ( PCDIAGP_BINARYFILE_HANDLER ) This;
+	LONGLONG Head;
+	LONGLONG Start;
+	LONGLONG Previous;
+	ULONG Remaining;
+	ULONG RecordSize;
+
+	if ( ! FileHandler ||
+		 ! CdiagpIsValidHandler( FileHandler ) ||
+		 ! CdiagsIsValidEventPacket( Packet ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	RecordSize = CDIAGS_ALIGN_UP(
+		sizeof( CDIAGS_BINFILE_RECORD ) + Packet->TotalSize,
+		CDIAGS_BINFILE_ALIGNMENT );
+
+	//
+	// Reserve space. If the record does not fit into the current
+	// block, skip to the next one. A torn read of Head on 32 bit
+	// platforms merely makes the first attempt fail.
+	//
+	Head = FileHandler->Header->Head;
+	for ( ;; )
+	{
+		Remaining = CDIAGS_BINFILE_BLOCK_SIZE -
+			( ( ULONG ) Head & ( CDIAGS_BINFILE_BLOCK_SIZE - 1 ) );
+		Start = Remaining < RecordSize ? Head + Remaining : Head;
+
+		Previous = InterlockedCompareExchange64(
+			&FileHandler->Header->Head,
+			Start + RecordSize,
+			Head );
+		if ( Previous == Head )
+		{
+			break;
+		}
+
+		Head = Previous;
+	}
+
+	if ( Start != Head )
+	{
+		CdiagsWriteRecord(
+			FileHandler,
+			Head,
+			Remaining | CDIAGS_BINFILE_RECORD_PADDING,
+			NULL );
+	}
+
+	CdiagsWriteRecord( FileHandler, Start, RecordSize, Packet );
+
+	return S_OK;
+}
+
+static VOID CdiagsBinaryFileDeleteHandler(
+	__in PCDIAGP_BINARYFILE_HANDLER FileHandler
+	)
+{
+	if ( FileHandler->Header )
+	{
+		_VERIFY( UnmapViewOfFile( FileHandler->Header ) );
+	}
+
+	if ( FileHandler->Mapping )
+	{
+		_VERIFY( CloseHandle( FileHandler->Mapping ) );
+	}
+
+	if ( FileHandler->File )
+	{
+		_VERIFY( CloseHandle( FileHandler->File ) );
+	}
+
+	CdiagpFree( FileHandler );
+}
+
+static HRESULT CdiagsBinaryFileSetNextHandler(
+	__in PCDIAG_HANDLER This,
+	__in PCDIAG_HANDLER Handler
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( Handler );
+	return CDIAG_E_CHAINING_NOT_SUPPORTED;
+}
+
+static HRESULT CdiagsBinaryFileGetNextHandler(
+	__in PCDIAG_HANDLER This,
+	__out_opt PCDIAG_HANDLER *Handler
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( Handler );
+	return CDIAG_E_CHAINING_NOT_SUPPORTED;
+}
+
+static VOID CdiagsBinaryFileReferenceHandler(
+	__in PCDIAG_HANDLER This
+	)
+{
+	PCDIAGP_BINARYFILE_HANDLER FileHandler = ( PCDIAGP_BINARYFILE_HANDLER ) This;
+	_ASSERTE( CdiagpIsValidHandler( FileHandler ) );
+
+	InterlockedIncrement( &FileHandler->ReferenceCount );
+}
+
+static VOID CdiagsBinaryFileDereferenceHandler(
+	__in PCDIAG_HANDLER This
+	)
+{
+	PCDIAGP_BINARYFILE_HANDLER FileHandler = ( PCDIAGP_BINARYFILE_HANDLER ) This;
+	_ASSERTE( CdiagpIsValidHandler( FileHandler ) );
+
+	if ( 0 == InterlockedDecrement( &FileHandler->ReferenceCount ) )
+	{
+		CdiagsBinaryFileDeleteHandler( FileHandler );
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Public.
+ *
+ */
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBinaryFileHandler(
+	__in PCWSTR FilePath,
+	__in ULONG FileSize,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	PCDIAGP_BINARYFILE_HANDLER FileHandler;
+	ULONG DataSize;
+	HRESULT Hr;
+
+	if ( ! FilePath || ! Handler )
+	{
+		return E_INVALIDARG;
+	}
+
+	*Handler = NULL;
+
+	if ( FileSize == 0 )
+	{
+		FileSize = CDIAG_BINARYFILE_DEFAULT_SIZE;
+	}
+
+	//
+	// Largest power of two that fits, but at least the minimum.
+	//
+	DataSize = CDIAGS_BINFILE_MIN_DATA_SIZE;
+	while ( FileSize > CDIAGS_BINFILE_HEADER_SIZE &&
+			DataSize <= ( FileSize - CDIAGS_BINFILE_HEADER_SIZE ) / 2 )
+	{
+		DataSize *= 2;
+	}
+
+	FileHandler = CdiagpMalloc( sizeof( CDIAGP_BINARYFILE_HANDLER ), TRUE );
+	if ( ! FileHandler )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	FileHandler->ReferenceCount = 1;
+	FileHandler->Base.Size = sizeof( CDIAG_HANDLER );
+
+	FileHandler->Base.Reference				= CdiagsBinaryFileReferenceHandler;
+	FileHandler->Base.Dereference			= CdiagsBinaryFileDereferenceHandler;
+	FileHandler->Base.GetNextHandler		= CdiagsBinaryFileGetNextHandler;
+	FileHandler->Base.SetNextHandler		= CdiagsBinaryFileSetNextHandler;
+	FileHandler->Base.Handle				= CdiagsBinaryFileHandle;
+
+	Hr = CdiagsMapBinaryFile(
+		FilePath,
+		DataSize,
+		&FileHandler->File,
+		&FileHandler->Mapping,
+		&FileHandler->Header );
+	if ( FAILED( Hr ) )
+	{
+		CdiagpFree( FileHandler );
+		return Hr;
+	}
+
+	FileHandler->Data		= ( PUCHAR ) FileHandler->Header + CDIAGS_BINFILE_HEADER_SIZE;
+	FileHandler->DataMask	= DataSize - 1;
+
+	*Handler = &FileHandler->Base;
+	return S_OK;
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagReadBinaryFile(
+	__in PCWSTR FilePath,
+	__in CDIAG_BINARYFILE_CALLBACK Callback,
+	__in_opt PVOID Context
+	)
+{
+	PCDIAGS_BINFILE_HEADER Header;
+	LONGLONG Position;
+	LONGLONG Head;
+	HANDLE Mapping;
+	HANDLE File;
+	PUCHAR Data;
+	HRESULT Hr;
+
+	if ( ! FilePath || ! Callback )
+	{
+		return E_INVALIDARG;
+	}
+
+	Hr = CdiagsMapBinaryFile( FilePath, 0, &File, &Mapping, &Header );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	Data = ( PUCHAR ) Header + Header->HeaderSize;
+	Head = Header->Head;
+
+	//
+	// The block Head points into has partially been overwritten
+	// already, so start at the block following it.
+	//
+	Position = ( ULONGLONG ) Head > Header->DataSize
+		? CDIAGS_ALIGN_UP(
+			Head - ( LONGLONG ) Header->DataSize,
+			( LONGLONG ) Header->BlockSize )
+		: 0;
+
+	while ( Position < Head )
+	{
+		PCDIAGS_BINFILE_RECORD Record = ( PCDIAGS_BINFILE_RECORD )
+			( Data + ( ( ULONGLONG ) Position & ( Header->DataSize - 1 ) ) );
+		ULONG Remaining = Header->BlockSize -
+			( ( ULONG ) Position & ( Header->BlockSize - 1 ) );
+		ULONG Size = Record->Size & ~CDIAGS_BINFILE_RECORD_PADDING;
+		PCDIAG_EVENT_PACKET Packet = ( PCDIAG_EVENT_PACKET ) ( Record + 1 );
+
+		if ( Record->Tag != CdiagsRecordTag( Position ) ||
+			 Size < sizeof( CDIAGS_BINFILE_RECORD ) ||
+			 Size > Remaining ||
+			 ( Size % CDIAGS_BINFILE_ALIGNMENT ) != 0 )
+		{
+			//
+			// Incomplete or stale record - the rest of the block
+			// cannot be trusted.
+			//
+			Position += Remaining;
+			continue;
+		}
+
+		if ( ! ( Record->Size & CDIAGS_BINFILE_RECORD_PADDING ) &&
+			 Size >= sizeof( CDIAGS_BINFILE_RECORD ) + sizeof( CDIAG_EVENT_PACKET ) &&
+			 CdiagsIsValidEventPacket( Packet ) &&
+			 Packet->TotalSize <= Size - sizeof( CDIAGS_BINFILE_RECORD ) &&
+			 Packet->Type <= CdiagMaxEvent &&
+			 Packet->Severity <= CdiagMaxSeverity &&
+			 CdiagsIsWellFormedEventPacket( Packet ) )
+		{
+			if ( ! ( Callback )( Packet, Context ) )
+			{
+				break;
+			}
+		}
+
+		Position += Size;
+	}
+
+	_VERIFY( UnmapViewOfFile( Header ) );
+	_VERIFY( CloseHandle( Mapping ) );
+	_VERIFY( CloseHandle( File ) );
+
+	return S_OK;
+}
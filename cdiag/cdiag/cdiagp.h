@@ -25,6 +25,7 @@
 
 #include <cdiag.h>
 #include <crtdbg.h>
+#include <epoch.h>
 
 #ifdef _DEBUG
 #define _VERIFY _ASSERTE
@@ -42,7 +43,9 @@ extern HMODULE CdiagpModule;
 
 /*++
 	Routine Description:
-		Allocate memory.
+		Allocate memory. Small allocations are served from 
+		per-size-class pools with per-thread caches, all backed by
+		a private heap.
 
 	Parameters:
 		Size	Size of memory to allocate
@@ -68,6 +71,20 @@ VOID CdiagpFree(
 	__in PVOID Ptr
 	);
 
+/*----------------------------------------------------------------------
+ *
+ * Synchronization
+ *
+ */
+
+/*++
+	Routine Description:
+		Yield routine to pass to JphtSynchronizeEpoch. Readers
+		may be preempted, so rather than spinning, the processor 
+		is yielded while waiting for them.
+--*/
+VOID CdiagpYieldEpoch();
+
 /*----------------------------------------------------------------------
  *
  * String handling
@@ -96,6 +113,43 @@ BOOL CdiagpIsStringValid(
 	__in BOOL AllowWhitespaceOnly
 	);
 
+/*++
+	Maximum number of bytes required to encode a UTF-16 string
+	of the given length as UTF-8.
+--*/
+#define CDIAGP_MAX_UTF8_CB( Cch ) ( ( Cch ) * 3 )
+
+/*++
+	Routine description:
+		Converts UTF-16 to UTF-8. Produces the same result as
+		WideCharToMultiByte( CP_UTF8 ), i.e. unpaired surrogates
+		are replaced by U+FFFD. No null termination is appended.
+
+	Parameters:
+		Source		- String to convert, need not be null-terminated.
+		SourceCch	- Length of Source in characters.
+		Target		- Buffer to receive the result.
+		TargetSize	- Size of Target in bytes. Using 
+					  CDIAGP_MAX_UTF8_CB( SourceCch ) bytes 
+					  guarantees success.
+		Written		- Number of bytes written.
+
+	Returns:
+		S_OK on success
+		CDIAG_E_BUFFER_TOO_SMALL if Target is too small. Target's
+			contents are undefined and Written is 0.
+--*/
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CDIAGCALLTYPE CdiagpConvertUtf16ToUtf8(
+	__in_ecount( SourceCch ) PCWSTR Source,
+	__in SIZE_T SourceCch,
+	__out_bcount_part( TargetSize, *Written ) PSTR Target,
+	__in SIZE_T TargetSize,
+	__out PSIZE_T Written
+	);
+
 /*----------------------------------------------------------------------
  *
  * String formatting
@@ -169,6 +223,445 @@ HRESULT CdiagpFormatString(
 	__out_ecount(BufferSizeInChars) PWSTR Buffer 
 	);
 
+//
+// Maximum number of variables a compiled template may refer to.
+//
+#define CDIAGP_MAX_FORMAT_VARIABLES 32
+
+typedef struct _FORMAT_PROGRAM *PFORMAT_PROGRAM;
+
+/*++
+	Routine Description:
+		Compile a template (see CdiagpFormatString) into a list of
+		literal spans and bound variables s.t. formatting neither
+		requires the template to be parsed nor variable names to
+		be looked up again.
+
+	Parameters:
+		VarCount	- Number of variables, at most 
+					  CDIAGP_MAX_FORMAT_VARIABLES.
+		Variables	- Variable definitions. Must remain valid for
+					  the lifetime of the program.
+		Format		- The format template.
+		Program		- Result. Free using CdiagpFreeFormatProgram.
+
+	Return Value:
+		S_OK on success.
+		(any HRESULT) on failure
+--*/
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CdiagpCompileFormatString(
+	__in ULONG VarCount,
+	__in CONST PFORMAT_VARIABLE Variables,
+	__in PCWSTR Format,
+	__out PFORMAT_PROGRAM *Program
+	);
+
+/*++
+	Routine Description:
+		Free a program created by CdiagpCompileFormatString.
+--*/
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+VOID CdiagpFreeFormatProgram(
+	__in PFORMAT_PROGRAM Program
+	);
+
+/*++
+	Routine Description:
+		Determine whether a program refers to a variable, i.e.
+		whether the binding of this variable is used.
+--*/
+BOOL CdiagpIsVariableUsedFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in ULONG VariableIndex
+	);
+
+/*++
+	Routine Description:
+		Format a string according to a compiled template. Yields
+		the same result as CdiagpFormatString.
+
+	Parameters:
+		Program		- Compiled template.
+		Bindings	- Values. Only bindings of variables used by
+					  the program are accessed.
+		BufferSizeInChars
+		Buffer
+
+	Return Value:
+		S_OK on success.
+		CDIAG_E_BUFFER_TOO_SMALL if the buffer is too small.
+		(any HRESULT) on failure
+--*/
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CdiagpRunFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in DWORD_PTR *Bindings,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer 
+	);
+
+
+/*----------------------------------------------------------------------
+ *
+ * Compression.
+ *
+ */
+
+/*++
+	Routine Description:
+		Compress a file into an LZ4 frame made up of independently
+		compressed blocks. The result can be decompressed by the
+		lz4 command line tool.
+
+	Parameters:
+		SourcePath	File to compress.
+		TargetPath	File to write compressed data to. Overwritten
+					if it exists, deleted on failure.
+
+	Return Value:
+		S_OK on success.
+		(any HRESULT) on failure
+--*/
+HRESULT CdiagpCompressFile(
+	__in PCWSTR SourcePath,
+	__in PCWSTR TargetPath
+	);
+
+/*----------------------------------------------------------------------
+ *
+ * Event batching.
+ *
+ */
+
+/*++
+	Routine Description:
+		Called to write out a batch of events. Data is followed by
+		room for a UNICODE_NULL, which the routine may use to 
+		terminate the batch.
+
+		Called with the output lock held.
+--*/
+typedef HRESULT ( *CDIAGP_BATCH_FLUSH_ROUTINE )(
+	__in PVOID Context,
+	__in PUCHAR Data,
+	__in ULONG DataSize
+	);
+
+/*++
+	Structure Description:
+		Double buffer events are appended to by handlers and 
+		written out in batches - either when the buffer runs full,
+		when a fatal event is appended, or by a thread pool thread
+		whenever the flush interval has elapsed or the buffer is
+		half full.
+
+		Lock ordering: OutputLock must be acquired before Lock.
+		
+		Initialize by zeroing, then calling 
+		CdiagpInitializeBatchBuffer.
+--*/
+typedef struct _CDIAGP_BATCH_BUFFER
+{
+	//
+	// Serializes calls to FlushRoutine s.t. batches are written
+	// in order. Owned by the caller, which may use it to serialize
+	// other output as well.
+	//
+	PCRITICAL_SECTION OutputLock;
+
+	CDIAGP_BATCH_FLUSH_ROUTINE FlushRoutine;
+	PVOID Context;
+
+	//
+	// Store text as UTF-8 rather than UTF-16.
+	//
+	BOOL Utf8;
+
+	//
+	// Protects Active and Used. Held for copying only, never
+	// for calling FlushRoutine.
+	//
+	CRITICAL_SECTION Lock;
+
+	//
+	// Buffer events are appended to and buffer being written.
+	// Both are Size bytes large, plus room for a terminator.
+	//
+	PUCHAR Active;
+	PUCHAR Pending;
+	ULONG Used;
+	ULONG Size;
+
+	HANDLE FlushEvent;
+	HANDLE WaitHandle;
+
+	//
+	// Result of last background flush, reported by the next
+	// append.
+	//
+	volatile LONG FlushResult;
+} CDIAGP_BATCH_BUFFER, *PCDIAGP_BATCH_BUFFER;
+
+/*++
+	Routine Description:
+		Allocate buffers and, if FlushInterval is nonzero, start
+		the background flush.
+
+	Parameters:
+		Batch			- Zeroed buffer to initialize.
+		Size			- Size of each buffer in bytes. Must be large
+						  enough to hold any single event.
+		FlushInterval	- Interval in ms, 0 to only flush when the
+						  buffer is full.
+		Utf8			- Store text as UTF-8.
+		OutputLock		- Lock to hold while flushing.
+		FlushRoutine	- Routine to write out batches.
+		Context			- Passed to FlushRoutine.
+
+	Return Value:
+		S_OK on success.
+		(any HRESULT) on failure. CdiagpDeleteBatchBuffer must
+			still be called.
+--*/
+HRESULT CdiagpInitializeBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch,
+	__in ULONG Size,
+	__in ULONG FlushInterval,
+	__in BOOL Utf8,
+	__in PCRITICAL_SECTION OutputLock,
+	__in CDIAGP_BATCH_FLUSH_ROUTINE FlushRoutine,
+	__in_opt PVOID Context
+	);
+
+/*++
+	Routine Description:
+		Write out the current batch. Appending may continue while
+		FlushRoutine is running.
+--*/
+HRESULT CdiagpFlushBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch
+	);
+
+/*++
+	Routine Description:
+		Append a formatted event. If the buffer is full, it is 
+		flushed synchronously. Fatal events may be followed by the
+		process going down, so they are flushed immediately.
+
+	Return Value:
+		S_OK on success.
+		(any HRESULT) if appending, flushing or the last background
+			flush failed.
+--*/
+HRESULT CdiagpAppendBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch,
+	__in UCHAR Severity,
+	__in_ecount( TextCch ) PCWSTR Text,
+	__in ULONG TextCch
+	);
+
+/*++
+	Routine Description:
+		Stop the background flush, write out what is left and free
+		the buffers. OutputLock must still be valid.
+--*/
+VOID CdiagpDeleteBatchBuffer(
+	__in PCDIAGP_BATCH_BUFFER Batch
+	);
+
+/*----------------------------------------------------------------------
+ *
+ * Configuration snapshots.
+ *
+ */
+
+/*++
+	Structure Description:
+		Setting held by a configuration snapshot. Data, group name
+		and name are stored inline, following the structure.
+--*/
+typedef struct _CDIAGP_CONFIG_ENTRY
+{
+	//
+	// CdiagGlobalScope or CdiagUserScope.
+	//
+	DWORD Scope;
+
+	//
+	// REG_DWORD, REG_SZ or REG_MULTI_SZ.
+	//
+	DWORD Type;
+
+	PCWSTR GroupName;
+	PCWSTR Name;
+
+	DWORD DataSize;
+	PBYTE Data;
+} CDIAGP_CONFIG_ENTRY, *PCDIAGP_CONFIG_ENTRY;
+
+/*++
+	Structure Description:
+		Set of settings, sorted by scope, group name and name
+		(case-insensitive).
+
+		A snapshot is modified by its creator only - once it has
+		been published by CdiagpPublishConfigSnapshot, it must
+		be treated as immutable.
+--*/
+typedef struct _CDIAGP_CONFIG_SNAPSHOT
+{
+	//
+	// Combination of CdiagGlobalScope and CdiagUserScope denoting
+	// the scopes that may be read. Reading any other scope fails
+	// with E_ACCESSDENIED.
+	//
+	DWORD ReadableScopes;
+
+	ULONG EntryCount;
+	ULONG EntryCapacity;
+	PCDIAGP_CONFIG_ENTRY *Entries;
+} CDIAGP_CONFIG_SNAPSHOT, *PCDIAGP_CONFIG_SNAPSHOT;
+
+/*++
+	Structure Description:
+		Holds the current snapshot of a configuration store. Reads
+		do not take any locks, updates replace the snapshot as a
+		whole.
+
+		Initialize by zeroing.
+--*/
+typedef struct _CDIAGP_CONFIG_CACHE
+{
+	//
+	// Current snapshot, NULL until the first one is published.
+	// Updates must be serialized by the caller; the caller may
+	// access the current snapshot (read-only) while holding 
+	// the lock used to serialize updates.
+	//
+	PCDIAGP_CONFIG_SNAPSHOT volatile Current;
+
+	//
+	// Epoch-based reclamation of replaced snapshots.
+	//
+	JPHT_EPOCH Reclamation;
+} CDIAGP_CONFIG_CACHE, *PCDIAGP_CONFIG_CACHE;
+
+/*++
+	Routine Description:
+		Create an empty snapshot.
+
+	Parameters:
+		ReadableScopes	See CDIAGP_CONFIG_SNAPSHOT.
+		Snapshot		Result. Free using CdiagpFreeConfigSnapshot.
+--*/
+HRESULT CdiagpCreateConfigSnapshot(
+	__in DWORD ReadableScopes,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	);
+
+/*++
+	Routine Description:
+		Create a deep copy of a snapshot.
+--*/
+HRESULT CdiagpCopyConfigSnapshot(
+	__in PCDIAGP_CONFIG_SNAPSHOT Source,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	);
+
+/*++
+	Routine Description:
+		Free a snapshot that has not been published.
+--*/
+VOID CdiagpFreeConfigSnapshot(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	);
+
+/*++
+	Routine Description:
+		Add a setting to a snapshot or replace an existing one.
+
+	Parameters:
+		Scope		CdiagGlobalScope or CdiagUserScope.
+		Type		REG_DWORD, REG_SZ or REG_MULTI_SZ.
+--*/
+HRESULT CdiagpSetConfigSnapshotEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Type,
+	__in DWORD DataSize,
+	__in_bcount( DataSize ) CONST VOID *Data
+	);
+
+/*++
+	Routine Description:
+		Remove a setting from a snapshot.
+
+	Returns:
+		S_OK on success
+		CDIAG_E_SETTING_NOT_FOUND if setting not found
+--*/
+HRESULT CdiagpDeleteConfigSnapshotEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name
+	);
+
+/*++
+	Routine Description:
+		Read a setting from the current snapshot of a cache. 
+		Semantics match those of CDIAG_CONFIGURATION_STORE's ReadXxx
+		methods: User scope takes precedence over global scope
+		for CdiagEffectiveScope, ActualLen is in bytes.
+
+	Returns:
+		S_OK on success
+		CDIAG_E_SETTING_NOT_FOUND if setting not found
+		CDIAG_E_BUFFER_TOO_SMALL if supplied buffer too small
+		CDIAG_E_SETTING_MISMATCH if datatype mismatch
+		E_ACCESSDENIED if the scope is not readable
+--*/
+HRESULT CdiagpReadConfigCache(
+	__in PCDIAGP_CONFIG_CACHE Cache,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD ExpectedType,
+	__in DWORD BufferLen,
+	__out_bcount( BufferLen ) PVOID Buffer,
+	__out_opt DWORD *ActualLen
+	);
+
+/*++
+	Routine Description:
+		Replace the current snapshot and free the previous one once
+		no reader can refer to it any more. The cache takes 
+		ownership of the snapshot.
+
+		Calls must be serialized by the caller.
+--*/
+VOID CdiagpPublishConfigSnapshot(
+	__in PCDIAGP_CONFIG_CACHE Cache,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	);
+
+/*++
+	Routine Description:
+		Free the current snapshot. There must not be any concurrent
+		readers.
+--*/
+VOID CdiagpDeleteConfigCache(
+	__in PCDIAGP_CONFIG_CACHE Cache
+	);
 
 /*----------------------------------------------------------------------
  *
@@ -177,6 +670,51 @@ HRESULT CdiagpFormatString(
  */
 VOID CdiagpInitializeFormatter();
 
+/*++
+	Routine Description:
+		Allocate the TLS slot used for event packet arenas. Must be
+		called from DllMain on process attachment.
+--*/
+BOOL CdiagpSetupEventPacketArena();
+
+/*++
+	Routine Description:
+		Free the current thread's arena and the TLS slot. Must be
+		called from DllMain on process detachment.
+--*/
+VOID CdiagpTeardownEventPacketArena();
+
+/*++
+	Routine Description:
+		Free the current thread's arena, if any. Must be called from
+		DllMain on thread detachment.
+--*/
+VOID CdiagpFreeEventPacketArena();
+
+/*++
+	Routine Description:
+		Allocate the TLS slot used for per-thread allocator caches.
+		Must be called from DllMain on process attachment. Without
+		it, all threads share the process-wide pools.
+--*/
+BOOL CdiagpSetupAllocator();
+
+/*++
+	Routine Description:
+		Free the current thread's cache, the TLS slot and the
+		process-wide pools. Must be called from DllMain on process
+		detachment, after all other teardown routines.
+--*/
+VOID CdiagpTeardownAllocator();
+
+/*++
+	Routine Description:
+		Return the current thread's cached blocks to the process-wide
+		pools. Must be called from DllMain on thread detachment, after
+		all other per-thread cleanup routines.
+--*/
+VOID CdiagpFreeThreadAllocatorCache();
+
 
 /*----------------------------------------------------------------------
  *
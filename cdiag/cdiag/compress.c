@@ -0,0 +1,427 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		LZ4 frame compression of files.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include "cdiagp.h"
+
+//
+// Files are compressed into LZ4 frames (as understood by the lz4
+// command line tool) consisting of independent blocks of at most
+// 64 KB. Each block can be decoded on its own, so a reader never
+// needs more than one block of history.
+//
+#define CDIAGS_LZ4_FRAME_MAGIC			0x184D2204
+#define CDIAGS_LZ4_BLOCK_SIZE			( 64 * 1024 )
+#define CDIAGS_LZ4_UNCOMPRESSED_FLAG	0x80000000
+
+//
+// Frame descriptor: Version 01, independent blocks, no checksums,
+// no content size; 64 KB maximum block size. The header checksum
+// is the second byte of the XXH32 hash of the two preceding bytes.
+//
+#define CDIAGS_LZ4_FRAME_FLG			0x60
+#define CDIAGS_LZ4_FRAME_BD				0x40
+#define CDIAGS_LZ4_FRAME_HC				0x82
+
+//
+// Block format constraints: Matches are at least 4 bytes long, the
+// last match must start at least 12 bytes before the end of the
+// block and the last 5 bytes are always literals.
+//
+#define CDIAGS_LZ4_MIN_MATCH			4
+#define CDIAGS_LZ4_MF_LIMIT				12
+#define CDIAGS_LZ4_LAST_LITERALS		5
+
+#define CDIAGS_LZ4_HASH_BITS			12
+
+//
+// Worst case size of a compressed block.
+//
+#define CDIAGS_LZ4_BLOCK_BOUND \
+	( CDIAGS_LZ4_BLOCK_SIZE + CDIAGS_LZ4_BLOCK_SIZE / 255 + 16 )
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static ULONG CdiagsLz4Read32(
+	__in CONST UCHAR *Pointer
+	)
+{
+	return ( ULONG ) Pointer[ 0 ] |
+		( ( ULONG ) Pointer[ 1 ] << 8 ) |
+		( ( ULONG ) Pointer[ 2 ] << 16 ) |
+		( ( ULONG ) Pointer[ 3 ] << 24 );
+}
+
+static VOID CdiagsLz4Write32(
+	__out_bcount( 4 ) PUCHAR Pointer,
+	__in ULONG Value
+	)
+{
+	Pointer[ 0 ] = ( UCHAR ) Value;
+	Pointer[ 1 ] = ( UCHAR ) ( Value >> 8 );
+	Pointer[ 2 ] = ( UCHAR ) ( Value >> 16 );
+	Pointer[ 3 ] = ( UCHAR ) ( Value >> 24 );
+}
+
+static ULONG CdiagsLz4Hash(
+	__in ULONG Sequence
+	)
+{
+	return ( Sequence * 2654435761U ) >> ( 32 - CDIAGS_LZ4_HASH_BITS );
+}
+
+/*++
+	Routine Description:
+		Emit a sequence, i.e. a token, literals and, unless MatchLength
+		is 0, a match.
+
+	Return Value:
+		Pointer past the sequence or NULL if OutputEnd would be
+		exceeded.
+--*/
+static PUCHAR CdiagsLz4EmitSequence(
+	__in PUCHAR Output,
+	__in PUCHAR OutputEnd,
+	__in CONST UCHAR *Literals,
+	__in ULONG LiteralLength,
+	__in ULONG Offset,
+	__in ULONG MatchLength
+	)
+{
+	PUCHAR Token;
+	ULONG Length;
+
+	//
+	// Token, length bytes, literals, offset, length bytes.
+	//
+	if ( ( SIZE_T ) ( OutputEnd - Output ) <
+		 1 + LiteralLength / 255 + 1 + LiteralLength + 2 + MatchLength / 255 + 1 )
+	{
+		return NULL;
+	}
+
+	Token = Output++;
+
+	if ( LiteralLength >= 15 )
+	{
+		*Token = 15 << 4;
+		for ( Length = LiteralLength - 15; Length >= 255; Length -= 255 )
+		{
+			*Output++ = 255;
+		}
+		*Output++ = ( UCHAR ) Length;
+	}
+	else
+	{
+		*Token = ( UCHAR ) ( LiteralLength << 4 );
+	}
+
+	CopyMemory( Output, Literals, LiteralLength );
+	Output += LiteralLength;
+
+	if ( MatchLength == 0 )
+	{
+		return Output;
+	}
+
+	_ASSERTE( Offset > 0 && Offset <= 0xFFFF );
+	*Output++ = ( UCHAR ) Offset;
+	*Output++ = ( UCHAR ) ( Offset >> 8 );
+
+	Length = MatchLength - CDIAGS_LZ4_MIN_MATCH;
+	if ( Length >= 15 )
+	{
+		*Token |= 15;
+		for ( Length -= 15; Length >= 255; Length -= 255 )
+		{
+			*Output++ = 255;
+		}
+		*Output++ = ( UCHAR ) Length;
+	}
+	else
+	{
+		*Token |= ( UCHAR ) Length;
+	}
+
+	return Output;
+}
+
+/*++
+	Routine Description:
+		Compress a single block using greedy matching.
+
+	Parameters:
+		HashTable	Scratch table of ( 1 << CDIAGS_LZ4_HASH_BITS )
+					entries.
+
+	Return Value:
+		Compressed size or 0 if the block does not compress into
+		OutputSize bytes.
+--*/
+static ULONG CdiagsLz4CompressBlock(
+	__in_bcount( InputSize ) CONST UCHAR *Input,
+	__in ULONG InputSize,
+	__out_bcount( OutputSize ) PUCHAR Output,
+	__in ULONG OutputSize,
+	__in PULONG HashTable
+	)
+{
+	PUCHAR OutputEnd = Output + OutputSize;
+	PUCHAR Out = Output;
+	ULONG Anchor = 0;
+	ULONG Position = 0;
+
+	_ASSERTE( InputSize <= CDIAGS_LZ4_BLOCK_SIZE );
+
+	ZeroMemory( HashTable, sizeof( ULONG ) << CDIAGS_LZ4_HASH_BITS );
+
+	if ( InputSize > CDIAGS_LZ4_MF_LIMIT )
+	{
+		ULONG MatchLimit = InputSize - CDIAGS_LZ4_LAST_LITERALS;
+		ULONG StartLimit = InputSize - CDIAGS_LZ4_MF_LIMIT;
+
+		while ( Position < StartLimit )
+		{
+			ULONG Sequence = CdiagsLz4Read32( Input + Position );
+			ULONG Hash = CdiagsLz4Hash( Sequence );
+			ULONG Candidate = HashTable[ Hash ];
+			ULONG MatchLength;
+
+			HashTable[ Hash ] = Position;
+
+			//
+			// The table starts out zeroed, so entries may be stale -
+			// the comparison weeds those out.
+			//
+			if ( Candidate >= Position ||
+				 CdiagsLz4Read32( Input + Candidate ) != Sequence )
+			{
+				Position++;
+				continue;
+			}
+
+			MatchLength = CDIAGS_LZ4_MIN_MATCH;
+			while ( Position + MatchLength < MatchLimit &&
+					Input[ Candidate + MatchLength ] == Input[ Position + MatchLength ] )
+			{
+				MatchLength++;
+			}
+
+			Out = CdiagsLz4EmitSequence(
+				Out,
+				OutputEnd,
+				Input + Anchor,
+				Position - Anchor,
+				Position - Candidate,
+				MatchLength );
+			if ( Out == NULL )
+			{
+				return 0;
+			}
+
+			Position += MatchLength;
+			Anchor = Position;
+		}
+	}
+
+	Out = CdiagsLz4EmitSequence(
+		Out,
+		OutputEnd,
+		Input + Anchor,
+		InputSize - Anchor,
+		0,
+		0 );
+	if ( Out == NULL )
+	{
+		return 0;
+	}
+
+	return ( ULONG ) ( Out - Output );
+}
+
+static HRESULT CdiagsWriteAll(
+	__in HANDLE File,
+	__in_bcount( Size ) CONST VOID *Buffer,
+	__in ULONG Size
+	)
+{
+	DWORD Written;
+	if ( WriteFile( File, Buffer, Size, &Written, NULL ) )
+	{
+		return S_OK;
+	}
+	else
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Internals.
+ *
+ */
+
+HRESULT CdiagpCompressFile(
+	__in PCWSTR SourcePath,
+	__in PCWSTR TargetPath
+	)
+{
+	UCHAR Header[ 7 ];
+	PUCHAR Input;
+	PUCHAR Output;
+	PULONG HashTable;
+	PUCHAR Memory;
+	HANDLE Source;
+	HANDLE Target;
+	HRESULT Hr;
+
+	if ( ! SourcePath || ! TargetPath )
+	{
+		return E_INVALIDARG;
+	}
+
+	//
+	// Input, output (preceded by the block size) and hash table.
+	//
+	Memory = ( PUCHAR ) CdiagpMalloc(
+		CDIAGS_LZ4_BLOCK_SIZE +
+			sizeof( ULONG ) + CDIAGS_LZ4_BLOCK_BOUND +
+			( sizeof( ULONG ) << CDIAGS_LZ4_HASH_BITS ),
+		FALSE );
+	if ( ! Memory )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HashTable	= ( PULONG ) Memory;
+	Input		= Memory + ( sizeof( ULONG ) << CDIAGS_LZ4_HASH_BITS );
+	Output		= Input + CDIAGS_LZ4_BLOCK_SIZE;
+
+	Source = CreateFile(
+		SourcePath,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL );
+	if ( Source == INVALID_HANDLE_VALUE )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		CdiagpFree( Memory );
+		return Hr;
+	}
+
+	Target = CreateFile(
+		TargetPath,
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL );
+	if ( Target == INVALID_HANDLE_VALUE )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		_VERIFY( CloseHandle( Source ) );
+		CdiagpFree( Memory );
+		return Hr;
+	}
+
+	CdiagsLz4Write32( Header, CDIAGS_LZ4_FRAME_MAGIC );
+	Header[ 4 ] = CDIAGS_LZ4_FRAME_FLG;
+	Header[ 5 ] = CDIAGS_LZ4_FRAME_BD;
+	Header[ 6 ] = CDIAGS_LZ4_FRAME_HC;
+
+	Hr = CdiagsWriteAll( Target, Header, sizeof( Header ) );
+	if ( FAILED( Hr ) )
+	{
+		goto Cleanup;
+	}
+
+	for ( ;; )
+	{
+		ULONG BlockSize;
+		DWORD Read;
+
+		if ( ! ReadFile( Source, Input, CDIAGS_LZ4_BLOCK_SIZE, &Read, NULL ) )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+		else if ( Read == 0 )
+		{
+			break;
+		}
+
+		//
+		// Blocks that do not shrink are stored as-is.
+		//
+		BlockSize = CdiagsLz4CompressBlock(
+			Input,
+			Read,
+			Output + sizeof( ULONG ),
+			Read - 1,
+			HashTable );
+		if ( BlockSize == 0 )
+		{
+			CopyMemory( Output + sizeof( ULONG ), Input, Read );
+			CdiagsLz4Write32( Output, Read | CDIAGS_LZ4_UNCOMPRESSED_FLAG );
+			BlockSize = Read;
+		}
+		else
+		{
+			CdiagsLz4Write32( Output, BlockSize );
+		}
+
+		Hr = CdiagsWriteAll( Target, Output, sizeof( ULONG ) + BlockSize );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+	}
+
+	//
+	// End mark.
+	//
+	CdiagsLz4Write32( Output, 0 );
+	Hr = CdiagsWriteAll( Target, Output, sizeof( ULONG ) );
+
+Cleanup:
+	_VERIFY( CloseHandle( Source ) );
+	_VERIFY( CloseHandle( Target ) );
+	CdiagpFree( Memory );
+
+	if ( FAILED( Hr ) )
+	{
+		( VOID ) DeleteFile( TargetPath );
+	}
+
+	return Hr;
+}
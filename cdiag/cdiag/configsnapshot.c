@@ -0,0 +1,522 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Immutable snapshots of configuration settings.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include "cdiagp.h"
+
+#define CDIAGS_INITIAL_ENTRY_CAPACITY	16
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static int CdiagsCompareEntry(
+	__in PCDIAGP_CONFIG_ENTRY Entry,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name
+	)
+{
+	int Result;
+
+	if ( Entry->Scope != Scope )
+	{
+		return Entry->Scope < Scope ? -1 : 1;
+	}
+
+	Result = _wcsicmp( Entry->GroupName, GroupName );
+	if ( Result != 0 )
+	{
+		return Result;
+	}
+
+	return _wcsicmp( Entry->Name, Name );
+}
+
+/*++
+	Routine Description:
+		Binary search for an entry.
+
+	Returns:
+		TRUE if found, Index then denotes the entry. FALSE otherwise,
+		Index then denotes the position at which the entry would
+		have to be inserted.
+--*/
+static BOOL CdiagsFindEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__out PULONG Index
+	)
+{
+	ULONG Low = 0;
+	ULONG High = Snapshot->EntryCount;
+
+	while ( Low < High )
+	{
+		ULONG Middle = Low + ( High - Low ) / 2;
+		int Result = CdiagsCompareEntry(
+			Snapshot->Entries[ Middle ],
+			Scope,
+			GroupName,
+			Name );
+		if ( Result == 0 )
+		{
+			*Index = Middle;
+			return TRUE;
+		}
+		else if ( Result < 0 )
+		{
+			Low = Middle + 1;
+		}
+		else
+		{
+			High = Middle;
+		}
+	}
+
+	*Index = Low;
+	return FALSE;
+}
+
+/*++
+	Routine Description:
+		Allocate an entry holding copies of all data in a single
+		block of memory.
+--*/
+static PCDIAGP_CONFIG_ENTRY CdiagsCreateEntry(
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Type,
+	__in DWORD DataSize,
+	__in_bcount( DataSize ) CONST VOID *Data
+	)
+{
+	SIZE_T GroupNameSize = ( wcslen( GroupName ) + 1 ) * sizeof( WCHAR );
+	SIZE_T NameSize = ( wcslen( Name ) + 1 ) * sizeof( WCHAR );
+	SIZE_T DataSizeAligned = ( DataSize + sizeof( WCHAR ) - 1 ) & ~( sizeof( WCHAR ) - 1 );
+	PCDIAGP_CONFIG_ENTRY Entry;
+	PBYTE Next;
+
+	Entry = CdiagpMalloc(
+		sizeof( CDIAGP_CONFIG_ENTRY ) +
+			DataSizeAligned + GroupNameSize + NameSize,
+		FALSE );
+	if ( ! Entry )
+	{
+		return NULL;
+	}
+
+	Next = ( PBYTE ) ( Entry + 1 );
+
+	Entry->Scope	= Scope;
+	Entry->Type		= Type;
+	Entry->DataSize	= DataSize;
+	Entry->Data		= Next;
+	CopyMemory( Next, Data, DataSize );
+	Next += DataSizeAligned;
+
+	Entry->GroupName = ( PCWSTR ) Next;
+	CopyMemory( Next, GroupName, GroupNameSize );
+	Next += GroupNameSize;
+
+	Entry->Name = ( PCWSTR ) Next;
+	CopyMemory( Next, Name, NameSize );
+
+	return Entry;
+}
+
+static HRESULT CdiagsReadEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD ExpectedType,
+	__in DWORD BufferLen,
+	__out_bcount( BufferLen ) PVOID Buffer,
+	__out_opt DWORD *ActualLen
+	)
+{
+	PCDIAGP_CONFIG_ENTRY Entry;
+	ULONG Index;
+
+	if ( ! ( Snapshot->ReadableScopes & Scope ) )
+	{
+		return E_ACCESSDENIED;
+	}
+
+	if ( ! CdiagsFindEntry( Snapshot, Scope, GroupName, Name, &Index ) )
+	{
+		return CDIAG_E_SETTING_NOT_FOUND;
+	}
+
+	Entry = Snapshot->Entries[ Index ];
+
+	//
+	// Same order of checks as RegQueryValueEx.
+	//
+	if ( Entry->DataSize > BufferLen )
+	{
+		if ( ActualLen )
+		{
+			*ActualLen = Entry->DataSize;
+		}
+
+		return CDIAG_E_BUFFER_TOO_SMALL;
+	}
+	else if ( Entry->Type != ExpectedType )
+	{
+		return CDIAG_E_SETTING_MISMATCH;
+	}
+
+	CopyMemory( Buffer, Entry->Data, Entry->DataSize );
+	if ( ActualLen )
+	{
+		*ActualLen = Entry->DataSize;
+	}
+
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Snapshots.
+ *
+ */
+
+HRESULT CdiagpCreateConfigSnapshot(
+	__in DWORD ReadableScopes,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT NewSnapshot;
+
+	_ASSERTE( ( ReadableScopes & ~CdiagEffectiveScope ) == 0 );
+	_ASSERTE( Snapshot );
+
+	NewSnapshot = CdiagpMalloc( sizeof( CDIAGP_CONFIG_SNAPSHOT ), TRUE );
+	if ( ! NewSnapshot )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	NewSnapshot->ReadableScopes = ReadableScopes;
+
+	*Snapshot = NewSnapshot;
+	return S_OK;
+}
+
+HRESULT CdiagpCopyConfigSnapshot(
+	__in PCDIAGP_CONFIG_SNAPSHOT Source,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT NewSnapshot;
+	HRESULT Hr;
+	ULONG Index;
+
+	_ASSERTE( Source );
+	_ASSERTE( Snapshot );
+
+	Hr = CdiagpCreateConfigSnapshot( Source->ReadableScopes, &NewSnapshot );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	if ( Source->EntryCount > 0 )
+	{
+		NewSnapshot->Entries = CdiagpMalloc(
+			Source->EntryCount * sizeof( PCDIAGP_CONFIG_ENTRY ),
+			FALSE );
+		if ( ! NewSnapshot->Entries )
+		{
+			CdiagpFreeConfigSnapshot( NewSnapshot );
+			return E_OUTOFMEMORY;
+		}
+
+		NewSnapshot->EntryCapacity = Source->EntryCount;
+	}
+
+	//
+	// Entries are already sorted.
+	//
+	for ( Index = 0; Index < Source->EntryCount; Index++ )
+	{
+		PCDIAGP_CONFIG_ENTRY Entry = Source->Entries[ Index ];
+
+		NewSnapshot->Entries[ Index ] = CdiagsCreateEntry(
+			Entry->Scope,
+			Entry->GroupName,
+			Entry->Name,
+			Entry->Type,
+			Entry->DataSize,
+			Entry->Data );
+		if ( ! NewSnapshot->Entries[ Index ] )
+		{
+			CdiagpFreeConfigSnapshot( NewSnapshot );
+			return E_OUTOFMEMORY;
+		}
+
+		NewSnapshot->EntryCount++;
+	}
+
+	*Snapshot = NewSnapshot;
+	return S_OK;
+}
+
+VOID CdiagpFreeConfigSnapshot(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	)
+{
+	ULONG Index;
+
+	_ASSERTE( Snapshot );
+
+	for ( Index = 0; Index < Snapshot->EntryCount; Index++ )
+	{
+		CdiagpFree( Snapshot->Entries[ Index ] );
+	}
+
+	if ( Snapshot->Entries )
+	{
+		CdiagpFree( Snapshot->Entries );
+	}
+
+	CdiagpFree( Snapshot );
+}
+
+HRESULT CdiagpSetConfigSnapshotEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Type,
+	__in DWORD DataSize,
+	__in_bcount( DataSize ) CONST VOID *Data
+	)
+{
+	PCDIAGP_CONFIG_ENTRY Entry;
+	ULONG Index;
+
+	_ASSERTE( Snapshot );
+	_ASSERTE( Scope == CdiagGlobalScope || Scope == CdiagUserScope );
+	_ASSERTE( GroupName );
+	_ASSERTE( Name );
+	_ASSERTE( Type == REG_DWORD || Type == REG_SZ || Type == REG_MULTI_SZ );
+	_ASSERTE( Data || DataSize == 0 );
+
+	Entry = CdiagsCreateEntry( Scope, GroupName, Name, Type, DataSize, Data );
+	if ( ! Entry )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	if ( CdiagsFindEntry( Snapshot, Scope, GroupName, Name, &Index ) )
+	{
+		CdiagpFree( Snapshot->Entries[ Index ] );
+		Snapshot->Entries[ Index ] = Entry;
+		return S_OK;
+	}
+
+	if ( Snapshot->EntryCount == Snapshot->EntryCapacity )
+	{
+		ULONG NewCapacity = Snapshot->EntryCapacity == 0
+			? CDIAGS_INITIAL_ENTRY_CAPACITY
+			: Snapshot->EntryCapacity * 2;
+		PCDIAGP_CONFIG_ENTRY *NewEntries = CdiagpMalloc(
+			NewCapacity * sizeof( PCDIAGP_CONFIG_ENTRY ),
+			FALSE );
+		if ( ! NewEntries )
+		{
+			CdiagpFree( Entry );
+			return E_OUTOFMEMORY;
+		}
+
+		if ( Snapshot->Entries )
+		{
+			CopyMemory(
+				NewEntries,
+				Snapshot->Entries,
+				Snapshot->EntryCount * sizeof( PCDIAGP_CONFIG_ENTRY ) );
+			CdiagpFree( Snapshot->Entries );
+		}
+
+		Snapshot->Entries		= NewEntries;
+		Snapshot->EntryCapacity	= NewCapacity;
+	}
+
+	MoveMemory(
+		&Snapshot->Entries[ Index + 1 ],
+		&Snapshot->Entries[ Index ],
+		( Snapshot->EntryCount - Index ) * sizeof( PCDIAGP_CONFIG_ENTRY ) );
+
+	Snapshot->Entries[ Index ] = Entry;
+	Snapshot->EntryCount++;
+
+	return S_OK;
+}
+
+HRESULT CdiagpDeleteConfigSnapshotEntry(
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name
+	)
+{
+	ULONG Index;
+
+	_ASSERTE( Snapshot );
+	_ASSERTE( Scope == CdiagGlobalScope || Scope == CdiagUserScope );
+	_ASSERTE( GroupName );
+	_ASSERTE( Name );
+
+	if ( ! CdiagsFindEntry( Snapshot, Scope, GroupName, Name, &Index ) )
+	{
+		return CDIAG_E_SETTING_NOT_FOUND;
+	}
+
+	CdiagpFree( Snapshot->Entries[ Index ] );
+
+	MoveMemory(
+		&Snapshot->Entries[ Index ],
+		&Snapshot->Entries[ Index + 1 ],
+		( Snapshot->EntryCount - Index - 1 ) * sizeof( PCDIAGP_CONFIG_ENTRY ) );
+	Snapshot->EntryCount--;
+
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Cache.
+ *
+ */
+
+HRESULT CdiagpReadConfigCache(
+	__in PCDIAGP_CONFIG_CACHE Cache,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD ExpectedType,
+	__in DWORD BufferLen,
+	__out_bcount( BufferLen ) PVOID Buffer,
+	__out_opt DWORD *ActualLen
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+	HRESULT Hr = CDIAG_E_SETTING_NOT_FOUND;
+	ULONG Epoch;
+
+	_ASSERTE( Cache );
+	_ASSERTE( GroupName );
+	_ASSERTE( Name );
+	_ASSERTE( Scope >= CdiagGlobalScope && Scope <= CdiagEffectiveScope );
+	_ASSERTE( Buffer );
+
+	Epoch = JphtEnterReadEpoch( &Cache->Reclamation );
+	Snapshot = Cache->Current;
+	_ASSERTE( Snapshot );
+
+	if ( Scope & CdiagUserScope )
+	{
+		Hr = CdiagsReadEntry(
+			Snapshot,
+			GroupName,
+			Name,
+			CdiagUserScope,
+			ExpectedType,
+			BufferLen,
+			Buffer,
+			ActualLen );
+
+		//
+		// User scope always wins, continue with global scope only
+		// if not found.
+		//
+		if ( CDIAG_E_SETTING_NOT_FOUND != Hr )
+		{
+			goto Cleanup;
+		}
+	}
+
+	if ( Scope & CdiagGlobalScope )
+	{
+		Hr = CdiagsReadEntry(
+			Snapshot,
+			GroupName,
+			Name,
+			CdiagGlobalScope,
+			ExpectedType,
+			BufferLen,
+			Buffer,
+			ActualLen );
+	}
+
+Cleanup:
+	JphtLeaveReadEpoch( &Cache->Reclamation, Epoch );
+	return Hr;
+}
+
+VOID CdiagpPublishConfigSnapshot(
+	__in PCDIAGP_CONFIG_CACHE Cache,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT OldSnapshot;
+
+	_ASSERTE( Cache );
+	_ASSERTE( Snapshot );
+
+	OldSnapshot = ( PCDIAGP_CONFIG_SNAPSHOT ) InterlockedExchangePointer(
+		( PVOID volatile * ) &Cache->Current,
+		Snapshot );
+	if ( ! OldSnapshot )
+	{
+		return;
+	}
+
+	JphtSynchronizeEpoch( &Cache->Reclamation, CdiagpYieldEpoch );
+
+	CdiagpFreeConfigSnapshot( OldSnapshot );
+}
+
+VOID CdiagpDeleteConfigCache(
+	__in PCDIAGP_CONFIG_CACHE Cache
+	)
+{
+	_ASSERTE( Cache );
+	_ASSERTE( Cache->Reclamation.Readers[ 0 ] == 0 && 
+			  Cache->Reclamation.Readers[ 1 ] == 0 );
+
+	if ( Cache->Current )
+	{
+		CdiagpFreeConfigSnapshot( Cache->Current );
+		Cache->Current = NULL;
+	}
+}
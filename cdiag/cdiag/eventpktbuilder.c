@@ -0,0 +1,537 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Event packet builder.
+ *
+ *		Packets are built in a per-thread arena: The packet header
+ *		is placed at the top of the arena, strings and debug
+ *		information are appended behind it. As packets are limited
+ *		to 64 KB (TotalSize being a USHORT), the arena is allocated
+ *		once per thread and never grows - building a packet thus does
+ *		not require any heap allocations. Releasing a packet pops it
+ *		(and any packet built on top of it) off the arena.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include "cdiagp.h"
+
+//
+// Size of a thread's arena. Must be able to hold at least one
+// packet of maximum size.
+//
+#define CDIAGS_EVENT_ARENA_SIZE		( 64 * 1024 )
+
+//
+// Space reserved behind the packet header s.t. the insertion string
+// offset array can be extended up to its maximum size.
+//
+#define CDIAGS_EVENT_PACKET_HEADER_SIZE									\
+	( sizeof( CDIAG_EVENT_PACKET ) +									\
+	  ( CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS - ANYSIZE_ARRAY ) *	\
+		sizeof( DWORD ) )
+
+//
+// Alignment of data appended to a packet. TotalSize is kept aligned
+// as well s.t. a nested packet can begin right behind its parent.
+//
+#define CDIAGS_EVENT_PACKET_ALIGNMENT	sizeof( DWORD )
+
+#define CDIAGS_ALIGN_UP( Value, Alignment ) \
+	( ( ( Value ) + ( Alignment ) - 1 ) & ~( ( Alignment ) - 1 ) )
+
+typedef struct _CDIAGS_EVENT_ARENA
+{
+	//
+	// Bytes of Data used by packets currently being built.
+	//
+	SIZE_T Used;
+
+	ULONGLONG Data[ CDIAGS_EVENT_ARENA_SIZE / sizeof( ULONGLONG ) ];
+} CDIAGS_EVENT_ARENA, *PCDIAGS_EVENT_ARENA;
+
+C_ASSERT( CDIAGS_EVENT_ARENA_SIZE > MAXUSHORT );
+C_ASSERT( CDIAGS_EVENT_PACKET_HEADER_SIZE % 
+		  CDIAGS_EVENT_PACKET_ALIGNMENT == 0 );
+
+//
+// TLS slot holding the current thread's arena.
+//
+static DWORD CdiagsEventArenaSlot = TLS_OUT_OF_INDEXES;
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static PCDIAGS_EVENT_ARENA CdiagsGetEventArena(
+	__in BOOL Create
+	)
+{
+	PCDIAGS_EVENT_ARENA Arena;
+
+	Arena = ( PCDIAGS_EVENT_ARENA ) TlsGetValue( CdiagsEventArenaSlot );
+	if ( Arena == NULL && Create )
+	{
+		//
+		// First packet on this thread.
+		//
+		Arena = ( PCDIAGS_EVENT_ARENA ) CdiagpMalloc(
+			sizeof( CDIAGS_EVENT_ARENA ), FALSE );
+		if ( Arena == NULL )
+		{
+			return NULL;
+		}
+
+		Arena->Used = 0;
+		_VERIFY( TlsSetValue( CdiagsEventArenaSlot, Arena ) );
+	}
+
+	return Arena;
+}
+
+/*++
+	Routine Description:
+		Check that the packet has been obtained from
+		CdiagBeginEventPacket on this thread and, if Topmost is TRUE,
+		that no other packet has been begun since.
+
+	Return Value:
+		Arena or NULL if invalid.
+--*/
+static PCDIAGS_EVENT_ARENA CdiagsGetEventArenaForPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in BOOL Topmost
+	)
+{
+	PCDIAGS_EVENT_ARENA Arena = CdiagsGetEventArena( FALSE );
+	PUCHAR Start;
+
+	if ( Arena == NULL )
+	{
+		return NULL;
+	}
+
+	Start = ( PUCHAR ) Arena->Data;
+	if ( ( PUCHAR ) Packet < Start ||
+		 ( PUCHAR ) Packet + sizeof( CDIAG_EVENT_PACKET ) > 
+			Start + Arena->Used )
+	{
+		return NULL;
+	}
+	else if ( ! CdiagsIsValidEventPacket( Packet ) ||
+		( PUCHAR ) Packet + Packet->TotalSize > Start + Arena->Used )
+	{
+		return NULL;
+	}
+	else if ( Topmost &&
+		( PUCHAR ) Packet + Packet->TotalSize != Start + Arena->Used )
+	{
+		return NULL;
+	}
+	else
+	{
+		return Arena;
+	}
+}
+
+/*++
+	Routine Description:
+		Append data to the topmost packet.
+
+	Parameters:
+		Packet		- Packet to extend.
+		Size		- Bytes to append.
+		Offset		- Offset of the appended data, relative to
+					  the packet.
+		Data		- Appended data.
+
+	Return Value:
+		S_OK on success.
+		CDIAG_E_BUFFER_TOO_SMALL if the packet would exceed its
+			maximum size.
+		E_INVALIDARG if the packet is not the topmost packet of
+			this thread.
+--*/
+static HRESULT CdiagsAppendEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in SIZE_T Size,
+	__out PDWORD Offset,
+	__out PVOID *Data
+	)
+{
+	PCDIAGS_EVENT_ARENA Arena;
+	SIZE_T PacketStart;
+	SIZE_T NewOffset;
+	SIZE_T NewTotalSize;
+
+	Arena = CdiagsGetEventArenaForPacket( Packet, TRUE );
+	if ( Arena == NULL )
+	{
+		return E_INVALIDARG;
+	}
+
+	PacketStart = ( SIZE_T ) ( ( PUCHAR ) Packet - ( PUCHAR ) Arena->Data );
+	NewOffset = Packet->TotalSize;
+	NewTotalSize = CDIAGS_ALIGN_UP(
+		NewOffset + Size,
+		CDIAGS_EVENT_PACKET_ALIGNMENT );
+
+	if ( NewTotalSize > MAXUSHORT ||
+		 PacketStart + NewTotalSize > CDIAGS_EVENT_ARENA_SIZE )
+	{
+		return CDIAG_E_BUFFER_TOO_SMALL;
+	}
+
+	Packet->TotalSize	= ( USHORT ) NewTotalSize;
+	Arena->Used			= PacketStart + NewTotalSize;
+
+	*Offset				= ( DWORD ) NewOffset;
+	*Data				= ( PUCHAR ) Packet + NewOffset;
+
+	return S_OK;
+}
+
+static HRESULT CdiagsAppendStringEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR String,
+	__out PDWORD Offset
+	)
+{
+	SIZE_T Cb = ( wcslen( String ) + 1 ) * sizeof( WCHAR );
+	PVOID Data;
+	HRESULT Hr;
+
+	Hr = CdiagsAppendEventPacket( Packet, Cb, Offset, &Data );
+	if ( SUCCEEDED( Hr ) )
+	{
+		CopyMemory( Data, String, Cb );
+	}
+
+	return Hr;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Internals.
+ *
+ */
+
+BOOL CdiagpSetupEventPacketArena()
+{
+	CdiagsEventArenaSlot = TlsAlloc();
+	return CdiagsEventArenaSlot != TLS_OUT_OF_INDEXES;
+}
+
+VOID CdiagpTeardownEventPacketArena()
+{
+	if ( CdiagsEventArenaSlot != TLS_OUT_OF_INDEXES )
+	{
+		//
+		// N.B. Arenas of threads other than the current one are
+		// leaked if the threads have not exited yet.
+		//
+		CdiagpFreeEventPacketArena();
+		_VERIFY( TlsFree( CdiagsEventArenaSlot ) );
+		CdiagsEventArenaSlot = TLS_OUT_OF_INDEXES;
+	}
+}
+
+VOID CdiagpFreeEventPacketArena()
+{
+	PCDIAGS_EVENT_ARENA Arena = CdiagsGetEventArena( FALSE );
+
+	if ( Arena != NULL )
+	{
+		CdiagpFree( Arena );
+		_VERIFY( TlsSetValue( CdiagsEventArenaSlot, NULL ) );
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Public.
+ *
+ */
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagBeginEventPacket(
+	__in CDIAG_EVENT_TYPE Type,
+	__in USHORT Flags,
+	__in CDIAG_SEVERITY_LEVEL Severity,
+	__in DWORD Code,
+	__out PCDIAG_EVENT_PACKET *Packet
+	)
+{
+	PCDIAGS_EVENT_ARENA Arena;
+	PCDIAG_EVENT_PACKET NewPacket;
+	if ( Type > CdiagMaxEvent ||
+		 Severity > CdiagMaxSeverity ||
+		 ! Packet )
+	{
+		return E_INVALIDARG;
+	}
+
+	*Packet = NULL;
+
+	Arena = CdiagsGetEventArena( TRUE );
+	if ( Arena == NULL )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	_ASSERTE( Arena->Used % CDIAGS_EVENT_PACKET_ALIGNMENT == 0 );
+	if ( Arena->Used + CDIAGS_EVENT_PACKET_HEADER_SIZE > CDIAGS_EVENT_ARENA_SIZE )
+	{
+		//
+		// Too many nested packets.
+		//
+		return CDIAG_E_BUFFER_TOO_SMALL;
+	}
+
+	NewPacket = ( PCDIAG_EVENT_PACKET ) ( ( PUCHAR ) Arena->Data + Arena->Used );
+	ZeroMemory( NewPacket, CDIAGS_EVENT_PACKET_HEADER_SIZE );
+
+	NewPacket->Size				= sizeof( CDIAG_EVENT_PACKET );
+	NewPacket->TotalSize		= ( USHORT ) CDIAGS_EVENT_PACKET_HEADER_SIZE;
+	NewPacket->Type				= Type;
+	NewPacket->Flags			= Flags;
+	NewPacket->Severity			= ( UCHAR ) Severity;
+	NewPacket->ProcessorMode	= CdiagUserMode;
+	NewPacket->ProcessId		= GetCurrentProcessId();
+	NewPacket->ThreadId			= GetCurrentThreadId();
+	NewPacket->Code				= Code;
+	GetSystemTimeAsFileTime( &NewPacket->Timestamp );
+
+	Arena->Used += CDIAGS_EVENT_PACKET_HEADER_SIZE;
+	*Packet = NewPacket;
+
+	return S_OK;
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetMachineEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR Machine
+	)
+{
+	if ( ! Packet || ! Machine )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsAppendStringEventPacket(
+		Packet,
+		Machine,
+		&Packet->MachineOffset );
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetMessageEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR Message
+	)
+{
+	if ( ! Packet || ! Message )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsAppendStringEventPacket(
+		Packet,
+		Message,
+		&Packet->MessageOffset );
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagAddInsertionStringEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR String
+	)
+{
+	HRESULT Hr;
+
+	if ( ! Packet || ! String )
+	{
+		return E_INVALIDARG;
+	}
+
+	if ( Packet->MessageInsertionStrings.Count >=
+		 CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS )
+	{
+		return CDIAG_E_BUFFER_TOO_SMALL;
+	}
+
+	Hr = CdiagsAppendStringEventPacket(
+		Packet,
+		String,
+		&Packet->MessageInsertionStrings.Offset[
+			Packet->MessageInsertionStrings.Count ] );
+	if ( SUCCEEDED( Hr ) )
+	{
+		Packet->MessageInsertionStrings.Count++;
+	}
+
+	return Hr;
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetDebugInfoEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_opt PCWSTR Module,
+	__in_opt PCWSTR FunctionName,
+	__in_opt PCWSTR SourceFile,
+	__in ULONG SourceLine
+	)
+{
+	PCWSTR Strings[ 3 ];
+	PDWORD Offsets[ 3 ];
+	SIZE_T StringCb[ 3 ];
+	SIZE_T Cb = sizeof( CDIAG_DEBUG_INFO );
+	PCDIAG_DEBUG_INFO DebugInfo;
+	DWORD DebugInfoOffset;
+	SIZE_T Index;
+	HRESULT Hr;
+
+	if ( ! Packet )
+	{
+		return E_INVALIDARG;
+	}
+
+	//
+	// The debug info structure is self-relative itself - append
+	// structure and strings as a single block.
+	//
+	Strings[ 0 ] = Module;
+	Strings[ 1 ] = FunctionName;
+	Strings[ 2 ] = SourceFile;
+
+	for ( Index = 0; Index < _countof( Strings ); Index++ )
+	{
+		StringCb[ Index ] = Strings[ Index ] != NULL
+			? ( wcslen( Strings[ Index ] ) + 1 ) * sizeof( WCHAR )
+			: 0;
+		Cb += StringCb[ Index ];
+	}
+
+	if ( Cb > MAXUSHORT )
+	{
+		return CDIAG_E_BUFFER_TOO_SMALL;
+	}
+
+	Hr = CdiagsAppendEventPacket(
+		Packet,
+		Cb,
+		&DebugInfoOffset,
+		( PVOID* ) &DebugInfo );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	DebugInfo->Size			= sizeof( CDIAG_DEBUG_INFO );
+	DebugInfo->TotalSize	= ( USHORT ) Cb;
+	DebugInfo->SourceLine	= SourceLine;
+
+	Offsets[ 0 ] = &DebugInfo->ModuleOffset;
+	Offsets[ 1 ] = &DebugInfo->FunctionNameOffset;
+	Offsets[ 2 ] = &DebugInfo->SourceFileOffset;
+
+	Cb = sizeof( CDIAG_DEBUG_INFO );
+	for ( Index = 0; Index < _countof( Strings ); Index++ )
+	{
+		if ( Strings[ Index ] != NULL )
+		{
+			CopyMemory(
+				( PUCHAR ) DebugInfo + Cb,
+				Strings[ Index ],
+				StringCb[ Index ] );
+			*Offsets[ Index ] = ( DWORD ) Cb;
+			Cb += StringCb[ Index ];
+		}
+		else
+		{
+			*Offsets[ Index ] = 0;
+		}
+	}
+
+	Packet->DebugInfoOffset = DebugInfoOffset;
+
+	return S_OK;
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetCustomDataEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_bcount(Length) CONST VOID *Data,
+	__in DWORD Length
+	)
+{
+	PVOID Buffer;
+	HRESULT Hr;
+
+	if ( ! Packet || ! Data || Length == 0 )
+	{
+		return E_INVALIDARG;
+	}
+
+	Hr = CdiagsAppendEventPacket(
+		Packet,
+		Length,
+		&Packet->CustomData.Offset,
+		&Buffer );
+	if ( SUCCEEDED( Hr ) )
+	{
+		CopyMemory( Buffer, Data, Length );
+		Packet->CustomData.Length = Length;
+	}
+
+	return Hr;
+}
+
+CDIAGAPI VOID CDIAGCALLTYPE CdiagReleaseEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	PCDIAGS_EVENT_ARENA Arena;
+
+	Arena = CdiagsGetEventArenaForPacket( Packet, FALSE );
+	_ASSERTE( Arena != NULL );
+	if ( Arena != NULL )
+	{
+		//
+		// Pop this packet and any packet begun after it.
+		//
+		Arena->Used = ( SIZE_T ) ( ( PUCHAR ) Packet - ( PUCHAR ) Arena->Data );
+	}
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCommitEventPacket(
+	__in_opt CDIAG_SESSION_HANDLE Session,
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	HRESULT Hr;
+
+	if ( CdiagsGetEventArenaForPacket( Packet, FALSE ) == NULL )
+	{
+		return E_INVALIDARG;
+	}
+
+	Hr = CdiagHandleEvent( Session, Packet );
+	CdiagReleaseEventPacket( Packet );
+
+	return Hr;
+}
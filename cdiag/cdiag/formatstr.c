@@ -271,5 +271,463 @@ HRESULT CdiagpFormatString(
 		return CDIAG_E_BUFFER_TOO_SMALL;
 	}
 
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Compiled templates.
+ *
+ */
+
+typedef enum _FORMAT_OPCODE
+{
+	//
+	// Copy literal text.
+	//
+	FormatLiteralOpcode,
+
+	//
+	// Copy string binding, equivalent to %s.
+	//
+	FormatStringOpcode,
+
+	//
+	// Unsigned decimal binding, equivalent to %u.
+	//
+	FormatUnsignedOpcode,
+
+	//
+	// Any other format - use _snwprintf.
+	//
+	FormatPrintfOpcode
+} FORMAT_OPCODE;
+
+typedef struct _FORMAT_INSTRUCTION
+{
+	FORMAT_OPCODE Opcode;
+
+	//
+	// Literal: Offset of text within Literals.
+	// Otherwise: Index of binding.
+	//
+	ULONG Operand;
+
+	//
+	// Literal: Length of text.
+	//
+	ULONG LiteralCch;
+
+	//
+	// Printf: Format of variable.
+	//
+	PCWSTR Format;
+} FORMAT_INSTRUCTION, *PFORMAT_INSTRUCTION;
+
+typedef struct _FORMAT_PROGRAM
+{
+	//
+	// Bit mask of variables referred to.
+	//
+	ULONG UsedVariables;
+
+	//
+	// Text of all literals, not null terminated.
+	//
+	PWSTR Literals;
+
+	ULONG InstructionCount;
+	FORMAT_INSTRUCTION Instructions[ ANYSIZE_ARRAY ];
+} FORMAT_PROGRAM;
+
+typedef struct _FORMAT_EMITTER
+{
+	//
+	// Program to emit to. If NULL, only sizes are calculated.
+	//
+	PFORMAT_PROGRAM Program;
+
+	ULONG InstructionCount;
+	ULONG LiteralCch;
+
+	//
+	// Can the last instruction be extended by further literals?
+	//
+	BOOL InLiteral;
+} FORMAT_EMITTER, *PFORMAT_EMITTER;
+
+static VOID CdiagsEmitLiteral(
+	__in PFORMAT_EMITTER Emitter,
+	__in WCHAR Char
+	)
+{
+	if ( ! Emitter->InLiteral )
+	{
+		if ( Emitter->Program )
+		{
+			PFORMAT_INSTRUCTION Instruction = 
+				&Emitter->Program->Instructions[ Emitter->InstructionCount ];
+			Instruction->Opcode		= FormatLiteralOpcode;
+			Instruction->Operand	= Emitter->LiteralCch;
+			Instruction->LiteralCch	= 0;
+			Instruction->Format		= NULL;
+		}
+
+		Emitter->InstructionCount++;
+		Emitter->InLiteral = TRUE;
+	}
+
+	if ( Emitter->Program )
+	{
+		Emitter->Program->Literals[ Emitter->LiteralCch ] = Char;
+		Emitter->Program->Instructions[ Emitter->InstructionCount - 1 ].LiteralCch++;
+	}
+
+	Emitter->LiteralCch++;
+}
+
+static VOID CdiagsEmitVariable(
+	__in PFORMAT_EMITTER Emitter,
+	__in ULONG VarCount,
+	__in PFORMAT_VARIABLE Variables,
+	__in CONST WCHAR* VariableNameBegin,
+	__in CONST WCHAR* VariableNameEndExcl
+	)
+{
+	INT BindingIndex;
+
+	if ( ! CdiagsGetVariableBindingIndex( 
+		VarCount,
+		Variables,
+		VariableNameBegin, 
+		VariableNameEndExcl - VariableNameBegin,
+		&BindingIndex ) )
+	{
+		//
+		// Unknown variables evaluate to '', literals may continue.
+		//
+		return;
+	}
+
+	if ( Emitter->Program )
+	{
+		PFORMAT_INSTRUCTION Instruction = 
+			&Emitter->Program->Instructions[ Emitter->InstructionCount ];
+		PCWSTR Format = Variables[ BindingIndex ].Format;
+
+		if ( 0 == wcscmp( Format, L"%s" ) )
+		{
+			Instruction->Opcode = FormatStringOpcode;
+		}
+		else if ( 0 == wcscmp( Format, L"%u" ) )
+		{
+			Instruction->Opcode = FormatUnsignedOpcode;
+		}
+		else
+		{
+			Instruction->Opcode = FormatPrintfOpcode;
+		}
+
+		Instruction->Operand	= ( ULONG ) BindingIndex;
+		Instruction->LiteralCch	= 0;
+		Instruction->Format		= Format;
+
+		Emitter->Program->UsedVariables |= ( 1 << BindingIndex );
+	}
+
+	Emitter->InstructionCount++;
+	Emitter->InLiteral = FALSE;
+}
+
+/*++
+	Routine Description:
+		Parse template and emit instructions. Mirrors the parsing
+		done by CdiagpFormatString.
+--*/
+static VOID CdiagsCompileFormatString(
+	__in ULONG VarCount,
+	__in PFORMAT_VARIABLE Variables,
+	__in PCWSTR FormatStringTemplate,
+	__in PFORMAT_EMITTER Emitter
+	)
+{
+	PCWSTR VariableName = NULL;
+	CONST WCHAR *Cur = 0;
+	BOOL InVariable = FALSE;
+
+	for ( Cur = FormatStringTemplate; *Cur != L'\0'; Cur++ )
+	{
+		if ( *Cur == L'%' )
+		{
+			if ( VariableName == Cur )
+			{
+				//
+				// That was a %%.
+				//
+				InVariable = FALSE;
+				CdiagsEmitLiteral( Emitter, *Cur );
+			}
+			else
+			{
+				InVariable = TRUE;
+
+				if ( VariableName )
+				{
+					CdiagsEmitVariable(
+						Emitter,
+						VarCount,
+						Variables,
+						VariableName,
+						Cur );
+				}
+
+				//
+				// Save beginning of keyword.
+				//
+				VariableName = Cur + 1;
+			}
+		}
+		else if ( InVariable && ! iswalnum( *Cur ) )
+		{
+			CdiagsEmitVariable(
+				Emitter,
+				VarCount,
+				Variables,
+				VariableName,
+				Cur );
+			
+			InVariable = FALSE;
+			VariableName = NULL;
+
+			CdiagsEmitLiteral( Emitter, *Cur );
+		}
+		else if ( ! InVariable )
+		{
+			CdiagsEmitLiteral( Emitter, *Cur );
+		}
+	}
+
+	if ( InVariable )
+	{
+		CdiagsEmitVariable(
+			Emitter,
+			VarCount,
+			Variables,
+			VariableName,
+			Cur );
+	}
+}
+
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CdiagpCompileFormatString(
+	__in ULONG VarCount,
+	__in CONST PFORMAT_VARIABLE Variables,
+	__in PCWSTR FormatStringTemplate,
+	__out PFORMAT_PROGRAM *Program
+	)
+{
+	FORMAT_EMITTER Emitter;
+	PFORMAT_PROGRAM NewProgram;
+	SIZE_T InstructionsCb;
+
+	if ( VarCount == 0 ||
+		 VarCount > CDIAGP_MAX_FORMAT_VARIABLES ||
+		 ! Variables ||
+		 ! CdiagpIsStringValid( FormatStringTemplate, 1, MAXWORD, FALSE ) ||
+		 ! Program )
+	{
+		return E_INVALIDARG;
+	}
+
+	//
+	// Size program.
+	//
+	ZeroMemory( &Emitter, sizeof( FORMAT_EMITTER ) );
+	CdiagsCompileFormatString(
+		VarCount,
+		Variables,
+		FormatStringTemplate,
+		&Emitter );
+
+	//
+	// Allocate instructions and literals in one go.
+	//
+	InstructionsCb = FIELD_OFFSET( 
+		FORMAT_PROGRAM, 
+		Instructions[ max( Emitter.InstructionCount, 1 ) ] );
+	NewProgram = ( PFORMAT_PROGRAM ) CdiagpMalloc( 
+		InstructionsCb + Emitter.LiteralCch * sizeof( WCHAR ),
+		TRUE );
+	if ( ! NewProgram )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	NewProgram->Literals = ( PWSTR ) ( ( PBYTE ) NewProgram + InstructionsCb );
+	NewProgram->InstructionCount = Emitter.InstructionCount;
+
+	//
+	// Emit.
+	//
+	ZeroMemory( &Emitter, sizeof( FORMAT_EMITTER ) );
+	Emitter.Program = NewProgram;
+	CdiagsCompileFormatString(
+		VarCount,
+		Variables,
+		FormatStringTemplate,
+		&Emitter );
+
+	_ASSERTE( Emitter.InstructionCount == NewProgram->InstructionCount );
+
+	*Program = NewProgram;
+	return S_OK;
+}
+
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+VOID CdiagpFreeFormatProgram(
+	__in PFORMAT_PROGRAM Program
+	)
+{
+	_ASSERTE( Program );
+	CdiagpFree( Program );
+}
+
+BOOL CdiagpIsVariableUsedFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in ULONG VariableIndex
+	)
+{
+	_ASSERTE( Program );
+	_ASSERTE( VariableIndex < CDIAGP_MAX_FORMAT_VARIABLES );
+
+	return ( Program->UsedVariables & ( 1 << VariableIndex ) ) != 0;
+}
+
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CdiagpRunFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in DWORD_PTR *Bindings,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer 
+	)
+{
+	WCHAR *BufferPtr;
+	WCHAR *BufferEnd;
+	ULONG Index;
+
+	if ( ! Program ||
+		 ! Bindings ||
+		 BufferSizeInChars == 0 ||
+		 ! Buffer )
+	{
+		return E_INVALIDARG;
+	}
+
+	//
+	// Reserve space for null termination.
+	//
+	BufferPtr = &Buffer[ 0 ];
+	BufferEnd = &Buffer[ BufferSizeInChars - 1 ];
+
+	for ( Index = 0; Index < Program->InstructionCount; Index++ )
+	{
+		PFORMAT_INSTRUCTION Instruction = &Program->Instructions[ Index ];
+
+		switch ( Instruction->Opcode )
+		{
+		case FormatLiteralOpcode:
+			if ( Instruction->LiteralCch > ( SIZE_T ) ( BufferEnd - BufferPtr ) )
+			{
+				return CDIAG_E_BUFFER_TOO_SMALL;
+			}
+
+			CopyMemory(
+				BufferPtr,
+				&Program->Literals[ Instruction->Operand ],
+				Instruction->LiteralCch * sizeof( WCHAR ) );
+			BufferPtr += Instruction->LiteralCch;
+			break;
+
+		case FormatStringOpcode:
+			{
+				//
+				// Print NULL like _snwprintf does.
+				//
+				PCWSTR String = Bindings[ Instruction->Operand ] != 0 
+					? ( PCWSTR ) ( PVOID ) Bindings[ Instruction->Operand ]
+					: L"(null)";
+
+				while ( *String != L'\0' )
+				{
+					if ( BufferPtr >= BufferEnd )
+					{
+						return CDIAG_E_BUFFER_TOO_SMALL;
+					}
+
+					*BufferPtr++ = *String++;
+				}
+			}
+			break;
+
+		case FormatUnsignedOpcode:
+			{
+				WCHAR Digits[ 10 ];
+				ULONG Value = ( ULONG ) Bindings[ Instruction->Operand ];
+				ULONG DigitCount = 0;
+
+				do
+				{
+					Digits[ DigitCount++ ] = ( WCHAR ) ( L'0' + Value % 10 );
+					Value /= 10;
+				}
+				while ( Value != 0 );
+
+				if ( DigitCount > ( SIZE_T ) ( BufferEnd - BufferPtr ) )
+				{
+					return CDIAG_E_BUFFER_TOO_SMALL;
+				}
+
+				while ( DigitCount > 0 )
+				{
+					*BufferPtr++ = Digits[ --DigitCount ];
+				}
+			}
+			break;
+
+		case FormatPrintfOpcode:
+			{
+				INT CharsWritten;
+
+#pragma warning( push )
+#pragma warning( disable : 4995 4996 )
+				CharsWritten = _snwprintf(
+					BufferPtr,
+					BufferEnd - BufferPtr,
+					Instruction->Format,
+					Bindings[ Instruction->Operand ] );
+#pragma warning( pop )
+
+				if ( CharsWritten < 0 )
+				{
+					return CDIAG_E_BUFFER_TOO_SMALL;
+				}
+
+				BufferPtr += CharsWritten;
+			}
+			break;
+
+		default:
+			_ASSERTE( !"Invalid opcode" );
+			return E_UNEXPECTED;
+		}
+	}
+
+	*BufferPtr = L'\0';
 	return S_OK;
 }
\ No newline at end of file
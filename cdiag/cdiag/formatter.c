@@ -50,6 +50,11 @@ typedef struct _CDIAGP_FORMATTER
 	//
 	PCWSTR FormatTemplate;
 
+	//
+	// FormatTemplate, compiled.
+	//
+	PFORMAT_PROGRAM Program;
+
 	//
 	// Optional: Resolver object. 
 	//
@@ -355,6 +360,7 @@ static BINDING_DEFINITION CdiagsEventPacketBindings[] =
 };
 
 C_ASSERT( _countof( CdiagsEventPacketVariables ) == _countof( CdiagsEventPacketBindings ) );
+C_ASSERT( _countof( CdiagsEventPacketVariables ) <= CDIAGP_MAX_FORMAT_VARIABLES );
 
 /*----------------------------------------------------------------------
  *
@@ -393,7 +399,20 @@ static HRESULT CdiagsFormat(
 	//
 	for ( Index = 0; Index <  _countof( CdiagsEventPacketVariables ); Index++ )
 	{
-		PVOID FieldPtr = CdiagsGetFieldViaOffset(
+		PVOID FieldPtr;
+
+		MustFree[ Index ] = FALSE;
+
+		if ( ! CdiagpIsVariableUsedFormatProgram( Formatter->Program, Index ) )
+		{
+			//
+			// Not referred to by template, avoid translation.
+			//
+			Bindings[ Index ] = 0;
+			continue;
+		}
+
+		FieldPtr = CdiagsGetFieldViaOffset(
 			EventPkt,
 			CdiagsEventPacketBindings[ Index ].StructOffset );
 
@@ -473,7 +492,6 @@ static HRESULT CdiagsFormat(
 		//
 		// Translate raw value if neccessary.
 		//
-		MustFree[ Index ] = FALSE;
 		if ( CdiagsEventPacketBindings[ Index ].TranslateRoutine )
 		{
 			_ASSERTE( CdiagsEventPacketBindings[ Index ].Type == SpecialType );
@@ -514,7 +532,10 @@ static HRESULT CdiagsFormat(
 	//
 	// Resolve message if neccessary.
 	//
-	if ( 0 == EventPkt->MessageOffset && Formatter->Resolver != NULL )
+	_ASSERTE( 0 == wcscmp( CdiagsEventPacketVariables[ 0 ].Name, L"Message" ) );
+	if ( 0 == EventPkt->MessageOffset && 
+		 Formatter->Resolver != NULL &&
+		 CdiagpIsVariableUsedFormatProgram( Formatter->Program, 0 ) )
 	{
 		for ( Index = 0; Index < EventPkt->MessageInsertionStrings.Count; Index++ )
 		{
@@ -536,7 +557,6 @@ static HRESULT CdiagsFormat(
 			//
 			// Update binding.
 			//
-			_ASSERTE( 0 == wcscmp( CdiagsEventPacketVariables[ 0 ].Name, L"Message" ) );
 			Bindings[ 0 ] = ( DWORD_PTR ) ResolverBuffer;
 		}
 	}
@@ -545,11 +565,9 @@ static HRESULT CdiagsFormat(
 	//
 	// Format the message.
 	//
-	Hr = CdiagpFormatString(
-		_countof( CdiagsEventPacketVariables ),
-		CdiagsEventPacketVariables,
+	Hr = CdiagpRunFormatProgram(
+		Formatter->Program,
 		Bindings,
-		Formatter->FormatTemplate,
 		BufferSizeInChars,
 		Buffer );
 
@@ -578,6 +596,11 @@ static HRESULT CdiagsDeleteFormatter(
 		Formatter->Resolver->Dereference( Formatter->Resolver );
 	}
 
+	if ( Formatter->Program )
+	{
+		CdiagpFreeFormatProgram( Formatter->Program );
+	}
+
 	CdiagpFree( Formatter );
 
 	return S_OK;
@@ -623,6 +646,7 @@ HRESULT CDIAGCALLTYPE CdiagCreateFormatter(
 	PCDIAGP_FORMATTER Formatter = NULL;
 	SIZE_T FormatTemplateCb;
 	PWSTR Temp;
+	HRESULT Hr;
 
 	if ( ! CdiagpIsStringValid( FormatTemplate, 1, MAXWORD, FALSE ) ||
 		 ! Result ||
@@ -655,6 +679,20 @@ HRESULT CDIAGCALLTYPE CdiagCreateFormatter(
 	Formatter->ReferenceCount = 1;
 	Formatter->FormatTemplate = Temp;
 
+	//
+	// Compile template once s.t. it need not be parsed per event.
+	//
+	Hr = CdiagpCompileFormatString(
+		_countof( CdiagsEventPacketVariables ),
+		CdiagsEventPacketVariables,
+		Temp,
+		&Formatter->Program );
+	if ( FAILED( Hr ) )
+	{
+		CdiagpFree( Formatter );
+		return Hr;
+	}
+
 	Formatter->Base.Size			= sizeof( CDIAGP_FORMATTER );
 	Formatter->Base.Dereference		= CdiagsDereferenceFormatter;
 	Formatter->Base.Reference		= CdiagsReferenceFormatter;
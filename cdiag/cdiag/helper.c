@@ -66,3 +66,8 @@ BOOL CdiagpIsStringValid(
 		SUCCEEDED( StringCchLength( String, MaxLengthInclusive + 1, &size ) ) &&
 		size >= MinLengthInclusive;
 }
+
+VOID CdiagpYieldEpoch()
+{
+	( VOID ) SwitchToThread();
+}
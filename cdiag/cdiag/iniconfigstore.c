@@ -0,0 +1,1493 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Implementation of the INI file configuration store
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CDIAGAPI
+
+#include <errno.h>
+#include <stdlib.h>
+#include "cdiagp.h"
+
+#pragma warning( push )
+#pragma warning( disable: 6011; disable: 6387 )
+#include <strsafe.h>
+#include <shlwapi.h>
+#pragma warning( pop )
+
+/*++
+	get array index from a _CDIAG_CONFIGURATION_SCOPES scope
+--*/
+#define FILE_INDEX_FOR_SCOPE( scope ) ( ( scope - 1 ) % 2 )
+#define FILE_SCOPE_FOR_INDEX( scope ) ( ( scope + 1 ) )
+#define MAX_FILE_INDEX 1
+
+/*++
+	limits - all settings are held in memory.
+--*/
+#define MAX_INI_FILE_CB ( 4 * 1024 * 1024 )
+#define MAX_INI_VALUE_CB ( 1024 * 1024 )
+#define MAX_INI_VALUE_CCH ( MAX_INI_VALUE_CB / sizeof( WCHAR ) )
+
+#define INI_TYPE_PREFIX_DWORD		L"dword:"
+#define INI_TYPE_PREFIX_SZ			L"sz:"
+#define INI_TYPE_PREFIX_MULTI_SZ	L"multi_sz:"
+
+#define INI_TEMP_SUFFIX				L".tmp"
+
+typedef struct _CDIAGP_INI_CONFIG_STORE *PCDIAGP_INI_CONFIG_STORE;
+
+typedef struct _CDIAGS_INI_FILE
+{
+	//
+	// Full path. Empty if the scope is not used.
+	//
+	// Initialized on creation, read-only from then on.
+	//
+	WCHAR Path[ MAX_PATH ];
+	BOOL Readable;
+	BOOL Writable;
+
+	//
+	// Change notification for the directory containing the file and
+	// the wait handle for it.
+	//
+	// Initialized on creation, read-only from then on.
+	//
+	HANDLE Change;
+	HANDLE WaitHandle;
+
+	//
+	// Back pointer, used as context by the wait callback.
+	//
+	PCDIAGP_INI_CONFIG_STORE Store;
+} CDIAGS_INI_FILE, *PCDIAGS_INI_FILE;
+
+typedef struct _CDIAGP_INI_CONFIG_STORE
+{
+	CDIAG_CONFIGURATION_STORE Base;
+
+	//
+	// Files. Use FILE_INDEX_FOR_SCOPE to calculate index.
+	//
+	CDIAGS_INI_FILE Files[ 2 ];
+
+	//
+	// Lock that serializes updates of the snapshot and file
+	// contents and guards the Callback struct.
+	//
+	CRITICAL_SECTION Lock;
+
+	//
+	// Snapshot of the contents of all files.
+	//
+	CDIAGP_CONFIG_CACHE Settings;
+
+	//
+	// Update callback
+	//
+	// Changes at any time.
+	//
+	struct _Callback
+	{
+		CDIAG_CONFIGSTORE_UPDATE_CALLBACK Function;
+		PVOID Context;
+	} Callback;
+} CDIAGP_INI_CONFIG_STORE;
+
+typedef struct _CDIAGS_INI_TEXT
+{
+	PWSTR Buffer;
+	SIZE_T Length;
+	SIZE_T Capacity;
+} CDIAGS_INI_TEXT, *PCDIAGS_INI_TEXT;
+
+/*----------------------------------------------------------------------
+ *
+ * Private helper routines
+ *
+ */
+
+#define CdiagsIsValidScope( scope ) ( scope >= 1 && scope <= 3 )
+#define CdiagsIsValidIniStore( store ) \
+	( ( store != NULL && store->Base.Size == sizeof( CDIAGP_INI_CONFIG_STORE ) ) )
+
+/*++
+	Routine description:
+		Tests whether a name is valid for use as a group or setting
+		name. In addition to the characters reserved by the INI
+		syntax, backslashes are rejected for consistency with the
+		registry store.
+--*/
+static BOOL CdiagsIsValidIniName(
+	__in LPCWSTR Name,
+	__in size_t MaxLen
+	)
+{
+	_ASSERTE( MaxLen );
+
+	return NULL != Name &&
+		   NULL == wcspbrk( Name, L"\\[]=;#\r\n" ) &&
+		   CdiagpIsStringValid( Name, 1, MaxLen, FALSE );
+}
+
+static HRESULT CdiagsAppendIniText(
+	__in PCDIAGS_INI_TEXT Text,
+	__in_ecount( Length ) PCWSTR String,
+	__in SIZE_T Length
+	)
+{
+	if ( Text->Length + Length > Text->Capacity )
+	{
+		SIZE_T NewCapacity = max(
+			Text->Capacity * 2,
+			Text->Length + Length + 256 );
+		PWSTR NewBuffer = CdiagpMalloc( NewCapacity * sizeof( WCHAR ), FALSE );
+		if ( ! NewBuffer )
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		if ( Text->Buffer )
+		{
+			CopyMemory( NewBuffer, Text->Buffer, Text->Length * sizeof( WCHAR ) );
+			CdiagpFree( Text->Buffer );
+		}
+
+		Text->Buffer	= NewBuffer;
+		Text->Capacity	= NewCapacity;
+	}
+
+	CopyMemory(
+		Text->Buffer + Text->Length,
+		String,
+		Length * sizeof( WCHAR ) );
+	Text->Length += Length;
+
+	return S_OK;
+}
+
+static HRESULT CdiagsAppendIniString(
+	__in PCDIAGS_INI_TEXT Text,
+	__in PCWSTR String
+	)
+{
+	return CdiagsAppendIniText( Text, String, wcslen( String ) );
+}
+
+/*++
+	Routine description:
+		Appends a string value, escaping characters as necessary.
+		For multi strings, Length covers all elements, separated
+		by \0.
+--*/
+static HRESULT CdiagsAppendEscapedIniValue(
+	__in PCDIAGS_INI_TEXT Text,
+	__in_ecount( Length ) PCWSTR Value,
+	__in SIZE_T Length
+	)
+{
+	HRESULT Hr = S_OK;
+	SIZE_T Index;
+
+	for ( Index = 0; Index < Length && SUCCEEDED( Hr ); Index++ )
+	{
+		switch ( Value[ Index ] )
+		{
+		case L'\\':
+			Hr = CdiagsAppendIniString( Text, L"\\\\" );
+			break;
+
+		case L'\r':
+			Hr = CdiagsAppendIniString( Text, L"\\r" );
+			break;
+
+		case L'\n':
+			Hr = CdiagsAppendIniString( Text, L"\\n" );
+			break;
+
+		case UNICODE_NULL:
+			Hr = CdiagsAppendIniString( Text, L"\\0" );
+			break;
+
+		default:
+			Hr = CdiagsAppendIniText( Text, &Value[ Index ], 1 );
+			break;
+		}
+	}
+
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Unescapes a string value. Target may be the same as Source
+		or precede it.
+
+	Returns:
+		Length of result in characters, excluding null termination,
+		or -1 if the value is malformed.
+--*/
+static LONG CdiagsUnescapeIniValue(
+	__in PCWSTR Source,
+	__out PWSTR Target,
+	__in BOOL MultiString
+	)
+{
+	PWSTR Start = Target;
+
+	while ( *Source != UNICODE_NULL )
+	{
+		if ( *Source != L'\\' )
+		{
+			*Target++ = *Source++;
+			continue;
+		}
+
+		switch ( Source[ 1 ] )
+		{
+		case L'\\':
+			*Target++ = L'\\';
+			break;
+
+		case L'r':
+			*Target++ = L'\r';
+			break;
+
+		case L'n':
+			*Target++ = L'\n';
+			break;
+
+		case L'0':
+			//
+			// Element separator - empty elements would terminate
+			// the multi string prematurely.
+			//
+			if ( ! MultiString ||
+				 Target == Start ||
+				 Target[ -1 ] == UNICODE_NULL )
+			{
+				return -1;
+			}
+
+			*Target++ = UNICODE_NULL;
+			break;
+
+		default:
+			return -1;
+		}
+
+		Source += 2;
+	}
+
+	if ( MultiString && Target != Start && Target[ -1 ] == UNICODE_NULL )
+	{
+		return -1;
+	}
+
+	*Target = UNICODE_NULL;
+	return ( LONG ) ( Target - Start );
+}
+
+/*++
+	Routine description:
+		Parses a single, null-terminated line of an INI file.
+
+	Parameters:
+		GroupName	Current group, updated if the line is a
+					section header.
+--*/
+static HRESULT CdiagsParseIniLine(
+	__in PWSTR Line,
+	__in DWORD Scope,
+	__inout_ecount( MAX_SETTINGGROUPNAME_CCH + 1 ) PWSTR GroupName,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	)
+{
+	PWSTR Value;
+
+	if ( *Line == UNICODE_NULL ||
+		 *Line == L';' ||
+		 *Line == L'#' ||
+		 CdiagpIsWhitespaceOnly( Line ) )
+	{
+		return S_OK;
+	}
+	else if ( *Line == L'[' )
+	{
+		PWSTR End = wcschr( Line, L']' );
+		if ( ! End || ! CdiagpIsWhitespaceOnly( End + 1 ) )
+		{
+			return CDIAG_E_INVALID_CONFIGURATION_FILE;
+		}
+
+		*End = UNICODE_NULL;
+
+		if ( ! CdiagsIsValidIniName( Line + 1, MAX_SETTINGGROUPNAME_CCH ) )
+		{
+			return CDIAG_E_INVALID_CONFIGURATION_FILE;
+		}
+
+		return StringCchCopy(
+			GroupName,
+			MAX_SETTINGGROUPNAME_CCH + 1,
+			Line + 1 );
+	}
+
+	Value = wcschr( Line, L'=' );
+	if ( *GroupName == UNICODE_NULL || ! Value )
+	{
+		return CDIAG_E_INVALID_CONFIGURATION_FILE;
+	}
+
+	*Value++ = UNICODE_NULL;
+
+	if ( ! CdiagsIsValidIniName( Line, MAX_SETTINGNAME_CCH ) )
+	{
+		return CDIAG_E_INVALID_CONFIGURATION_FILE;
+	}
+
+	if ( 0 == wcsncmp(
+		Value,
+		INI_TYPE_PREFIX_DWORD,
+		_countof( INI_TYPE_PREFIX_DWORD ) - 1 ) )
+	{
+		PWSTR Digits = Value + _countof( INI_TYPE_PREFIX_DWORD ) - 1;
+		PWSTR End;
+		DWORD Data;
+
+		errno = 0;
+		Data = wcstoul( Digits, &End, 0 );
+		if ( ! iswdigit( *Digits ) ||
+			 errno == ERANGE ||
+			 ! CdiagpIsWhitespaceOnly( End ) )
+		{
+			return CDIAG_E_INVALID_CONFIGURATION_FILE;
+		}
+
+		return CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Line,
+			REG_DWORD,
+			sizeof( DWORD ),
+			&Data );
+	}
+	else if ( 0 == wcsncmp(
+		Value,
+		INI_TYPE_PREFIX_SZ,
+		_countof( INI_TYPE_PREFIX_SZ ) - 1 ) )
+	{
+		LONG Length = CdiagsUnescapeIniValue(
+			Value + _countof( INI_TYPE_PREFIX_SZ ) - 1,
+			Value,
+			FALSE );
+		if ( Length < 0 )
+		{
+			return CDIAG_E_INVALID_CONFIGURATION_FILE;
+		}
+
+		return CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Line,
+			REG_SZ,
+			( Length + 1 ) * sizeof( WCHAR ),
+			Value );
+	}
+	else if ( 0 == wcsncmp(
+		Value,
+		INI_TYPE_PREFIX_MULTI_SZ,
+		_countof( INI_TYPE_PREFIX_MULTI_SZ ) - 1 ) )
+	{
+		//
+		// The prefix leaves enough room for the second terminator.
+		//
+		LONG Length = CdiagsUnescapeIniValue(
+			Value + _countof( INI_TYPE_PREFIX_MULTI_SZ ) - 1,
+			Value,
+			TRUE );
+		if ( Length < 0 )
+		{
+			return CDIAG_E_INVALID_CONFIGURATION_FILE;
+		}
+		else if ( Length > 0 )
+		{
+			Value[ Length + 1 ] = UNICODE_NULL;
+			Length++;
+		}
+
+		return CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Line,
+			REG_MULTI_SZ,
+			( Length + 1 ) * sizeof( WCHAR ),
+			Value );
+	}
+	else
+	{
+		return CDIAG_E_INVALID_CONFIGURATION_FILE;
+	}
+}
+
+/*++
+	Routine description:
+		Adds all settings of a file to a snapshot. A missing file
+		is treated as being empty.
+--*/
+static HRESULT CdiagsParseIniFile(
+	__in PCWSTR Path,
+	__in DWORD Scope,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	)
+{
+	WCHAR GroupName[ MAX_SETTINGGROUPNAME_CCH + 1 ] = { 0 };
+	LARGE_INTEGER FileSize;
+	PSTR Utf8 = NULL;
+	PWSTR Text = NULL;
+	PWSTR Line;
+	DWORD Utf8Length;
+	DWORD BytesRead;
+	int TextLength;
+	HANDLE File;
+	HRESULT Hr;
+
+	File = CreateFile(
+		Path,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		0,
+		NULL );
+	if ( File == INVALID_HANDLE_VALUE )
+	{
+		DWORD Err = GetLastError();
+		return ( Err == ERROR_FILE_NOT_FOUND )
+			? S_OK
+			: HRESULT_FROM_WIN32( Err );
+	}
+
+	if ( ! GetFileSizeEx( File, &FileSize ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+	else if ( FileSize.QuadPart > MAX_INI_FILE_CB )
+	{
+		Hr = CDIAG_E_INVALID_CONFIGURATION_FILE;
+		goto Cleanup;
+	}
+	else if ( FileSize.QuadPart == 0 )
+	{
+		Hr = S_OK;
+		goto Cleanup;
+	}
+
+	Utf8 = CdiagpMalloc( ( SIZE_T ) FileSize.QuadPart, FALSE );
+	if ( ! Utf8 )
+	{
+		Hr = E_OUTOFMEMORY;
+		goto Cleanup;
+	}
+
+	if ( ! ReadFile( File, Utf8, FileSize.LowPart, &BytesRead, NULL ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+
+	//
+	// Skip BOM.
+	//
+	Utf8Length = BytesRead;
+	if ( Utf8Length >= 3 && 0 == memcmp( Utf8, "\xEF\xBB\xBF", 3 ) )
+	{
+		MoveMemory( Utf8, Utf8 + 3, Utf8Length - 3 );
+		Utf8Length -= 3;
+	}
+
+	if ( Utf8Length == 0 )
+	{
+		Hr = S_OK;
+		goto Cleanup;
+	}
+
+	TextLength = MultiByteToWideChar(
+		CP_UTF8,
+		MB_ERR_INVALID_CHARS,
+		Utf8,
+		Utf8Length,
+		NULL,
+		0 );
+	if ( TextLength == 0 )
+	{
+		Hr = CDIAG_E_INVALID_CONFIGURATION_FILE;
+		goto Cleanup;
+	}
+
+	Text = CdiagpMalloc( ( TextLength + 1 ) * sizeof( WCHAR ), FALSE );
+	if ( ! Text )
+	{
+		Hr = E_OUTOFMEMORY;
+		goto Cleanup;
+	}
+
+	_VERIFY( TextLength == MultiByteToWideChar(
+		CP_UTF8,
+		MB_ERR_INVALID_CHARS,
+		Utf8,
+		Utf8Length,
+		Text,
+		TextLength ) );
+	Text[ TextLength ] = UNICODE_NULL;
+
+	Hr = S_OK;
+	for ( Line = Text; *Line != UNICODE_NULL && SUCCEEDED( Hr ); )
+	{
+		PWSTR Next = wcspbrk( Line, L"\r\n" );
+		if ( Next )
+		{
+			if ( Next[ 0 ] == L'\r' && Next[ 1 ] == L'\n' )
+			{
+				*Next++ = UNICODE_NULL;
+			}
+
+			*Next++ = UNICODE_NULL;
+		}
+		else
+		{
+			Next = Line + wcslen( Line );
+		}
+
+		Hr = CdiagsParseIniLine( Line, Scope, GroupName, Snapshot );
+		Line = Next;
+	}
+
+Cleanup:
+	if ( Text )
+	{
+		CdiagpFree( Text );
+	}
+
+	if ( Utf8 )
+	{
+		CdiagpFree( Utf8 );
+	}
+
+	_VERIFY( CloseHandle( File ) );
+
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Creates a snapshot of the contents of all files. Settings
+		of write-only scopes are included as files are always
+		rewritten as a whole.
+--*/
+static HRESULT CdiagsLoadSnapshot(
+	__in PCDIAGP_INI_CONFIG_STORE Store,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT NewSnapshot;
+	DWORD ReadableScopes = 0;
+	HRESULT Hr;
+	UINT i;
+
+	for ( i = 0; i <= MAX_FILE_INDEX; i++ )
+	{
+		if ( Store->Files[ i ].Readable )
+		{
+			ReadableScopes |= FILE_SCOPE_FOR_INDEX( i );
+		}
+	}
+
+	Hr = CdiagpCreateConfigSnapshot( ReadableScopes, &NewSnapshot );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	for ( i = 0; i <= MAX_FILE_INDEX; i++ )
+	{
+		if ( Store->Files[ i ].Path[ 0 ] != UNICODE_NULL )
+		{
+			Hr = CdiagsParseIniFile(
+				Store->Files[ i ].Path,
+				FILE_SCOPE_FOR_INDEX( i ),
+				NewSnapshot );
+			if ( FAILED( Hr ) )
+			{
+				CdiagpFreeConfigSnapshot( NewSnapshot );
+				return Hr;
+			}
+		}
+	}
+
+	*Snapshot = NewSnapshot;
+	return S_OK;
+}
+
+/*++
+	Routine description:
+		Writes all settings of one scope to its file. The file is
+		replaced atomically s.t. readers never see partial contents.
+--*/
+static HRESULT CdiagsWriteIniFile(
+	__in PCDIAGP_INI_CONFIG_STORE Store,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot,
+	__in DWORD Scope
+	)
+{
+	PCWSTR Path = Store->Files[ FILE_INDEX_FOR_SCOPE( Scope ) ].Path;
+	WCHAR TempPath[ MAX_PATH ];
+	CDIAGS_INI_TEXT Text = { NULL, 0, 0 };
+	PCWSTR GroupName = NULL;
+	PSTR Utf8 = NULL;
+	SIZE_T Utf8Length = 0;
+	DWORD Written;
+	HANDLE File;
+	HRESULT Hr;
+	ULONG Index;
+
+	Hr = StringCchPrintf(
+		TempPath,
+		_countof( TempPath ),
+		L"%s" INI_TEMP_SUFFIX,
+		Path );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	//
+	// Entries of a group are adjacent as the snapshot is sorted.
+	//
+	for ( Index = 0; Index < Snapshot->EntryCount && SUCCEEDED( Hr ); Index++ )
+	{
+		PCDIAGP_CONFIG_ENTRY Entry = Snapshot->Entries[ Index ];
+		PCWSTR Value = ( PCWSTR ) Entry->Data;
+		SIZE_T ValueLength = Entry->DataSize / sizeof( WCHAR );
+
+		if ( Entry->Scope != Scope )
+		{
+			continue;
+		}
+
+		if ( ! GroupName || 0 != _wcsicmp( GroupName, Entry->GroupName ) )
+		{
+			GroupName = Entry->GroupName;
+
+			if ( Text.Length > 0 )
+			{
+				Hr = CdiagsAppendIniString( &Text, L"\r\n" );
+			}
+
+			if ( SUCCEEDED( Hr ) )
+			{
+				Hr = CdiagsAppendIniString( &Text, L"[" );
+			}
+			if ( SUCCEEDED( Hr ) )
+			{
+				Hr = CdiagsAppendIniString( &Text, GroupName );
+			}
+			if ( SUCCEEDED( Hr ) )
+			{
+				Hr = CdiagsAppendIniString( &Text, L"]\r\n" );
+			}
+		}
+
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = CdiagsAppendIniString( &Text, Entry->Name );
+		}
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = CdiagsAppendIniString( &Text, L"=" );
+		}
+
+		if ( FAILED( Hr ) )
+		{
+			break;
+		}
+
+		switch ( Entry->Type )
+		{
+		case REG_DWORD:
+			{
+				WCHAR Digits[ 11 ];
+				_ASSERTE( Entry->DataSize == sizeof( DWORD ) );
+
+				Hr = StringCchPrintf(
+					Digits,
+					_countof( Digits ),
+					L"%u",
+					*( DWORD* ) Entry->Data );
+				if ( SUCCEEDED( Hr ) )
+				{
+					Hr = CdiagsAppendIniString( &Text, INI_TYPE_PREFIX_DWORD );
+				}
+				if ( SUCCEEDED( Hr ) )
+				{
+					Hr = CdiagsAppendIniString( &Text, Digits );
+				}
+			}
+			break;
+
+		case REG_SZ:
+			//
+			// Strip terminator.
+			//
+			while ( ValueLength > 0 && Value[ ValueLength - 1 ] == UNICODE_NULL )
+			{
+				ValueLength--;
+			}
+
+			Hr = CdiagsAppendIniString( &Text, INI_TYPE_PREFIX_SZ );
+			if ( SUCCEEDED( Hr ) )
+			{
+				Hr = CdiagsAppendEscapedIniValue( &Text, Value, ValueLength );
+			}
+			break;
+
+		case REG_MULTI_SZ:
+			//
+			// Strip both terminators, keep separators.
+			//
+			while ( ValueLength > 0 && Value[ ValueLength - 1 ] == UNICODE_NULL )
+			{
+				ValueLength--;
+			}
+
+			Hr = CdiagsAppendIniString( &Text, INI_TYPE_PREFIX_MULTI_SZ );
+			if ( SUCCEEDED( Hr ) )
+			{
+				Hr = CdiagsAppendEscapedIniValue( &Text, Value, ValueLength );
+			}
+			break;
+
+		default:
+			_ASSERTE( !"Invalid type" );
+			Hr = E_UNEXPECTED;
+		}
+
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = CdiagsAppendIniString( &Text, L"\r\n" );
+		}
+	}
+
+	if ( FAILED( Hr ) )
+	{
+		goto Cleanup;
+	}
+
+	if ( Text.Length > 0 )
+	{
+		Utf8 = CdiagpMalloc( CDIAGP_MAX_UTF8_CB( Text.Length ), FALSE );
+		if ( ! Utf8 )
+		{
+			Hr = E_OUTOFMEMORY;
+			goto Cleanup;
+		}
+
+		Hr = CdiagpConvertUtf16ToUtf8(
+			Text.Buffer,
+			Text.Length,
+			Utf8,
+			CDIAGP_MAX_UTF8_CB( Text.Length ),
+			&Utf8Length );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+	}
+
+	File = CreateFile(
+		TempPath,
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		0,
+		NULL );
+	if ( File == INVALID_HANDLE_VALUE )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		goto Cleanup;
+	}
+
+	if ( Utf8Length > 0 &&
+		 ! WriteFile( File, Utf8, ( DWORD ) Utf8Length, &Written, NULL ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	_VERIFY( CloseHandle( File ) );
+
+	if ( SUCCEEDED( Hr ) &&
+		 ! MoveFileEx( TempPath, Path, MOVEFILE_REPLACE_EXISTING ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	if ( FAILED( Hr ) )
+	{
+		( VOID ) DeleteFile( TempPath );
+	}
+
+Cleanup:
+	if ( Utf8 )
+	{
+		CdiagpFree( Utf8 );
+	}
+
+	if ( Text.Buffer )
+	{
+		CdiagpFree( Text.Buffer );
+	}
+
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Writes or deletes (DataType == REG_NONE) a setting. The
+		update is based on the current file contents rather than
+		the current snapshot s.t. changes made by other processes
+		are not lost if their notification is still pending.
+--*/
+static HRESULT CdiagsUpdateSetting(
+	__in PCDIAGP_INI_CONFIG_STORE Store,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD DataType,
+	__in DWORD DataLen,
+	__in_opt CONST PBYTE Data
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+	HRESULT Hr;
+
+	_ASSERTE( Scope == CdiagGlobalScope || Scope == CdiagUserScope );
+
+	if ( ! Store->Files[ FILE_INDEX_FOR_SCOPE( Scope ) ].Writable )
+	{
+		return E_ACCESSDENIED;
+	}
+
+	EnterCriticalSection( &Store->Lock );
+
+	Hr = CdiagsLoadSnapshot( Store, &Snapshot );
+	if ( FAILED( Hr ) )
+	{
+		goto Cleanup;
+	}
+
+	if ( DataType == REG_NONE )
+	{
+		Hr = CdiagpDeleteConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Name );
+	}
+	else
+	{
+		Hr = CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Name,
+			DataType,
+			DataLen,
+			Data );
+	}
+
+	if ( SUCCEEDED( Hr ) )
+	{
+		Hr = CdiagsWriteIniFile( Store, Snapshot, Scope );
+	}
+
+	if ( FAILED( Hr ) )
+	{
+		CdiagpFreeConfigSnapshot( Snapshot );
+		goto Cleanup;
+	}
+
+	CdiagpPublishConfigSnapshot( &Store->Settings, Snapshot );
+
+Cleanup:
+	LeaveCriticalSection( &Store->Lock );
+
+	return Hr;
+}
+
+/*++
+	The callback function registered for the directory change
+	notifications.
+--*/
+static VOID CALLBACK CdiagsFileChangeNotificationCallback(
+	__in PVOID Context,
+	__in BOOLEAN TimedOut
+	)
+{
+	PCDIAGS_INI_FILE File = ( PCDIAGS_INI_FILE ) Context;
+	PCDIAGP_INI_CONFIG_STORE Store = File->Store;
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+
+	_ASSERTE( CdiagsIsValidIniStore( Store ) );
+
+	UNREFERENCED_PARAMETER( TimedOut );
+
+	//
+	// Re-arm before reloading s.t. no change can be missed.
+	//
+	_VERIFY( FindNextChangeNotification( File->Change ) );
+
+	EnterCriticalSection( &Store->Lock );
+
+	//
+	// If reloading fails (e.g. because the file is being edited),
+	// keep using the current snapshot.
+	//
+	if ( SUCCEEDED( CdiagsLoadSnapshot( Store, &Snapshot ) ) )
+	{
+		CdiagpPublishConfigSnapshot( &Store->Settings, Snapshot );
+	}
+
+	if ( Store->Callback.Function )
+	{
+		Store->Callback.Function( Store->Callback.Context );
+	}
+
+	LeaveCriticalSection( &Store->Lock );
+}
+
+/*----------------------------------------------------------------------
+ *
+ * CDIAG_CONFIGURATION_STORE methods
+ *
+ */
+
+static HRESULT CdiagsReadDwordSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__out DWORD *Value
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+	DWORD Data = 0;
+	HRESULT Hr = E_UNEXPECTED;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ! CdiagsIsValidScope( Scope ) ||
+		 ! Value )
+	{
+		return E_INVALIDARG;
+	}
+
+	*Value = 0;
+
+	Hr = CdiagpReadConfigCache(
+		&Store->Settings,
+		GroupName,
+		Name,
+		Scope,
+		REG_DWORD,
+		sizeof( DWORD ),
+		&Data,
+		NULL );
+	if ( CDIAG_E_BUFFER_TOO_SMALL == Hr )
+	{
+		//
+		// A wrong buffer size can only be due to a mismatched Data type
+		//
+		return CDIAG_E_SETTING_MISMATCH;
+	}
+	else if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+	else
+	{
+		*Value = Data;
+		return S_OK;
+	}
+}
+
+static HRESULT CdiagsReadStringSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount( BufferSize ) PWSTR StringBuffer,
+	__out_opt DWORD *ActualSize
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ! CdiagsIsValidScope( Scope ) ||
+		 BufferSizeInChars == 0 || BufferSizeInChars > MAX_INI_VALUE_CCH ||
+		 ! StringBuffer )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagpReadConfigCache(
+		&Store->Settings,
+		GroupName,
+		Name,
+		Scope,
+		REG_SZ,
+		( DWORD ) ( BufferSizeInChars * sizeof( WCHAR ) ),
+		StringBuffer,
+		ActualSize );
+}
+
+static HRESULT CdiagsReadMultiStringSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount( BufferSize ) PWSTR StringBuffer,
+	__out_opt DWORD *ActualSize
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ! CdiagsIsValidScope( Scope ) ||
+		 BufferSizeInChars == 0 || BufferSizeInChars > MAX_INI_VALUE_CCH ||
+		 ! StringBuffer )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagpReadConfigCache(
+		&Store->Settings,
+		GroupName,
+		Name,
+		Scope,
+		REG_MULTI_SZ,
+		( DWORD ) ( BufferSizeInChars * sizeof( WCHAR ) ),
+		StringBuffer,
+		ActualSize );
+}
+
+static HRESULT CdiagsWriteDwordSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD Value
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ( Scope != CdiagUserScope && Scope != CdiagGlobalScope ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsUpdateSetting(
+		Store,
+		GroupName,
+		Name,
+		Scope,
+		REG_DWORD,
+		sizeof( DWORD ),
+		( PBYTE ) &Value );
+}
+
+static HRESULT CdiagsWriteStringSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in PCWSTR Value
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+	HRESULT Hr = E_UNEXPECTED;
+	size_t stringLenCch = 0;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ( Scope != CdiagUserScope && Scope != CdiagGlobalScope ) ||
+		 ! Value )
+	{
+		return E_INVALIDARG;
+	}
+
+	Hr = StringCchLength( Value, MAX_INI_VALUE_CCH, &stringLenCch );
+	if ( FAILED( Hr ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsUpdateSetting(
+		Store,
+		GroupName,
+		Name,
+		Scope,
+		REG_SZ,
+		( DWORD ) ( ( stringLenCch + 1 ) * sizeof( WCHAR ) ),
+		( PBYTE ) Value );
+}
+
+static HRESULT CdiagsWriteMultiStringSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in PCWSTR Value
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+	HRESULT Hr = E_UNEXPECTED;
+	size_t ElementLenCch = 0;
+	size_t TotalLenCch = 0;
+	PCWSTR Substr = Value;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ( Scope != CdiagUserScope && Scope != CdiagGlobalScope ) ||
+		 ! Value )
+	{
+		return E_INVALIDARG;
+	}
+
+	do
+	{
+		Hr = StringCchLength( Substr, MAX_INI_VALUE_CCH, &ElementLenCch );
+		if ( FAILED( Hr ) )
+		{
+			return E_INVALIDARG;
+		}
+
+		Substr += ElementLenCch + 1;
+		TotalLenCch += ElementLenCch + 1;
+	}
+	while ( SUCCEEDED( Hr ) && ElementLenCch > 0 );
+
+	return CdiagsUpdateSetting(
+		Store,
+		GroupName,
+		Name,
+		Scope,
+		REG_MULTI_SZ,
+		( DWORD ) ( TotalLenCch * sizeof( WCHAR ) ),
+		( PBYTE ) Value );
+}
+
+static HRESULT CdiagsDeleteSetting(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ! CdiagsIsValidIniName( GroupName, MAX_SETTINGGROUPNAME_CCH ) ||
+		 ! CdiagsIsValidIniName( Name, MAX_SETTINGNAME_CCH ) ||
+		 ( Scope != CdiagUserScope && Scope != CdiagGlobalScope ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsUpdateSetting(
+		Store,
+		GroupName,
+		Name,
+		Scope,
+		REG_NONE,
+		0,
+		NULL );
+}
+
+static HRESULT CdiagsRegisterUpdateCallback(
+	__in PCDIAG_CONFIGURATION_STORE This,
+	__in_opt CDIAG_CONFIGSTORE_UPDATE_CALLBACK UpdateCallback,
+	__in_opt PVOID UpdateCallbackContext
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+
+	if ( ! CdiagsIsValidIniStore( Store ) ||
+		 ( UpdateCallbackContext != NULL && UpdateCallback == NULL ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	//
+	// Change notifications are always active as they are required
+	// to refresh the snapshot.
+	//
+	EnterCriticalSection( &Store->Lock );
+	Store->Callback.Function	= UpdateCallback;
+	Store->Callback.Context		= UpdateCallback ? UpdateCallbackContext : NULL;
+	LeaveCriticalSection( &Store->Lock );
+
+	return S_OK;
+}
+
+static HRESULT CdiagsDeleteStore(
+	__in PCDIAG_CONFIGURATION_STORE This
+	)
+{
+	PCDIAGP_INI_CONFIG_STORE Store = ( PCDIAGP_INI_CONFIG_STORE ) This;
+	UINT i;
+
+	if ( ! CdiagsIsValidIniStore( Store ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	for ( i = 0; i <= MAX_FILE_INDEX; i++ )
+	{
+		if ( Store->Files[ i ].WaitHandle )
+		{
+			//
+			// Wait until all callbacks have been completed -
+			// otherwise our callback might touch freed memory.
+			//
+			if ( ! UnregisterWaitEx(
+				Store->Files[ i ].WaitHandle,
+				INVALID_HANDLE_VALUE ) )
+			{
+				return HRESULT_FROM_WIN32( GetLastError() );
+			}
+
+			Store->Files[ i ].WaitHandle = NULL;
+		}
+
+		if ( Store->Files[ i ].Change )
+		{
+			_VERIFY( FindCloseChangeNotification( Store->Files[ i ].Change ) );
+			Store->Files[ i ].Change = NULL;
+		}
+	}
+
+	CdiagpDeleteConfigCache( &Store->Settings );
+	DeleteCriticalSection( &Store->Lock );
+
+	CdiagpFree( Store );
+
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Public
+ *
+ */
+HRESULT CDIAGCALLTYPE CdiagCreateIniFileStore(
+	__in_opt PCWSTR GlobalFilePath,
+	__in_opt PCWSTR UserFilePath,
+	__in DWORD AccessMode,
+	__out PCDIAG_CONFIGURATION_STORE *Store
+	)
+{
+	HRESULT Hr = E_UNEXPECTED;
+	PCDIAGP_INI_CONFIG_STORE TempStore = NULL;
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+	UINT i;
+
+	if ( ! Store ||
+		 0 == ( AccessMode & CDIAG_CFGS_ACCESS_ALL ) ||
+		 ( AccessMode & ~( CDIAG_CFGS_ACCESS_ALL | CDIAG_CFGS_CACHE_SETTINGS ) ) ||
+		 ( ( AccessMode & ( CDIAG_CFGS_ACCESS_READ_MACHINE |
+							CDIAG_CFGS_ACCESS_WRITE_MACHINE ) ) &&
+		   ! CdiagpIsStringValid( GlobalFilePath, 1, MAX_PATH - 1, FALSE ) ) ||
+		 ( ( AccessMode & ( CDIAG_CFGS_ACCESS_READ_USER |
+							CDIAG_CFGS_ACCESS_WRITE_USER ) ) &&
+		   ! CdiagpIsStringValid( UserFilePath, 1, MAX_PATH - 1, FALSE ) ) )
+	{
+		return E_INVALIDARG;
+	}
+
+	*Store = NULL;
+
+	//
+	// Allocate memory to hold structure
+	//
+	TempStore = CdiagpMalloc(
+		sizeof( CDIAGP_INI_CONFIG_STORE ),
+		TRUE );
+	if ( ! TempStore )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	TempStore->Base.Delete					= CdiagsDeleteStore;
+	TempStore->Base.DeleteSetting			= CdiagsDeleteSetting;
+	TempStore->Base.ReadDwordSetting		= CdiagsReadDwordSetting;
+	TempStore->Base.ReadStringSetting		= CdiagsReadStringSetting;
+	TempStore->Base.ReadMultiStringSetting	= CdiagsReadMultiStringSetting;
+	TempStore->Base.WriteDwordSetting		= CdiagsWriteDwordSetting;
+	TempStore->Base.RegisterUpdateCallback	= CdiagsRegisterUpdateCallback;
+	TempStore->Base.WriteStringSetting		= CdiagsWriteStringSetting;
+	TempStore->Base.WriteMultiStringSetting	= CdiagsWriteMultiStringSetting;
+
+	TempStore->Base.Size = sizeof( CDIAGP_INI_CONFIG_STORE );
+
+	InitializeCriticalSection( &TempStore->Lock );
+
+	for ( i = 0; i <= MAX_FILE_INDEX; i++ )
+	{
+		PCDIAGS_INI_FILE File = &TempStore->Files[ i ];
+		WCHAR Directory[ MAX_PATH ];
+		PCWSTR Path;
+		DWORD PathCch;
+		HANDLE Change;
+
+		if ( i == FILE_INDEX_FOR_SCOPE( CdiagUserScope ) )
+		{
+			Path			= UserFilePath;
+			File->Readable	= ( AccessMode & CDIAG_CFGS_ACCESS_READ_USER ) != 0;
+			File->Writable	= ( AccessMode & CDIAG_CFGS_ACCESS_WRITE_USER ) != 0;
+		}
+		else
+		{
+			Path			= GlobalFilePath;
+			File->Readable	= ( AccessMode & CDIAG_CFGS_ACCESS_READ_MACHINE ) != 0;
+			File->Writable	= ( AccessMode & CDIAG_CFGS_ACCESS_WRITE_MACHINE ) != 0;
+		}
+
+		File->Store = TempStore;
+
+		if ( ! File->Readable && ! File->Writable )
+		{
+			continue;
+		}
+
+		//
+		// Resolve relative paths s.t. changing the current directory
+		// does not affect the store. The temporary file used for
+		// writing must fit into MAX_PATH as well.
+		//
+		PathCch = GetFullPathName( Path, _countof( File->Path ), File->Path, NULL );
+		if ( PathCch == 0 )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+		else if ( PathCch + _countof( INI_TEMP_SUFFIX ) > _countof( File->Path ) )
+		{
+			File->Path[ 0 ] = UNICODE_NULL;
+			Hr = HRESULT_FROM_WIN32( ERROR_FILENAME_EXCED_RANGE );
+			goto Cleanup;
+		}
+
+		//
+		// Watch the directory - the file itself may not exist yet
+		// and is replaced on each write.
+		//
+		Hr = StringCchCopy( Directory, _countof( Directory ), File->Path );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+
+		_VERIFY( PathRemoveFileSpec( Directory ) );
+
+		Change = FindFirstChangeNotification(
+			Directory,
+			FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE );
+		if ( Change == INVALID_HANDLE_VALUE )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+
+		File->Change = Change;
+
+		if ( ! RegisterWaitForSingleObject(
+			&File->WaitHandle,
+			File->Change,
+			CdiagsFileChangeNotificationCallback,
+			File,
+			INFINITE,
+			WT_EXECUTEDEFAULT ) )
+		{
+			File->WaitHandle = NULL;
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+			goto Cleanup;
+		}
+	}
+
+	//
+	// Load initial snapshot. Change notifications are already
+	// active, so no change can be missed.
+	//
+	EnterCriticalSection( &TempStore->Lock );
+
+	Hr = CdiagsLoadSnapshot( TempStore, &Snapshot );
+	if ( SUCCEEDED( Hr ) )
+	{
+		CdiagpPublishConfigSnapshot( &TempStore->Settings, Snapshot );
+	}
+
+	LeaveCriticalSection( &TempStore->Lock );
+
+	if ( FAILED( Hr ) )
+	{
+		goto Cleanup;
+	}
+
+	*Store = ( PCDIAG_CONFIGURATION_STORE ) TempStore;
+	Hr = S_OK;
+
+Cleanup:
+	if ( FAILED( Hr ) )
+	{
+		CdiagsDeleteStore( ( PCDIAG_CONFIGURATION_STORE ) TempStore );
+	}
+
+	return Hr;
+}
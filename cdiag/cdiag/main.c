@@ -35,10 +35,30 @@ BOOL APIENTRY DllMain(
 	if ( Reason == DLL_PROCESS_ATTACH )
 	{
 		CdiagpModule = Module;
+
+		if ( ! CdiagpSetupAllocator() )
+		{
+			return FALSE;
+		}
+
 		CdiagpInitializeFormatter();
+
+		if ( ! CdiagpSetupEventPacketArena() )
+		{
+			CdiagpTeardownAllocator();
+			return FALSE;
+		}
+	}
+	else if ( Reason == DLL_THREAD_DETACH )
+	{
+		CdiagpFreeEventPacketArena();
+		CdiagpFreeThreadAllocatorCache();
 	}
 	else if ( Reason == DLL_PROCESS_DETACH )
 	{
+		CdiagpTeardownEventPacketArena();
+		CdiagpTeardownAllocator();
+
 #ifdef DBG	
 		_CrtDumpMemoryLeaks();
 #endif
@@ -1,6 +1,6 @@
 /*----------------------------------------------------------------------
  * Purpose:
- *		Memory allocation wrapper routines
+ *		Memory allocation routines
  *
  * Copyright:
  *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
@@ -21,16 +21,202 @@
  * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define CDIAGAPI
+
 #include <stdlib.h>
 #include "cdiagp.h"
+#include "list.h"
+
+/*----------------------------------------------------------------------
+ *
+ * Definitions.
+ *
+ */
+
+//
+// Size classes: 16, 32, ..., 2048 bytes. Larger allocations bypass
+// the pools and are tracked in the last class.
+//
+#define CDIAGS_SMALLEST_CLASS_CB	16
+#define CDIAGS_LARGEST_CLASS_CB		2048
+#define CDIAGS_POOLED_CLASSES		( CDIAG_ALLOCATION_CLASSES - 1 )
+#define CDIAGS_LARGE_CLASS			CDIAGS_POOLED_CLASSES
+
+#define CDIAGS_CLASS_CB( Class ) \
+	( ( SIZE_T ) CDIAGS_SMALLEST_CLASS_CB << ( Class ) )
+
+C_ASSERT( CDIAGS_CLASS_CB( CDIAGS_POOLED_CLASSES - 1 ) == 
+		  CDIAGS_LARGEST_CLASS_CB );
 
 #ifdef _DEBUG
 
 //
-// In debug builds use CRT allocator s.t. we can track leaks.
+// In debug builds use CRT allocator s.t. we can track leaks. Blocks
+// are not cached as cached blocks would be reported as leaks.
 //
+#define CDIAGS_THREAD_CACHE_CB		0
+#define CDIAGS_POOL_CB				0
 
-PVOID CdiagpMalloc( 
+#else
+
+//
+// Maximum number of bytes cached per class by each thread and by
+// the process-wide pool, respectively.
+//
+#define CDIAGS_THREAD_CACHE_CB		( 16 * 1024 )
+#define CDIAGS_POOL_CB				( 256 * 1024 )
+
+#endif
+
+/*++
+	Structure Description:
+		Header preceding each block. Keeps the data that follows
+		suitably aligned.
+--*/
+typedef union DECLSPEC_ALIGN( MEMORY_ALLOCATION_ALIGNMENT ) _CDIAGS_BLOCK_HEADER
+{
+	//
+	// Used while the block is cached.
+	//
+	SLIST_ENTRY FreeListEntry;
+
+	//
+	// Used while the block is allocated.
+	//
+	struct
+	{
+		ULONG Class;
+		SIZE_T Size;
+	} Allocated;
+} CDIAGS_BLOCK_HEADER, *PCDIAGS_BLOCK_HEADER;
+
+typedef struct _CDIAGS_CLASS_COUNTERS
+{
+	volatile LONGLONG Allocations;
+	volatile LONGLONG Frees;
+	volatile LONGLONG BytesAllocated;
+	volatile LONGLONG BytesFreed;
+} CDIAGS_CLASS_COUNTERS, *PCDIAGS_CLASS_COUNTERS;
+
+/*++
+	Structure Description:
+		Counters of a thread cache. Only written by the owning 
+		thread, so they are updated without interlocked operations.
+		They are pointer-sized s.t. other threads can read them 
+		without tearing. Before a counter can overflow, the counters
+		are folded into CdiagsGlobalCounters.
+--*/
+typedef struct _CDIAGS_THREAD_COUNTERS
+{
+	volatile ULONG_PTR Allocations;
+	volatile ULONG_PTR Frees;
+	volatile ULONG_PTR BytesAllocated;
+	volatile ULONG_PTR BytesFreed;
+} CDIAGS_THREAD_COUNTERS, *PCDIAGS_THREAD_COUNTERS;
+
+#define CDIAGS_MAX_THREAD_COUNT ( ( ULONG_PTR ) MAXLONG_PTR )
+
+/*++
+	Structure Description:
+		Per-thread cache. Only accessed by the owning thread, except
+		for the counters, which are read by 
+		CdiagQueryAllocationStatistics.
+--*/
+typedef struct _CDIAGS_THREAD_CACHE
+{
+	//
+	// Linked into CdiagsThreadCaches, protected by 
+	// CdiagsThreadCachesLock.
+	//
+	LIST_ENTRY ListEntry;
+
+	struct
+	{
+		PSLIST_ENTRY Head;
+		ULONG Depth;
+	} Classes[ CDIAGS_POOLED_CLASSES ];
+
+	CDIAGS_THREAD_COUNTERS Counters[ CDIAG_ALLOCATION_CLASSES ];
+} CDIAGS_THREAD_CACHE, *PCDIAGS_THREAD_CACHE;
+
+//
+// Process-wide pools. Zero-initialized SLIST_HEADERs are empty.
+//
+static SLIST_HEADER CdiagsPools[ CDIAGS_POOLED_CLASSES ];
+
+//
+// Private heap backing the pools s.t. cdiag neither contends for nor
+// fragments the process heap used by the code under test. Created
+// on first use.
+//
+static HANDLE volatile CdiagsHeap;
+
+//
+// TLS slot holding the current thread's cache. Only allocated when
+// used as a DLL - otherwise, all threads use the process-wide pools.
+//
+static DWORD CdiagsThreadCacheSlot = TLS_OUT_OF_INDEXES;
+
+static LIST_ENTRY CdiagsThreadCaches;
+static CRITICAL_SECTION CdiagsThreadCachesLock;
+
+//
+// Counters of threads without cache and of threads that have exited.
+//
+static CDIAGS_CLASS_COUNTERS CdiagsGlobalCounters[ CDIAG_ALLOCATION_CLASSES ];
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static VOID CdiagsAdd64(
+	__inout volatile LONGLONG *Target,
+	__in LONGLONG Value
+	)
+{
+	LONGLONG Old;
+
+	do
+	{
+		Old = *Target;
+	}
+	while ( InterlockedCompareExchange64( Target, Old + Value, Old ) != Old );
+}
+
+static LONGLONG CdiagsRead64(
+	__in volatile LONGLONG *Source
+	)
+{
+	//
+	// Avoid torn reads on 32 bit platforms.
+	//
+	return InterlockedCompareExchange64( Source, 0, 0 );
+}
+
+static ULONG CdiagsClassFromSize(
+	__in SIZE_T Size
+	)
+{
+	ULONG Class = 0;
+
+	if ( Size > CDIAGS_LARGEST_CLASS_CB )
+	{
+		return CDIAGS_LARGE_CLASS;
+	}
+
+	while ( Size > CDIAGS_CLASS_CB( Class ) )
+	{
+		Class++;
+	}
+
+	return Class;
+}
+
+#ifdef _DEBUG
+
+static PCDIAGS_BLOCK_HEADER CdiagsAllocateBlock(
 	__in SIZE_T Size,
 	__in BOOL Zero
 	)
@@ -41,33 +227,480 @@ PVOID CdiagpMalloc(
 		ZeroMemory( Mem, Size );
 	}
 
-	return Mem;
+	return ( PCDIAGS_BLOCK_HEADER ) Mem;
 }
 
-VOID CdiagpFree( 
-	__in PVOID Ptr
+static VOID CdiagsFreeBlock(
+	__in PCDIAGS_BLOCK_HEADER Block
 	)
 {
-	free( Ptr );
+	free( Block );
 }
 
 #else
 
-PVOID CdiagpMalloc( 
+static HANDLE CdiagsGetHeap()
+{
+	HANDLE Heap = CdiagsHeap;
+
+	if ( Heap == NULL )
+	{
+		ULONG LowFragmentation = 2;
+		HANDLE PreviousHeap;
+
+		Heap = HeapCreate( 0, 0, 0 );
+		if ( Heap == NULL )
+		{
+			return NULL;
+		}
+
+		//
+		// Large allocations are not pooled - let the LFH deal with
+		// them. Failure is not critical.
+		//
+		( VOID ) HeapSetInformation(
+			Heap,
+			HeapCompatibilityInformation,
+			&LowFragmentation,
+			sizeof( ULONG ) );
+
+		PreviousHeap = InterlockedCompareExchangePointer(
+			&CdiagsHeap,
+			Heap,
+			NULL );
+		if ( PreviousHeap != NULL )
+		{
+			//
+			// Lost the race.
+			//
+			_VERIFY( HeapDestroy( Heap ) );
+			Heap = PreviousHeap;
+		}
+	}
+
+	return Heap;
+}
+
+static PCDIAGS_BLOCK_HEADER CdiagsAllocateBlock(
 	__in SIZE_T Size,
 	__in BOOL Zero
 	)
 {
-	return HeapAlloc( 
-		GetProcessHeap(), 
+	HANDLE Heap = CdiagsGetHeap();
+	if ( Heap == NULL )
+	{
+		return NULL;
+	}
+
+	return ( PCDIAGS_BLOCK_HEADER ) HeapAlloc( 
+		Heap, 
 		Zero ? HEAP_ZERO_MEMORY : 0, 
 		Size );
 }
 
+static VOID CdiagsFreeBlock(
+	__in PCDIAGS_BLOCK_HEADER Block
+	)
+{
+	_ASSERTE( CdiagsHeap != NULL );
+	_VERIFY( HeapFree( CdiagsHeap, 0, Block ) );
+}
+
+#endif
+
+/*++
+	Routine Description:
+		Get the current thread's cache, create it if necessary.
+
+	Returns:
+		Cache or NULL if thread caches are not available.
+--*/
+static PCDIAGS_THREAD_CACHE CdiagsGetThreadCache(
+	__in BOOL Create
+	)
+{
+	PCDIAGS_THREAD_CACHE Cache;
+
+	if ( CdiagsThreadCacheSlot == TLS_OUT_OF_INDEXES )
+	{
+		return NULL;
+	}
+
+	Cache = ( PCDIAGS_THREAD_CACHE ) TlsGetValue( CdiagsThreadCacheSlot );
+	if ( Cache == NULL && Create )
+	{
+		//
+		// First allocation on this thread. The cache itself is
+		// allocated from the process heap s.t. caches of threads 
+		// still running on process exit are not reported as leaks.
+		//
+		Cache = ( PCDIAGS_THREAD_CACHE ) HeapAlloc(
+			GetProcessHeap(),
+			HEAP_ZERO_MEMORY,
+			sizeof( CDIAGS_THREAD_CACHE ) );
+		if ( Cache == NULL )
+		{
+			return NULL;
+		}
+
+		EnterCriticalSection( &CdiagsThreadCachesLock );
+		InsertTailList( &CdiagsThreadCaches, &Cache->ListEntry );
+		LeaveCriticalSection( &CdiagsThreadCachesLock );
+
+		_VERIFY( TlsSetValue( CdiagsThreadCacheSlot, Cache ) );
+	}
+
+	return Cache;
+}
+
+/*++
+	Routine Description:
+		Move a thread's counters to the global counters.
+
+		CdiagsThreadCachesLock must be held s.t. 
+		CdiagQueryAllocationStatistics does not count them twice.
+--*/
+static VOID CdiagsFoldThreadCounters(
+	__in PCDIAGS_THREAD_COUNTERS Counters,
+	__in PCDIAGS_CLASS_COUNTERS GlobalCounters
+	)
+{
+	CdiagsAdd64( &GlobalCounters->Allocations, Counters->Allocations );
+	CdiagsAdd64( &GlobalCounters->Frees, Counters->Frees );
+	CdiagsAdd64( &GlobalCounters->BytesAllocated, Counters->BytesAllocated );
+	CdiagsAdd64( &GlobalCounters->BytesFreed, Counters->BytesFreed );
+
+	Counters->Allocations		= 0;
+	Counters->Frees				= 0;
+	Counters->BytesAllocated	= 0;
+	Counters->BytesFreed		= 0;
+}
+
+/*++
+	Routine Description:
+		Count an allocation or free. Thread caches are counted
+		without interlocked operations, other threads update the
+		global counters.
+--*/
+static VOID CdiagsCount(
+	__in_opt PCDIAGS_THREAD_CACHE Cache,
+	__in ULONG Class,
+	__in BOOL Free,
+	__in SIZE_T Size
+	)
+{
+	PCDIAGS_THREAD_COUNTERS Counters;
+	volatile ULONG_PTR *Count;
+	volatile ULONG_PTR *Bytes;
+
+	if ( Cache == NULL )
+	{
+		PCDIAGS_CLASS_COUNTERS GlobalCounters = &CdiagsGlobalCounters[ Class ];
+
+		CdiagsAdd64( 
+			Free ? &GlobalCounters->Frees : &GlobalCounters->Allocations, 
+			1 );
+		CdiagsAdd64( 
+			Free ? &GlobalCounters->BytesFreed : &GlobalCounters->BytesAllocated, 
+			Size );
+		return;
+	}
+
+	Counters	= &Cache->Counters[ Class ];
+	Count		= Free ? &Counters->Frees : &Counters->Allocations;
+	Bytes		= Free ? &Counters->BytesFreed : &Counters->BytesAllocated;
+
+	if ( *Count >= CDIAGS_MAX_THREAD_COUNT ||
+		 Size > CDIAGS_MAX_THREAD_COUNT - *Bytes )
+	{
+		EnterCriticalSection( &CdiagsThreadCachesLock );
+		CdiagsFoldThreadCounters( Counters, &CdiagsGlobalCounters[ Class ] );
+		LeaveCriticalSection( &CdiagsThreadCachesLock );
+	}
+
+	*Count += 1;
+	*Bytes += Size;
+}
+
+/*++
+	Routine Description:
+		Return a block to the process-wide pool or the heap.
+--*/
+static VOID CdiagsReleaseBlock(
+	__in PCDIAGS_BLOCK_HEADER Block,
+	__in ULONG Class
+	)
+{
+	if ( Class != CDIAGS_LARGE_CLASS &&
+		 QueryDepthSList( &CdiagsPools[ Class ] ) < 
+			CDIAGS_POOL_CB / CDIAGS_CLASS_CB( Class ) )
+	{
+		InterlockedPushEntrySList(
+			&CdiagsPools[ Class ],
+			&Block->FreeListEntry );
+	}
+	else
+	{
+		CdiagsFreeBlock( Block );
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Internals.
+ *
+ */
+
+PVOID CdiagpMalloc( 
+	__in SIZE_T Size,
+	__in BOOL Zero
+	)
+{
+	PCDIAGS_THREAD_CACHE Cache;
+	PCDIAGS_BLOCK_HEADER Block = NULL;
+	ULONG Class;
+	SIZE_T BlockSize;
+
+	Class = CdiagsClassFromSize( Size );
+	Cache = CdiagsGetThreadCache( TRUE );
+
+	if ( Class == CDIAGS_LARGE_CLASS )
+	{
+		if ( Size > MAXSIZE_T - sizeof( CDIAGS_BLOCK_HEADER ) )
+		{
+			return NULL;
+		}
+
+		BlockSize = sizeof( CDIAGS_BLOCK_HEADER ) + Size;
+	}
+	else
+	{
+		BlockSize = sizeof( CDIAGS_BLOCK_HEADER ) + CDIAGS_CLASS_CB( Class );
+
+		//
+		// Try thread cache first, then the process-wide pool.
+		//
+		if ( Cache != NULL && Cache->Classes[ Class ].Head != NULL )
+		{
+			Block = ( PCDIAGS_BLOCK_HEADER ) Cache->Classes[ Class ].Head;
+			Cache->Classes[ Class ].Head = Block->FreeListEntry.Next;
+			Cache->Classes[ Class ].Depth--;
+		}
+		else
+		{
+			Block = ( PCDIAGS_BLOCK_HEADER ) InterlockedPopEntrySList(
+				&CdiagsPools[ Class ] );
+		}
+
+		if ( Block != NULL && Zero )
+		{
+			ZeroMemory( Block + 1, Size );
+		}
+	}
+
+	if ( Block == NULL )
+	{
+		Block = CdiagsAllocateBlock( BlockSize, Zero );
+		if ( Block == NULL )
+		{
+			return NULL;
+		}
+	}
+
+	Block->Allocated.Class	= Class;
+	Block->Allocated.Size	= Size;
+
+	CdiagsCount( Cache, Class, FALSE, Size );
+
+	return Block + 1;
+}
+
 VOID CdiagpFree( 
 	__in PVOID Ptr
 	)
 {
-	HeapFree( GetProcessHeap(), 0, Ptr );
+	PCDIAGS_THREAD_CACHE Cache;
+	PCDIAGS_BLOCK_HEADER Block;
+	ULONG Class;
+
+	if ( Ptr == NULL )
+	{
+		return;
+	}
+
+	Block = ( ( PCDIAGS_BLOCK_HEADER ) Ptr ) - 1;
+	Class = Block->Allocated.Class;
+	_ASSERTE( Class < CDIAG_ALLOCATION_CLASSES );
+
+	Cache = CdiagsGetThreadCache( FALSE );
+	CdiagsCount( Cache, Class, TRUE, Block->Allocated.Size );
+
+	if ( Cache != NULL &&
+		 Class != CDIAGS_LARGE_CLASS &&
+		 Cache->Classes[ Class ].Depth < 
+			CDIAGS_THREAD_CACHE_CB / CDIAGS_CLASS_CB( Class ) )
+	{
+		Block->FreeListEntry.Next		= Cache->Classes[ Class ].Head;
+		Cache->Classes[ Class ].Head	= &Block->FreeListEntry;
+		Cache->Classes[ Class ].Depth++;
+	}
+	else
+	{
+		CdiagsReleaseBlock( Block, Class );
+	}
+}
+
+BOOL CdiagpSetupAllocator()
+{
+	CdiagsThreadCacheSlot = TlsAlloc();
+	if ( CdiagsThreadCacheSlot == TLS_OUT_OF_INDEXES )
+	{
+		return FALSE;
+	}
+
+	InitializeListHead( &CdiagsThreadCaches );
+	InitializeCriticalSection( &CdiagsThreadCachesLock );
+
+	return TRUE;
+}
+
+VOID CdiagpTeardownAllocator()
+{
+	if ( CdiagsThreadCacheSlot != TLS_OUT_OF_INDEXES )
+	{
+		ULONG Class;
+		PSLIST_ENTRY Entry;
+
+		//
+		// N.B. Caches of threads other than the current one are
+		// leaked if the threads have not exited yet.
+		//
+		CdiagpFreeThreadAllocatorCache();
+		_VERIFY( TlsFree( CdiagsThreadCacheSlot ) );
+		CdiagsThreadCacheSlot = TLS_OUT_OF_INDEXES;
+
+		DeleteCriticalSection( &CdiagsThreadCachesLock );
+
+		for ( Class = 0; Class < CDIAGS_POOLED_CLASSES; Class++ )
+		{
+			while ( ( Entry = InterlockedPopEntrySList( 
+				&CdiagsPools[ Class ] ) ) != NULL )
+			{
+				CdiagsFreeBlock( ( PCDIAGS_BLOCK_HEADER ) Entry );
+			}
+		}
+	}
+}
+
+VOID CdiagpFreeThreadAllocatorCache()
+{
+	PCDIAGS_THREAD_CACHE Cache = CdiagsGetThreadCache( FALSE );
+	ULONG Class;
+
+	if ( Cache == NULL )
+	{
+		return;
+	}
+
+	EnterCriticalSection( &CdiagsThreadCachesLock );
+	RemoveEntryList( &Cache->ListEntry );
+
+	for ( Class = 0; Class < CDIAG_ALLOCATION_CLASSES; Class++ )
+	{
+		CdiagsFoldThreadCounters( 
+			&Cache->Counters[ Class ], 
+			&CdiagsGlobalCounters[ Class ] );
+	}
+
+	LeaveCriticalSection( &CdiagsThreadCachesLock );
+
+	for ( Class = 0; Class < CDIAGS_POOLED_CLASSES; Class++ )
+	{
+		while ( Cache->Classes[ Class ].Head != NULL )
+		{
+			PCDIAGS_BLOCK_HEADER Block = 
+				( PCDIAGS_BLOCK_HEADER ) Cache->Classes[ Class ].Head;
+			Cache->Classes[ Class ].Head = Block->FreeListEntry.Next;
+
+			CdiagsReleaseBlock( Block, Class );
+		}
+	}
+
+	_VERIFY( TlsSetValue( CdiagsThreadCacheSlot, NULL ) );
+	_VERIFY( HeapFree( GetProcessHeap(), 0, Cache ) );
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Public.
+ *
+ */
+
+HRESULT CDIAGCALLTYPE CdiagQueryAllocationStatistics(
+	__out PCDIAG_ALLOCATION_STATISTICS Statistics
+	)
+{
+	ULONG Class;
+
+	if ( Statistics == NULL )
+	{
+		return E_INVALIDARG;
+	}
+
+	ZeroMemory( Statistics, sizeof( CDIAG_ALLOCATION_STATISTICS ) );
+
+	//
+	// Hold the lock while reading the global counters as well s.t.
+	// counters being folded are neither missed nor counted twice.
+	//
+	if ( CdiagsThreadCacheSlot != TLS_OUT_OF_INDEXES )
+	{
+		EnterCriticalSection( &CdiagsThreadCachesLock );
+	}
+
+	for ( Class = 0; Class < CDIAG_ALLOCATION_CLASSES; Class++ )
+	{
+		PCDIAG_ALLOCATION_CLASS_STATISTICS Stat = &Statistics->Classes[ Class ];
+		PCDIAGS_CLASS_COUNTERS Counters = &CdiagsGlobalCounters[ Class ];
+
+		Stat->BlockSize = Class == CDIAGS_LARGE_CLASS
+			? 0
+			: ( ULONG ) CDIAGS_CLASS_CB( Class );
+
+		Stat->Allocations		= CdiagsRead64( &Counters->Allocations );
+		Stat->Frees				= CdiagsRead64( &Counters->Frees );
+		Stat->BytesAllocated	= CdiagsRead64( &Counters->BytesAllocated );
+		Stat->BytesFreed		= CdiagsRead64( &Counters->BytesFreed );
+	}
+
+	if ( CdiagsThreadCacheSlot != TLS_OUT_OF_INDEXES )
+	{
+		PLIST_ENTRY ListEntry;
+
+		for ( ListEntry = CdiagsThreadCaches.Flink;
+			  ListEntry != &CdiagsThreadCaches;
+			  ListEntry = ListEntry->Flink )
+		{
+			PCDIAGS_THREAD_CACHE Cache = CONTAINING_RECORD(
+				ListEntry,
+				CDIAGS_THREAD_CACHE,
+				ListEntry );
+
+			for ( Class = 0; Class < CDIAG_ALLOCATION_CLASSES; Class++ )
+			{
+				PCDIAG_ALLOCATION_CLASS_STATISTICS Stat = 
+					&Statistics->Classes[ Class ];
+				PCDIAGS_THREAD_COUNTERS Counters = &Cache->Counters[ Class ];
+
+				Stat->Allocations		+= Counters->Allocations;
+				Stat->Frees				+= Counters->Frees;
+				Stat->BytesAllocated	+= Counters->BytesAllocated;
+				Stat->BytesFreed		+= Counters->BytesFreed;
+			}
+		}
+
+		LeaveCriticalSection( &CdiagsThreadCachesLock );
+	}
+
+	return S_OK;
 }
-#endif
\ No newline at end of file
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include "cdiagp.h"
 #include "list.h"
+#include <concurrenthashtable.h>
 
 #pragma warning( push )
 #pragma warning( disable: 6011; disable: 6387 )
@@ -36,6 +37,19 @@
 #define MAX_DLLNAME 64
 #define MAX_MESSAGE_CCH 0xFFFF
 
+//
+// Maximum number of messages cached per resolver, and number of
+// buckets of the cache.
+//
+#define CDIAGS_MESSAGE_CACHE_CAPACITY	256
+#define CDIAGS_MESSAGE_CACHE_BUCKETS	127
+
+//
+// Templates up to this length are copied to the stack before
+// inserts are substituted, longer ones to the heap.
+//
+#define CDIAGS_STACK_TEMPLATE_CCH		512
+
 #define CDIAGP_RESOLVER_ALL_FLAGS ( CDIAG_MSGRES_RESOLVE_IGNORE_INSERTS |	\
 							 CDIAG_MSGRES_NO_SYSTEM |				\
 							 CDIAG_MSGRES_FALLBACK_TO_DEFAULT |	\
@@ -59,6 +73,37 @@ typedef struct _CDIAGP_RESOLVER
 		//
 		LIST_ENTRY ListHead;
 	} RegisteredDlls;
+
+	//
+	// Cache of message templates, see CACHED_MESSAGE.
+	//
+	struct
+	{
+		//
+		// Lookups do not require any lock. All modifications are
+		// serialized by Lock.
+		//
+		JPHT_CONCURRENT_HASHTABLE Table;
+
+		//
+		// Lock guarding modifications of Table and the
+		// members below.
+		//
+		CRITICAL_SECTION Lock;
+
+		//
+		// List of CACHED_MESSAGEs in eviction order, the head being
+		// the next candidate for eviction.
+		//
+		LIST_ENTRY ClockListHead;
+		ULONG Count;
+
+		//
+		// Incremented whenever the set of registered DLLs changes.
+		// Messages loaded before are not cached any more.
+		//
+		volatile LONG Generation;
+	} Cache;
 } CDIAGP_RESOLVER, *PCDIAGP_RESOLVER;
 
 typedef struct _REGISTERED_DLL
@@ -77,6 +122,46 @@ typedef struct _REGISTERED_DLL
 	HMODULE Module;
 } REGISTERED_DLL, *PREGISTERED_DLL;
 
+typedef struct _MESSAGE_CACHE_KEY
+{
+	DWORD MessageId;
+
+	//
+	// Has the system been searched (i.e. CDIAG_MSGRES_NO_SYSTEM
+	// not specified)?
+	//
+	BOOL SearchSystem;
+} MESSAGE_CACHE_KEY, *PMESSAGE_CACHE_KEY;
+
+/*++
+	Structure Description:
+		Result of searching a message template in the system and 
+		the registered DLLs. Templates are stored with inserts not
+		being substituted.
+--*/
+typedef struct _CACHED_MESSAGE
+{
+	//
+	// Key is a PMESSAGE_CACHE_KEY pointing to Key.
+	//
+	JPHT_HASHTABLE_ENTRY HashtableEntry;
+	MESSAGE_CACHE_KEY Key;
+
+	LIST_ENTRY ClockListEntry;
+
+	//
+	// Set on each lookup, cleared when the entry is spared 
+	// from eviction.
+	//
+	volatile LONG Referenced;
+
+	//
+	// FALSE if the message is unknown - Template is empty then.
+	//
+	BOOL Found;
+	WCHAR Template[ ANYSIZE_ARRAY ];
+} CACHED_MESSAGE, *PCACHED_MESSAGE;
+
 
 /*----------------------------------------------------------------------
  *
@@ -139,42 +224,85 @@ static VOID CdiagsDeleteRegisteredDllEntry(
 
 /*++
 	Routine description:
-		Try to resolve a message from a given module or from system
-		(if Module is NULL)
+		Load the template of a message from a given module or from 
+		system (if Module is NULL). Inserts are not substituted.
+
+		The template must be freed using LocalFree.
 --*/
-static HRESULT CdiagsFormatMessage(
+static HRESULT CdiagsLoadMessageTemplate(
 	__in_opt HMODULE Module,
 	__in DWORD MessageId,
+	__out PWSTR *Template
+	)
+{
+	_ASSERTE( Template );
+
+	*Template = NULL;
+
+	if ( FormatMessage(
+		FORMAT_MESSAGE_ALLOCATE_BUFFER |
+		  FORMAT_MESSAGE_IGNORE_INSERTS |
+		  ( Module 
+			? FORMAT_MESSAGE_FROM_HMODULE 
+			: FORMAT_MESSAGE_FROM_SYSTEM ),
+		Module,
+		MessageId,
+		0,
+		( PWSTR ) Template,
+		0,
+		NULL ) > 0 )
+	{
+		return S_OK;
+	}
+	else
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+}
+
+/*++
+	Routine description:
+		Format a message from a template obtained by 
+		CdiagsLoadMessageTemplate.
+--*/
+static HRESULT CdiagsFormatMessageTemplate(
+	__in PCWSTR Template,
 	__in BOOL UseInsertionStrings,
 	__in_opt PCTSTR* InsertionStrings,
 	__in SIZE_T BufferSizeInChars,
 	__out_ecount(BufferSizeInChars) PWSTR Buffer
 	)
 {
-	BOOL Success;
-	
+	HRESULT Hr;
+
+	_ASSERTE( Template );
 	_ASSERTE( BufferSizeInChars );
 	_ASSERTE( BufferSizeInChars < MAX_MESSAGE_CCH );
 	_ASSERTE( Buffer );
 
-	Success = FormatMessage(
-		( ( UseInsertionStrings 
-			? 0 
-			: FORMAT_MESSAGE_IGNORE_INSERTS ) |
-		  ( Module 
-			? FORMAT_MESSAGE_FROM_HMODULE 
-			: FORMAT_MESSAGE_FROM_SYSTEM ) |
-		  FORMAT_MESSAGE_ARGUMENT_ARRAY ),
-		( Module
-		  ? Module
-		  : NULL ),
-		MessageId,
+	if ( ! UseInsertionStrings || NULL == wcschr( Template, L'%' ) )
+	{
+		//
+		// Nothing to substitute - the template is the message.
+		//
+		Hr = StringCchCopy( Buffer, BufferSizeInChars, Template );
+		if ( STRSAFE_E_INSUFFICIENT_BUFFER == Hr )
+		{
+			return CDIAG_E_BUFFER_TOO_SMALL;
+		}
+		else
+		{
+			return Hr;
+		}
+	}
+	else if ( FormatMessage(
+		FORMAT_MESSAGE_FROM_STRING | FORMAT_MESSAGE_ARGUMENT_ARRAY,
+		Template,
+		0,
 		0,
 		Buffer,
 		( DWORD ) BufferSizeInChars,
-		( va_list* ) ( DWORD_PTR* ) InsertionStrings ) > 0;
-
-	if ( Success )
+		( va_list* ) ( DWORD_PTR* ) InsertionStrings ) > 0 )
 	{
 		return S_OK;
 	}
@@ -192,6 +320,353 @@ static HRESULT CdiagsFormatMessage(
 	}
 }
 
+/*----------------------------------------------------------------------
+ *
+ * Message cache.
+ *
+ * Resolving a message requires searching the system and all 
+ * registered DLLs, which is expensive and requires the DLL list to be
+ * locked. Templates found (as well as the fact that a message could 
+ * not be found) are therefore cached. Lookups are lock-free, 
+ * insertions and evictions are serialized by Cache.Lock.
+ *
+ * When the cache is full, an entry is evicted using the CLOCK 
+ * algorithm, which approximates LRU without requiring lookups to 
+ * modify the list: Entries referenced since the last sweep are 
+ * spared and moved to the tail.
+ *
+ */
+
+static ULONG CdiagsHashMessageKey(
+	__in ULONG_PTR Key
+	)
+{
+	PMESSAGE_CACHE_KEY MessageKey = ( PMESSAGE_CACHE_KEY ) ( PVOID ) Key;
+	return ( MessageKey->MessageId * 2654435761U ) ^ ( ULONG ) MessageKey->SearchSystem;
+}
+
+static BOOLEAN CdiagsEqualsMessageKey(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	PMESSAGE_CACHE_KEY Lhs = ( PMESSAGE_CACHE_KEY ) ( PVOID ) KeyLhs;
+	PMESSAGE_CACHE_KEY Rhs = ( PMESSAGE_CACHE_KEY ) ( PVOID ) KeyRhs;
+
+	return ( BOOLEAN ) ( Lhs->MessageId == Rhs->MessageId &&
+						 Lhs->SearchSystem == Rhs->SearchSystem );
+}
+
+static PVOID CdiagsAllocateHashtableMemory(
+	__in SIZE_T Size 
+	)
+{
+	return CdiagpMalloc( Size, FALSE );
+}
+
+static VOID CdiagsFreeHashtableMemory(
+	__in PVOID Mem
+	)
+{
+	CdiagpFree( Mem );
+}
+
+/*++
+	Routine description:
+		Format a message using the cached template, if any.
+
+		Substituting inserts may take a while, so the template is
+		copied and substituted after the read section has been left.
+
+	Return Value:
+		TRUE if the message was found in the cache. Hr receives
+		the result then, CDIAG_E_UNKNOWN_MESSAGE indicating a 
+		message known to be not resolvable.
+		FALSE if not cached.
+--*/
+static BOOL CdiagsFormatCachedMessage(
+	__in PCDIAGP_RESOLVER Resolver,
+	__in PMESSAGE_CACHE_KEY Key,
+	__in BOOL UseInsertionStrings,
+	__in_opt PCTSTR* InsertionStrings,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer,
+	__out HRESULT *Hr
+	)
+{
+	WCHAR StackTemplate[ CDIAGS_STACK_TEMPLATE_CCH ];
+	PWSTR Template = NULL;
+	PJPHT_HASHTABLE_ENTRY Entry;
+	BOOL Cached = FALSE;
+	ULONG Epoch;
+
+	Epoch = JphtEnterReadConcurrentHashtable( &Resolver->Cache.Table );
+
+	Entry = JphtGetEntryConcurrentHashtable( 
+		&Resolver->Cache.Table,
+		( ULONG_PTR ) Key );
+	if ( Entry != NULL )
+	{
+		PCACHED_MESSAGE Message = CONTAINING_RECORD(
+			Entry,
+			CACHED_MESSAGE,
+			HashtableEntry );
+
+		//
+		// Avoid dirtying the cache line if already set.
+		//
+		if ( ! Message->Referenced )
+		{
+			Message->Referenced = TRUE;
+		}
+
+		if ( ! Message->Found )
+		{
+			*Hr = CDIAG_E_UNKNOWN_MESSAGE;
+		}
+		else if ( ! UseInsertionStrings || 
+				  NULL == wcschr( Message->Template, L'%' ) )
+		{
+			//
+			// Nothing to substitute - copying is cheap enough to
+			// be done right away.
+			//
+			*Hr = CdiagsFormatMessageTemplate(
+				Message->Template,
+				FALSE,
+				NULL,
+				BufferSizeInChars,
+				Buffer );
+		}
+		else
+		{
+			SIZE_T TemplateCch = wcslen( Message->Template ) + 1;
+
+			Template = TemplateCch <= _countof( StackTemplate )
+				? StackTemplate
+				: ( PWSTR ) CdiagpMalloc( TemplateCch * sizeof( WCHAR ), FALSE );
+			if ( Template )
+			{
+				CopyMemory( 
+					Template, 
+					Message->Template, 
+					TemplateCch * sizeof( WCHAR ) );
+			}
+			else
+			{
+				*Hr = E_OUTOFMEMORY;
+			}
+		}
+
+		Cached = TRUE;
+	}
+
+	JphtLeaveReadConcurrentHashtable( &Resolver->Cache.Table, Epoch );
+
+	if ( Template )
+	{
+		*Hr = CdiagsFormatMessageTemplate(
+			Template,
+			UseInsertionStrings,
+			InsertionStrings,
+			BufferSizeInChars,
+			Buffer );
+
+		if ( Template != StackTemplate )
+		{
+			CdiagpFree( Template );
+		}
+	}
+
+	return Cached;
+}
+
+/*++
+	Routine description:
+		Add a message to the cache unless the set of registered
+		DLLs has changed since Generation has been obtained or the
+		message has been added concurrently.
+
+		Failure to add a message is not an error.
+
+	Parameters:
+		Template	- Template or NULL if the message is unknown.
+--*/
+static VOID CdiagsCacheMessage(
+	__in PCDIAGP_RESOLVER Resolver,
+	__in PMESSAGE_CACHE_KEY Key,
+	__in LONG Generation,
+	__in_opt PCWSTR Template
+	)
+{
+	PCACHED_MESSAGE Evicted = NULL;
+	PCACHED_MESSAGE Message;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	SIZE_T TemplateCch = Template ? wcslen( Template ) + 1 : 1;
+
+	Message = ( PCACHED_MESSAGE ) CdiagpMalloc(
+		FIELD_OFFSET( CACHED_MESSAGE, Template[ TemplateCch ] ),
+		FALSE );
+	if ( ! Message )
+	{
+		return;
+	}
+
+	Message->Key					= *Key;
+	Message->HashtableEntry.Key		= ( ULONG_PTR ) &Message->Key;
+	Message->Referenced				= FALSE;
+	Message->Found					= ( Template != NULL );
+
+	if ( Template )
+	{
+		CopyMemory( 
+			Message->Template, 
+			Template, 
+			TemplateCch * sizeof( WCHAR ) );
+	}
+	else
+	{
+		Message->Template[ 0 ] = UNICODE_NULL;
+	}
+
+	EnterCriticalSection( &Resolver->Cache.Lock );
+
+	if ( Generation == Resolver->Cache.Generation )
+	{
+		ULONG Epoch;
+		BOOL Present;
+
+		Epoch = JphtEnterReadConcurrentHashtable( &Resolver->Cache.Table );
+		Present = NULL != JphtGetEntryConcurrentHashtable( 
+			&Resolver->Cache.Table,
+			( ULONG_PTR ) Key );
+		JphtLeaveReadConcurrentHashtable( &Resolver->Cache.Table, Epoch );
+
+		if ( ! Present )
+		{
+			if ( Resolver->Cache.Count >= CDIAGS_MESSAGE_CACHE_CAPACITY )
+			{
+				//
+				// Sweep until an entry not referenced recently is found.
+				// Terminates after one round at most as Referenced
+				// flags are cleared on the way.
+				//
+				for ( ;; )
+				{
+					PLIST_ENTRY Head = RemoveHeadList( 
+						&Resolver->Cache.ClockListHead );
+					PCACHED_MESSAGE Candidate = CONTAINING_RECORD(
+						Head,
+						CACHED_MESSAGE,
+						ClockListEntry );
+
+					if ( InterlockedExchange( &Candidate->Referenced, FALSE ) )
+					{
+						InsertTailList( 
+							&Resolver->Cache.ClockListHead, 
+							&Candidate->ClockListEntry );
+					}
+					else
+					{
+						Evicted = Candidate;
+						break;
+					}
+				}
+
+				JphtRemoveEntryConcurrentHashtable(
+					&Resolver->Cache.Table,
+					Evicted->HashtableEntry.Key,
+					&OldEntry );
+				_ASSERTE( OldEntry == &Evicted->HashtableEntry );
+				Resolver->Cache.Count--;
+			}
+
+			JphtPutEntryConcurrentHashtable(
+				&Resolver->Cache.Table,
+				&Message->HashtableEntry,
+				&OldEntry );
+			_ASSERTE( OldEntry == NULL );
+			InsertTailList( 
+				&Resolver->Cache.ClockListHead, 
+				&Message->ClockListEntry );
+			Resolver->Cache.Count++;
+
+			Message = NULL;
+		}
+	}
+
+	LeaveCriticalSection( &Resolver->Cache.Lock );
+
+	if ( Evicted )
+	{
+		//
+		// Readers may still be using the evicted entry.
+		//
+		JphtSynchronizeConcurrentHashtable( &Resolver->Cache.Table );
+		CdiagpFree( Evicted );
+	}
+
+	if ( Message )
+	{
+		//
+		// Not used.
+		//
+		CdiagpFree( Message );
+	}
+}
+
+/*++
+	Routine description:
+		Remove all messages from the cache. Must be called after 
+		the set of registered DLLs has changed.
+--*/
+static VOID CdiagsFlushMessageCache(
+	__in PCDIAGP_RESOLVER Resolver
+	)
+{
+	LIST_ENTRY Flushed;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+
+	EnterCriticalSection( &Resolver->Cache.Lock );
+
+	InterlockedIncrement( &Resolver->Cache.Generation );
+
+	InitializeListHead( &Flushed );
+	while ( ! IsListEmpty( &Resolver->Cache.ClockListHead ) )
+	{
+		PLIST_ENTRY Entry = RemoveHeadList( &Resolver->Cache.ClockListHead );
+		PCACHED_MESSAGE Message = CONTAINING_RECORD(
+			Entry,
+			CACHED_MESSAGE,
+			ClockListEntry );
+
+		JphtRemoveEntryConcurrentHashtable(
+			&Resolver->Cache.Table,
+			Message->HashtableEntry.Key,
+			&OldEntry );
+		_ASSERTE( OldEntry == &Message->HashtableEntry );
+		InsertTailList( &Flushed, Entry );
+	}
+
+	Resolver->Cache.Count = 0;
+
+	LeaveCriticalSection( &Resolver->Cache.Lock );
+
+	if ( ! IsListEmpty( &Flushed ) )
+	{
+		JphtSynchronizeConcurrentHashtable( &Resolver->Cache.Table );
+
+		while ( ! IsListEmpty( &Flushed ) )
+		{
+			PLIST_ENTRY Entry = RemoveHeadList( &Flushed );
+			CdiagpFree( CONTAINING_RECORD(
+				Entry,
+				CACHED_MESSAGE,
+				ClockListEntry ) );
+		}
+	}
+}
+
 /*----------------------------------------------------------------------
  *
  * CDIAG_MESSAGE_CDIAGP_RESOLVER methods
@@ -291,6 +766,14 @@ HRESULT CdiagsRegisterMessageDll(
 
 	LeaveCriticalSection( &Resolver->RegisteredDlls.Lock );
 
+	if ( SUCCEEDED( Hr ) )
+	{
+		//
+		// Messages previously unknown may now be resolvable.
+		//
+		CdiagsFlushMessageCache( Resolver );
+	}
+
 Cleanup:
 	if ( FAILED( Hr ) )
 	{
@@ -338,6 +821,14 @@ HRESULT CdiagsUnregisterMessageDll(
 
 	LeaveCriticalSection( &Resolver->RegisteredDlls.Lock );
 
+	if ( SUCCEEDED( Hr ) )
+	{
+		//
+		// Cached templates may stem from the DLL just unloaded.
+		//
+		CdiagsFlushMessageCache( Resolver );
+	}
+
 	return Hr;
 }
 
@@ -394,6 +885,9 @@ HRESULT CdiagsResolveMessage(
 		( 0 == ( Flags & CDIAG_MSGRES_RESOLVE_IGNORE_INSERTS ) );
 	BOOL FallbackToDefault = 
 		( Flags & CDIAG_MSGRES_FALLBACK_TO_DEFAULT );
+	MESSAGE_CACHE_KEY Key;
+	PWSTR Template = NULL;
+	LONG Generation;
 	HRESULT Hr = S_OK;
 
 	if ( ! CdiagsIsValidResolver( Resolver ) ||
@@ -405,84 +899,87 @@ HRESULT CdiagsResolveMessage(
 		return E_INVALIDARG;
 	}
 
-	//
-	// First, try system.
-	//
-	if ( ! ( Flags & CDIAG_MSGRES_NO_SYSTEM ) )
+	Key.MessageId		= MessageId;
+	Key.SearchSystem	= ! ( Flags & CDIAG_MSGRES_NO_SYSTEM );
+
+	if ( CdiagsFormatCachedMessage(
+		Resolver,
+		&Key,
+		UseInsertionStrings,
+		InsertionStrings,
+		BufferSizeInChars,
+		Buffer,
+		&Hr ) )
 	{
-		Hr = CdiagsFormatMessage(
-			NULL,	// System
-			MessageId,
-			UseInsertionStrings,
-			InsertionStrings,
-			BufferSizeInChars,
-			Buffer );
-		if ( S_OK == Hr)
-		{
-			//
-			// Msg found.
-			//
-			Resolved = TRUE;
-		}
-		else if ( CDIAG_E_BUFFER_TOO_SMALL == Hr )
+		Resolved = SUCCEEDED( Hr );
+	}
+	else
+	{
+		//
+		// Not cached, search the template. Obtain the generation
+		// before s.t. the template is not cached if the set of 
+		// registered DLLs changes in the meantime.
+		//
+		Generation = Resolver->Cache.Generation;
+
+		//
+		// First, try system.
+		//
+		if ( Key.SearchSystem )
 		{
-			//
-			// Buffer too small, bail out.
-			//
-			return Hr;
+			Hr = CdiagsLoadMessageTemplate(
+				NULL,	// System
+				MessageId,
+				&Template );
 		}
-		else
+
+		if ( Template == NULL )
 		{
 			//
-			// Continue search.
+			// Try registered DLLs.
 			//
+			EnterCriticalSection( &Resolver->RegisteredDlls.Lock );
+			
+			Entry = Resolver->RegisteredDlls.ListHead.Flink;
+			while ( Entry != &Resolver->RegisteredDlls.ListHead && 
+					Template == NULL )
+			{
+				PREGISTERED_DLL RegDll = 
+					CONTAINING_RECORD( Entry, REGISTERED_DLL, ListEntry );
+
+				Hr = CdiagsLoadMessageTemplate(
+					RegDll->Module,
+					MessageId,
+					&Template );
+
+				Entry = Entry->Flink;
+			}
+			LeaveCriticalSection( &Resolver->RegisteredDlls.Lock );
 		}
-	}
 
-	if ( ! Resolved )
-	{
-		//
-		// Try registered DLLs.
-		//
-		EnterCriticalSection( &Resolver->RegisteredDlls.Lock );
-		
-		Entry = Resolver->RegisteredDlls.ListHead.Flink;
-		while ( Entry != &Resolver->RegisteredDlls.ListHead && ! Resolved )
+		if ( Template != NULL )
 		{
-			PREGISTERED_DLL RegDll = 
-				CONTAINING_RECORD( Entry, REGISTERED_DLL, ListEntry );
+			CdiagsCacheMessage( Resolver, &Key, Generation, Template );
 
-			Hr = CdiagsFormatMessage(
-				RegDll->Module,
-				MessageId,
+			Hr = CdiagsFormatMessageTemplate(
+				Template,
 				UseInsertionStrings,
 				InsertionStrings,
 				BufferSizeInChars,
 				Buffer );
-			if ( S_OK == Hr )
-			{
-				//
-				// Msg found.
-				//
-				Resolved = TRUE;
-			}
-			else if ( CDIAG_E_BUFFER_TOO_SMALL == Hr )
-			{
-				//
-				// Buffer too small, bail out.
-				//
-				break;
-			}
-			else
-			{
-				//
-				// Continue search.
-				//
-			}
+			Resolved = SUCCEEDED( Hr );
 
-			Entry = Entry->Flink;
+			LocalFree( Template );
+		}
+		else if ( Hr != HRESULT_FROM_WIN32( ERROR_NOT_ENOUGH_MEMORY ) &&
+				  Hr != HRESULT_FROM_WIN32( ERROR_OUTOFMEMORY ) )
+		{
+			//
+			// Message unknown. Cache this fact as well, unless
+			// the failure may have been transient.
+			//
+			CdiagsCacheMessage( Resolver, &Key, Generation, NULL );
 		}
-		LeaveCriticalSection( &Resolver->RegisteredDlls.Lock );
 	}
 
 	if ( Resolved )
@@ -558,9 +1055,14 @@ HRESULT CdiagsDeleteResolver(
 
 	_ASSERTE( IsListEmpty( &Resolver->RegisteredDlls.ListHead ) );
 
+	CdiagsFlushMessageCache( Resolver );
+	_ASSERTE( IsListEmpty( &Resolver->Cache.ClockListHead ) );
+
 	//
 	// Free object.
 	//
+	JphtDeleteConcurrentHashtable( &Resolver->Cache.Table );
+	DeleteCriticalSection( &Resolver->Cache.Lock );
 	DeleteCriticalSection( &Resolver->RegisteredDlls.Lock );
 	CdiagpFree( Resolver );
 
@@ -630,6 +1132,28 @@ HRESULT CDIAGCALLTYPE CdiagCreateMessageResolver(
 	Resolver->Base.ResolveMessage		= CdiagsResolveMessage;
 	Resolver->Base.UnregisterMessageDll = CdiagsUnregisterMessageDll;
 
+	if ( ! JphtInitializeConcurrentHashtable(
+		&Resolver->Cache.Table,
+		CdiagsAllocateHashtableMemory,
+		CdiagsFreeHashtableMemory,
+		CdiagsHashMessageKey,
+		CdiagsEqualsMessageKey,
+		CDIAGS_MESSAGE_CACHE_BUCKETS ) )
+	{
+		CdiagpFree( Resolver );
+		return E_OUTOFMEMORY;
+	}
+
+	//
+	// Readers may be preempted while in a read section.
+	//
+	JphtSetYieldRoutineConcurrentHashtable( 
+		&Resolver->Cache.Table, 
+		CdiagpYieldEpoch );
+
+	InitializeCriticalSection( &Resolver->Cache.Lock );
+	InitializeListHead( &Resolver->Cache.ClockListHead );
+
 	InitializeCriticalSection( &Resolver->RegisteredDlls.Lock );
 	InitializeListHead( &Resolver->RegisteredDlls.ListHead );
 
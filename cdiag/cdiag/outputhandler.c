@@ -26,6 +26,16 @@
 #include <stdlib.h>
 #include "cdiagp.h"
 
+//
+// Maximum length of a formatted event.
+//
+#define CDIAGS_MAX_EVENT_CCH 3072
+
+//
+// A batch must be able to hold at least one event plus newline.
+//
+#define CDIAGS_MIN_BUFFER_CCH ( CDIAGS_MAX_EVENT_CCH + 1 )
+
 typedef struct _CDIAGP_OUT_HANDLER
 {
 	CDIAG_HANDLER Base;
@@ -35,8 +45,44 @@ typedef struct _CDIAGP_OUT_HANDLER
 	PCDIAG_FORMATTER Formatter;
 
 	CDIAG_OUTPUT_ROUTINE OutputRoutine;
+
+	//
+	// Serializes calls to OutputRoutine s.t. batches are output
+	// in order.
+	//
+	CRITICAL_SECTION OutputLock;
+
+	//
+	// Only used in batching mode, i.e. if Batch.Active != NULL.
+	//
+	CDIAGP_BATCH_BUFFER Batch;
 } CDIAGP_OUT_HANDLER, *PCDIAGP_OUT_HANDLER;
 
+/*----------------------------------------------------------------------
+ *
+ * Batching.
+ *
+ */
+
+/*++
+	Routine Description:
+		Pass a batch to the output routine.
+--*/
+static HRESULT CdiagsOutFlushBatch(
+	__in PVOID Context,
+	__in PUCHAR Data,
+	__in ULONG DataSize
+	)
+{
+	PCDIAGP_OUT_HANDLER Oh = ( PCDIAGP_OUT_HANDLER ) Context;
+	PWSTR Text = ( PWSTR ) Data;
+
+	Text[ DataSize / sizeof( WCHAR ) ] = UNICODE_NULL;
+	( Oh->OutputRoutine ) ( Text );
+
+	return S_OK;
+}
+
 /*----------------------------------------------------------------------
  *
  * Methods.
@@ -47,9 +93,10 @@ static HRESULT CdiagsOutHandle(
 	__in PCDIAG_EVENT_PACKET Packet
 	)
 {
-	WCHAR Buffer[ 3072 ];
+	WCHAR Buffer[ CDIAGS_MAX_EVENT_CCH + 1 ];
 	PCDIAGP_OUT_HANDLER Oh = ( PCDIAGP_OUT_HANDLER ) This;
 	HRESULT Hr;
+	ULONG BufferCch;
 
 	if ( ! Oh ||
 		! CdiagpIsValidHandler( Oh ) )
@@ -60,18 +107,45 @@ static HRESULT CdiagsOutHandle(
 	Hr = Oh->Formatter->Format(
 		Oh->Formatter,
 		Packet,
-		_countof( Buffer ),
+		CDIAGS_MAX_EVENT_CCH,
 		Buffer );
 	if ( FAILED( Hr ) )
 	{
 		return Hr;
 	}
 
+	if ( ! Oh->Batch.Active )
+	{
+		//
+		// Output.
+		//
+		( Oh->OutputRoutine ) ( Buffer );
+		return S_OK;
+	}
+
 	//
-	// Output.
+	// Effective size.
 	//
-	( Oh->OutputRoutine ) ( Buffer );
-	return S_OK;
+#pragma warning( push )
+#pragma warning( disable: 6054 )
+	BufferCch = ( ULONG ) wcslen( Buffer );
+#pragma warning( pop )
+
+	//
+	// Events within a batch must be told apart, so make sure each
+	// ends with a newline.
+	//
+	if ( BufferCch == 0 || Buffer[ BufferCch - 1 ] != L'\n' )
+	{
+		Buffer[ BufferCch++ ] = L'\n';
+		Buffer[ BufferCch ] = UNICODE_NULL;
+	}
+
+	return CdiagpAppendBatchBuffer( 
+		&Oh->Batch, 
+		Packet->Severity, 
+		Buffer, 
+		BufferCch );
 }
 
 
@@ -79,11 +153,15 @@ static VOID CdiagsOutDeleteHandler(
 	__in PCDIAGP_OUT_HANDLER Oh 
 	)
 {
+	CdiagpDeleteBatchBuffer( &Oh->Batch );
+
 	if ( Oh->Formatter )
 	{
 		Oh->Formatter->Dereference( Oh->Formatter );
 	}
 
+	DeleteCriticalSection( &Oh->OutputLock );
+
 	CdiagpFree( Oh );
 }
 
@@ -130,15 +208,11 @@ static VOID CdiagsOutDereferenceHandler(
 	}
 }
 
-/*----------------------------------------------------------------------
- *
- * Public.
- *
- */
-
-CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateOutputHandler(
+static HRESULT CdiagsCreateOutputHandler(
 	__in CDIAG_SESSION_HANDLE Session,
 	__in CDIAG_OUTPUT_ROUTINE OutputRoutine,
+	__in ULONG BufferCch,
+	__in ULONG FlushInterval,
 	__out PCDIAG_HANDLER *Handler
 	)
 {
@@ -174,6 +248,7 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateOutputHandler(
 	Oh->Base.Handle				= CdiagsOutHandle;
 
 	Oh->OutputRoutine = OutputRoutine;
+	InitializeCriticalSection( &Oh->OutputLock );
 
 	//
 	// Obtain formatter.
@@ -188,6 +263,27 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateOutputHandler(
 		goto Cleanup;
 	}
 
+	if ( BufferCch > 0 )
+	{
+		if ( BufferCch < CDIAGS_MIN_BUFFER_CCH )
+		{
+			BufferCch = CDIAGS_MIN_BUFFER_CCH;
+		}
+
+		Hr = CdiagpInitializeBatchBuffer(
+			&Oh->Batch,
+			BufferCch * sizeof( WCHAR ),
+			FlushInterval,
+			FALSE,
+			&Oh->OutputLock,
+			CdiagsOutFlushBatch,
+			Oh );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+	}
+
 	*Handler = &Oh->Base;
 	Hr = S_OK;
 
@@ -202,3 +298,39 @@ Cleanup:
 
 	return Hr;
 }
+
+/*----------------------------------------------------------------------
+ *
+ * Public.
+ *
+ */
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateOutputHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in CDIAG_OUTPUT_ROUTINE OutputRoutine,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	return CdiagsCreateOutputHandler(
+		Session,
+		OutputRoutine,
+		0,
+		0,
+		Handler );
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBatchingOutputHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in CDIAG_OUTPUT_ROUTINE OutputRoutine,
+	__in ULONG BufferCch,
+	__in ULONG FlushInterval,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	return CdiagsCreateOutputHandler(
+		Session,
+		OutputRoutine,
+		BufferCch > 0 ? BufferCch : CDIAG_OUTPUT_DEFAULT_BUFFER_CCH,
+		FlushInterval,
+		Handler );
+}
@@ -93,6 +93,25 @@ typedef struct _CDIAGP_REG_CONFIG_STORE
 			PVOID Context;
 		} Callback;	
 	} Notify;
+
+	//
+	// Snapshot of all readable settings. Only used if the store has
+	// been created with CDIAG_CFGS_CACHE_SETTINGS.
+	//
+	struct _Cache
+	{
+		//
+		// Initialized on creation, read-only from then on.
+		//
+		BOOL Enabled;
+
+		//
+		// Lock that serializes updates of the snapshot.
+		//
+		CRITICAL_SECTION Lock;
+
+		CDIAGP_CONFIG_CACHE Settings;
+	} Cache;
 } CDIAGP_REG_CONFIG_STORE, *PCDIAGP_REG_CONFIG_STORE;
 
 /*----------------------------------------------------------------------
@@ -123,6 +142,338 @@ static BOOL CdiagsIsValidRegistryName(
 		   CdiagpIsStringValid( Name, 1, MaxLen, FALSE );
 }
 
+/*----------------------------------------------------------------------
+ *
+ * Snapshot handling helper routines
+ *
+ */
+
+/*++
+	Routine description:
+		Adds all settings of a group to a snapshot. Values of
+		types other than REG_DWORD, REG_SZ and REG_MULTI_SZ are
+		ignored.
+--*/
+static HRESULT CdiagsLoadGroupIntoSnapshot(
+	__in HKEY GroupKey,
+	__in PCWSTR GroupName,
+	__in DWORD Scope,
+	__in PCDIAGP_CONFIG_SNAPSHOT Snapshot
+	)
+{
+	WCHAR Name[ MAX_SETTINGNAME_CCH + 1 ];
+	DWORD MaxDataLen;
+	PBYTE Data;
+	DWORD Index;
+	LONG Res;
+	HRESULT Hr = S_OK;
+
+	Res = RegQueryInfoKey(
+		GroupKey,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		&MaxDataLen,
+		NULL,
+		NULL );
+	if ( ERROR_SUCCESS != Res )
+	{
+		return HRESULT_FROM_WIN32( Res );
+	}
+
+	MaxDataLen = max( MaxDataLen, ( DWORD ) sizeof( DWORD ) );
+
+	Data = CdiagpMalloc( MaxDataLen, FALSE );
+	if ( ! Data )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for ( Index = 0; ; Index++ )
+	{
+		DWORD NameLen = _countof( Name );
+		DWORD DataLen = MaxDataLen;
+		DWORD DataType;
+
+		Res = RegEnumValue(
+			GroupKey,
+			Index,
+			Name,
+			&NameLen,
+			NULL,
+			&DataType,
+			Data,
+			&DataLen );
+		if ( ERROR_NO_MORE_ITEMS == Res )
+		{
+			break;
+		}
+		else if ( ERROR_MORE_DATA == Res )
+		{
+			//
+			// Name too long to be a valid setting name or value
+			// grown since querying the key - the latter is covered 
+			// by the next change notification.
+			//
+			continue;
+		}
+		else if ( ERROR_SUCCESS != Res )
+		{
+			Hr = HRESULT_FROM_WIN32( Res );
+			break;
+		}
+
+		if ( DataType != REG_DWORD && 
+			 DataType != REG_SZ && 
+			 DataType != REG_MULTI_SZ )
+		{
+			continue;
+		}
+
+		Hr = CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Name,
+			DataType,
+			DataLen,
+			Data );
+		if ( FAILED( Hr ) )
+		{
+			break;
+		}
+	}
+
+	CdiagpFree( Data );
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Creates a snapshot of all settings in all readable scopes.
+--*/
+static HRESULT CdiagsLoadSnapshot(
+	__in PCDIAGP_REG_CONFIG_STORE Store,
+	__out PCDIAGP_CONFIG_SNAPSHOT *Snapshot
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT NewSnapshot = NULL;
+	DWORD ReadableScopes = 0;
+	HRESULT Hr = E_UNEXPECTED;
+	UINT i;
+
+	for ( i = 0; i <= MAX_KEY_INDEX; i++ )
+	{
+		if ( Store->Key[ i ] && 
+			 ( Store->KeyAccessMask[ i ] & KEY_QUERY_VALUE ) )
+		{
+			ReadableScopes |= KEY_SCOPE_FOR_INDEX( i );
+		}
+	}
+
+	Hr = CdiagpCreateConfigSnapshot( ReadableScopes, &NewSnapshot );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	for ( i = 0; i <= MAX_KEY_INDEX; i++ )
+	{
+		DWORD Index;
+
+		if ( ! ( ReadableScopes & KEY_SCOPE_FOR_INDEX( i ) ) )
+		{
+			continue;
+		}
+
+		for ( Index = 0; ; Index++ )
+		{
+			WCHAR GroupName[ MAX_SETTINGGROUPNAME_CCH + 1 ];
+			DWORD GroupNameLen = _countof( GroupName );
+			HKEY GroupKey;
+			LONG Res;
+
+			Res = RegEnumKeyEx(
+				Store->Key[ i ],
+				Index,
+				GroupName,
+				&GroupNameLen,
+				NULL,
+				NULL,
+				NULL,
+				NULL );
+			if ( ERROR_NO_MORE_ITEMS == Res )
+			{
+				break;
+			}
+			else if ( ERROR_MORE_DATA == Res )
+			{
+				//
+				// Not a valid group name.
+				//
+				continue;
+			}
+			else if ( ERROR_SUCCESS != Res )
+			{
+				Hr = HRESULT_FROM_WIN32( Res );
+				goto Cleanup;
+			}
+
+			Res = RegOpenKeyEx(
+				Store->Key[ i ],
+				GroupName,
+				0,
+				Store->KeyAccessMask[ i ] & KEY_READ,
+				&GroupKey );
+			if ( ERROR_FILE_NOT_FOUND == Res )
+			{
+				//
+				// Deleted in the meantime.
+				//
+				continue;
+			}
+			else if ( ERROR_SUCCESS != Res )
+			{
+				Hr = HRESULT_FROM_WIN32( Res );
+				goto Cleanup;
+			}
+
+			Hr = CdiagsLoadGroupIntoSnapshot(
+				GroupKey,
+				GroupName,
+				KEY_SCOPE_FOR_INDEX( i ),
+				NewSnapshot );
+
+			_VERIFY( ERROR_SUCCESS == RegCloseKey( GroupKey ) );
+
+			if ( FAILED( Hr ) )
+			{
+				goto Cleanup;
+			}
+		}
+	}
+
+	*Snapshot = NewSnapshot;
+	NewSnapshot = NULL;
+	Hr = S_OK;
+
+Cleanup:
+	if ( NewSnapshot )
+	{
+		CdiagpFreeConfigSnapshot( NewSnapshot );
+	}
+
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Reloads the snapshot from the registry. On failure, the
+		current snapshot remains in place.
+--*/
+static HRESULT CdiagsRefreshSnapshot(
+	__in PCDIAGP_REG_CONFIG_STORE Store
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+	HRESULT Hr;
+
+	_ASSERTE( Store->Cache.Enabled );
+
+	EnterCriticalSection( &Store->Cache.Lock );
+
+	Hr = CdiagsLoadSnapshot( Store, &Snapshot );
+	if ( SUCCEEDED( Hr ) )
+	{
+		CdiagpPublishConfigSnapshot( &Store->Cache.Settings, Snapshot );
+	}
+
+	LeaveCriticalSection( &Store->Cache.Lock );
+
+	return Hr;
+}
+
+/*++
+	Routine description:
+		Reflects a write or deletion (DataType == REG_NONE) in the
+		snapshot s.t. it is visible to subsequent reads immediately,
+		without having to wait for the change notification.
+--*/
+static HRESULT CdiagsUpdateSnapshot(
+	__in PCDIAGP_REG_CONFIG_STORE Store,
+	__in PCWSTR GroupName,
+	__in PCWSTR Name,
+	__in DWORD Scope,
+	__in DWORD DataType,
+	__in DWORD DataLen,
+	__in_opt CONST PBYTE Data
+	)
+{
+	PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+	HRESULT Hr;
+
+	if ( ! Store->Cache.Enabled )
+	{
+		return S_OK;
+	}
+
+	EnterCriticalSection( &Store->Cache.Lock );
+
+	if ( ! ( Store->Cache.Settings.Current->ReadableScopes & Scope ) )
+	{
+		//
+		// Scope not cached.
+		//
+		Hr = S_OK;
+		goto Cleanup;
+	}
+
+	Hr = CdiagpCopyConfigSnapshot( Store->Cache.Settings.Current, &Snapshot );
+	if ( FAILED( Hr ) )
+	{
+		goto Cleanup;
+	}
+
+	if ( DataType == REG_NONE )
+	{
+		Hr = CdiagpDeleteConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Name );
+	}
+	else
+	{
+		Hr = CdiagpSetConfigSnapshotEntry(
+			Snapshot,
+			Scope,
+			GroupName,
+			Name,
+			DataType,
+			DataLen,
+			Data );
+	}
+
+	if ( FAILED( Hr ) && Hr != CDIAG_E_SETTING_NOT_FOUND )
+	{
+		CdiagpFreeConfigSnapshot( Snapshot );
+		goto Cleanup;
+	}
+
+	CdiagpPublishConfigSnapshot( &Store->Cache.Settings, Snapshot );
+	Hr = S_OK;
+
+Cleanup:
+	LeaveCriticalSection( &Store->Cache.Lock );
+
+	return Hr;
+}
+
 /*++
 	Routine description:
 		Deletes a setting using a single scope, i.e. either HKCU or
@@ -175,7 +526,14 @@ static HRESULT CdiagsDeleteSettingInSingleScope(
 	}
 	else
 	{
-		Hr = S_OK;
+		Hr = CdiagsUpdateSnapshot(
+			Store,
+			GroupName,
+			Name,
+			Scope,
+			REG_NONE,
+			0,
+			NULL );
 	}
 
 	_VERIFY( ERROR_SUCCESS == RegCloseKey( Key ) );
@@ -243,7 +601,14 @@ static HRESULT CdiagsWriteSettingInSingleScope(
 	}
 	else
 	{
-		Hr = S_OK;
+		Hr = CdiagsUpdateSnapshot(
+			Store,
+			GroupName,
+			Name,
+			Scope,
+			DataType,
+			DataLen,
+			Data );
 	}
 
 	_VERIFY( ERROR_SUCCESS == RegCloseKey( Key ) );
@@ -367,6 +732,19 @@ static HRESULT CdiagsReadSetting(
 	_ASSERTE( BufferLen );
 	_ASSERTE( Buffer );
 
+	if ( Store->Cache.Enabled )
+	{
+		return CdiagpReadConfigCache(
+			&Store->Cache.Settings,
+			GroupName,
+			Name,
+			Scope,
+			ExpectedDataType,
+			BufferLen,
+			Buffer,
+			ActualLen );
+	}
+
 	if ( Scope & CdiagUserScope )
 	{
 		HRESULT Hr = CdiagsReadSettingInSingleScope(
@@ -502,19 +880,8 @@ static HRESULT CdiagsRegisterKeyChangeNotification(
 	_ASSERTE( Callback );
 
 	//
-	// Has the event already been created?
-	//
-	if ( NULL != Store->Notify.Event && 
-		 NULL != Store->Notify.WaitHandle )
-	{
-		//
-		// Already set up
-		//
-		return S_OK;
-	}
-	
-	//
-	// If no event yet, create one.
+	// If no event yet, create one. Note that the notification still
+	// has to be registered for each key.
 	//
 	if ( ! Store->Notify.Event )
 	{
@@ -561,19 +928,8 @@ static VOID CdiagsKeyChangeNotificationCallback(
 	UNREFERENCED_PARAMETER( TimedOut );
 
 	//
-	// Grab CS to avoid the callback function being changed - as soon as 
-	// the callback function is changed, the context may not be valid any
-	// more.
-	//
-	EnterCriticalSection( &Store->Notify.Lock );
-	if ( Store->Notify.Callback.Function )
-	{
-		Store->Notify.Callback.Function( Store->Notify.Callback.Context );
-	}
-	LeaveCriticalSection( &Store->Notify.Lock );
-
-	//
-	// Register for next change event.
+	// Register for next change event. Done before reloading the 
+	// snapshot s.t. no change can be missed.
 	//
 	for ( i = 0; i <= MAX_KEY_INDEX; i++ )
 	{
@@ -587,6 +943,26 @@ static VOID CdiagsKeyChangeNotificationCallback(
 				TRUE ) );
 		}
 	}
+
+	if ( Store->Cache.Enabled )
+	{
+		//
+		// If reloading fails, keep using the current snapshot.
+		//
+		( VOID ) CdiagsRefreshSnapshot( Store );
+	}
+
+	//
+	// Grab CS to avoid the callback function being changed - as soon as 
+	// the callback function is changed, the context may not be valid any
+	// more.
+	//
+	EnterCriticalSection( &Store->Notify.Lock );
+	if ( Store->Notify.Callback.Function )
+	{
+		Store->Notify.Callback.Function( Store->Notify.Callback.Context );
+	}
+	LeaveCriticalSection( &Store->Notify.Lock );
 }
 
 /*----------------------------------------------------------------------
@@ -972,6 +1348,12 @@ static HRESULT CdiagsDeleteStore(
 		}
 
 		DeleteCriticalSection( &Store->Notify.Lock );
+
+		if ( Store->Cache.Enabled )
+		{
+			CdiagpDeleteConfigCache( &Store->Cache.Settings );
+			DeleteCriticalSection( &Store->Cache.Lock );
+		}
 	}
 
 	//
@@ -1001,8 +1383,8 @@ HRESULT CDIAGCALLTYPE CdiagCreateRegistryStore(
 
 	if ( ! CdiagpIsStringValid( BaseKeyName, 1, MAX_REG_NAME_CCH, FALSE ) || 
 		 ! Store || 
-		 0 == AccessMode ||
-		 AccessMode > CDIAG_CFGS_ACCESS_ALL )
+		 0 == ( AccessMode & CDIAG_CFGS_ACCESS_ALL ) ||
+		 ( AccessMode & ~( CDIAG_CFGS_ACCESS_ALL | CDIAG_CFGS_CACHE_SETTINGS ) ) )
 	{
 		Hr = E_INVALIDARG;
 		goto Cleanup;
@@ -1088,6 +1470,51 @@ HRESULT CDIAGCALLTYPE CdiagCreateRegistryStore(
 
 	InitializeCriticalSection( &TempStore->Notify.Lock );
 
+	if ( AccessMode & CDIAG_CFGS_CACHE_SETTINGS )
+	{
+		PCDIAGP_CONFIG_SNAPSHOT Snapshot;
+
+		InitializeCriticalSection( &TempStore->Cache.Lock );
+		TempStore->Cache.Enabled = TRUE;
+
+		//
+		// Watch for changes before taking the initial snapshot s.t.
+		// no change can be missed.
+		//
+		Hr = S_OK;
+
+		EnterCriticalSection( &TempStore->Notify.Lock );
+		for ( i = 0; i <= MAX_KEY_INDEX; i++ )
+		{
+			if ( TempStore->Key[ i ] )
+			{
+				Hr = CdiagsRegisterKeyChangeNotification(
+					TempStore,
+					TempStore->Key[ i ],
+					CdiagsKeyChangeNotificationCallback,
+					TempStore );
+				if ( FAILED ( Hr ) )
+				{
+					break;
+				}
+			}
+		}
+		LeaveCriticalSection( &TempStore->Notify.Lock );
+
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+
+		Hr = CdiagsLoadSnapshot( TempStore, &Snapshot );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+
+		CdiagpPublishConfigSnapshot( &TempStore->Cache.Settings, Snapshot );
+	}
+
 	*Store = ( PCDIAG_CONFIGURATION_STORE ) TempStore;
 	Hr = S_OK;
 
@@ -25,7 +25,6 @@
 
 #include "cdiagp.h"
 #include "list.h"
-#include <hashtable.h>
 
 #define DEFAULT_FORMAT					\
 		L"Type=%Type, "					\
@@ -44,19 +43,67 @@
 
 #define CDIAGP_SESSION_SIGNATURE 'sseS'
 
+//
+// Size of a dispatch slot. Packets not fitting into the slot are
+// copied to an overflow block allocated from the heap.
+//
+#define CDIAGS_DISPATCH_SLOT_SIZE			1024
+#define CDIAGS_DISPATCH_MAX_SLOT_COUNT		( 64 * 1024 )
+
+//
+// Index of the default handler in HANDLER_TABLE::Registrations.
+//
+#define CDIAGS_DEFAULT_HANDLER_INDEX		( CdiagMaxEvent + 1 )
+
 typedef struct _HANDLER_REGISTRATION
 {
-	union
-	{
-		CDIAG_EVENT_TYPE Type;
-		JPHT_HASHTABLE_ENTRY HashtableEntry;
-	} Key;
-
+	//
+	// Referenced, may be NULL.
+	//
 	PCDIAG_HANDLER Handler;
 
 	DWORD SeverityFilter;
 } HANDLER_REGISTRATION, *PHANDLER_REGISTRATION;
 
+/*++
+	Structure Description:
+		Immutable snapshot of all handler registrations of a session.
+		Updates copy the current table, modify the copy and publish
+		it, s.t. readers never observe a table being modified.
+--*/
+typedef struct _HANDLER_TABLE
+{
+	//
+	// Registrations by event type, followed by the default handler,
+	// which is used for all types lacking a handler of their own.
+	//
+	HANDLER_REGISTRATION Registrations[ CdiagMaxEvent + 2 ];
+
+	//
+	// Handler to dispatch to by event type and severity. NULL if 
+	// there is none or the severity is filtered. Entries are not 
+	// referenced on their own.
+	//
+	PCDIAG_HANDLER Dispatch[ CdiagMaxEvent + 1 ][ CdiagMaxSeverity + 1 ];
+} HANDLER_TABLE, *PHANDLER_TABLE;
+
+typedef struct _CDIAGS_DISPATCH_SLOT
+{
+	//
+	// Position the slot is free for (== Position) or the 
+	// position it holds an event for (== Position + 1).
+	//
+	volatile LONG Sequence;
+
+	//
+	// Copy of the packet if it does not fit into Data, NULL otherwise.
+	//
+	PCDIAG_EVENT_PACKET OverflowPacket;
+
+	ULONGLONG Data[ ( CDIAGS_DISPATCH_SLOT_SIZE - 2 * sizeof( PVOID ) ) 
+		/ sizeof( ULONGLONG ) ];
+} CDIAGS_DISPATCH_SLOT, *PCDIAGS_DISPATCH_SLOT;
+
 typedef struct _CDIAGP_SESSION
 {
 	DWORD Signature;
@@ -66,24 +113,81 @@ typedef struct _CDIAGP_SESSION
 	struct
 	{
 		//
-		// Lock guarding sub-struct.
+		// Lock guarding sub-struct. Also serializes updates of
+		// the handler table.
 		//
 		CRITICAL_SECTION Lock;
 
 		PCDIAG_FORMATTER Formatter;
 		PCDIAG_MESSAGE_RESOLVER Resolver;
+	} Members;
+
+	//
+	// Handler table. Lookups do not take any locks but must be 
+	// performed within a read section, see 
+	// CdiagsEnterReadHandlerTable.
+	//
+	struct
+	{
+		PHANDLER_TABLE volatile Current;
 
 		//
-		// Default handler used when no entry in hashtable.
-		// DefaultHandler->Handler May be NULL.
+		// Epoch-based reclamation of replaced tables.
 		//
-		HANDLER_REGISTRATION DefaultHandler;
+		JPHT_EPOCH Reclamation;
 
 		//
-		// Hashtable: EventType->HANDLER_REGISTRATION
+		// Bitmask of severities that Current dispatches to a handler,
+		// by event type. Read without synchronization by 
+		// CdiagIsEventEnabled, updated whenever a table is published.
 		//
-		JPHT_HASHTABLE Handlers;
-	} Members;
+		volatile DWORD EnabledSeverities[ CdiagMaxEvent + 1 ];
+	} Handlers;
+
+	//
+	// Asynchronous dispatching, only used if Slots != NULL. 
+	//
+	// Slots form a bounded MPSC ring: Producers claim a position
+	// by incrementing EnqueuePos, the worker thread is the only
+	// consumer. Positions are free-running and wrap around.
+	//
+	struct
+	{
+		PCDIAGS_DISPATCH_SLOT Slots;
+		LONG SlotMask;
+		CDIAG_ASYNC_OVERFLOW_POLICY Policy;
+
+		volatile LONG EnqueuePos;
+		volatile LONG DequeuePos;
+
+		volatile LONG DroppedEvents;
+
+		//
+		// Set by the worker before waiting for WorkAvailableEvent.
+		//
+		volatile LONG WorkerWaiting;
+
+		//
+		// Number of producers waiting for SpaceAvailableEvent.
+		//
+		volatile LONG BlockedProducers;
+
+		volatile BOOL Stopping;
+
+		//
+		// Auto-reset.
+		//
+		HANDLE WorkAvailableEvent;
+		HANDLE SpaceAvailableEvent;
+
+		//
+		// Manual-reset, signalled while the worker is idle.
+		//
+		HANDLE DrainedEvent;
+
+		HANDLE WorkerThread;
+		DWORD WorkerThreadId;
+	} Dispatch;
 } CDIAGP_SESSION, *PCDIAGP_SESSION;
 
 #define CdiagsIsValidSession( p ) \
@@ -91,84 +195,182 @@ typedef struct _CDIAGP_SESSION
 
 
 /*----------------------------------------------------------------------
- * 
- * Hashtable callbacks.
+ *
+ * Handler table.
  *
  */
-static DWORD CdiagsHashEventType(
-	__in DWORD_PTR Key
+
+static ULONG CdiagsEnterReadHandlerTable(
+	__in PCDIAGP_SESSION Session
 	)
 {
-	return ( DWORD ) Key;
+	return JphtEnterReadEpoch( &Session->Handlers.Reclamation );
 }
 
-
-static BOOLEAN CdiagsEqualsEventType(
-	__in DWORD_PTR KeyLhs,
-	__in DWORD_PTR KeyRhs
+static VOID CdiagsLeaveReadHandlerTable(
+	__in PCDIAGP_SESSION Session,
+	__in ULONG Epoch
 	)
 {
-	return ( BOOLEAN ) ( ( ( DWORD ) KeyLhs ) == ( ( DWORD ) KeyRhs ) );
+	JphtLeaveReadEpoch( &Session->Handlers.Reclamation, Epoch );
 }
 
-static PVOID CdiagsAllocateHashtableMemory(
-	__in SIZE_T Size 
+static VOID CdiagsDeleteHandlerTable(
+	__in PHANDLER_TABLE Table
 	)
 {
-	return CdiagpMalloc( Size, FALSE );
+	ULONG Index;
+
+	for ( Index = 0; Index < _countof( Table->Registrations ); Index++ )
+	{
+		PCDIAG_HANDLER Handler = Table->Registrations[ Index ].Handler;
+		if ( Handler )
+		{
+			_ASSERTE( CdiagpIsValidHandler( Handler ) );
+			Handler->Dereference( Handler );
+		}
+	}
+
+	CdiagpFree( Table );
 }
 
-static VOID CdiagsFreeHashtableMemory(
-	__in PVOID Mem
+/*++
+	Routine Description:
+		Create a copy of a table, referencing all handlers again.
+		If Source is NULL, an empty table is created.
+--*/
+static HRESULT CdiagsCopyHandlerTable(
+	__in_opt PHANDLER_TABLE Source,
+	__out PHANDLER_TABLE *Table
 	)
 {
-	CdiagpFree( Mem );
+	PHANDLER_TABLE NewTable;
+	ULONG Index;
+
+	NewTable = ( PHANDLER_TABLE ) CdiagpMalloc( sizeof( HANDLER_TABLE ), TRUE );
+	if ( ! NewTable )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for ( Index = 0; Index < _countof( NewTable->Registrations ); Index++ )
+	{
+		if ( Source )
+		{
+			NewTable->Registrations[ Index ] = Source->Registrations[ Index ];
+			if ( NewTable->Registrations[ Index ].Handler )
+			{
+				NewTable->Registrations[ Index ].Handler->Reference(
+					NewTable->Registrations[ Index ].Handler );
+			}
+		}
+		else
+		{
+			NewTable->Registrations[ Index ].SeverityFilter = 0xffffffff;
+		}
+	}
+
+	*Table = NewTable;
+	return S_OK;
 }
 
-/*----------------------------------------------------------------------
- *
- * Privates.
- *
- */
-static VOID CdiagsDeleteHandlerRegistration(
-	__in PHANDLER_REGISTRATION HandlerReg
+/*++
+	Routine Description:
+		Compute the dispatch matrix from the registrations.
+--*/
+static VOID CdiagsPrepareHandlerTable(
+	__in PHANDLER_TABLE Table
 	)
 {
-	_ASSERTE( HandlerReg->Handler );
-	if ( HandlerReg->Handler )
+	ULONG Type;
+	ULONG Severity;
+
+	for ( Type = 0; Type <= CdiagMaxEvent; Type++ )
 	{
-		_ASSERTE( CdiagpIsValidHandler( HandlerReg->Handler ) );
-		HandlerReg->Handler->Dereference( HandlerReg->Handler );
+		PHANDLER_REGISTRATION HandlerReg = &Table->Registrations[ Type ];
+		if ( HandlerReg->Handler == NULL )
+		{
+			HandlerReg = &Table->Registrations[ CDIAGS_DEFAULT_HANDLER_INDEX ];
+		}
+
+		for ( Severity = 0; Severity <= CdiagMaxSeverity; Severity++ )
+		{
+			Table->Dispatch[ Type ][ Severity ] = 
+				( HandlerReg->SeverityFilter & ( 1 << Severity ) )
+					? HandlerReg->Handler
+					: NULL;
+		}
 	}
+}
+
+/*++
+	Routine Description:
+		Derive the EnabledSeverities masks from the current table.
+
+		Lock must be held or the session not be published yet.
+--*/
+static VOID CdiagsUpdateEnabledSeverities(
+	__in PCDIAGP_SESSION Session
+	)
+{
+	PHANDLER_TABLE Table = Session->Handlers.Current;
+	ULONG Type;
+	ULONG Severity;
+
+	for ( Type = 0; Type <= CdiagMaxEvent; Type++ )
+	{
+		DWORD Mask = 0;
+
+		for ( Severity = 0; Severity <= CdiagMaxSeverity; Severity++ )
+		{
+			if ( Table->Dispatch[ Type ][ Severity ] != NULL )
+			{
+				Mask |= 1 << Severity;
+			}
+		}
 
-	CdiagpFree( HandlerReg );
+		InterlockedExchange( 
+			( volatile LONG* ) &Session->Handlers.EnabledSeverities[ Type ], 
+			( LONG ) Mask );
+	}
 }
 
-static VOID CdiagsTearDownHandlerFromHashtableCallback(
-	__in PJPHT_HASHTABLE Hashtable,
-	__in PJPHT_HASHTABLE_ENTRY Entry,
-	__in_opt PVOID Context
+/*++
+	Routine Description:
+		Replace the current table by a modified copy and delete
+		the old table once no reader can refer to it any more.
+
+		Lock must be held.
+--*/
+static VOID CdiagsPublishHandlerTable(
+	__in PCDIAGP_SESSION Session,
+	__in PHANDLER_TABLE Table
 	)
 {
-	PHANDLER_REGISTRATION HandlerReg;
-	PJPHT_HASHTABLE_ENTRY OldEntry;
-	
-	UNREFERENCED_PARAMETER( Context );
-	JphtRemoveEntryHashtable(
-		Hashtable,
-		Entry->Key,
-		&OldEntry );
-
-	_ASSERTE( OldEntry == Entry );
-
-	HandlerReg = CONTAINING_RECORD(
-		Entry,
-		HANDLER_REGISTRATION,
-		Key.HashtableEntry );
-
-	CdiagsDeleteHandlerRegistration( HandlerReg );
+	PHANDLER_TABLE OldTable;
+
+	CdiagsPrepareHandlerTable( Table );
+
+	OldTable = ( PHANDLER_TABLE ) InterlockedExchangePointer(
+		( PVOID volatile * ) &Session->Handlers.Current,
+		Table );
+
+	CdiagsUpdateEnabledSeverities( Session );
+
+	JphtSynchronizeEpoch( &Session->Handlers.Reclamation, CdiagpYieldEpoch );
+
+	CdiagsDeleteHandlerTable( OldTable );
 }
 
+/*----------------------------------------------------------------------
+ *
+ * Privates.
+ *
+ */
+static VOID CdiagsStopDispatch(
+	__in PCDIAGP_SESSION Session
+	);
+
 static VOID CdiagsDeleteSession(
 	__in PCDIAGP_SESSION Session
 	)
@@ -176,20 +378,16 @@ static VOID CdiagsDeleteSession(
 	_ASSERTE( CdiagsIsValidSession( Session ) );
 
 	//
-	// Tear down handlers.
+	// Handle queued events before the handlers go away.
 	//
-	JphtEnumerateEntries(
-		&Session->Members.Handlers,
-		CdiagsTearDownHandlerFromHashtableCallback,
-		NULL );
-	
-	JphtDeleteHashtable( &Session->Members.Handlers );
+	CdiagsStopDispatch( Session );
 
-	if ( Session->Members.DefaultHandler.Handler )
-	{
-		Session->Members.DefaultHandler.Handler->Dereference( 
-			Session->Members.DefaultHandler.Handler );
-	}
+	//
+	// Tear down handlers.
+	//
+	_ASSERTE( Session->Handlers.Reclamation.Readers[ 0 ] == 0 );
+	_ASSERTE( Session->Handlers.Reclamation.Readers[ 1 ] == 0 );
+	CdiagsDeleteHandlerTable( Session->Handlers.Current );
 
 	DeleteCriticalSection( &Session->Members.Lock );
 	if ( Session->Members.Formatter )
@@ -205,168 +403,515 @@ static VOID CdiagsDeleteSession(
 	CdiagpFree( Session );
 }
 
-static HRESULT CdiagsQueryDefaultHandler(
+static HRESULT CdiagsQueryHandler(
 	__in PCDIAGP_SESSION Session,
+	__in ULONG Index,
 	__out PCDIAG_HANDLER *Handler 
 	)
 {
-	*Handler = Session->Members.DefaultHandler.Handler;
+	_ASSERTE( Index <= CDIAGS_DEFAULT_HANDLER_INDEX );
+
+	*Handler = Session->Handlers.Current->Registrations[ Index ].Handler;
 	if ( *Handler )
 	{
 		( *Handler )->Reference( *Handler );
+		return S_OK;
+	}
+	else
+	{
+		return S_FALSE;
 	}
-	
-	return S_OK;
 }
 
-static HRESULT CdiagsSetDefaultHandler(
+static HRESULT CdiagsSetHandler(
 	__in PCDIAGP_SESSION Session,
+	__in ULONG Index,
 	__in PCDIAG_HANDLER Handler 
 	)
 {
-	PCDIAG_HANDLER OldHandler;
-	if ( ! CdiagpIsValidHandler( Handler ) )
+	PHANDLER_REGISTRATION HandlerReg;
+	PHANDLER_TABLE Table;
+	HRESULT Hr;
+
+	if ( Index > CDIAGS_DEFAULT_HANDLER_INDEX ||
+		 ! CdiagpIsValidHandler( Handler ) )
 	{
 		return E_INVALIDARG;
 	}
 
-	//
-	// Remove old handler.
-	//
-	OldHandler = Session->Members.DefaultHandler.Handler;
-	if ( OldHandler )
+	Hr = CdiagsCopyHandlerTable( Session->Handlers.Current, &Table );
+	if ( FAILED( Hr ) )
 	{
-		OldHandler->Dereference( OldHandler );
+		return Hr;
+	}
+
+	HandlerReg = &Table->Registrations[ Index ];
+	if ( HandlerReg->Handler )
+	{
+		HandlerReg->Handler->Dereference( HandlerReg->Handler );
 	}
 
-	//
-	// Set new.
-	//
 	Handler->Reference( Handler );
-	Session->Members.DefaultHandler.Handler = Handler;
+	HandlerReg->Handler = Handler;
+
+	if ( Index != CDIAGS_DEFAULT_HANDLER_INDEX )
+	{
+		//
+		// New registration, reset filter.
+		//
+		HandlerReg->SeverityFilter = 0xffffffff;
+	}
+
+	CdiagsPublishHandlerTable( Session, Table );
 	return S_OK;
 }
 
-static HRESULT CdiagsQueryHandler(
+static HRESULT CdiagsQuerySeverityFilter(
 	__in PCDIAGP_SESSION Session,
 	__in CDIAG_EVENT_TYPE Type,
-	__out PCDIAG_HANDLER *Handler 
+	__out PDWORD Filter
 	)
 {
-	PJPHT_HASHTABLE_ENTRY Entry;
 	PHANDLER_REGISTRATION HandlerReg;
-	Entry = JphtGetEntryHashtable( &Session->Members.Handlers, Type );
-	if ( ! Entry )
-	{	
-		*Handler = NULL;
+
+	if ( ( DWORD ) Type > CdiagMaxEvent ||
+		 Session->Handlers.Current->Registrations[ Type ].Handler == NULL )
+	{
+		*Filter = 0;
 		return S_FALSE;
 	}
-	else
+
+	HandlerReg = &Session->Handlers.Current->Registrations[ Type ];
+	*Filter = HandlerReg->SeverityFilter;
+	return S_OK;
+}
+
+static HRESULT CdiagsSetSeverityFilter(
+	__in PCDIAGP_SESSION Session,
+	__in CDIAG_EVENT_TYPE Type,
+	__in DWORD Filter
+	)
+{
+	PHANDLER_TABLE Table;
+	HRESULT Hr;
+
+	if ( ( DWORD ) Type > CdiagMaxEvent ||
+		 Session->Handlers.Current->Registrations[ Type ].Handler == NULL )
 	{
-		HandlerReg = CONTAINING_RECORD(
-			Entry,
-			HANDLER_REGISTRATION,
-			Key.HashtableEntry );
+		return S_FALSE;
+	}
 
-		*Handler = HandlerReg->Handler;
-		( *Handler )->Reference( *Handler );
-		return S_OK;
+	Hr = CdiagsCopyHandlerTable( Session->Handlers.Current, &Table );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
 	}
+
+	Table->Registrations[ Type ].SeverityFilter = Filter;
+
+	CdiagsPublishHandlerTable( Session, Table );
+	return S_OK;
 }
 
-static HRESULT CdiagsSetHandler(
+static HRESULT CdiagsDispatchEvent(
 	__in PCDIAGP_SESSION Session,
-	__in CDIAG_EVENT_TYPE Type,
-	__in PCDIAG_HANDLER Handler 
+	__in PCDIAG_EVENT_PACKET Packet
 	)
 {
-	PJPHT_HASHTABLE_ENTRY OldEntry;
+	PCDIAG_HANDLER Handler;
+	HRESULT Hr;
+	ULONG Epoch;
+
+	_ASSERTE( ( DWORD ) Packet->Type <= CdiagMaxEvent );
+	_ASSERTE( Packet->Severity <= CdiagMaxSeverity );
 
 	//
-	// Create new registration...
+	// Grab handler. In order to leave the read section early, we 
+	// need to add-ref the handler.
 	//
-	PHANDLER_REGISTRATION HandlerReg = CdiagpMalloc( 
-		sizeof( HANDLER_REGISTRATION ), TRUE );
+	Epoch = CdiagsEnterReadHandlerTable( Session );
 
-	HandlerReg->Key.Type = Type;
-	HandlerReg->SeverityFilter = 0xffffffff;
-	HandlerReg->Handler = Handler;
-	Handler->Reference( Handler );
+	Handler = Session->Handlers.Current->Dispatch
+		[ Packet->Type ][ Packet->Severity ];
+	if ( Handler )
+	{
+		Handler->Reference( Handler );
+	}
+
+	CdiagsLeaveReadHandlerTable( Session, Epoch );
+
+	if ( Handler )
+	{
+		Hr = Handler->Handle( Handler, Packet );
+		Handler->Dereference( Handler );
+	}
+	else
+	{
+		//
+		// No handler or filtered.
+		//
+		Hr = S_FALSE;
+	}
+
+	return Hr;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Asynchronous dispatching.
+ *
+ */
+
+static BOOL CdiagsIsQueuedEventAvailable(
+	__in PCDIAGP_SESSION Session
+	)
+{
+	LONG Pos = Session->Dispatch.DequeuePos;
+	return Session->Dispatch.Slots[ Pos & Session->Dispatch.SlotMask ].Sequence
+		== Pos + 1;
+}
+
+/*++
+	Routine Description:
+		Dispatch the oldest queued event and make its slot available
+		again.
+
+		Only to be called by the worker thread.
+
+	Return Value:
+		TRUE if an event has been dispatched, FALSE if none was
+		available.
+--*/
+static BOOL CdiagsDispatchQueuedEvent(
+	__in PCDIAGP_SESSION Session
+	)
+{
+	PCDIAGS_DISPATCH_SLOT Slot;
+	PCDIAG_EVENT_PACKET Packet;
+	LONG Pos;
+
+	Pos = Session->Dispatch.DequeuePos;
+	Slot = &Session->Dispatch.Slots[ Pos & Session->Dispatch.SlotMask ];
+	if ( Slot->Sequence != Pos + 1 )
+	{
+		return FALSE;
+	}
+
+	if ( Slot->OverflowPacket != NULL )
+	{
+		Packet = Slot->OverflowPacket;
+	}
+	else
+	{
+		Packet = ( PCDIAG_EVENT_PACKET ) Slot->Data;
+	}
 
 	//
-	// Register it...
+	// There is noone to report a failure to.
 	//
-	JphtPutEntryHashtable(
-		&Session->Members.Handlers,
-		&HandlerReg->Key.HashtableEntry,
-		&OldEntry );
+	( VOID ) CdiagsDispatchEvent( Session, Packet );
+
+	if ( Slot->OverflowPacket != NULL )
+	{
+		CdiagpFree( Slot->OverflowPacket );
+		Slot->OverflowPacket = NULL;
+	}
+
+	Session->Dispatch.DequeuePos = Pos + 1;
+	InterlockedExchange( 
+		&Slot->Sequence, 
+		Pos + Session->Dispatch.SlotMask + 1 );
+
+	if ( Session->Dispatch.BlockedProducers > 0 )
+	{
+		_VERIFY( SetEvent( Session->Dispatch.SpaceAvailableEvent ) );
+	}
+
+	return TRUE;
+}
+
+static DWORD CALLBACK CdiagsDispatchThreadProc(
+	__in PVOID Parameter
+	)
+{
+	PCDIAGP_SESSION Session = ( PCDIAGP_SESSION ) Parameter;
+
+	for ( ;; )
+	{
+		if ( CdiagsIsQueuedEventAvailable( Session ) )
+		{
+			_VERIFY( ResetEvent( Session->Dispatch.DrainedEvent ) );
+			while ( CdiagsDispatchQueuedEvent( Session ) )
+			{
+				;
+			}
+			_VERIFY( SetEvent( Session->Dispatch.DrainedEvent ) );
+		}
+
+		if ( Session->Dispatch.Stopping )
+		{
+			break;
+		}
+
+		//
+		// Announce that we are about to wait, then check again -- a
+		// producer publishing an event in between either sees 
+		// WorkerWaiting set or its event is seen here.
+		//
+		InterlockedExchange( &Session->Dispatch.WorkerWaiting, TRUE );
+		if ( CdiagsIsQueuedEventAvailable( Session ) ||
+			 Session->Dispatch.Stopping )
+		{
+			InterlockedExchange( &Session->Dispatch.WorkerWaiting, FALSE );
+			continue;
+		}
+
+		( VOID ) WaitForSingleObject( 
+			Session->Dispatch.WorkAvailableEvent, 
+			INFINITE );
+	}
+
+	return 0;
+}
+
+/*++
+	Routine Description:
+		Claim the next free slot.
+
+	Return Value:
+		TRUE if a slot has been claimed, FALSE if the ring is full.
+--*/
+static BOOL CdiagsClaimDispatchSlot(
+	__in PCDIAGP_SESSION Session,
+	__out PLONG Position
+	)
+{
+	for ( ;; )
+	{
+		LONG Pos = Session->Dispatch.EnqueuePos;
+		LONG Diff = Session->Dispatch.Slots[ 
+			Pos & Session->Dispatch.SlotMask ].Sequence - Pos;
+
+		if ( Diff == 0 )
+		{
+			if ( Pos == InterlockedCompareExchange( 
+				&Session->Dispatch.EnqueuePos,
+				Pos + 1,
+				Pos ) )
+			{
+				*Position = Pos;
+				return TRUE;
+			}
+		}
+		else if ( Diff < 0 )
+		{
+			//
+			// Slot still holds the event from the previous round.
+			//
+			return FALSE;
+		}
+
+		//
+		// Another producer claimed the slot, retry.
+		//
+	}
+}
+
+/*++
+	Routine Description:
+		Copy the packet to the ring.
+
+	Return Value:
+		S_OK if queued.
+		S_FALSE if dropped because the ring is full.
+		E_OUTOFMEMORY if dropped because no overflow block could
+			be allocated.
+--*/
+static HRESULT CdiagsQueueEvent(
+	__in PCDIAGP_SESSION Session,
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	PCDIAG_EVENT_PACKET OverflowPacket = NULL;
+	PCDIAGS_DISPATCH_SLOT Slot;
+	BOOL Claimed;
+	LONG Pos;
+
+	if ( Packet->TotalSize > sizeof( Slot->Data ) )
+	{
+		OverflowPacket = ( PCDIAG_EVENT_PACKET ) 
+			CdiagpMalloc( Packet->TotalSize, FALSE );
+		if ( OverflowPacket == NULL )
+		{
+			InterlockedIncrement( &Session->Dispatch.DroppedEvents );
+			return E_OUTOFMEMORY;
+		}
+
+		CopyMemory( OverflowPacket, Packet, Packet->TotalSize );
+	}
+
+	for ( ;; )
+	{
+		if ( CdiagsClaimDispatchSlot( Session, &Pos ) )
+		{
+			break;
+		}
+		else if ( Session->Dispatch.Policy == CdiagAsyncDropOnOverflow )
+		{
+			if ( OverflowPacket != NULL )
+			{
+				CdiagpFree( OverflowPacket );
+			}
+
+			InterlockedIncrement( &Session->Dispatch.DroppedEvents );
+			return S_FALSE;
+		}
+
+		//
+		// Register as blocked before checking again s.t. the worker
+		// cannot free a slot unnoticed in between.
+		//
+		InterlockedIncrement( &Session->Dispatch.BlockedProducers );
+		Claimed = CdiagsClaimDispatchSlot( Session, &Pos );
+		if ( ! Claimed )
+		{
+			( VOID ) WaitForSingleObject( 
+				Session->Dispatch.SpaceAvailableEvent, 
+				INFINITE );
+		}
+
+		if ( InterlockedDecrement( &Session->Dispatch.BlockedProducers ) > 0 )
+		{
+			//
+			// The worker may have freed several slots but the event 
+			// only wakes a single producer -- pass it on.
+			//
+			_VERIFY( SetEvent( Session->Dispatch.SpaceAvailableEvent ) );
+		}
+
+		if ( Claimed )
+		{
+			break;
+		}
+	}
+
+	Slot = &Session->Dispatch.Slots[ Pos & Session->Dispatch.SlotMask ];
+	if ( OverflowPacket == NULL )
+	{
+		CopyMemory( Slot->Data, Packet, Packet->TotalSize );
+	}
+	Slot->OverflowPacket = OverflowPacket;
 
 	//
-	// Dispose old.
+	// Publish.
 	//
-	if ( OldEntry )
-	{
-		PHANDLER_REGISTRATION OldReg = CONTAINING_RECORD(
-			OldEntry,
-			HANDLER_REGISTRATION,
-			Key.HashtableEntry );
+	InterlockedExchange( &Slot->Sequence, Pos + 1 );
 
-		CdiagsDeleteHandlerRegistration( OldReg );
+	if ( Session->Dispatch.WorkerWaiting &&
+		 InterlockedExchange( &Session->Dispatch.WorkerWaiting, FALSE ) )
+	{
+		_VERIFY( SetEvent( Session->Dispatch.WorkAvailableEvent ) );
 	}
 
 	return S_OK;
 }
 
-static HRESULT CdiagsQuerySeverityFilter(
+static HRESULT CdiagsStartDispatch(
 	__in PCDIAGP_SESSION Session,
-	__in CDIAG_EVENT_TYPE Type,
-	__out PDWORD Filter
+	__in ULONG SlotCount,
+	__in CDIAG_ASYNC_OVERFLOW_POLICY Policy
 	)
 {
-	PJPHT_HASHTABLE_ENTRY Entry;
-	PHANDLER_REGISTRATION HandlerReg;
-	Entry = JphtGetEntryHashtable( &Session->Members.Handlers, Type );
-	if ( ! Entry )
-	{	
-		*Filter = 0;
-		return S_FALSE;
+	PCDIAGS_DISPATCH_SLOT Slots;
+	ULONG Index;
+
+	Slots = ( PCDIAGS_DISPATCH_SLOT ) CdiagpMalloc( 
+		SlotCount * sizeof( CDIAGS_DISPATCH_SLOT ), 
+		FALSE );
+	if ( Slots == NULL )
+	{
+		return E_OUTOFMEMORY;
 	}
-	else
+
+	for ( Index = 0; Index < SlotCount; Index++ )
 	{
-		HandlerReg = CONTAINING_RECORD(
-			Entry,
-			HANDLER_REGISTRATION,
-			Key.HashtableEntry );
+		Slots[ Index ].Sequence			= ( LONG ) Index;
+		Slots[ Index ].OverflowPacket	= NULL;
+	}
 
-		*Filter = HandlerReg->SeverityFilter;
-		return S_OK;
+	Session->Dispatch.Slots		= Slots;
+	Session->Dispatch.SlotMask	= ( LONG ) SlotCount - 1;
+	Session->Dispatch.Policy	= Policy;
+
+	Session->Dispatch.WorkAvailableEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	Session->Dispatch.SpaceAvailableEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	Session->Dispatch.DrainedEvent = CreateEvent( NULL, TRUE, TRUE, NULL );
+	if ( Session->Dispatch.WorkAvailableEvent == NULL ||
+		 Session->Dispatch.SpaceAvailableEvent == NULL ||
+		 Session->Dispatch.DrainedEvent == NULL )
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	Session->Dispatch.WorkerThread = CreateThread(
+		NULL,
+		0,
+		CdiagsDispatchThreadProc,
+		Session,
+		0,
+		&Session->Dispatch.WorkerThreadId );
+	if ( Session->Dispatch.WorkerThread == NULL )
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
 	}
+
+	return S_OK;
 }
 
-static HRESULT CdiagsSetSeverityFilter(
-	__in PCDIAGP_SESSION Session,
-	__in CDIAG_EVENT_TYPE Type,
-	__in DWORD Filter
+/*++
+	Routine Description:
+		Let the worker handle all queued events, wait for it to
+		terminate and free all resources. May be called on a 
+		partially started or synchronous session.
+--*/
+static VOID CdiagsStopDispatch(
+	__in PCDIAGP_SESSION Session
 	)
 {
-	PJPHT_HASHTABLE_ENTRY Entry;
-	PHANDLER_REGISTRATION HandlerReg;
-	Entry = JphtGetEntryHashtable( &Session->Members.Handlers, Type );
-	if ( ! Entry )
-	{	
-		return S_FALSE;
+	if ( Session->Dispatch.WorkerThread != NULL )
+	{
+		_ASSERTE( GetCurrentThreadId() != Session->Dispatch.WorkerThreadId );
+
+		Session->Dispatch.Stopping = TRUE;
+		_VERIFY( SetEvent( Session->Dispatch.WorkAvailableEvent ) );
+
+		( VOID ) WaitForSingleObject( Session->Dispatch.WorkerThread, INFINITE );
+		_VERIFY( CloseHandle( Session->Dispatch.WorkerThread ) );
+
+		_ASSERTE( ! CdiagsIsQueuedEventAvailable( Session ) );
 	}
-	else
+
+	if ( Session->Dispatch.WorkAvailableEvent != NULL )
 	{
-		HandlerReg = CONTAINING_RECORD(
-			Entry,
-			HANDLER_REGISTRATION,
-			Key.HashtableEntry );
+		_VERIFY( CloseHandle( Session->Dispatch.WorkAvailableEvent ) );
+	}
 
-		HandlerReg->SeverityFilter = Filter;
-		return S_OK;
+	if ( Session->Dispatch.SpaceAvailableEvent != NULL )
+	{
+		_VERIFY( CloseHandle( Session->Dispatch.SpaceAvailableEvent ) );
+	}
+
+	if ( Session->Dispatch.DrainedEvent != NULL )
+	{
+		_VERIFY( CloseHandle( Session->Dispatch.DrainedEvent ) );
+	}
+
+	if ( Session->Dispatch.Slots != NULL )
+	{
+		CdiagpFree( Session->Dispatch.Slots );
 	}
 }
+
 /*----------------------------------------------------------------------
  *
  * Exports.
@@ -412,6 +957,7 @@ HRESULT CDIAGCALLTYPE CdiagCreateSession(
 {
 	HRESULT Hr = E_UNEXPECTED;
 	PCDIAGP_SESSION Session;
+	PHANDLER_TABLE Table;
 
 	if ( ! SessionHandle )
 	{
@@ -426,21 +972,18 @@ HRESULT CDIAGCALLTYPE CdiagCreateSession(
 
 	Session->Signature = CDIAGP_SESSION_SIGNATURE;
 	Session->ReferenceCount = 1;
-	Session->Members.DefaultHandler.SeverityFilter = 0xffffffff;
 	InitializeCriticalSection( &Session->Members.Lock );
 
-	if ( ! JphtInitializeHashtable(
-		&Session->Members.Handlers,
-		CdiagsAllocateHashtableMemory,
-		CdiagsFreeHashtableMemory,
-		CdiagsHashEventType,
-		CdiagsEqualsEventType,
-		23 ) )
+	Hr = CdiagsCopyHandlerTable( NULL, &Table );
+	if ( FAILED( Hr ) )
 	{
-		Hr = E_OUTOFMEMORY;
 		goto Cleanup;
 	}
 
+	CdiagsPrepareHandlerTable( Table );
+	Session->Handlers.Current = Table;
+	CdiagsUpdateEnabledSeverities( Session );
+
 	if ( Resolver )
 	{
 		Resolver->Reference( Resolver );
@@ -496,6 +1039,11 @@ Cleanup:
 			Session->Members.Resolver->Dereference( Session->Members.Resolver );
 		}
 
+		if ( Session->Handlers.Current )
+		{
+			CdiagsDeleteHandlerTable( Session->Handlers.Current );
+		}
+
 		CdiagpFree( Session );
 	}
 
@@ -503,83 +1051,140 @@ Cleanup:
 }
 
 
+HRESULT CDIAGCALLTYPE CdiagCreateAsyncSession(
+	__in_opt PCDIAG_FORMATTER Formatter,
+	__in_opt PCDIAG_MESSAGE_RESOLVER Resolver,
+	__in ULONG SlotCount,
+	__in CDIAG_ASYNC_OVERFLOW_POLICY Policy,
+	__out CDIAG_SESSION_HANDLE *SessionHandle
+	)
+{
+	CDIAG_SESSION_HANDLE NewSession;
+	HRESULT Hr;
+
+	if ( SlotCount == 0 )
+	{
+		SlotCount = CDIAG_SESSION_DEFAULT_SLOT_COUNT;
+	}
+
+	if ( SlotCount > CDIAGS_DISPATCH_MAX_SLOT_COUNT ||
+		 ( SlotCount & ( SlotCount - 1 ) ) != 0 ||
+		 Policy > CdiagAsyncMaxOverflowPolicy ||
+		 ! SessionHandle )
+	{
+		return E_INVALIDARG;
+	}
+
+	Hr = CdiagCreateSession( Formatter, Resolver, &NewSession );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	Hr = CdiagsStartDispatch( 
+		( PCDIAGP_SESSION ) NewSession, 
+		SlotCount, 
+		Policy );
+	if ( FAILED( Hr ) )
+	{
+		_VERIFY( S_OK == CdiagDereferenceSession( NewSession ) );
+		return Hr;
+	}
+
+	*SessionHandle = NewSession;
+	return S_OK;
+}
+
 HRESULT CDIAGCALLTYPE CdiagHandleEvent(
 	__in CDIAG_SESSION_HANDLE SessionHandle,
 	__in PCDIAG_EVENT_PACKET Packet
 	)
 {
 	PCDIAGP_SESSION Session = ( PCDIAGP_SESSION ) SessionHandle;
-	PJPHT_HASHTABLE_ENTRY Entry;
-	PHANDLER_REGISTRATION HandlerReg;
-	PCDIAG_HANDLER Handler;
-	DWORD SeverityFilter;
-	HRESULT Hr;
 
 	if ( ! Packet ||
-		 ! CdiagsIsValidSession( Session ) )
+		 ! CdiagsIsValidSession( Session ) ||
+		 ( DWORD ) Packet->Type > CdiagMaxEvent ||
+		 Packet->Severity > CdiagMaxSeverity )
 	{
 		return E_INVALIDARG;
 	}
 
 	//
-	// Grab handler registration.
+	// Events raised by handlers running on the worker thread are 
+	// dispatched synchronously -- blocking on a full ring would 
+	// deadlock.
 	//
-	EnterCriticalSection( &Session->Members.Lock );
-
-	Entry = JphtGetEntryHashtable( 
-		&Session->Members.Handlers, 
-		Packet->Type );
-	if ( Entry )
+	if ( Session->Dispatch.Slots != NULL &&
+		 GetCurrentThreadId() != Session->Dispatch.WorkerThreadId )
 	{
-		HandlerReg = CONTAINING_RECORD(
-			Entry,
-			HANDLER_REGISTRATION,
-			Key.HashtableEntry );
+		if ( ! CdiagsIsValidEventPacket( Packet ) )
+		{
+			return E_INVALIDARG;
+		}
+
+		return CdiagsQueueEvent( Session, Packet );
 	}
 	else
 	{
-		//
-		// Use default.
-		//
-		HandlerReg = &Session->Members.DefaultHandler;
+		return CdiagsDispatchEvent( Session, Packet );
 	}
+}
 
-	Handler = HandlerReg->Handler;
-	SeverityFilter =  HandlerReg->SeverityFilter;
+BOOL CDIAGCALLTYPE CdiagIsEventEnabled(
+	__in CDIAG_SESSION_HANDLE SessionHandle,
+	__in CDIAG_EVENT_TYPE Type,
+	__in CDIAG_SEVERITY_LEVEL Severity
+	)
+{
+	PCDIAGP_SESSION Session = ( PCDIAGP_SESSION ) SessionHandle;
 
-	//
-	// In order to leave the critsec early, we need to add-ref the
-	// handler.
-	//
-	if ( Handler )
+	if ( ! CdiagsIsValidSession( Session ) ||
+		 ( DWORD ) Type > CdiagMaxEvent ||
+		 ( DWORD ) Severity > CdiagMaxSeverity )
 	{
-		Handler->Reference( Handler );
+		return FALSE;
 	}
 
-	LeaveCriticalSection( &Session->Members.Lock );
+	return ( Session->Handlers.EnabledSeverities[ Type ] & ( 1 << Severity ) ) != 0;
+}
 
-	if ( Handler )
+HRESULT CDIAGCALLTYPE CdiagFlushSession(
+	__in CDIAG_SESSION_HANDLE SessionHandle
+	)
+{
+	PCDIAGP_SESSION Session = ( PCDIAGP_SESSION ) SessionHandle;
+	LONG Target;
+
+	if ( ! CdiagsIsValidSession( Session ) )
 	{
-		//
-		// Filter & Handle.
-		//
-		if ( 0 != ( ( 1 << Packet->Type ) & SeverityFilter ) )
-		{
-			Hr = Handler->Handle( Handler, Packet );
-		}
-		else
-		{
-			Hr = S_FALSE;
-		}
+		return E_INVALIDARG;
+	}
 
-		Handler->Dereference( Handler );
+	if ( Session->Dispatch.Slots == NULL )
+	{
+		return S_OK;
 	}
-	else
+	else if ( GetCurrentThreadId() == Session->Dispatch.WorkerThreadId )
 	{
-		Hr = S_FALSE;
+		return HRESULT_FROM_WIN32( ERROR_POSSIBLE_DEADLOCK );
 	}
 
-	return Hr;
+	Target = Session->Dispatch.EnqueuePos;
+	while ( Target - Session->Dispatch.DequeuePos > 0 )
+	{
+		( VOID ) WaitForSingleObject( 
+			Session->Dispatch.DrainedEvent, 
+			INFINITE );
+
+		//
+		// DrainedEvent may still be signalled from before the pending
+		// events were published -- let the worker catch up.
+		//
+		( VOID ) SwitchToThread();
+	}
+
+	return S_OK;
 }
 
 HRESULT CDIAGCALLTYPE CdiagSetInformationSession(
@@ -609,12 +1214,14 @@ HRESULT CDIAGCALLTYPE CdiagSetInformationSession(
 	{
 	case CdiagSessionDefaultHandler:
 		Handler = ( PCDIAG_HANDLER ) Value;
-		Hr = CdiagsSetDefaultHandler( Session, Handler );
+		Hr = CdiagsSetHandler( Session, CDIAGS_DEFAULT_HANDLER_INDEX, Handler );
 		break;
 
 	case CdiagSessionHandler:
 		Handler = ( PCDIAG_HANDLER ) Value;
-		Hr = CdiagsSetHandler( Session, EventType, Handler );
+		Hr = EventType <= CdiagMaxEvent
+			? CdiagsSetHandler( Session, EventType, Handler )
+			: E_INVALIDARG;
 		break;
 
 	case CdiagSessionSeverityFilter:
@@ -670,11 +1277,23 @@ HRESULT CDIAGCALLTYPE CdiagQueryInformationSession(
 	switch ( Class )
 	{
 	case CdiagSessionDefaultHandler:
-		Hr = CdiagsQueryDefaultHandler( Session, ( PCDIAG_HANDLER* ) Value );
+		( VOID ) CdiagsQueryHandler( 
+			Session, 
+			CDIAGS_DEFAULT_HANDLER_INDEX, 
+			( PCDIAG_HANDLER* ) Value );
+		Hr = S_OK;
 		break;
 
 	case CdiagSessionHandler:
-		Hr = CdiagsQueryHandler( Session, EventType, ( PCDIAG_HANDLER* ) Value );
+		if ( EventType <= CdiagMaxEvent )
+		{
+			Hr = CdiagsQueryHandler( Session, EventType, ( PCDIAG_HANDLER* ) Value );
+		}
+		else
+		{
+			*Value = NULL;
+			Hr = S_FALSE;
+		}
 		break;
 
 	case CdiagSessionSeverityFilter:
@@ -693,6 +1312,11 @@ HRESULT CDIAGCALLTYPE CdiagQueryInformationSession(
 		Hr = S_OK;
 		break;
 
+	case CdiagSessionDroppedEvents:
+		*( ( PDWORD ) Value ) = ( DWORD ) Session->Dispatch.DroppedEvents;
+		Hr = Session->Dispatch.Slots != NULL ? S_OK : S_FALSE;
+		break;
+
 	default:
 		Hr = E_INVALIDARG;
 		break;
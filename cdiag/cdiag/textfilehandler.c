@@ -26,6 +26,37 @@
 #include <stdlib.h>
 #include "cdiagp.h"
 
+#pragma warning( push )
+#pragma warning( disable: 6011; disable: 6387 )
+#include <strsafe.h>
+#include <shlwapi.h>
+#pragma warning( pop )
+
+//
+// Maximum length of a formatted event, including CRLF.
+//
+#define CDIAGS_MAX_EVENT_CCH 2048
+
+//
+// A buffer must be able to hold at least one event, even if
+// each character requires 3 bytes when encoded as UTF-8.
+//
+#define CDIAGS_MIN_BUFFER_SIZE ( 4 * CDIAGS_MAX_EVENT_CCH )
+C_ASSERT( CDIAGS_MIN_BUFFER_SIZE >= CDIAGP_MAX_UTF8_CB( CDIAGS_MAX_EVENT_CCH ) );
+
+//
+// Suffixes appended to the file path to form segment names. The
+// sequence number takes at most 10 digits.
+//
+#define CDIAGS_SEGMENT_FORMAT			L"%s.%06u"
+#define CDIAGS_COMPRESSED_SUFFIX		L".lz4"
+#define CDIAGS_MAX_SEGMENT_SUFFIX_CCH	( 1 + 10 + 4 )
+
+//
+// FILETIME units per second.
+//
+#define CDIAGS_FILETIME_PER_SECOND		10000000ULL
+
 typedef struct _CDIAGP_TEXTFILE_HANDLER
 {
 	CDIAG_HANDLER Base;
@@ -34,29 +65,93 @@ typedef struct _CDIAGP_TEXTFILE_HANDLER
 
 	PCDIAG_FORMATTER Formatter;
 
+	CDIAG_TEXTFILE_ENCODING Encoding;
+
+	//
+	// Routine used in unbuffered mode.
+	//
 	HRESULT ( *AppendRoutine ) (
 		__in HANDLE File,
 		__in PVOID Buffer,
-		__in DWORD BufferSizeInBytes
+		__in DWORD BufferSizeInBytes,
+		__out PULONG BytesWritten
 		);
 
 	struct
 	{
+		//
+		// Serializes writes to the file. In buffered mode, also
+		// serializes flushes.
+		//
 		CRITICAL_SECTION Lock;
 
 		HANDLE Handle;
 	} File;
+
+	//
+	// Only used in buffered mode, i.e. if Batch.Active != NULL.
+	// Flushed under File.Lock.
+	//
+	CDIAGP_BATCH_BUFFER Batch;
+
+	//
+	// Only used if rotation is enabled, i.e. if Enabled is TRUE.
+	//
+	struct
+	{
+		BOOL Enabled;
+		CDIAG_TEXTFILE_ROTATION Policy;
+
+		//
+		// Path of the active file. Completed segments are named
+		// <Path>.<Sequence>, with CDIAGS_COMPRESSED_SUFFIX appended
+		// once compressed.
+		//
+		WCHAR Path[ MAX_PATH ];
+
+		//
+		// Size and time of creation (as FILETIME) of the active
+		// file, sequence number of the next segment. Protected 
+		// by File.Lock.
+		//
+		ULONGLONG FileSize;
+		ULONGLONG FileCreated;
+		ULONG NextSequence;
+
+		//
+		// Background thread compressing and pruning segments up to
+		// and including RetiredSequence. Only created if there is
+		// anything to do, i.e. if segments are to be compressed or
+		// pruned. WorkEvent is auto-reset.
+		//
+		HANDLE Thread;
+		HANDLE WorkEvent;
+		volatile LONG Stopping;
+		volatile LONG RetiredSequence;
+
+		//
+		// Only accessed by Thread.
+		//
+		ULONG ProcessedSequence;
+
+		//
+		// Result of last failed background operation, reported by 
+		// the next call to Handle.
+		//
+		volatile LONG JobResult;
+	} Rotation;
 } CDIAGP_TEXTFILE_HANDLER, *PCDIAGP_TEXTFILE_HANDLER;
 
 /*----------------------------------------------------------------------
  *
- * Methods.
+ * File output.
  *
  */
 static HRESULT CdiagsAppendToFile(
 	__in HANDLE File,
 	__in PVOID Buffer,
-	__in DWORD BufferSizeInBytes
+	__in DWORD BufferSizeInBytes,
+	__out PULONG BytesWritten
 	)
 {
 	DWORD Written;
@@ -67,6 +162,7 @@ static HRESULT CdiagsAppendToFile(
 		&Written,
 		NULL ) )
 	{
+		*BytesWritten = Written;
 		return S_OK;
 	}
 	else
@@ -78,33 +174,462 @@ static HRESULT CdiagsAppendToFile(
 static HRESULT CdiagsConvertToUtf8AndAppendToFile(
 	__in HANDLE File,
 	__in PVOID Utf16Buffer,
-	__in DWORD Utf16BufferSizeInBytes
+	__in DWORD Utf16BufferSizeInBytes,
+	__out PULONG BytesWritten
 	)
 {
-	CHAR Utf8Buffer[ 2048 ];
+	CHAR Utf8Buffer[ CDIAGP_MAX_UTF8_CB( CDIAGS_MAX_EVENT_CCH ) ];
+	SIZE_T Utf8Size;
+	HRESULT Hr;
 
-	UNREFERENCED_PARAMETER( Utf16BufferSizeInBytes );
 	_ASSERT( ( Utf16BufferSizeInBytes % 2 ) == 0 );
 
-	if ( 0 == WideCharToMultiByte(
-		CP_UTF8,
-		0,
-		Utf16Buffer,
-		-1,
+	Hr = CdiagpConvertUtf16ToUtf8(
+		( PCWSTR ) Utf16Buffer,
+		Utf16BufferSizeInBytes / sizeof( WCHAR ),
 		Utf8Buffer,
 		sizeof( Utf8Buffer ),
-		NULL,
-		NULL ) )
+		&Utf8Size );
+	if ( FAILED( Hr ) )
 	{
-		return HRESULT_FROM_WIN32( GetLastError() );
+		return Hr;
 	}
 	else
 	{
 		return CdiagsAppendToFile( 
 			File, 
 			Utf8Buffer, 
-			( DWORD ) strlen( Utf8Buffer ) );
+			( DWORD ) Utf8Size,
+			BytesWritten );
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Rotation.
+ *
+ */
+
+static ULONGLONG CdiagsQuerySystemTime()
+{
+	FILETIME Now;
+	ULARGE_INTEGER Time;
+
+	GetSystemTimeAsFileTime( &Now );
+	Time.LowPart	= Now.dwLowDateTime;
+	Time.HighPart	= Now.dwHighDateTime;
+
+	return Time.QuadPart;
+}
+
+/*++
+	Routine Description:
+		Open a file for appending and position at EOF.
+--*/
+static HRESULT CdiagsOpenTextFile(
+	__in PCWSTR FilePath,
+	__in DWORD ShareMode,
+	__out PHANDLE Handle,
+	__out PULONGLONG FileSize
+	)
+{
+	LARGE_INTEGER Offset; 
+	LARGE_INTEGER End; 
+	HANDLE File;
+	HRESULT Hr;
+
+	File = CreateFile(
+		FilePath,
+		FILE_APPEND_DATA,
+		ShareMode,
+		NULL,
+		OPEN_ALWAYS,
+		0,
+		NULL );
+	if ( File == INVALID_HANDLE_VALUE )
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	//
+	// Position at EOF.
+	//
+	Offset.QuadPart = 0;
+	if ( ! SetFilePointerEx( File, Offset, &End, FILE_END ) )
+	{
+		Hr = HRESULT_FROM_WIN32( GetLastError() );
+		_VERIFY( CloseHandle( File ) );
+		return Hr;
+	}
+
+	*Handle		= File;
+	*FileSize	= ( ULONGLONG ) End.QuadPart;
+
+	return S_OK;
+}
+
+/*++
+	Routine Description:
+		Parse the part of a segment name following the file name,
+		i.e. .<Sequence> or .<Sequence>.lz4.
+--*/
+static BOOL CdiagsParseSegmentSuffix(
+	__in PCWSTR Suffix,
+	__out PULONG Sequence
+	)
+{
+	ULONGLONG Value = 0;
+	UINT Digits = 0;
+
+	if ( *Suffix++ != L'.' )
+	{
+		return FALSE;
+	}
+
+	while ( *Suffix >= L'0' && *Suffix <= L'9' )
+	{
+		Value = Value * 10 + ( *Suffix++ - L'0' );
+		if ( ++Digits > 10 || Value > MAXULONG )
+		{
+			return FALSE;
+		}
+	}
+
+	if ( Value == 0 ||
+		 ( *Suffix != UNICODE_NULL && 
+		   0 != _wcsicmp( Suffix, CDIAGS_COMPRESSED_SUFFIX ) ) )
+	{
+		return FALSE;
+	}
+
+	*Sequence = ( ULONG ) Value;
+	return TRUE;
+}
+
+/*++
+	Routine Description:
+		Find completed segments and delete those having a sequence
+		number lower than DeleteBelow.
+
+	Parameters:
+		DeleteBelow			Lowest sequence number to retain, 0 
+							to only find segments.
+		HighestSequence		Highest sequence number found, 0 if
+							there are no segments.
+--*/
+static HRESULT CdiagsScanSegments(
+	__in PCDIAGP_TEXTFILE_HANDLER FileHandler,
+	__in ULONG DeleteBelow,
+	__out PULONG HighestSequence
+	)
+{
+	WCHAR Pattern[ MAX_PATH ];
+	WCHAR SegmentPath[ MAX_PATH ];
+	WIN32_FIND_DATA FindData;
+	PCWSTR FileName;
+	SIZE_T DirectoryCch;
+	SIZE_T FileNameCch;
+	HANDLE Find;
+	HRESULT Hr;
+
+	*HighestSequence = 0;
+
+	FileName		= PathFindFileName( FileHandler->Rotation.Path );
+	DirectoryCch	= FileName - FileHandler->Rotation.Path;
+	FileNameCch		= wcslen( FileName );
+
+	Hr = StringCchPrintf(
+		Pattern,
+		_countof( Pattern ),
+		L"%s.*",
+		FileHandler->Rotation.Path );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	Find = FindFirstFile( Pattern, &FindData );
+	if ( Find == INVALID_HANDLE_VALUE )
+	{
+		DWORD Error = GetLastError();
+		return Error == ERROR_FILE_NOT_FOUND 
+			? S_OK 
+			: HRESULT_FROM_WIN32( Error );
+	}
+
+	do
+	{
+		ULONG Sequence;
+
+		//
+		// The pattern may also have matched short names.
+		//
+		if ( 0 != _wcsnicmp( FindData.cFileName, FileName, FileNameCch ) ||
+			 ! CdiagsParseSegmentSuffix( 
+				FindData.cFileName + FileNameCch, 
+				&Sequence ) )
+		{
+			continue;
+		}
+
+		if ( Sequence > *HighestSequence )
+		{
+			*HighestSequence = Sequence;
+		}
+
+		if ( Sequence < DeleteBelow )
+		{
+			HRESULT DeleteHr = StringCchPrintf(
+				SegmentPath,
+				_countof( SegmentPath ),
+				L"%.*s%s",
+				( int ) DirectoryCch,
+				FileHandler->Rotation.Path,
+				FindData.cFileName );
+			if ( SUCCEEDED( DeleteHr ) && ! DeleteFile( SegmentPath ) )
+			{
+				DeleteHr = HRESULT_FROM_WIN32( GetLastError() );
+			}
+
+			if ( FAILED( DeleteHr ) )
+			{
+				Hr = DeleteHr;
+			}
+		}
+	}
+	while ( FindNextFile( Find, &FindData ) );
+
+	_VERIFY( FindClose( Find ) );
+
+	return Hr;
+}
+
+/*++
+	Routine Description:
+		Compress a completed segment and delete segments exceeding
+		the number of segments to retain. Called on the background
+		thread.
+--*/
+static HRESULT CdiagsProcessSegment(
+	__in PCDIAGP_TEXTFILE_HANDLER FileHandler,
+	__in ULONG Sequence
+	)
+{
+	PCDIAG_TEXTFILE_ROTATION Policy = &FileHandler->Rotation.Policy;
+	HRESULT Hr = S_OK;
+
+	if ( Policy->Flags & CDIAG_TEXTFILE_ROTATION_COMPRESS )
+	{
+		WCHAR SegmentPath[ MAX_PATH ];
+		WCHAR CompressedPath[ MAX_PATH ];
+
+		//
+		// Path lengths have been checked on creation.
+		//
+		_VERIFY( SUCCEEDED( StringCchPrintf(
+			SegmentPath,
+			_countof( SegmentPath ),
+			CDIAGS_SEGMENT_FORMAT,
+			FileHandler->Rotation.Path,
+			Sequence ) ) );
+		_VERIFY( SUCCEEDED( StringCchPrintf(
+			CompressedPath,
+			_countof( CompressedPath ),
+			CDIAGS_SEGMENT_FORMAT CDIAGS_COMPRESSED_SUFFIX,
+			FileHandler->Rotation.Path,
+			Sequence ) ) );
+
+		Hr = CdiagpCompressFile( SegmentPath, CompressedPath );
+		if ( SUCCEEDED( Hr ) && ! DeleteFile( SegmentPath ) )
+		{
+			Hr = HRESULT_FROM_WIN32( GetLastError() );
+		}
+	}
+
+	if ( Policy->MaxSegments > 0 && Sequence >= Policy->MaxSegments )
+	{
+		ULONG HighestSequence;
+		HRESULT PruneHr = CdiagsScanSegments(
+			FileHandler,
+			Sequence - Policy->MaxSegments + 1,
+			&HighestSequence );
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = PruneHr;
+		}
+	}
+
+	return Hr;
+}
+
+static DWORD CALLBACK CdiagsRotationThreadProc(
+	__in PVOID Context
+	)
+{
+	PCDIAGP_TEXTFILE_HANDLER FileHandler = ( PCDIAGP_TEXTFILE_HANDLER ) Context;
+	BOOL Stopping;
+
+	do
+	{
+		_VERIFY( WAIT_OBJECT_0 == WaitForSingleObject( 
+			FileHandler->Rotation.WorkEvent, 
+			INFINITE ) );
+
+		//
+		// Check for stop request first s.t. segments retired before
+		// stopping are still processed.
+		//
+		Stopping = FileHandler->Rotation.Stopping;
+
+		while ( FileHandler->Rotation.ProcessedSequence != 
+				( ULONG ) FileHandler->Rotation.RetiredSequence )
+		{
+			HRESULT Hr = CdiagsProcessSegment( 
+				FileHandler, 
+				++FileHandler->Rotation.ProcessedSequence );
+			if ( FAILED( Hr ) )
+			{
+				InterlockedExchange( &FileHandler->Rotation.JobResult, Hr );
+			}
+		}
+	}
+	while ( ! Stopping );
+
+	return 0;
+}
+
+/*++
+	Routine Description:
+		Account for data written to the active file and, if it is
+		due, rename the file to a segment and continue in a new 
+		file. Writes are held off for renaming and swapping the
+		handle only - compressing and pruning is left to the 
+		background thread.
+
+		File.Lock must be held.
+--*/
+static HRESULT CdiagsRotateTextFileIfDue(
+	__in PCDIAGP_TEXTFILE_HANDLER FileHandler,
+	__in ULONG BytesWritten
+	)
+{
+	PCDIAG_TEXTFILE_ROTATION Policy = &FileHandler->Rotation.Policy;
+	WCHAR SegmentPath[ MAX_PATH ];
+	ULONGLONG FileSize;
+	ULONG Sequence;
+	BOOL Due;
+	HANDLE File;
+	HRESULT Hr;
+
+	if ( ! FileHandler->Rotation.Enabled )
+	{
+		return S_OK;
+	}
+
+	FileHandler->Rotation.FileSize += BytesWritten;
+
+	Due = Policy->MaxFileSize > 0 && 
+		  FileHandler->Rotation.FileSize >= Policy->MaxFileSize;
+	if ( ! Due && Policy->MaxAge > 0 )
+	{
+		Due = CdiagsQuerySystemTime() - FileHandler->Rotation.FileCreated >=
+			Policy->MaxAge * CDIAGS_FILETIME_PER_SECOND;
+	}
+
+	if ( ! Due )
+	{
+		return S_OK;
+	}
+
+	//
+	// Whether rotating succeeds or not, start over s.t. a failure
+	// is not retried on each write.
+	//
+	FileHandler->Rotation.FileSize		= 0;
+	FileHandler->Rotation.FileCreated	= CdiagsQuerySystemTime();
+
+	Sequence = FileHandler->Rotation.NextSequence;
+	Hr = StringCchPrintf(
+		SegmentPath,
+		_countof( SegmentPath ),
+		CDIAGS_SEGMENT_FORMAT,
+		FileHandler->Rotation.Path,
+		Sequence );
+	if ( FAILED( Hr ) )
+	{
+		return Hr;
+	}
+
+	//
+	// The file has been opened with FILE_SHARE_DELETE, so it can
+	// be renamed while open.
+	//
+	if ( ! MoveFile( FileHandler->Rotation.Path, SegmentPath ) )
+	{
+		return HRESULT_FROM_WIN32( GetLastError() );
+	}
+
+	Hr = CdiagsOpenTextFile(
+		FileHandler->Rotation.Path,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		&File,
+		&FileSize );
+	if ( FAILED( Hr ) )
+	{
+		//
+		// Continue writing to the old file, under its old name.
+		//
+		( VOID ) MoveFile( SegmentPath, FileHandler->Rotation.Path );
+		return Hr;
+	}
+
+	_VERIFY( CloseHandle( FileHandler->File.Handle ) );
+	FileHandler->File.Handle			= File;
+	FileHandler->Rotation.FileSize		= FileSize;
+	FileHandler->Rotation.NextSequence	= Sequence + 1;
+
+	if ( FileHandler->Rotation.Thread )
+	{
+		InterlockedExchange( 
+			&FileHandler->Rotation.RetiredSequence, 
+			( LONG ) Sequence );
+		_VERIFY( SetEvent( FileHandler->Rotation.WorkEvent ) );
 	}
+
+	return S_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Methods.
+ *
+ */
+
+/*++
+	Routine Description:
+		Write a batch to the file. File.Lock is held.
+--*/
+static HRESULT CdiagsFlushTextFileBatch(
+	__in PVOID Context,
+	__in PUCHAR Data,
+	__in ULONG DataSize
+	)
+{
+	PCDIAGP_TEXTFILE_HANDLER FileHandler = ( PCDIAGP_TEXTFILE_HANDLER ) Context;
+	ULONG Written;
+	HRESULT Hr;
+
+	Hr = CdiagsAppendToFile( 
+		FileHandler->File.Handle, 
+		Data, 
+		DataSize,
+		&Written );
+	if ( SUCCEEDED( Hr ) )
+	{
+		Hr = CdiagsRotateTextFileIfDue( FileHandler, Written );
+	}
+
+	return Hr;
 }
 
 static HRESULT CdiagsTextFileHandle(
@@ -113,10 +638,11 @@ static HRESULT CdiagsTextFileHandle(
 	)
 {
 	PCDIAGP_TEXTFILE_HANDLER FileHandler = ( PCDIAGP_TEXTFILE_HANDLER ) This;
-	WCHAR Buffer[ 2048 ];
+	WCHAR Buffer[ CDIAGS_MAX_EVENT_CCH ];
 	HRESULT Hr;
 	//UINT Index;
 	UINT BufferCch;
+	ULONG Written;
 
 	if ( ! FileHandler ||
 		! CdiagpIsValidHandler( FileHandler ) )
@@ -179,20 +705,42 @@ static HRESULT CdiagsTextFileHandle(
 	//Buffer[ BufferCch++ ] = L'\n';
 	//Buffer[ BufferCch++ ] = L'\0';
 
-	//
-	// Protect agains concurrent appends.
-	//
-	EnterCriticalSection( &FileHandler->File.Lock );
+	if ( FileHandler->Batch.Active )
+	{
+		Hr = CdiagpAppendBatchBuffer( 
+			&FileHandler->Batch, 
+			Packet->Severity, 
+			Buffer, 
+			BufferCch );
+	}
+	else
+	{
+		//
+		// Protect agains concurrent appends.
+		//
+		EnterCriticalSection( &FileHandler->File.Lock );
 
-	//
-	// Output.
-	//
-	Hr = ( FileHandler->AppendRoutine )( 
-		FileHandler->File.Handle, 
-		Buffer, 
-		2 * BufferCch );
+		//
+		// Output.
+		//
+		Hr = ( FileHandler->AppendRoutine )( 
+			FileHandler->File.Handle, 
+			Buffer, 
+			2 * BufferCch,
+			&Written );
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = CdiagsRotateTextFileIfDue( FileHandler, Written );
+		}
 
-	LeaveCriticalSection( &FileHandler->File.Lock );
+		LeaveCriticalSection( &FileHandler->File.Lock );
+	}
+
+	if ( SUCCEEDED( Hr ) && FileHandler->Rotation.Enabled )
+	{
+		Hr = ( HRESULT ) InterlockedExchange(
+			&FileHandler->Rotation.JobResult, S_OK );
+	}
 
 	return Hr;
 }
@@ -202,6 +750,36 @@ static VOID CdiagsTextFileDeleteHandler(
 	__in PCDIAGP_TEXTFILE_HANDLER FileHandler 
 	)
 {
+	//
+	// Flushing may retire a segment, so do so before stopping
+	// the background thread.
+	//
+	CdiagpDeleteBatchBuffer( &FileHandler->Batch );
+
+	if ( FileHandler->Rotation.Thread )
+	{
+		//
+		// Wait for the background thread to process the segments
+		// retired so far, including by the final flush.
+		//
+		InterlockedExchange( &FileHandler->Rotation.Stopping, TRUE );
+		_VERIFY( SetEvent( FileHandler->Rotation.WorkEvent ) );
+		_VERIFY( WAIT_OBJECT_0 == WaitForSingleObject( 
+			FileHandler->Rotation.Thread, 
+			INFINITE ) );
+		_VERIFY( CloseHandle( FileHandler->Rotation.Thread ) );
+	}
+
+	if ( FileHandler->Rotation.WorkEvent )
+	{
+		_VERIFY( CloseHandle( FileHandler->Rotation.WorkEvent ) );
+	}
+
+	if ( FileHandler->File.Handle )
+	{
+		_VERIFY( CloseHandle( FileHandler->File.Handle ) );
+	}
+
 	if ( FileHandler->Formatter )
 	{
 		FileHandler->Formatter->Dereference( FileHandler->Formatter );
@@ -255,27 +833,33 @@ static VOID CdiagsTextFileDereferenceHandler(
 	}
 }
 
-/*----------------------------------------------------------------------
- *
- * Public.
- *
- */
-
-CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
+/*++
+	Routine Description:
+		Create handler. If BufferSize is 0, the handler is unbuffered.
+		If Rotation is NULL, the file is never rotated.
+--*/
+static HRESULT CdiagsCreateTextFileHandler(
 	__in CDIAG_SESSION_HANDLE Session,
 	__in PCWSTR FilePath,
 	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__in ULONG BufferSize,
+	__in ULONG FlushInterval,
+	__in_opt PCDIAG_TEXTFILE_ROTATION Rotation,
 	__out PCDIAG_HANDLER *Handler
 	)
 {
 	PCDIAGP_TEXTFILE_HANDLER FileHandler = NULL;
 	HRESULT Hr = E_UNEXPECTED;
-	LARGE_INTEGER Offset; 
+	WCHAR FullPath[ MAX_PATH ];
+	ULONGLONG FileSize;
 	HANDLE File;
 
 	if ( ! Session || 
 		 ! FilePath || 
 		 ( Encoding != CdiagEncodingUtf16 && Encoding != CdiagEncodingUtf8 ) ||
+		 ( Rotation && 
+		   ( ( Rotation->MaxFileSize == 0 && Rotation->MaxAge == 0 ) ||
+		     ( Rotation->Flags & ~CDIAG_TEXTFILE_ROTATION_COMPRESS ) ) ) ||
 		 ! Handler )
 	{
 		return E_INVALIDARG;
@@ -283,26 +867,37 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
 
 	*Handler = NULL;
 
-	File = CreateFile(
-		FilePath,
-		FILE_APPEND_DATA,
-		FILE_SHARE_READ,
-		NULL,
-		OPEN_ALWAYS,
-		0,
-		NULL );
-	if ( File == INVALID_HANDLE_VALUE )
+	if ( Rotation )
 	{
-		return HRESULT_FROM_WIN32( GetLastError() );
+		//
+		// The file is renamed later, so resolve relative paths now.
+		// Segment names must fit into MAX_PATH as well.
+		//
+		DWORD PathCch = GetFullPathName( 
+			FilePath, 
+			_countof( FullPath ), 
+			FullPath, 
+			NULL );
+		if ( PathCch == 0 )
+		{
+			return HRESULT_FROM_WIN32( GetLastError() );
+		}
+		else if ( PathCch + CDIAGS_MAX_SEGMENT_SUFFIX_CCH >= _countof( FullPath ) )
+		{
+			return HRESULT_FROM_WIN32( ERROR_FILENAME_EXCED_RANGE );
+		}
+
+		FilePath = FullPath;
 	}
 
-	//
-	// Position at EOF.
-	//
-	Offset.QuadPart = 0;
-	if ( ! SetFilePointerEx( File, Offset, NULL, FILE_END ) )
+	Hr = CdiagsOpenTextFile(
+		FilePath,
+		Rotation ? FILE_SHARE_READ | FILE_SHARE_DELETE : FILE_SHARE_READ,
+		&File,
+		&FileSize );
+	if ( FAILED( Hr ) )
 	{
-		return HRESULT_FROM_WIN32( GetLastError() );
+		return Hr;
 	}
 
 	//
@@ -311,6 +906,7 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
 	FileHandler = CdiagpMalloc( sizeof( CDIAGP_TEXTFILE_HANDLER ), TRUE );
 	if ( ! FileHandler )
 	{
+		_VERIFY( CloseHandle( File ) );
 		return E_OUTOFMEMORY;
 	}
 
@@ -326,6 +922,7 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
 	FileHandler->Base.SetNextHandler		= CdiagsTextFileSetNextHandler;
 	FileHandler->Base.Handle				= CdiagsTextFileHandle;
 
+	FileHandler->Encoding					= Encoding;
 	FileHandler->File.Handle				= File;
 	InitializeCriticalSection( &FileHandler->File.Lock );
 
@@ -351,6 +948,86 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
 		goto Cleanup;
 	}
 
+	if ( BufferSize > 0 )
+	{
+		if ( BufferSize < CDIAGS_MIN_BUFFER_SIZE )
+		{
+			BufferSize = CDIAGS_MIN_BUFFER_SIZE;
+		}
+
+		Hr = CdiagpInitializeBatchBuffer(
+			&FileHandler->Batch,
+			BufferSize,
+			FlushInterval,
+			Encoding == CdiagEncodingUtf8,
+			&FileHandler->File.Lock,
+			CdiagsFlushTextFileBatch,
+			FileHandler );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+	}
+
+	if ( Rotation )
+	{
+		ULONG HighestSequence;
+
+		FileHandler->Rotation.Enabled		= TRUE;
+		FileHandler->Rotation.Policy		= *Rotation;
+		FileHandler->Rotation.FileSize		= FileSize;
+		FileHandler->Rotation.FileCreated	= CdiagsQuerySystemTime();
+
+		Hr = StringCchCopy( 
+			FileHandler->Rotation.Path, 
+			_countof( FileHandler->Rotation.Path ),
+			FullPath );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+
+		//
+		// Continue numbering where previous handlers left off.
+		//
+		Hr = CdiagsScanSegments( FileHandler, 0, &HighestSequence );
+		if ( FAILED( Hr ) )
+		{
+			goto Cleanup;
+		}
+
+		FileHandler->Rotation.NextSequence		= HighestSequence + 1;
+		FileHandler->Rotation.RetiredSequence	= ( LONG ) HighestSequence;
+		FileHandler->Rotation.ProcessedSequence	= HighestSequence;
+
+		if ( ( Rotation->Flags & CDIAG_TEXTFILE_ROTATION_COMPRESS ) ||
+			 Rotation->MaxSegments > 0 )
+		{
+			//
+			// Note: event is auto-reset.
+			//
+			FileHandler->Rotation.WorkEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+			if ( ! FileHandler->Rotation.WorkEvent )
+			{
+				Hr = HRESULT_FROM_WIN32( GetLastError() );
+				goto Cleanup;
+			}
+
+			FileHandler->Rotation.Thread = CreateThread(
+				NULL,
+				0,
+				CdiagsRotationThreadProc,
+				FileHandler,
+				0,
+				NULL );
+			if ( ! FileHandler->Rotation.Thread )
+			{
+				Hr = HRESULT_FROM_WIN32( GetLastError() );
+				goto Cleanup;
+			}
+		}
+	}
+
 	*Handler = &FileHandler->Base;
 	Hr = S_OK;
 
@@ -365,3 +1042,70 @@ Cleanup:
 
 	return Hr;
 }
+
+/*----------------------------------------------------------------------
+ *
+ * Public.
+ *
+ */
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in PCWSTR FilePath,
+	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	return CdiagsCreateTextFileHandler(
+		Session,
+		FilePath,
+		Encoding,
+		0,
+		0,
+		NULL,
+		Handler );
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBufferedTextFileHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in PCWSTR FilePath,
+	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__in ULONG BufferSize,
+	__in ULONG FlushInterval,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	return CdiagsCreateTextFileHandler(
+		Session,
+		FilePath,
+		Encoding,
+		BufferSize > 0 ? BufferSize : CDIAG_TEXTFILE_DEFAULT_BUFFER_SIZE,
+		FlushInterval,
+		NULL,
+		Handler );
+}
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateRotatingTextFileHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in PCWSTR FilePath,
+	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__in ULONG BufferSize,
+	__in ULONG FlushInterval,
+	__in PCDIAG_TEXTFILE_ROTATION Rotation,
+	__out PCDIAG_HANDLER *Handler
+	)
+{
+	if ( ! Rotation )
+	{
+		return E_INVALIDARG;
+	}
+
+	return CdiagsCreateTextFileHandler(
+		Session,
+		FilePath,
+		Encoding,
+		BufferSize,
+		FlushInterval,
+		Rotation,
+		Handler );
+}
@@ -0,0 +1,199 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		UTF-16 to UTF-8 transcoding
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdiagp.h"
+
+#if defined( _M_IX86 ) || defined( _M_AMD64 )
+#define CDIAGS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define CDIAGS_IS_HIGH_SURROGATE( Ch ) ( ( Ch ) >= 0xD800 && ( Ch ) <= 0xDBFF )
+#define CDIAGS_IS_LOW_SURROGATE( Ch ) ( ( Ch ) >= 0xDC00 && ( Ch ) <= 0xDFFF )
+
+//
+// Used for unpaired surrogates, like WideCharToMultiByte does.
+//
+#define CDIAGS_REPLACEMENT_CHARACTER 0xFFFD
+
+#ifdef CDIAGS_USE_SSE2
+
+/*++
+	Routine Description:
+		Copy ASCII characters in blocks of 16 until a block 
+		containing a non-ASCII character is encountered.
+
+	Returns:
+		Number of characters copied.
+--*/
+static SIZE_T CdiagsCopyAsciiSse2(
+	__in_ecount( Cch ) PCWSTR Source,
+	__in SIZE_T Cch,
+	__out_bcount( Cch ) PSTR Target
+	)
+{
+	const __m128i NonAscii = _mm_set1_epi16( ( SHORT ) 0xFF80 );
+	const __m128i Zero = _mm_setzero_si128();
+	SIZE_T Index = 0;
+
+	while ( Index + 16 <= Cch )
+	{
+		__m128i Low = _mm_loadu_si128( ( const __m128i* ) ( Source + Index ) );
+		__m128i High = _mm_loadu_si128( ( const __m128i* ) ( Source + Index + 8 ) );
+		__m128i Bits = _mm_and_si128( _mm_or_si128( Low, High ), NonAscii );
+
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi16( Bits, Zero ) ) != 0xFFFF )
+		{
+			break;
+		}
+
+		//
+		// All characters are < 0x80, so saturation never kicks in.
+		//
+		_mm_storeu_si128( 
+			( __m128i* ) ( Target + Index ), 
+			_mm_packus_epi16( Low, High ) );
+		Index += 16;
+	}
+
+	return Index;
+}
+
+#endif
+
+#ifdef _DEBUG
+__declspec(dllexport)
+#endif 
+HRESULT CDIAGCALLTYPE CdiagpConvertUtf16ToUtf8(
+	__in_ecount( SourceCch ) PCWSTR Source,
+	__in SIZE_T SourceCch,
+	__out_bcount_part( TargetSize, *Written ) PSTR Target,
+	__in SIZE_T TargetSize,
+	__out PSIZE_T Written
+	)
+{
+	SIZE_T SourceIndex = 0;
+	SIZE_T TargetIndex = 0;
+#ifdef CDIAGS_USE_SSE2
+#ifdef _M_AMD64
+	const BOOL UseSse2 = TRUE;
+#else
+	const BOOL UseSse2 = IsProcessorFeaturePresent( 
+		PF_XMMI64_INSTRUCTIONS_AVAILABLE );
+#endif
+#endif
+
+	_ASSERTE( Source || SourceCch == 0 );
+	_ASSERTE( Target || TargetSize == 0 );
+	_ASSERTE( Written );
+
+	*Written = 0;
+
+	while ( SourceIndex < SourceCch )
+	{
+		ULONG Ch = Source[ SourceIndex ];
+
+		if ( Ch < 0x80 )
+		{
+#ifdef CDIAGS_USE_SSE2
+			if ( UseSse2 )
+			{
+				SIZE_T Copied = CdiagsCopyAsciiSse2(
+					Source + SourceIndex,
+					min( SourceCch - SourceIndex, TargetSize - TargetIndex ),
+					Target + TargetIndex );
+
+				SourceIndex += Copied;
+				TargetIndex += Copied;
+			}
+#endif
+			//
+			// Scalar ASCII loop, handles the remainder as well as 
+			// platforms without SSE2.
+			//
+			while ( SourceIndex < SourceCch && 
+					( Ch = Source[ SourceIndex ] ) < 0x80 )
+			{
+				if ( TargetIndex == TargetSize )
+				{
+					return CDIAG_E_BUFFER_TOO_SMALL;
+				}
+
+				Target[ TargetIndex++ ] = ( CHAR ) Ch;
+				SourceIndex++;
+			}
+
+			continue;
+		}
+		else if ( Ch < 0x800 )
+		{
+			if ( TargetSize - TargetIndex < 2 )
+			{
+				return CDIAG_E_BUFFER_TOO_SMALL;
+			}
+
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0xC0 | ( Ch >> 6 ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( Ch & 0x3F ) );
+			SourceIndex++;
+		}
+		else if ( CDIAGS_IS_HIGH_SURROGATE( Ch ) &&
+				  SourceIndex + 1 < SourceCch &&
+				  CDIAGS_IS_LOW_SURROGATE( Source[ SourceIndex + 1 ] ) )
+		{
+			if ( TargetSize - TargetIndex < 4 )
+			{
+				return CDIAG_E_BUFFER_TOO_SMALL;
+			}
+
+			Ch = 0x10000 + 
+				( ( Ch - 0xD800 ) << 10 ) + 
+				( Source[ SourceIndex + 1 ] - 0xDC00 );
+
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0xF0 | ( Ch >> 18 ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( ( Ch >> 12 ) & 0x3F ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( ( Ch >> 6 ) & 0x3F ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( Ch & 0x3F ) );
+			SourceIndex += 2;
+		}
+		else
+		{
+			if ( TargetSize - TargetIndex < 3 )
+			{
+				return CDIAG_E_BUFFER_TOO_SMALL;
+			}
+
+			if ( CDIAGS_IS_HIGH_SURROGATE( Ch ) || CDIAGS_IS_LOW_SURROGATE( Ch ) )
+			{
+				Ch = CDIAGS_REPLACEMENT_CHARACTER;
+			}
+
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0xE0 | ( Ch >> 12 ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( ( Ch >> 6 ) & 0x3F ) );
+			Target[ TargetIndex++ ] = ( CHAR ) ( 0x80 | ( Ch & 0x3F ) );
+			SourceIndex++;
+		}
+	}
+
+	*Written = TargetIndex;
+	return S_OK;
+}
@@ -0,0 +1,261 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Decoder for files written by the binary file handler.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cdiag.h>
+
+#define CDIAGDUMP_EXIT_SUCCESS			0
+#define CDIAGDUMP_EXIT_USAGE_FAILURE	1
+#define CDIAGDUMP_EXIT_FAILURE			2
+
+#define CDIAGDUMP_DEFAULT_FORMAT \
+	L"%Timestamp %ProcessId:%ThreadId %Severity %Type %Function: %Message"
+
+//
+// Formatted events exceeding the stack buffer are formatted into a 
+// heap buffer, which is grown up to this size.
+//
+#define CDIAGDUMP_MAX_EVENT_CCH		( 1024 * 1024 )
+
+typedef struct _CDIAGDUMP_CONTEXT
+{
+	PCDIAG_FORMATTER Formatter;
+	ULONG EventCount;
+	HRESULT Result;
+
+	//
+	// Heap buffer for long events, NULL until first required.
+	//
+	PWSTR LongBuffer;
+	SIZE_T LongBufferCch;
+} CDIAGDUMP_CONTEXT, *PCDIAGDUMP_CONTEXT;
+
+static VOID CdiagdumpsPrintUsage(
+	__in PCWSTR BinName
+	)
+{
+	wprintf( 
+		L"Usage:\n"
+		L"  %s [-f <format>] [-r] <file>\n"
+		L"\n"
+		L"  Print the events contained in a file written by the binary\n"
+		L"  file handler, oldest first.\n"
+		L"\n"
+		L"  Options:\n"
+		L"    -f <format>      Format template, see CdiagCreateFormatter.\n"
+		L"                     (Default: %s)\n"
+		L"    -r               Resolve message codes of events not\n"
+		L"                     containing a message.\n"
+		L"\n"
+		L"  Exit codes:\n"
+		L"    %d  Success\n"
+		L"    %d  Usage failure\n"
+		L"    %d  Other failures\n"
+		L"\n",
+		BinName,
+		CDIAGDUMP_DEFAULT_FORMAT,
+		CDIAGDUMP_EXIT_SUCCESS,
+		CDIAGDUMP_EXIT_USAGE_FAILURE,
+		CDIAGDUMP_EXIT_FAILURE );
+}
+
+static BOOL CDIAGCALLTYPE CdiagdumpsPrintEvent(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_opt PVOID Context
+	)
+{
+	PCDIAGDUMP_CONTEXT DumpContext = ( PCDIAGDUMP_CONTEXT ) Context;
+	WCHAR StackBuffer[ 2048 ];
+	PWSTR Buffer = StackBuffer;
+	SIZE_T BufferCch = _countof( StackBuffer );
+	HRESULT Hr;
+
+	for ( ;; )
+	{
+		SIZE_T NewCch;
+		PWSTR NewBuffer;
+
+		Hr = DumpContext->Formatter->Format(
+			DumpContext->Formatter,
+			Packet,
+			BufferCch,
+			Buffer );
+		if ( Hr != CDIAG_E_BUFFER_TOO_SMALL ||
+			 BufferCch >= CDIAGDUMP_MAX_EVENT_CCH )
+		{
+			break;
+		}
+
+		if ( Buffer == StackBuffer && 
+			 DumpContext->LongBufferCch > BufferCch )
+		{
+			//
+			// Retry with the buffer grown for earlier events.
+			//
+			Buffer		= DumpContext->LongBuffer;
+			BufferCch	= DumpContext->LongBufferCch;
+			continue;
+		}
+
+		//
+		// Packet strings are UTF-16, so TotalSize characters plus
+		// the template should usually suffice.
+		//
+		NewCch = max( 
+			2 * BufferCch, 
+			Packet->TotalSize + _countof( StackBuffer ) );
+		NewCch = min( NewCch, CDIAGDUMP_MAX_EVENT_CCH );
+
+		NewBuffer = ( PWSTR ) realloc( 
+			DumpContext->LongBuffer, 
+			NewCch * sizeof( WCHAR ) );
+		if ( NewBuffer == NULL )
+		{
+			Hr = E_OUTOFMEMORY;
+			break;
+		}
+
+		DumpContext->LongBuffer		= NewBuffer;
+		DumpContext->LongBufferCch	= NewCch;
+		Buffer						= NewBuffer;
+		BufferCch					= NewCch;
+	}
+
+	if ( Hr == CDIAG_E_BUFFER_TOO_SMALL )
+	{
+		//
+		// Skip, but keep dumping the remaining events.
+		//
+		fwprintf( 
+			stderr, 
+			L"Event %u exceeds %u characters, skipped\n", 
+			DumpContext->EventCount,
+			CDIAGDUMP_MAX_EVENT_CCH );
+		DumpContext->EventCount++;
+		return TRUE;
+	}
+	else if ( FAILED( Hr ) )
+	{
+		DumpContext->Result = Hr;
+		return FALSE;
+	}
+
+	wprintf( L"%s\n", Buffer );
+	DumpContext->EventCount++;
+
+	return TRUE;
+}
+
+int __cdecl wmain(
+	__in UINT Argc,
+	__in PCWSTR *Argv
+	)
+{
+	PCDIAG_MESSAGE_RESOLVER Resolver = NULL;
+	PCWSTR Format = CDIAGDUMP_DEFAULT_FORMAT;
+	PCWSTR FilePath = NULL;
+	CDIAGDUMP_CONTEXT Context;
+	BOOL Resolve = FALSE;
+	HRESULT Hr;
+	UINT Index;
+
+	if ( Argc == 0 )
+	{
+		return CDIAGDUMP_EXIT_USAGE_FAILURE;
+	}
+
+	for ( Index = 1; Index < Argc; Index++ )
+	{
+		if ( 0 == wcscmp( Argv[ Index ], L"-f" ) && Index + 1 < Argc )
+		{
+			Format = Argv[ ++Index ];
+		}
+		else if ( 0 == wcscmp( Argv[ Index ], L"-r" ) )
+		{
+			Resolve = TRUE;
+		}
+		else if ( Argv[ Index ][ 0 ] != L'-' && FilePath == NULL )
+		{
+			FilePath = Argv[ Index ];
+		}
+		else
+		{
+			FilePath = NULL;
+			break;
+		}
+	}
+
+	if ( FilePath == NULL )
+	{
+		CdiagdumpsPrintUsage( Argv[ 0 ] );
+		return CDIAGDUMP_EXIT_USAGE_FAILURE;
+	}
+
+	if ( Resolve )
+	{
+		Hr = CdiagCreateMessageResolver( &Resolver );
+		if ( FAILED( Hr ) )
+		{
+			fwprintf( stderr, L"Creating message resolver failed: 0x%08X\n", Hr );
+			return CDIAGDUMP_EXIT_FAILURE;
+		}
+	}
+
+	Context.EventCount		= 0;
+	Context.Result			= S_OK;
+	Context.LongBuffer		= NULL;
+	Context.LongBufferCch	= 0;
+
+	Hr = CdiagCreateFormatter( Format, Resolver, 0, &Context.Formatter );
+	if ( FAILED( Hr ) )
+	{
+		fwprintf( stderr, L"Invalid format: 0x%08X\n", Hr );
+		if ( Resolver )
+		{
+			Resolver->Dereference( Resolver );
+		}
+		return CDIAGDUMP_EXIT_FAILURE;
+	}
+
+	Hr = CdiagReadBinaryFile( FilePath, CdiagdumpsPrintEvent, &Context );
+	if ( SUCCEEDED( Hr ) )
+	{
+		Hr = Context.Result;
+	}
+
+	Context.Formatter->Dereference( Context.Formatter );
+	free( Context.LongBuffer );
+	if ( Resolver )
+	{
+		Resolver->Dereference( Resolver );
+	}
+
+	if ( FAILED( Hr ) )
+	{
+		fwprintf( stderr, L"Reading %s failed: 0x%08X\n", FilePath, Hr );
+		return CDIAGDUMP_EXIT_FAILURE;
+	}
+
+	return CDIAGDUMP_EXIT_SUCCESS;
+}
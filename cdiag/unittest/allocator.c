@@ -0,0 +1,227 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Test case for the pooling allocator
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#define RESOLVERS_PER_THREAD 100
+
+//
+// Exported for testing only.
+//
+extern PVOID CdiagpMalloc( 
+	__in SIZE_T Size,
+	__in BOOL Zero
+	);
+
+extern VOID CdiagpFree( 
+	__in PVOID Ptr
+	);
+
+static void SumStatistics(
+	__in PCDIAG_ALLOCATION_STATISTICS Stats,
+	__out PULONGLONG Allocations,
+	__out PULONGLONG Frees
+	)
+{
+	ULONG Class;
+
+	*Allocations = 0;
+	*Frees = 0;
+
+	for ( Class = 0; Class < CDIAG_ALLOCATION_CLASSES; Class++ )
+	{
+		*Allocations += Stats->Classes[ Class ].Allocations;
+		*Frees += Stats->Classes[ Class ].Frees;
+
+		TEST( Stats->Classes[ Class ].Allocations >= 
+			  Stats->Classes[ Class ].Frees );
+		TEST( Stats->Classes[ Class ].BytesAllocated >= 
+			  Stats->Classes[ Class ].BytesFreed );
+	}
+}
+
+static DWORD CALLBACK CreateResolversThreadProc( PVOID Unused )
+{
+	PCDIAG_MESSAGE_RESOLVER Resolver;
+	UINT i;
+
+	UNREFERENCED_PARAMETER( Unused );
+
+	for ( i = 0; i < RESOLVERS_PER_THREAD; i++ )
+	{
+		TEST_HR( CdiagCreateMessageResolver( &Resolver ) );
+		Resolver->Dereference( Resolver );
+	}
+
+	return 0;
+}
+
+static void TestQueryStatistics()
+{
+	CDIAG_ALLOCATION_STATISTICS Stats;
+	ULONG Class;
+
+	TEST( E_INVALIDARG == CdiagQueryAllocationStatistics( NULL ) );
+	TEST_HR( CdiagQueryAllocationStatistics( &Stats ) );
+
+	for ( Class = 0; Class < CDIAG_ALLOCATION_CLASSES - 1; Class++ )
+	{
+		TEST( Stats.Classes[ Class ].BlockSize == ( 16UL << Class ) );
+	}
+
+	TEST( Stats.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ].BlockSize == 0 );
+}
+
+static void TestStatisticsIncludeExitedThreads()
+{
+	CDIAG_ALLOCATION_STATISTICS Stats;
+	ULONGLONG AllocationsBefore, FreesBefore;
+	ULONGLONG AllocationsAfter, FreesAfter;
+	HANDLE Threads[ 4 ];
+	UINT i;
+
+	TEST_HR( CdiagQueryAllocationStatistics( &Stats ) );
+	SumStatistics( &Stats, &AllocationsBefore, &FreesBefore );
+
+	for ( i = 0; i < _countof( Threads ); i++ )
+	{
+		Threads[ i ] = CreateThread( 
+			NULL, 0, CreateResolversThreadProc, NULL, 0, NULL );
+		CFIX_ASSUME( Threads[ i ] != NULL );
+	}
+
+	TEST( WAIT_OBJECT_0 == WaitForMultipleObjects( 
+		_countof( Threads ), Threads, TRUE, INFINITE ) );
+
+	for ( i = 0; i < _countof( Threads ); i++ )
+	{
+		TEST( CloseHandle( Threads[ i ] ) );
+	}
+
+	TEST_HR( CdiagQueryAllocationStatistics( &Stats ) );
+	SumStatistics( &Stats, &AllocationsAfter, &FreesAfter );
+
+	TEST( AllocationsAfter >= 
+		AllocationsBefore + _countof( Threads ) * RESOLVERS_PER_THREAD );
+	TEST( FreesAfter >= 
+		FreesBefore + _countof( Threads ) * RESOLVERS_PER_THREAD );
+}
+
+static void TestPooledBlocksReused()
+{
+	PVOID Block;
+	PVOID Other;
+
+	Block = CdiagpMalloc( 100, FALSE );
+	CFIX_ASSUME( Block != NULL );
+	CdiagpFree( Block );
+
+	//
+	// Same size class.
+	//
+	Other = CdiagpMalloc( 120, FALSE );
+	CFIX_ASSUME( Other != NULL );
+
+#ifndef _DEBUG
+	//
+	// Debug builds do not cache blocks.
+	//
+	TEST( Other == Block );
+#endif
+
+	CdiagpFree( Other );
+}
+
+static void TestRecycledBlocksZeroed()
+{
+	PUCHAR Block;
+	PUCHAR Other;
+	ULONG Index;
+
+	Block = ( PUCHAR ) CdiagpMalloc( 64, FALSE );
+	CFIX_ASSUME( Block != NULL );
+	FillMemory( Block, 64, 0xAB );
+	CdiagpFree( Block );
+
+	Other = ( PUCHAR ) CdiagpMalloc( 64, TRUE );
+	CFIX_ASSUME( Other != NULL );
+
+#ifndef _DEBUG
+	TEST( Other == Block );
+#endif
+
+	for ( Index = 0; Index < 64; Index++ )
+	{
+		TEST( Other[ Index ] == 0 );
+	}
+
+	CdiagpFree( Other );
+}
+
+static void TestLargeAllocations()
+{
+	CDIAG_ALLOCATION_STATISTICS Before;
+	CDIAG_ALLOCATION_STATISTICS After;
+	PCDIAG_ALLOCATION_CLASS_STATISTICS Large;
+	PUCHAR Block;
+	ULONG Index;
+	const ULONG Size = 64 * 1024 + 3;
+
+	TEST_HR( CdiagQueryAllocationStatistics( &Before ) );
+
+	Block = ( PUCHAR ) CdiagpMalloc( Size, TRUE );
+	CFIX_ASSUME( Block != NULL );
+
+	for ( Index = 0; Index < Size; Index++ )
+	{
+		TEST( Block[ Index ] == 0 );
+		Block[ Index ] = ( UCHAR ) Index;
+	}
+
+	for ( Index = 0; Index < Size; Index++ )
+	{
+		TEST( Block[ Index ] == ( UCHAR ) Index );
+	}
+
+	CdiagpFree( Block );
+
+	TEST_HR( CdiagQueryAllocationStatistics( &After ) );
+
+	Large = &After.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ];
+	TEST( Large->Allocations >= 
+		Before.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ].Allocations + 1 );
+	TEST( Large->Frees >= 
+		Before.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ].Frees + 1 );
+	TEST( Large->BytesAllocated >= 
+		Before.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ].BytesAllocated + Size );
+	TEST( Large->BytesFreed >= 
+		Before.Classes[ CDIAG_ALLOCATION_CLASSES - 1 ].BytesFreed + Size );
+}
+
+CFIX_BEGIN_FIXTURE( Allocator )
+	CFIX_FIXTURE_ENTRY( TestQueryStatistics )
+	CFIX_FIXTURE_ENTRY( TestStatisticsIncludeExitedThreads )
+	CFIX_FIXTURE_ENTRY( TestPooledBlocksReused )
+	CFIX_FIXTURE_ENTRY( TestRecycledBlocksZeroed )
+	CFIX_FIXTURE_ENTRY( TestLargeAllocations )
+CFIX_END_FIXTURE()
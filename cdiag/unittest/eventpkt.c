@@ -21,7 +21,7 @@
 #include "stdafx.h"
 #include "eventpkt.h"
 
-VOID InitializeEventPacket(
+PCDIAG_EVENT_PACKET CreateEventPacket(
 	__in CDIAG_EVENT_TYPE Type,
 	__in USHORT Flags,
 	__in UCHAR Sev,
@@ -36,105 +36,43 @@ VOID InitializeEventPacket(
 	__in PCWSTR Module,
 	__in PCWSTR Function,
 	__in PCWSTR SourceFile,
-	__in ULONG SourceLine,
-	__out PEVENT_PACKET_WITH_DATA Pkt
+	__in ULONG SourceLine
 	)
 {
 	FILETIME ZeroTime = { 0, 0 };
+	PCDIAG_EVENT_PACKET Pkt;
 
-	Pkt->EventPacket.Size = sizeof( CDIAG_EVENT_PACKET );
-	Pkt->EventPacket.TotalSize = sizeof( EVENT_PACKET_WITH_DATA );
+	TEST_HR( CdiagBeginEventPacket(
+		Type,
+		Flags,
+		( CDIAG_SEVERITY_LEVEL ) Sev,
+		Code,
+		&Pkt ) );
+
+	Pkt->ProcessorMode = Mode;
+	Pkt->ProcessId = ProcessId;
+	Pkt->ThreadId = ThreadId;
+	Pkt->Timestamp = ( Timestamp ? *Timestamp : ZeroTime );
 
-	Pkt->EventPacket.Type = Type;
-	Pkt->EventPacket.Flags = Flags;
-	Pkt->EventPacket.Severity = ( UCHAR ) Sev;
-	Pkt->EventPacket.ProcessorMode = ( UCHAR ) Mode;
 	if ( Machine )
 	{
-		StringCchCopy( 
-			Pkt->Machine,
-			_countof( Pkt->Machine ), 
-			Machine );
-		Pkt->EventPacket.MachineOffset = 
-			FIELD_OFFSET( EVENT_PACKET_WITH_DATA, Machine );
-	}
-	else
-	{
-		Pkt->EventPacket.MachineOffset = 0;
+		TEST_HR( CdiagSetMachineEventPacket( Pkt, Machine ) );
 	}
-	Pkt->EventPacket.ProcessId = ProcessId;
-	Pkt->EventPacket.ThreadId = ThreadId;
-	Pkt->EventPacket.Timestamp = 
-		( Timestamp ? *Timestamp : ZeroTime );
-	Pkt->EventPacket.Code = Code;
+
 	if ( Message )
 	{
-		StringCchCopy( 
-			Pkt->Message, 
-			_countof( Pkt->Message ), 
-			Message );
-		Pkt->EventPacket.MessageOffset = 
-			FIELD_OFFSET( EVENT_PACKET_WITH_DATA, Message );
-	}
-	else
-	{
-		Pkt->EventPacket.MessageOffset = 0;
+		TEST_HR( CdiagSetMessageEventPacket( Pkt, Message ) );
 	}
 
 	if ( ProvideDebugInfo )
 	{
-		if ( Module )
-		{
-			StringCchCopy( 
-				Pkt->DebugInfo.Module, 
-				_countof( Pkt->DebugInfo.Module ), 
-				Module );
-			Pkt->DebugInfo.DebugInfo.ModuleOffset = 
-				FIELD_OFFSET( DEBUG_INFO_WITH_DATA, Module );
-		}
-		else
-		{
-			Pkt->DebugInfo.DebugInfo.ModuleOffset = 0;
-		}
-
-		if ( Function )
-		{
-			StringCchCopy( 
-				Pkt->DebugInfo.Function, 
-				_countof( Pkt->DebugInfo.Function ), 
-				Function );
-			Pkt->DebugInfo.DebugInfo.FunctionNameOffset = 
-				FIELD_OFFSET( DEBUG_INFO_WITH_DATA, Function );
-		}
-		else
-		{
-			Pkt->DebugInfo.DebugInfo.FunctionNameOffset = 0;
-		}
-
-		if ( SourceFile )
-		{
-			StringCchCopy( 
-				Pkt->DebugInfo.SourceFile, 
-				_countof( Pkt->DebugInfo.SourceFile ), 
-				SourceFile );
-			Pkt->DebugInfo.DebugInfo.SourceFileOffset = 
-				FIELD_OFFSET( DEBUG_INFO_WITH_DATA, SourceFile );
-		}
-		else
-		{
-			Pkt->DebugInfo.DebugInfo.SourceFileOffset = 0;
-		}
-		Pkt->DebugInfo.DebugInfo.SourceLine = SourceLine;
-		
-		Pkt->EventPacket.DebugInfoOffset = 
-			FIELD_OFFSET( EVENT_PACKET_WITH_DATA, DebugInfo );
-	}
-	else
-	{
-		Pkt->EventPacket.DebugInfoOffset = 0;
+		TEST_HR( CdiagSetDebugInfoEventPacket(
+			Pkt,
+			Module,
+			Function,
+			SourceFile,
+			SourceLine ) );
 	}
 
-	Pkt->EventPacket.CustomData.Offset = 0;
-	Pkt->EventPacket.CustomData.Length = 0;
-	Pkt->EventPacket.MessageInsertionStrings.Count = 0;
+	return Pkt;
 }
\ No newline at end of file
@@ -20,28 +20,12 @@
  * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-typedef struct _DEBUG_INFO_WITH_DATA
-{
-	CDIAG_DEBUG_INFO DebugInfo;
-	WCHAR Module[ 32 ];
-	WCHAR Function[ 32 ];
-	WCHAR SourceFile[ 32 ];
-} DEBUG_INFO_WITH_DATA, *PDEBUG_INFO_WITH_DATA;
-
-typedef struct _EVENT_PACKET_WITH_DATA
-{
-	CDIAG_EVENT_PACKET EventPacket;
-	DEBUG_INFO_WITH_DATA DebugInfo;
-	WCHAR Machine[ 32 ];
-	WCHAR Message[ 64 ];	
-} EVENT_PACKET_WITH_DATA, *PEVENT_PACKET_WITH_DATA;
-
-
 /*++
 	Routine Description:
-		Initialize a self-relative event packet.
+		Build a self-relative event packet using the packet builder. 
+		The packet must be released using CdiagReleaseEventPacket.
 --*/
-VOID InitializeEventPacket(
+PCDIAG_EVENT_PACKET CreateEventPacket(
 	__in CDIAG_EVENT_TYPE Type,
 	__in USHORT Flags,
 	__in UCHAR Sev,
@@ -56,6 +40,5 @@ VOID InitializeEventPacket(
 	__in PCWSTR Module,
 	__in PCWSTR Function,
 	__in PCWSTR SourceFile,
-	__in ULONG SourceLine,
-	__out PEVENT_PACKET_WITH_DATA Pkt
+	__in ULONG SourceLine
 	);
\ No newline at end of file
@@ -0,0 +1,179 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Event packet builder tests.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#define PKT_STRING( Pkt, Offset ) \
+	( ( PCWSTR ) ( ( PUCHAR ) ( Pkt ) + ( Offset ) ) )
+
+static VOID TestBuildPacket()
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	PCDIAG_DEBUG_INFO DebugInfo;
+	UCHAR Custom[] = { 1, 2, 3 };
+
+	TEST_HR( CdiagBeginEventPacket(
+		CdiagLogEvent,
+		7,
+		CdiagWarningSeverity,
+		ERROR_BAD_EXE_FORMAT,
+		&Pkt ) );
+	CFIX_ASSUME( Pkt );
+
+	TEST( Pkt->Size == sizeof( CDIAG_EVENT_PACKET ) );
+	TEST( Pkt->TotalSize >= Pkt->Size );
+	TEST( Pkt->Type == CdiagLogEvent );
+	TEST( Pkt->Flags == 7 );
+	TEST( Pkt->Severity == CdiagWarningSeverity );
+	TEST( Pkt->ProcessorMode == CdiagUserMode );
+	TEST( Pkt->ProcessId == GetCurrentProcessId() );
+	TEST( Pkt->ThreadId == GetCurrentThreadId() );
+	TEST( Pkt->Code == ERROR_BAD_EXE_FORMAT );
+	TEST( Pkt->MachineOffset == 0 );
+	TEST( Pkt->MessageOffset == 0 );
+	TEST( Pkt->DebugInfoOffset == 0 );
+	TEST( Pkt->CustomData.Offset == 0 );
+	TEST( Pkt->MessageInsertionStrings.Count == 0 );
+
+	TEST_HR( CdiagSetMachineEventPacket( Pkt, L"machine" ) );
+	TEST_HR( CdiagSetMessageEventPacket( Pkt, L"message" ) );
+	TEST_HR( CdiagAddInsertionStringEventPacket( Pkt, L"one" ) );
+	TEST_HR( CdiagAddInsertionStringEventPacket( Pkt, L"two" ) );
+	TEST_HR( CdiagSetDebugInfoEventPacket( Pkt, L"mod", NULL, L"src", 42 ) );
+	TEST_HR( CdiagSetCustomDataEventPacket( Pkt, Custom, sizeof( Custom ) ) );
+
+	TEST( 0 == wcscmp( PKT_STRING( Pkt, Pkt->MachineOffset ), L"machine" ) );
+	TEST( 0 == wcscmp( PKT_STRING( Pkt, Pkt->MessageOffset ), L"message" ) );
+	TEST( Pkt->MessageInsertionStrings.Count == 2 );
+	TEST( 0 == wcscmp( PKT_STRING( 
+		Pkt, Pkt->MessageInsertionStrings.Offset[ 0 ] ), L"one" ) );
+	TEST( 0 == wcscmp( PKT_STRING( 
+		Pkt, Pkt->MessageInsertionStrings.Offset[ 1 ] ), L"two" ) );
+
+	DebugInfo = ( PCDIAG_DEBUG_INFO ) 
+		( ( PUCHAR ) Pkt + Pkt->DebugInfoOffset );
+	TEST( DebugInfo->Size == sizeof( CDIAG_DEBUG_INFO ) );
+	TEST( DebugInfo->TotalSize > DebugInfo->Size );
+	TEST( DebugInfo->SourceLine == 42 );
+	TEST( DebugInfo->FunctionNameOffset == 0 );
+	TEST( 0 == wcscmp( PKT_STRING( DebugInfo, DebugInfo->ModuleOffset ), L"mod" ) );
+	TEST( 0 == wcscmp( PKT_STRING( DebugInfo, DebugInfo->SourceFileOffset ), L"src" ) );
+
+	TEST( Pkt->CustomData.Length == sizeof( Custom ) );
+	TEST( 0 == memcmp( 
+		( PUCHAR ) Pkt + Pkt->CustomData.Offset, 
+		Custom, 
+		sizeof( Custom ) ) );
+	TEST( Pkt->CustomData.Offset + Pkt->CustomData.Length <= Pkt->TotalSize );
+
+	CdiagReleaseEventPacket( Pkt );
+}
+
+static VOID TestNestedPackets()
+{
+	PCDIAG_EVENT_PACKET Outer;
+	PCDIAG_EVENT_PACKET Inner;
+	PCDIAG_EVENT_PACKET Reused;
+
+	TEST_HR( CdiagBeginEventPacket(
+		CdiagLogEvent, 0, CdiagInfoSeverity, 0, &Outer ) );
+	TEST_HR( CdiagSetMessageEventPacket( Outer, L"outer" ) );
+
+	TEST_HR( CdiagBeginEventPacket(
+		CdiagTraceEvent, 0, CdiagInfoSeverity, 0, &Inner ) );
+	TEST( ( PUCHAR ) Inner >= ( PUCHAR ) Outer + Outer->TotalSize );
+
+	//
+	// Only the packet begun last may be extended.
+	//
+	TEST( E_INVALIDARG == CdiagSetMessageEventPacket( Outer, L"x" ) );
+	TEST_HR( CdiagSetMessageEventPacket( Inner, L"inner" ) );
+	TEST( 0 == wcscmp( PKT_STRING( Outer, Outer->MessageOffset ), L"outer" ) );
+
+	CdiagReleaseEventPacket( Inner );
+	TEST_HR( CdiagSetMachineEventPacket( Outer, L"machine" ) );
+
+	//
+	// Space is reused.
+	//
+	CdiagReleaseEventPacket( Outer );
+	TEST_HR( CdiagBeginEventPacket(
+		CdiagLogEvent, 0, CdiagInfoSeverity, 0, &Reused ) );
+	TEST( Reused == Outer );
+	CdiagReleaseEventPacket( Reused );
+
+	//
+	// Stack-allocated packets cannot be extended.
+	//
+	{
+		CDIAG_EVENT_PACKET StackPkt;
+		ZeroMemory( &StackPkt, sizeof( StackPkt ) );
+		StackPkt.Size = sizeof( CDIAG_EVENT_PACKET );
+		StackPkt.TotalSize = sizeof( CDIAG_EVENT_PACKET );
+		TEST( E_INVALIDARG == CdiagSetMessageEventPacket( &StackPkt, L"x" ) );
+	}
+}
+
+static VOID TestPacketLimits()
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	WCHAR LongString[ 0x4000 ];
+	UINT Index;
+
+	TEST( E_INVALIDARG == CdiagBeginEventPacket(
+		( CDIAG_EVENT_TYPE ) ( CdiagMaxEvent + 1 ), 
+		0, CdiagInfoSeverity, 0, &Pkt ) );
+
+	TEST_HR( CdiagBeginEventPacket(
+		CdiagLogEvent, 0, CdiagInfoSeverity, 0, &Pkt ) );
+
+	for ( Index = 0; Index < CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS; Index++ )
+	{
+		TEST_HR( CdiagAddInsertionStringEventPacket( Pkt, L"s" ) );
+	}
+	TEST( CDIAG_E_BUFFER_TOO_SMALL == 
+		CdiagAddInsertionStringEventPacket( Pkt, L"s" ) );
+
+	//
+	// Packets are limited to 64 KB.
+	//
+	for ( Index = 0; Index < _countof( LongString ) - 1; Index++ )
+	{
+		LongString[ Index ] = L'x';
+	}
+	LongString[ Index ] = UNICODE_NULL;
+
+	TEST_HR( CdiagSetMessageEventPacket( Pkt, LongString ) );
+	TEST( CDIAG_E_BUFFER_TOO_SMALL == 
+		CdiagSetMessageEventPacket( Pkt, LongString ) );
+	TEST( CdiagsIsValidEventPacket( Pkt ) );
+	TEST( 0 == wcscmp( PKT_STRING( Pkt, Pkt->MessageOffset ), LongString ) );
+
+	CdiagReleaseEventPacket( Pkt );
+}
+
+CFIX_BEGIN_FIXTURE( EventPacketBuilder )
+	CFIX_FIXTURE_ENTRY( TestBuildPacket )
+	CFIX_FIXTURE_ENTRY( TestNestedPackets )
+	CFIX_FIXTURE_ENTRY( TestPacketLimits )
+CFIX_END_FIXTURE()
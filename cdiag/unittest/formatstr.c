@@ -37,17 +37,39 @@ extern HRESULT CDIAGCALLTYPE CdiagpFormatString(
 	__out_ecount(BufferSizeInChars) PWSTR Buffer 
 	);
 
+typedef struct _FORMAT_PROGRAM *PFORMAT_PROGRAM;
+
+extern HRESULT CDIAGCALLTYPE CdiagpCompileFormatString(
+	__in ULONG VarCount,
+	__in PFORMAT_VARIABLE Variables,
+	__in PCWSTR Format,
+	__out PFORMAT_PROGRAM *Program
+	);
+
+extern VOID CDIAGCALLTYPE CdiagpFreeFormatProgram(
+	__in PFORMAT_PROGRAM Program
+	);
+
+extern HRESULT CDIAGCALLTYPE CdiagpRunFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in DWORD_PTR *Bindings,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer 
+	);
+
 static FORMAT_VARIABLE VarDef[] =
 {
 	{ L"x",		L"%x" },
 	{ L"Str1",	L"%s" },
-	{ L"Int",	L"%d" }
+	{ L"Int",	L"%d" },
+	{ L"Uint",	L"%u" }
 };
 
-static DWORD_PTR VarBindings[][ 3 ] =
+static DWORD_PTR VarBindings[][ 4 ] =
 {
-	{ 0,		  ( DWORD_PTR ) ( PVOID ) L"",			0 },
-	{ 0xDEADBEEF, ( DWORD_PTR ) ( PVOID ) L" Foo",		( DWORD_PTR ) -1 }
+	{ 0,		  ( DWORD_PTR ) ( PVOID ) L"",			0,					0 },
+	{ 0xDEADBEEF, ( DWORD_PTR ) ( PVOID ) L" Foo",		( DWORD_PTR ) -1,	0xFFFFFFFF },
+	{ 0,		  0,									0,					4711 }
 };
 
 typedef struct _FORMAT
@@ -66,6 +88,8 @@ static FORMAT Formats[] =
 	{ L" %%%% %str1%str1 %str1%int",	VarBindings[ 1 ], L" %%  Foo Foo  Foo-1" },
 	{ L"-%x-",							VarBindings[ 1 ], L"-deadbeef-" },
 	{ L"-%int-",						VarBindings[ 1 ], L"--1-" },
+	{ L"%uint%str1%",					VarBindings[ 1 ], L"4294967295 Foo" },
+	{ L"%UINT%%%Str1",					VarBindings[ 2 ], L"4711%(null)" },
 	{ 0 }
 };
 
@@ -92,7 +116,7 @@ static VOID TestFormats()
 			Buffer[ BufferLen + 4 ] = 0xBAD5;
 
 			Hr = CdiagpFormatString(
-				3,
+				_countof( VarDef ),
 				VarDef,
 				Format->Bindings,
 				Format->Format,
@@ -134,8 +158,82 @@ static VOID TestIntArgs()
 #endif
 }
 
+static VOID TestCompiledFormats()
+{
+#ifdef _DEBUG
+	PFORMAT Format;
+	SIZE_T BufferLen;
+	WCHAR Buffer[ 100 ];
+	WCHAR Expected[ 100 ];
+	PFORMAT_PROGRAM Program;
+	HRESULT Hr;
+
+	for ( Format = Formats; Format->Format != 0; Format++ )
+	{
+		TEST_HR( CdiagpCompileFormatString(
+			_countof( VarDef ),
+			VarDef,
+			Format->Format,
+			&Program ) );
+
+		for ( BufferLen = _countof( Buffer ) - 5; BufferLen > 0; BufferLen-- )
+		{
+			// 
+			// Mark end of buffer
+			//
+			memset( Buffer, 0, sizeof( Buffer ) );
+			Buffer[ BufferLen     ] = 0xBAD1;
+			Buffer[ BufferLen + 1 ] = 0xBAD2;
+			Buffer[ BufferLen + 2 ] = 0xBAD3;
+			Buffer[ BufferLen + 3 ] = 0xBAD4;
+			Buffer[ BufferLen + 4 ] = 0xBAD5;
+
+			Hr = CdiagpRunFormatProgram(
+				Program,
+				Format->Bindings,
+				BufferLen,
+				Buffer );
+			TEST( CDIAG_E_BUFFER_TOO_SMALL == Hr ||
+				  ( S_OK == Hr &&
+					0 == wcscmp( Buffer, Format->Expected ) ) );
+
+			//
+			// Must fail iff the output does not fit.
+			//
+			TEST( ( S_OK == Hr ) == ( wcslen( Format->Expected ) < BufferLen ) );
+
+			TEST( Buffer[ BufferLen     ] == 0xBAD1 );
+			TEST( Buffer[ BufferLen + 1 ] == 0xBAD2 );
+			TEST( Buffer[ BufferLen + 2 ] == 0xBAD3 );
+			TEST( Buffer[ BufferLen + 3 ] == 0xBAD4 );
+			TEST( Buffer[ BufferLen + 4 ] == 0xBAD5 );
+		}
+
+		//
+		// Must match the interpreted result.
+		//
+		TEST_HR( CdiagpFormatString(
+			_countof( VarDef ),
+			VarDef,
+			Format->Bindings,
+			Format->Format,
+			_countof( Expected ),
+			Expected ) );
+		TEST_HR( CdiagpRunFormatProgram(
+			Program,
+			Format->Bindings,
+			_countof( Buffer ),
+			Buffer ) );
+		TEST( 0 == wcscmp( Buffer, Expected ) );
+
+		CdiagpFreeFormatProgram( Program );
+	}
+#endif
+}
+
 CFIX_BEGIN_FIXTURE( Internals )
 	CFIX_FIXTURE_ENTRY( TestFormats )
 	CFIX_FIXTURE_ENTRY( TestIntArgs )
+	CFIX_FIXTURE_ENTRY( TestCompiledFormats )
 CFIX_END_FIXTURE()
 
@@ -240,7 +240,7 @@ static VOID TestFormatter()
 	for ( MessageAndCode = SampleMessageAndCode; MessageAndCode->CodeString != 0; MessageAndCode++ )
 	for ( DebugInfo =	SampleDebugInfo; DebugInfo->ModuleString != 0; DebugInfo++ )
 	{
-		EVENT_PACKET_WITH_DATA EvPktWithData;
+		PCDIAG_EVENT_PACKET EvPkt;
 		HRESULT Hr;
 		
 		TEST_HR( CdiagCreateFormatter( 
@@ -249,7 +249,7 @@ static VOID TestFormatter()
 			0,
 			&Fmt ) );
 
-		InitializeEventPacket( 
+		EvPkt = CreateEventPacket( 
 			( CDIAG_EVENT_TYPE ) Type->Type,
 			Flags->Flag,
 			Severity->Severity,
@@ -264,8 +264,7 @@ static VOID TestFormatter()
 			DebugInfo->Module,
 			DebugInfo->Function,
 			DebugInfo->SrcFile,
-			DebugInfo->Line,
-			&EvPktWithData );
+			DebugInfo->Line );
 
 		//
 		// Construct expected string.
@@ -311,7 +310,7 @@ static VOID TestFormatter()
 
 		Hr = Fmt->Format(
 			Fmt,
-			&EvPktWithData.EventPacket,
+			EvPkt,
 			BufferLen,
 			Buffer );
 		TEST( CDIAG_E_BUFFER_TOO_SMALL == Hr ||
@@ -320,7 +319,7 @@ static VOID TestFormatter()
 
 		TEST( Buffer[ BufferLen ] == 0xBAD1 );
 
-
+		CdiagReleaseEventPacket( EvPkt );
 		Fmt->Dereference( Fmt );
 	}
 	Resolver->Dereference( Resolver );
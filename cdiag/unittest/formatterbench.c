@@ -0,0 +1,263 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Formatter benchmark.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+#include "eventpkt.h"
+
+#define BENCH_EVENT_COUNT	100000
+
+typedef struct _FORMAT_VARIABLE
+{
+	PWSTR Name;
+	PWSTR Format;
+} FORMAT_VARIABLE, *PFORMAT_VARIABLE;
+
+typedef struct _FORMAT_PROGRAM *PFORMAT_PROGRAM;
+
+extern HRESULT CDIAGCALLTYPE CdiagpFormatString(
+	__in ULONG VarCount,
+	__in PFORMAT_VARIABLE Variables,
+	__in DWORD_PTR *Bindings,
+	__in PCWSTR Format,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer
+	);
+
+extern HRESULT CDIAGCALLTYPE CdiagpCompileFormatString(
+	__in ULONG VarCount,
+	__in PFORMAT_VARIABLE Variables,
+	__in PCWSTR Format,
+	__out PFORMAT_PROGRAM *Program
+	);
+
+extern VOID CDIAGCALLTYPE CdiagpFreeFormatProgram(
+	__in PFORMAT_PROGRAM Program
+	);
+
+extern HRESULT CDIAGCALLTYPE CdiagpRunFormatProgram(
+	__in PFORMAT_PROGRAM Program,
+	__in DWORD_PTR *Bindings,
+	__in SIZE_T BufferSizeInChars,
+	__out_ecount(BufferSizeInChars) PWSTR Buffer
+	);
+
+//
+// Same as the session's default format.
+//
+#define BENCH_DEFAULT_FORMAT			\
+		L"Type=%Type, "					\
+		L"Flags=%Flags, "				\
+		L"Severity=%Severity, "			\
+		L"Mode=%ProcessorMode, "		\
+		L"Machine=%Machine, "			\
+		L"ProcessId=%ProcessId, "		\
+		L"ThreadId=%ThreadId, "			\
+		L"Code=%Code, "					\
+		L"Module=%Module, "				\
+		L"Function=%Function, "			\
+		L"File=%File, "					\
+		L"Line=%Line, "					\
+		L"Message=%Message"
+
+static PCWSTR BenchFormats[] =
+{
+	BENCH_DEFAULT_FORMAT,
+	L"%Message",
+	L"%Timestamp %Severity: %Message"
+};
+
+static double BenchEventsPerSecond(
+	__in PLARGE_INTEGER Start,
+	__in PLARGE_INTEGER Stop
+	)
+{
+	LARGE_INTEGER Frequency;
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+
+	return BENCH_EVENT_COUNT * ( double ) Frequency.QuadPart /
+		( double ) ( Stop->QuadPart - Start->QuadPart );
+}
+
+/*++
+	Routine Description:
+		Measure events per second formatted by the formatter.
+--*/
+static VOID BenchmarkFormatter()
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	FILETIME Ft = { 1, 2 };
+	WCHAR Buffer[ 1024 ];
+	UINT FormatIndex;
+	UINT Index;
+
+	Pkt = CreateEventPacket(
+		CdiagLogEvent,
+		0,
+		CdiagErrorSeverity,
+		CdiagUserMode,
+		L"machine",
+		GetCurrentProcessId(),
+		GetCurrentThreadId(),
+		&Ft,
+		ERROR_BAD_EXE_FORMAT,
+		L"Something failed",
+		TRUE,
+		L"Module",
+		L"Function",
+		L"SourceFile",
+		42 );
+
+	for ( FormatIndex = 0; FormatIndex < _countof( BenchFormats ); FormatIndex++ )
+	{
+		PCDIAG_FORMATTER Fmt;
+		LARGE_INTEGER Start;
+		LARGE_INTEGER Stop;
+
+		TEST_HR( CdiagCreateFormatter(
+			BenchFormats[ FormatIndex ],
+			NULL,
+			0,
+			&Fmt ) );
+
+		TEST( QueryPerformanceCounter( &Start ) );
+		for ( Index = 0; Index < BENCH_EVENT_COUNT; Index++ )
+		{
+			TEST_HR( Fmt->Format(
+				Fmt,
+				Pkt,
+				_countof( Buffer ),
+				Buffer ) );
+		}
+		TEST( QueryPerformanceCounter( &Stop ) );
+
+		CFIX_LOG(
+			L"%-40.40s: %8.0f events/s",
+			BenchFormats[ FormatIndex ],
+			BenchEventsPerSecond( &Start, &Stop ) );
+
+		Fmt->Dereference( Fmt );
+	}
+
+	CdiagReleaseEventPacket( Pkt );
+}
+
+/*++
+	Routine Description:
+		Compare interpreting the template on each call to running
+		a compiled template, using bindings similar to the ones
+		used by the formatter.
+--*/
+static VOID BenchmarkCompiledTemplate()
+{
+#ifdef _DEBUG
+	FORMAT_VARIABLE Variables[] =
+	{
+		{ L"Message",		L"%s" },
+		{ L"Type",			L"%s" },
+		{ L"Flags",			L"0x%04X" },
+		{ L"Severity",		L"%s" },
+		{ L"ProcessorMode", L"%s" },
+		{ L"Machine",		L"%s" },
+		{ L"ProcessId",		L"%u" },
+		{ L"ThreadId",		L"%u" },
+		{ L"Timestamp",		L"%s" },
+		{ L"Code",			L"0x%08X" },
+		{ L"Module",		L"%s" },
+		{ L"Function",		L"%s" },
+		{ L"File",			L"%s" },
+		{ L"Line",			L"%u" },
+	};
+	DWORD_PTR Bindings[] =
+	{
+		( DWORD_PTR ) ( PVOID ) L"Something failed",
+		( DWORD_PTR ) ( PVOID ) L"Log",
+		0,
+		( DWORD_PTR ) ( PVOID ) L"Error",
+		( DWORD_PTR ) ( PVOID ) L"User",
+		( DWORD_PTR ) ( PVOID ) L"machine",
+		4711,
+		4712,
+		( DWORD_PTR ) ( PVOID ) L"12:00:00",
+		ERROR_BAD_EXE_FORMAT,
+		( DWORD_PTR ) ( PVOID ) L"Module",
+		( DWORD_PTR ) ( PVOID ) L"Function",
+		( DWORD_PTR ) ( PVOID ) L"SourceFile",
+		42
+	};
+	WCHAR Buffer[ 1024 ];
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	PFORMAT_PROGRAM Program;
+	double Interpreted;
+	double Compiled;
+	UINT Index;
+
+	C_ASSERT( _countof( Variables ) == _countof( Bindings ) );
+
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < BENCH_EVENT_COUNT; Index++ )
+	{
+		TEST_HR( CdiagpFormatString(
+			_countof( Variables ),
+			Variables,
+			Bindings,
+			BENCH_DEFAULT_FORMAT,
+			_countof( Buffer ),
+			Buffer ) );
+	}
+	TEST( QueryPerformanceCounter( &Stop ) );
+	Interpreted = BenchEventsPerSecond( &Start, &Stop );
+
+	TEST_HR( CdiagpCompileFormatString(
+		_countof( Variables ),
+		Variables,
+		BENCH_DEFAULT_FORMAT,
+		&Program ) );
+
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < BENCH_EVENT_COUNT; Index++ )
+	{
+		TEST_HR( CdiagpRunFormatProgram(
+			Program,
+			Bindings,
+			_countof( Buffer ),
+			Buffer ) );
+	}
+	TEST( QueryPerformanceCounter( &Stop ) );
+	Compiled = BenchEventsPerSecond( &Start, &Stop );
+
+	CdiagpFreeFormatProgram( Program );
+
+	CFIX_LOG(
+		L"Default template: interpreted %8.0f events/s, "
+		L"compiled %8.0f events/s (%.1fx)",
+		Interpreted,
+		Compiled,
+		Compiled / Interpreted );
+#endif
+}
+
+CFIX_BEGIN_FIXTURE( FormatterBenchmark )
+	CFIX_FIXTURE_ENTRY( BenchmarkFormatter )
+	CFIX_FIXTURE_ENTRY( BenchmarkCompiledTemplate )
+CFIX_END_FIXTURE()
@@ -26,7 +26,7 @@ static VOID TestNonChainableHandler(
 	)
 {
 	PCDIAG_HANDLER OtherHdl;
-	EVENT_PACKET_WITH_DATA Pkt;
+	PCDIAG_EVENT_PACKET Pkt;
 	FILETIME Ft = { 1, 2 };
 	UINT Index;
 
@@ -42,7 +42,7 @@ static VOID TestNonChainableHandler(
 		Hdl->Reference( Hdl );
 		Hdl->Dereference( Hdl );
 
-		InitializeEventPacket(
+		Pkt = CreateEventPacket(
 			CdiagLogEvent,
 			0,
 			CdiagFatalSeverity,
@@ -57,10 +57,10 @@ static VOID TestNonChainableHandler(
 			L"Module",
 			L"Function",
 			L"SourceFile",
-			42,
-			&Pkt );
+			42 );
 
-		TEST_HR( Hdl->Handle( Hdl, &Pkt.EventPacket ) );
+		TEST_HR( Hdl->Handle( Hdl, Pkt ) );
+		CdiagReleaseEventPacket( Pkt );
 	}
 }
 
@@ -78,6 +78,15 @@ VOID TestHandlers()
 	TestNonChainableHandler( Handler );
 	Handler->Dereference( Handler );
 
+	TEST_HR( CdiagCreateBatchingOutputHandler( 
+		Session, 
+		OutputDebugString, 
+		0,
+		100,
+		&Handler ) );
+	TestNonChainableHandler( Handler );
+	Handler->Dereference( Handler );
+
 	//
 	// UTF16 textfile handler.
 	//
@@ -104,10 +113,730 @@ VOID TestHandlers()
 
 	TEST( GetFileAttributes( L"__utf8.txt" ) != INVALID_FILE_ATTRIBUTES );
 
+	//
+	// Buffered textfile handlers.
+	//
+	TEST_HR( CdiagCreateBufferedTextFileHandler( 
+		Session, 
+		L"__utf16buf.txt",
+		CdiagEncodingUtf16, 
+		0,
+		100,
+		&Handler ) );
+	TestNonChainableHandler( Handler );
+	Handler->Dereference( Handler );
+
+	TEST( GetFileAttributes( L"__utf16buf.txt" ) != INVALID_FILE_ATTRIBUTES );
+
+	TEST_HR( CdiagCreateBufferedTextFileHandler( 
+		Session, 
+		L"__utf8buf.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Handler ) );
+	TestNonChainableHandler( Handler );
+	Handler->Dereference( Handler );
+
+	TEST( GetFileAttributes( L"__utf8buf.txt" ) != INVALID_FILE_ATTRIBUTES );
+
+	TEST_HR( CdiagDereferenceSession( Session ) );
+}
+
+static ULONG GetFileSizeByName(
+	__in PCWSTR Path
+	)
+{
+	WIN32_FILE_ATTRIBUTE_DATA Data;
+	TEST( GetFileAttributesEx( Path, GetFileExInfoStandard, &Data ) );
+	return Data.nFileSizeLow;
+}
+
+static VOID HandleEvent(
+	__in PCDIAG_HANDLER Hdl,
+	__in UCHAR Severity
+	)
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	FILETIME Ft = { 1, 2 };
+
+	Pkt = CreateEventPacket(
+		CdiagLogEvent,
+		0,
+		Severity,
+		CdiagUserMode,
+		L"machine",
+		GetCurrentProcessId(),
+		GetCurrentThreadId(),
+		&Ft,
+		0,
+		L"Message",
+		FALSE,
+		NULL,
+		NULL,
+		NULL,
+		0 );
+
+	TEST_HR( Hdl->Handle( Hdl, Pkt ) );
+	CdiagReleaseEventPacket( Pkt );
+}
+
+VOID TestBufferedTextFileHandler()
+{
+	CDIAG_SESSION_HANDLE Session;
+	PCDIAG_HANDLER Handler;
+	ULONG Size;
+	ULONG Index;
+
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Session ) );
+
+	//
+	// Without flush interval, output must be held back until the
+	// buffer runs full, a fatal event occurs or the handler is deleted.
+	//
+	DeleteFile( L"__buffered.txt" );
+	TEST_HR( CdiagCreateBufferedTextFileHandler( 
+		Session, 
+		L"__buffered.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	HandleEvent( Handler, CdiagErrorSeverity );
+	TEST( GetFileSizeByName( L"__buffered.txt" ) == 0 );
+
+	HandleEvent( Handler, CdiagFatalSeverity );
+	Size = GetFileSizeByName( L"__buffered.txt" );
+	TEST( Size > 0 );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	TEST( GetFileSizeByName( L"__buffered.txt" ) == Size );
+
+	Handler->Dereference( Handler );
+	TEST( GetFileSizeByName( L"__buffered.txt" ) > Size );
+
+	//
+	// Smallest buffer possible - must flush on size.
+	//
+	DeleteFile( L"__buffered.txt" );
+	TEST_HR( CdiagCreateBufferedTextFileHandler( 
+		Session, 
+		L"__buffered.txt",
+		CdiagEncodingUtf16, 
+		1,
+		0,
+		&Handler ) );
+
+	for ( Index = 0; Index < 1000; Index++ )
+	{
+		HandleEvent( Handler, CdiagInfoSeverity );
+	}
+	Size = GetFileSizeByName( L"__buffered.txt" );
+	TEST( Size > 0 );
+
+	Handler->Dereference( Handler );
+	TEST( GetFileSizeByName( L"__buffered.txt" ) > Size );
+
+	//
+	// With flush interval, output must be written in the background.
+	//
+	DeleteFile( L"__buffered.txt" );
+	TEST_HR( CdiagCreateBufferedTextFileHandler( 
+		Session, 
+		L"__buffered.txt",
+		CdiagEncodingUtf8, 
+		0,
+		10,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	for ( Index = 0; Index < 500; Index++ )
+	{
+		if ( GetFileSizeByName( L"__buffered.txt" ) > 0 )
+		{
+			break;
+		}
+
+		Sleep( 10 );
+	}
+	TEST( GetFileSizeByName( L"__buffered.txt" ) > 0 );
+
+	Handler->Dereference( Handler );
+
 	TEST_HR( CdiagDereferenceSession( Session ) );
 }
 
+static volatile LONG BatchOutputCalls = 0;
+static volatile LONG BatchOutputLines = 0;
+
+static VOID CALLBACK BatchOutput( PCWSTR Text )
+{
+	for ( ; *Text != UNICODE_NULL; Text++ )
+	{
+		if ( *Text == L'\n' )
+		{
+			InterlockedIncrement( &BatchOutputLines );
+		}
+	}
+
+	//
+	// Count the call last, the test polls for it and then checks
+	// the lines.
+	//
+	InterlockedIncrement( &BatchOutputCalls );
+}
+
+VOID TestBatchingOutputHandler()
+{
+	CDIAG_SESSION_HANDLE Session;
+	PCDIAG_HANDLER Handler;
+	ULONG Index;
+
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Session ) );
+
+	TEST( E_INVALIDARG == CdiagCreateBatchingOutputHandler( 
+		Session, NULL, 0, 0, &Handler ) );
+
+	//
+	// Without flush interval, output must be held back until the
+	// batch runs full, a fatal event occurs or the handler is deleted.
+	//
+	BatchOutputCalls = 0;
+	BatchOutputLines = 0;
+	TEST_HR( CdiagCreateBatchingOutputHandler( 
+		Session, 
+		BatchOutput,
+		0,
+		0,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	HandleEvent( Handler, CdiagErrorSeverity );
+	TEST( BatchOutputCalls == 0 );
+
+	HandleEvent( Handler, CdiagFatalSeverity );
+	TEST( BatchOutputCalls == 1 );
+	TEST( BatchOutputLines == 3 );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	TEST( BatchOutputCalls == 1 );
+
+	Handler->Dereference( Handler );
+	TEST( BatchOutputCalls == 2 );
+	TEST( BatchOutputLines == 4 );
+
+	//
+	// Smallest batch possible - must flush on size, but still
+	// coalesce events.
+	//
+	BatchOutputCalls = 0;
+	BatchOutputLines = 0;
+	TEST_HR( CdiagCreateBatchingOutputHandler( 
+		Session, 
+		BatchOutput,
+		1,
+		0,
+		&Handler ) );
+
+	for ( Index = 0; Index < 1000; Index++ )
+	{
+		HandleEvent( Handler, CdiagInfoSeverity );
+	}
+	TEST( BatchOutputCalls > 0 );
+	TEST( BatchOutputCalls < 1000 );
+
+	Handler->Dereference( Handler );
+	TEST( BatchOutputLines == 1000 );
+
+	//
+	// With flush interval, output must happen in the background.
+	//
+	BatchOutputCalls = 0;
+	BatchOutputLines = 0;
+	TEST_HR( CdiagCreateBatchingOutputHandler( 
+		Session, 
+		BatchOutput,
+		0,
+		10,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	for ( Index = 0; Index < 500; Index++ )
+	{
+		if ( BatchOutputCalls > 0 )
+		{
+			break;
+		}
+
+		Sleep( 10 );
+	}
+	TEST( BatchOutputCalls == 1 );
+	TEST( BatchOutputLines == 1 );
+
+	Handler->Dereference( Handler );
+	TEST( BatchOutputCalls == 1 );
+
+	TEST_HR( CdiagDereferenceSession( Session ) );
+}
+
+static BOOL SegmentExists(
+	__in ULONG Sequence,
+	__in BOOL Compressed
+	)
+{
+	WCHAR Path[ MAX_PATH ];
+	TEST_HR( StringCchPrintf(
+		Path,
+		_countof( Path ),
+		L"__rotating.txt.%06u%s",
+		Sequence,
+		Compressed ? L".lz4" : L"" ) );
+	return GetFileAttributes( Path ) != INVALID_FILE_ATTRIBUTES;
+}
+
+static VOID DeleteSegments()
+{
+	WCHAR Path[ MAX_PATH ];
+	ULONG Sequence;
+
+	DeleteFile( L"__rotating.txt" );
+	for ( Sequence = 1; Sequence <= 20; Sequence++ )
+	{
+		TEST_HR( StringCchPrintf(
+			Path,
+			_countof( Path ),
+			L"__rotating.txt.%06u",
+			Sequence ) );
+		DeleteFile( Path );
+
+		TEST_HR( StringCchCat( Path, _countof( Path ), L".lz4" ) );
+		DeleteFile( Path );
+	}
+}
+
+VOID TestRotatingTextFileHandler()
+{
+	CDIAG_TEXTFILE_ROTATION Rotation;
+	CDIAG_SESSION_HANDLE Session;
+	PCDIAG_HANDLER Handler;
+	ULONG Index;
+
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Session ) );
+	DeleteSegments();
+
+	//
+	// Invalid policies.
+	//
+	ZeroMemory( &Rotation, sizeof( Rotation ) );
+	TEST( E_INVALIDARG == CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		NULL,
+		&Handler ) );
+	TEST( E_INVALIDARG == CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Rotation,
+		&Handler ) );
+
+	Rotation.MaxAge = 60;
+	Rotation.Flags = 0x80;
+	TEST( E_INVALIDARG == CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Rotation,
+		&Handler ) );
+
+	//
+	// Rotate after each event, retain 3 segments.
+	//
+	ZeroMemory( &Rotation, sizeof( Rotation ) );
+	Rotation.MaxFileSize = 1;
+	Rotation.MaxSegments = 3;
+
+	TEST_HR( CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Rotation,
+		&Handler ) );
+	TestNonChainableHandler( Handler );
+
+	for ( Index = 0; Index < 5; Index++ )
+	{
+		HandleEvent( Handler, CdiagInfoSeverity );
+	}
+
+	//
+	// Deleting the handler waits for pruning to complete.
+	//
+	Handler->Dereference( Handler );
+
+	TEST( GetFileSizeByName( L"__rotating.txt" ) == 0 );
+	TEST( ! SegmentExists( 7, FALSE ) );
+	TEST( SegmentExists( 8, FALSE ) );
+	TEST( SegmentExists( 9, FALSE ) );
+	TEST( SegmentExists( 10, FALSE ) );
+	TEST( ! SegmentExists( 11, FALSE ) );
+
+	//
+	// Numbering continues, buffered output is rotated on flush,
+	// segments are compressed.
+	//
+	Rotation.MaxSegments = 0;
+	Rotation.Flags = CDIAG_TEXTFILE_ROTATION_COMPRESS;
+
+	TEST_HR( CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf16, 
+		1,
+		0,
+		&Rotation,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	TEST( GetFileSizeByName( L"__rotating.txt" ) == 0 );
+
+	HandleEvent( Handler, CdiagFatalSeverity );
+	HandleEvent( Handler, CdiagFatalSeverity );
+
+	Handler->Dereference( Handler );
+
+	TEST( GetFileSizeByName( L"__rotating.txt" ) == 0 );
+	TEST( SegmentExists( 8, FALSE ) );
+	TEST( ! SegmentExists( 11, FALSE ) );
+	TEST( SegmentExists( 11, TRUE ) );
+	TEST( ! SegmentExists( 12, FALSE ) );
+	TEST( SegmentExists( 12, TRUE ) );
+	TEST( ! SegmentExists( 13, TRUE ) );
+
+	//
+	// Age-based rotation.
+	//
+	ZeroMemory( &Rotation, sizeof( Rotation ) );
+	Rotation.MaxAge = 1;
+
+	TEST_HR( CdiagCreateRotatingTextFileHandler( 
+		Session, 
+		L"__rotating.txt",
+		CdiagEncodingUtf8, 
+		0,
+		0,
+		&Rotation,
+		&Handler ) );
+
+	HandleEvent( Handler, CdiagInfoSeverity );
+	TEST( ! SegmentExists( 13, FALSE ) );
+
+	Sleep( 1100 );
+	HandleEvent( Handler, CdiagInfoSeverity );
+	TEST( SegmentExists( 13, FALSE ) );
+	TEST( GetFileSizeByName( L"__rotating.txt" ) == 0 );
+
+	Handler->Dereference( Handler );
+
+	DeleteSegments();
+	TEST_HR( CdiagDereferenceSession( Session ) );
+}
+
+typedef struct _BINARY_FILE_CONTENTS
+{
+	ULONG Count;
+	DWORD FirstCode;
+	DWORD LastCode;
+	BOOL InOrder;
+} BINARY_FILE_CONTENTS, *PBINARY_FILE_CONTENTS;
+
+static BOOL CDIAGCALLTYPE CollectBinaryFileEvent(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_opt PVOID Context
+	)
+{
+	PBINARY_FILE_CONTENTS Contents = ( PBINARY_FILE_CONTENTS ) Context;
+
+	TEST( Packet->Type == CdiagTraceEvent );
+
+	if ( Contents->Count == 0 )
+	{
+		Contents->FirstCode = Packet->Code;
+	}
+	else if ( Packet->Code != Contents->LastCode + 1 )
+	{
+		Contents->InOrder = FALSE;
+	}
+
+	Contents->LastCode = Packet->Code;
+	Contents->Count++;
+
+	return TRUE;
+}
+
+static VOID ReadBinaryFile(
+	__in PCWSTR Path,
+	__out PBINARY_FILE_CONTENTS Contents
+	)
+{
+	Contents->Count		= 0;
+	Contents->FirstCode	= 0;
+	Contents->LastCode	= 0;
+	Contents->InOrder	= TRUE;
+
+	TEST_HR( CdiagReadBinaryFile( Path, CollectBinaryFileEvent, Contents ) );
+}
+
+static VOID HandleTraceEvents(
+	__in PCDIAG_HANDLER Hdl,
+	__in DWORD FirstCode,
+	__in DWORD Count
+	)
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	FILETIME Ft = { 1, 2 };
+	DWORD Code;
+
+	for ( Code = FirstCode; Code < FirstCode + Count; Code++ )
+	{
+		Pkt = CreateEventPacket(
+			CdiagTraceEvent,
+			0,
+			CdiagTraceSeverity,
+			CdiagUserMode,
+			NULL,
+			GetCurrentProcessId(),
+			GetCurrentThreadId(),
+			&Ft,
+			Code,
+			L"Trace",
+			FALSE,
+			NULL,
+			NULL,
+			NULL,
+			0 );
+
+		TEST_HR( Hdl->Handle( Hdl, Pkt ) );
+		CdiagReleaseEventPacket( Pkt );
+	}
+}
+
+VOID TestBinaryFileHandler()
+{
+	BINARY_FILE_CONTENTS Contents;
+	PCDIAG_HANDLER Handler;
+	HANDLE File;
+	DWORD Written;
+
+	TEST( E_INVALIDARG == CdiagCreateBinaryFileHandler( NULL, 0, &Handler ) );
+	TEST( E_INVALIDARG == CdiagReadBinaryFile( 
+		L"__binary.bin", 
+		NULL, 
+		NULL ) );
+
+	//
+	// Not a binary file.
+	//
+	File = CreateFile(
+		L"__notbinary.bin",
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		0,
+		NULL );
+	TEST( File != INVALID_HANDLE_VALUE );
+	TEST( WriteFile( File, "text", 4, &Written, NULL ) );
+	TEST( CloseHandle( File ) );
+
+	TEST( CDIAG_E_INVALID_BINARY_FILE == CdiagReadBinaryFile( 
+		L"__notbinary.bin", 
+		CollectBinaryFileEvent, 
+		&Contents ) );
+
+	DeleteFile( L"__binary.bin" );
+	TEST_HR( CdiagCreateBinaryFileHandler( L"__binary.bin", 0, &Handler ) );
+	TestNonChainableHandler( Handler );
+	Handler->Dereference( Handler );
+
+	//
+	// Smallest file possible. Events must be readable while the
+	// handler is still writing.
+	//
+	DeleteFile( L"__binary.bin" );
+	TEST_HR( CdiagCreateBinaryFileHandler( L"__binary.bin", 1, &Handler ) );
+
+	HandleTraceEvents( Handler, 0, 100 );
+	ReadBinaryFile( L"__binary.bin", &Contents );
+	TEST( Contents.Count == 100 );
+	TEST( Contents.FirstCode == 0 );
+	TEST( Contents.LastCode == 99 );
+	TEST( Contents.InOrder );
+
+	//
+	// Wrap around several times - oldest events are lost.
+	//
+	HandleTraceEvents( Handler, 100, 100000 );
+	ReadBinaryFile( L"__binary.bin", &Contents );
+	TEST( Contents.Count > 0 );
+	TEST( Contents.FirstCode > 0 );
+	TEST( Contents.LastCode == 100099 );
+	TEST( Contents.InOrder );
+
+	Handler->Dereference( Handler );
+
+	//
+	// A new handler continues where the last one left off.
+	//
+	TEST_HR( CdiagCreateBinaryFileHandler( L"__binary.bin", 1, &Handler ) );
+	HandleTraceEvents( Handler, 100100, 1 );
+	Handler->Dereference( Handler );
+
+	ReadBinaryFile( L"__binary.bin", &Contents );
+	TEST( Contents.LastCode == 100100 );
+	TEST( Contents.InOrder );
+
+	DeleteFile( L"__binary.bin" );
+	DeleteFile( L"__notbinary.bin" );
+}
+
+typedef struct _RAW_EVENT_PACKET
+{
+	CDIAG_EVENT_PACKET Packet;
+	DWORD MoreOffsets[ CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS ];
+	WCHAR Data[ 16 ];
+} RAW_EVENT_PACKET, *PRAW_EVENT_PACKET;
+
+typedef enum
+{
+	RawTooManyInsertionStrings,
+	RawInsertionStringOutOfRange,
+	RawMessageOutOfRange,
+	RawMessageUnterminated,
+	RawDebugInfoOutOfRange,
+	RawDebugInfoStringOutOfRange,
+	RawCustomDataOutOfRange,
+	RawWellFormed
+} RAW_EVENT_PACKET_KIND;
+
+static VOID HandleRawTraceEvent(
+	__in PCDIAG_HANDLER Hdl,
+	__in RAW_EVENT_PACKET_KIND Kind,
+	__in DWORD Code
+	)
+{
+	RAW_EVENT_PACKET Raw;
+	PCDIAG_DEBUG_INFO DebugInfo;
+	DWORD DataOffset = FIELD_OFFSET( RAW_EVENT_PACKET, Data );
+
+	ZeroMemory( &Raw, sizeof( RAW_EVENT_PACKET ) );
+	Raw.Packet.Size			= sizeof( CDIAG_EVENT_PACKET );
+	Raw.Packet.TotalSize	= sizeof( RAW_EVENT_PACKET );
+	Raw.Packet.Type			= CdiagTraceEvent;
+	Raw.Packet.Severity		= CdiagTraceSeverity;
+	Raw.Packet.Code			= Code;
+
+	switch ( Kind )
+	{
+	case RawTooManyInsertionStrings:
+		Raw.Packet.MessageInsertionStrings.Count = 
+			CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS + 1;
+		break;
+
+	case RawInsertionStringOutOfRange:
+		Raw.Packet.MessageInsertionStrings.Count = 1;
+		Raw.Packet.MessageInsertionStrings.Offset[ 0 ] = 0xFFFF;
+		break;
+
+	case RawMessageOutOfRange:
+		Raw.Packet.MessageOffset = sizeof( RAW_EVENT_PACKET );
+		break;
+
+	case RawMessageUnterminated:
+		wmemset( Raw.Data, L'x', _countof( Raw.Data ) );
+		Raw.Packet.MessageOffset = DataOffset;
+		break;
+
+	case RawDebugInfoOutOfRange:
+		Raw.Packet.DebugInfoOffset = sizeof( RAW_EVENT_PACKET ) - sizeof( DWORD );
+		break;
+
+	case RawDebugInfoStringOutOfRange:
+		DebugInfo = ( PCDIAG_DEBUG_INFO ) Raw.Data;
+		DebugInfo->Size			= sizeof( CDIAG_DEBUG_INFO );
+		DebugInfo->TotalSize	= sizeof( CDIAG_DEBUG_INFO );
+		DebugInfo->ModuleOffset	= 0x1000;
+		Raw.Packet.DebugInfoOffset = DataOffset;
+		break;
+
+	case RawCustomDataOutOfRange:
+		Raw.Packet.CustomData.Offset = DataOffset;
+		Raw.Packet.CustomData.Length = sizeof( Raw.Data ) + 1;
+		break;
+
+	case RawWellFormed:
+		TEST_HR( StringCchCopy( Raw.Data, _countof( Raw.Data ), L"Trace" ) );
+		Raw.Packet.MessageInsertionStrings.Count = 1;
+		Raw.Packet.MessageInsertionStrings.Offset[ 0 ] = DataOffset;
+		Raw.Packet.MessageOffset = DataOffset;
+		break;
+
+	default:
+		TEST( !"Invalid kind" );
+	}
+
+	TEST_HR( Hdl->Handle( Hdl, &Raw.Packet ) );
+}
+
+VOID TestReadMalformedBinaryFile()
+{
+	BINARY_FILE_CONTENTS Contents;
+	PCDIAG_HANDLER Handler;
+	ULONG Kind;
+
+	DeleteFile( L"__binary.bin" );
+	TEST_HR( CdiagCreateBinaryFileHandler( L"__binary.bin", 1, &Handler ) );
+
+	//
+	// Malformed packets must be skipped, i.e. must neither be
+	// passed to the callback nor affect the packets following them.
+	//
+	HandleTraceEvents( Handler, 0, 10 );
+	for ( Kind = RawTooManyInsertionStrings; Kind < RawWellFormed; Kind++ )
+	{
+		HandleRawTraceEvent( Handler, ( RAW_EVENT_PACKET_KIND ) Kind, MAXDWORD );
+	}
+	HandleRawTraceEvent( Handler, RawWellFormed, 10 );
+	HandleTraceEvents( Handler, 11, 10 );
+
+	Handler->Dereference( Handler );
+
+	ReadBinaryFile( L"__binary.bin", &Contents );
+	TEST( Contents.Count == 21 );
+	TEST( Contents.FirstCode == 0 );
+	TEST( Contents.LastCode == 20 );
+	TEST( Contents.InOrder );
+
+	DeleteFile( L"__binary.bin" );
+}
+
 CFIX_BEGIN_FIXTURE( Handlers )
 	CFIX_FIXTURE_ENTRY( TestHandlers )
+	CFIX_FIXTURE_ENTRY( TestBufferedTextFileHandler )
+	CFIX_FIXTURE_ENTRY( TestBatchingOutputHandler )
+	CFIX_FIXTURE_ENTRY( TestRotatingTextFileHandler )
+	CFIX_FIXTURE_ENTRY( TestBinaryFileHandler )
+	CFIX_FIXTURE_ENTRY( TestReadMalformedBinaryFile )
 CFIX_END_FIXTURE()
 
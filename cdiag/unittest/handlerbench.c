@@ -0,0 +1,174 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Handler benchmark.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+#include "eventpkt.h"
+
+#define BENCH_EVENT_COUNT	1000000
+
+/*++
+	Routine Description:
+		Measure events per second written by the binary file 
+		handler on a single thread. As no formatting takes place,
+		the handler should be bound by copying the packet only.
+--*/
+static VOID BenchmarkBinaryFileHandler()
+{
+	PCDIAG_EVENT_PACKET Pkt;
+	PCDIAG_HANDLER Handler;
+	FILETIME Ft = { 1, 2 };
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	double EventsPerSecond;
+	UINT Index;
+
+	Pkt = CreateEventPacket(
+		CdiagLogEvent,
+		0,
+		CdiagErrorSeverity,
+		CdiagUserMode,
+		L"machine",
+		GetCurrentProcessId(),
+		GetCurrentThreadId(),
+		&Ft,
+		ERROR_BAD_EXE_FORMAT,
+		L"Something failed",
+		TRUE,
+		L"Module",
+		L"Function",
+		L"SourceFile",
+		42 );
+
+	DeleteFile( L"__bench.bin" );
+	TEST_HR( CdiagCreateBinaryFileHandler( L"__bench.bin", 0, &Handler ) );
+
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < BENCH_EVENT_COUNT; Index++ )
+	{
+		TEST_HR( Handler->Handle( Handler, Pkt ) );
+	}
+	TEST( QueryPerformanceCounter( &Stop ) );
+
+	EventsPerSecond = BENCH_EVENT_COUNT * ( double ) Frequency.QuadPart /
+		( double ) ( Stop.QuadPart - Start.QuadPart );
+
+	CFIX_LOG(
+		L"Binary file handler: %10.0f events/s, %u bytes/event",
+		EventsPerSecond,
+		Pkt->TotalSize );
+
+	Handler->Dereference( Handler );
+	CdiagReleaseEventPacket( Pkt );
+
+	DeleteFile( L"__bench.bin" );
+}
+
+#define BENCH_OUTPUT_EVENT_COUNT	100000
+
+static double MeasureOutputHandler(
+	__in PCDIAG_HANDLER Handler,
+	__in PCDIAG_EVENT_PACKET Pkt
+	)
+{
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	UINT Index;
+
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < BENCH_OUTPUT_EVENT_COUNT; Index++ )
+	{
+		TEST_HR( Handler->Handle( Handler, Pkt ) );
+	}
+
+	//
+	// Include the final batch.
+	//
+	Handler->Dereference( Handler );
+	TEST( QueryPerformanceCounter( &Stop ) );
+
+	return BENCH_OUTPUT_EVENT_COUNT * ( double ) Frequency.QuadPart /
+		( double ) ( Stop.QuadPart - Start.QuadPart );
+}
+
+/*++
+	Routine Description:
+		Measure events per second passed to OutputDebugString with
+		and without batching. Run with and without a debugger 
+		attached to see the difference.
+--*/
+static VOID BenchmarkOutputHandler()
+{
+	CDIAG_SESSION_HANDLE Session;
+	PCDIAG_EVENT_PACKET Pkt;
+	PCDIAG_HANDLER Handler;
+	FILETIME Ft = { 1, 2 };
+	double Plain;
+	double Batched;
+
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Session ) );
+
+	Pkt = CreateEventPacket(
+		CdiagLogEvent,
+		0,
+		CdiagErrorSeverity,
+		CdiagUserMode,
+		L"machine",
+		GetCurrentProcessId(),
+		GetCurrentThreadId(),
+		&Ft,
+		ERROR_BAD_EXE_FORMAT,
+		L"Something failed",
+		TRUE,
+		L"Module",
+		L"Function",
+		L"SourceFile",
+		42 );
+
+	TEST_HR( CdiagCreateOutputHandler( Session, OutputDebugString, &Handler ) );
+	Plain = MeasureOutputHandler( Handler, Pkt );
+
+	TEST_HR( CdiagCreateBatchingOutputHandler( 
+		Session, 
+		OutputDebugString, 
+		0, 
+		0, 
+		&Handler ) );
+	Batched = MeasureOutputHandler( Handler, Pkt );
+
+	CFIX_LOG(
+		L"Output handler: %10.0f events/s, batched: %10.0f events/s",
+		Plain,
+		Batched );
+
+	CdiagReleaseEventPacket( Pkt );
+	TEST_HR( CdiagDereferenceSession( Session ) );
+}
+
+CFIX_BEGIN_FIXTURE( HandlerBenchmark )
+	CFIX_FIXTURE_ENTRY( BenchmarkBinaryFileHandler )
+	CFIX_FIXTURE_ENTRY( BenchmarkOutputHandler )
+CFIX_END_FIXTURE()
@@ -0,0 +1,282 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Test case for the INI file configuration store
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#define GLOBAL_INI	L"__global.ini"
+#define USER_INI	L"__user.ini"
+
+static void WriteIniFile( PCWSTR Path, PCSTR Contents )
+{
+	HANDLE File = CreateFile(
+		Path,
+		GENERIC_WRITE,
+		FILE_SHARE_READ,
+		NULL,
+		CREATE_ALWAYS,
+		0,
+		NULL );
+	CFIX_ASSUME( File != INVALID_HANDLE_VALUE );
+
+	DWORD Written;
+	TEST( WriteFile(
+		File,
+		Contents,
+		( DWORD ) strlen( Contents ),
+		&Written,
+		NULL ) );
+	TEST( CloseHandle( File ) );
+}
+
+static VOID CALLBACK UpdateCallback( PVOID Context )
+{
+	TEST( SetEvent( ( HANDLE ) Context ) );
+}
+
+static void TestInvalidArgs()
+{
+	PCDIAG_CONFIGURATION_STORE Store;
+
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_ACCESS_ALL, NULL ) );
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, 0, &Store ) );
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_CACHE_SETTINGS, &Store ) );
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		NULL, USER_INI, CDIAG_CFGS_ACCESS_ALL, &Store ) );
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		GLOBAL_INI, NULL, CDIAG_CFGS_ACCESS_ALL, &Store ) );
+	TEST( E_INVALIDARG == CdiagCreateIniFileStore(
+		GLOBAL_INI, L"", CDIAG_CFGS_ACCESS_ALL, &Store ) );
+
+	//
+	// Only the paths of scopes used are required.
+	//
+	TEST_HR( CdiagCreateIniFileStore(
+		NULL, USER_INI, CDIAG_CFGS_ACCESS_READ_USER, &Store ) );
+	TEST( E_ACCESSDENIED == Store->WriteDwordSetting(
+		Store, L"A", L"B", CdiagUserScope, 1 ) );
+	TEST( E_ACCESSDENIED == Store->WriteDwordSetting(
+		Store, L"A", L"B", CdiagGlobalScope, 1 ) );
+	TEST_HR( Store->Delete( Store ) );
+
+	TEST_HR( CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_ACCESS_ALL, &Store ) );
+
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A[", L"B", CdiagUserScope, 1 ) );
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A]", L"B", CdiagUserScope, 1 ) );
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A", L"B=", CdiagUserScope, 1 ) );
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A", L";B", CdiagUserScope, 1 ) );
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A", L"B\n", CdiagUserScope, 1 ) );
+	TEST( E_INVALIDARG == Store->WriteDwordSetting( Store, L"A", L"B", CdiagEffectiveScope, 1 ) );
+
+	TEST_HR( Store->Delete( Store ) );
+
+	DeleteFile( GLOBAL_INI );
+	DeleteFile( USER_INI );
+}
+
+static void TestReadHandWrittenFile()
+{
+	PCDIAG_CONFIGURATION_STORE Store;
+	WCHAR Buffer[ 32 ];
+	DWORD Dword;
+
+	WriteIniFile(
+		GLOBAL_INI,
+		"\xEF\xBB\xBF"
+		"; Comment\r\n"
+		"\r\n"
+		"[Group]\r\n"
+		"Dword=dword:0x2A\r\n"
+		"String=sz:a\\\\b\\r\\nc\r\n"
+		"Multi=multi_sz:Foo\\0Bar\r\n"
+		"\r\n"
+		"[Other]\n"
+		"Dword=dword:7\n" );
+	WriteIniFile(
+		USER_INI,
+		"[group]\r\n"
+		"dword=dword:1\r\n" );
+
+	TEST_HR( CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_ACCESS_ALL, &Store ) );
+
+	TEST_HR( Store->ReadDwordSetting( Store, L"Group", L"Dword", CdiagGlobalScope, &Dword ) );
+	TEST( Dword == 42 );
+	TEST_HR( Store->ReadDwordSetting( Store, L"Group", L"Dword", CdiagUserScope, &Dword ) );
+	TEST( Dword == 1 );
+	TEST_HR( Store->ReadDwordSetting( Store, L"Group", L"Dword", CdiagEffectiveScope, &Dword ) );
+	TEST( Dword == 1 );
+	TEST_HR( Store->ReadDwordSetting( Store, L"Other", L"Dword", CdiagEffectiveScope, &Dword ) );
+	TEST( Dword == 7 );
+
+	TEST_HR( Store->ReadStringSetting(
+		Store, L"Group", L"String", CdiagEffectiveScope, _countof( Buffer ), Buffer, NULL ) );
+	TEST( 0 == wcscmp( Buffer, L"a\\b\r\nc" ) );
+
+	TEST_HR( Store->ReadMultiStringSetting(
+		Store, L"Group", L"Multi", CdiagEffectiveScope, _countof( Buffer ), Buffer, NULL ) );
+	TEST( 0 == memcmp( Buffer, L"Foo\0Bar\0", 9 * sizeof( WCHAR ) ) );
+
+	TEST( CDIAG_E_SETTING_MISMATCH == Store->ReadDwordSetting(
+		Store, L"Group", L"String", CdiagEffectiveScope, &Dword ) );
+	TEST( CDIAG_E_SETTING_NOT_FOUND == Store->ReadDwordSetting(
+		Store, L"Group", L"Missing", CdiagEffectiveScope, &Dword ) );
+
+	TEST_HR( Store->Delete( Store ) );
+
+	DeleteFile( GLOBAL_INI );
+	DeleteFile( USER_INI );
+}
+
+static void TestRejectMalformedFile()
+{
+	PCSTR Malformed[] =
+	{
+		"Name=dword:1\r\n",
+		"[Group\r\n",
+		"[Group]\r\nName\r\n",
+		"[Group]\r\nName=dword:\r\n",
+		"[Group]\r\nName=dword:-1\r\n",
+		"[Group]\r\nName=qword:1\r\n",
+		"[Group]\r\nName=sz:\\x\r\n",
+		"[Group]\r\nName=sz:a\\0b\r\n",
+		"[Group]\r\nName=multi_sz:a\\0\\0b\r\n",
+		"[Group]\r\n=sz:a\r\n",
+		"[Group]\r\nName=sz:\xC0\r\n"
+	};
+
+	for ( UINT i = 0; i < _countof( Malformed ); i++ )
+	{
+		PCDIAG_CONFIGURATION_STORE Store;
+
+		WriteIniFile( GLOBAL_INI, Malformed[ i ] );
+		TEST( CDIAG_E_INVALID_CONFIGURATION_FILE == CdiagCreateIniFileStore(
+			GLOBAL_INI, NULL, CDIAG_CFGS_ACCESS_READ_MACHINE, &Store ) );
+	}
+
+	DeleteFile( GLOBAL_INI );
+}
+
+static void TestWriteAndReload()
+{
+	PCDIAG_CONFIGURATION_STORE Writer;
+	PCDIAG_CONFIGURATION_STORE Reader;
+	WCHAR Buffer[ 32 ];
+	DWORD Dword;
+
+	DeleteFile( GLOBAL_INI );
+	DeleteFile( USER_INI );
+
+	TEST_HR( CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_ACCESS_ALL, &Writer ) );
+
+	TEST( CDIAG_E_SETTING_NOT_FOUND == Writer->DeleteSetting(
+		Writer, L"A", L"B", CdiagUserScope ) );
+
+	TEST_HR( Writer->WriteDwordSetting( Writer, L"A", L"Dword", CdiagUserScope, 0xF00 ) );
+	TEST_HR( Writer->WriteStringSetting( Writer, L"A", L"String", CdiagUserScope, L"x=y;\\z\r\n" ) );
+	TEST_HR( Writer->WriteMultiStringSetting( Writer, L"B", L"Multi", CdiagGlobalScope, L"Foo\0Bar\0" ) );
+	TEST_HR( Writer->WriteStringSetting( Writer, L"B", L"Empty", CdiagGlobalScope, L"" ) );
+	TEST_HR( Writer->WriteStringSetting( Writer, L"B", L"Deleted", CdiagGlobalScope, L"" ) );
+	TEST_HR( Writer->DeleteSetting( Writer, L"B", L"Deleted", CdiagGlobalScope ) );
+
+	//
+	// Written settings are visible immediately.
+	//
+	TEST_HR( Writer->ReadDwordSetting( Writer, L"A", L"Dword", CdiagUserScope, &Dword ) );
+	TEST( Dword == 0xF00 );
+
+	//
+	// ...and survive a round trip through the file.
+	//
+	TEST_HR( CdiagCreateIniFileStore(
+		GLOBAL_INI, USER_INI, CDIAG_CFGS_ACCESS_READ_USER | CDIAG_CFGS_ACCESS_READ_MACHINE, &Reader ) );
+
+	TEST_HR( Reader->ReadDwordSetting( Reader, L"A", L"Dword", CdiagEffectiveScope, &Dword ) );
+	TEST( Dword == 0xF00 );
+	TEST_HR( Reader->ReadStringSetting(
+		Reader, L"A", L"String", CdiagEffectiveScope, _countof( Buffer ), Buffer, NULL ) );
+	TEST( 0 == wcscmp( Buffer, L"x=y;\\z\r\n" ) );
+	TEST_HR( Reader->ReadMultiStringSetting(
+		Reader, L"B", L"Multi", CdiagGlobalScope, _countof( Buffer ), Buffer, NULL ) );
+	TEST( 0 == memcmp( Buffer, L"Foo\0Bar\0", 9 * sizeof( WCHAR ) ) );
+	TEST_HR( Reader->ReadStringSetting(
+		Reader, L"B", L"Empty", CdiagGlobalScope, _countof( Buffer ), Buffer, NULL ) );
+	TEST( Buffer[ 0 ] == UNICODE_NULL );
+	TEST( CDIAG_E_SETTING_NOT_FOUND == Reader->ReadStringSetting(
+		Reader, L"B", L"Deleted", CdiagGlobalScope, _countof( Buffer ), Buffer, NULL ) );
+
+	TEST_HR( Reader->Delete( Reader ) );
+	TEST_HR( Writer->Delete( Writer ) );
+
+	DeleteFile( GLOBAL_INI );
+	DeleteFile( USER_INI );
+}
+
+static void TestExternalChangeIsPickedUp()
+{
+	PCDIAG_CONFIGURATION_STORE Store;
+	DWORD Dword;
+
+	WriteIniFile( USER_INI, "[A]\r\nB=dword:1\r\n" );
+
+	HANDLE Event = CreateEvent( NULL, FALSE, FALSE, NULL );
+	CFIX_ASSUME( Event != NULL );
+
+	TEST_HR( CdiagCreateIniFileStore(
+		NULL, USER_INI, CDIAG_CFGS_ACCESS_READ_USER, &Store ) );
+	TEST_HR( Store->RegisterUpdateCallback( Store, UpdateCallback, Event ) );
+
+	TEST_HR( Store->ReadDwordSetting( Store, L"A", L"B", CdiagUserScope, &Dword ) );
+	TEST( Dword == 1 );
+
+	WriteIniFile( USER_INI, "[A]\r\nB=dword:2\r\n" );
+
+	//
+	// The directory may be notified about more than one change - wait
+	// until the new value has been picked up.
+	//
+	for ( UINT i = 0; i < 10 && Dword != 2; i++ )
+	{
+		TEST( WAIT_OBJECT_0 == WaitForSingleObject( Event, 5000 ) );
+		TEST_HR( Store->ReadDwordSetting( Store, L"A", L"B", CdiagUserScope, &Dword ) );
+	}
+
+	TEST( Dword == 2 );
+
+	TEST_HR( Store->Delete( Store ) );
+	TEST( CloseHandle( Event ) );
+
+	DeleteFile( USER_INI );
+}
+
+CFIX_BEGIN_FIXTURE( IniFileStore )
+	CFIX_FIXTURE_ENTRY( TestInvalidArgs )
+	CFIX_FIXTURE_ENTRY( TestReadHandWrittenFile )
+	CFIX_FIXTURE_ENTRY( TestRejectMalformedFile )
+	CFIX_FIXTURE_ENTRY( TestWriteAndReload )
+	CFIX_FIXTURE_ENTRY( TestExternalChangeIsPickedUp )
+CFIX_END_FIXTURE()
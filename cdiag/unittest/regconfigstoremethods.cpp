@@ -137,7 +137,9 @@ static struct _PARAM_ACCESS
 };
 
 
-static void TestCdiagCreateRegistryStoreMethod()
+static void TestRegistryStoreMethods(
+	__in DWORD CacheMode
+	)
 {
 	PCDIAG_CONFIGURATION_STORE Store;
 	PCWSTR BaseKeyName = L"Software\\JP\\__test";
@@ -157,7 +159,7 @@ static void TestCdiagCreateRegistryStoreMethod()
 	TEST_HR( EnableRegistryRedirection( L"Software\\JP\\__test\\virtual" ) );
 
 	TEST_HR( CdiagCreateRegistryStore( 
-		BaseKeyName, CDIAG_CFGS_ACCESS_ALL, &Store ) );
+		BaseKeyName, CDIAG_CFGS_ACCESS_ALL | CacheMode, &Store ) );
 
 	//
 	// Test deletion
@@ -221,7 +223,7 @@ static void TestCdiagCreateRegistryStoreMethod()
 				HRESULT expectedHr;
 				TEST_HR( CdiagCreateRegistryStore( 
 					BaseKeyName, 
-					access->AccessMode, 
+					access->AccessMode | CacheMode, 
 					&Store ) );
 
 				//
@@ -465,6 +467,17 @@ static void TestCdiagCreateRegistryStoreMethod()
 	TEST_HR( DisableRegistryRedirection() );
 }
 
+static void TestCdiagCreateRegistryStoreMethod()
+{
+	TestRegistryStoreMethods( 0 );
+}
+
+static void TestCdiagCreateRegistryStoreMethodCached()
+{
+	TestRegistryStoreMethods( CDIAG_CFGS_CACHE_SETTINGS );
+}
+
 CFIX_BEGIN_FIXTURE( RegistryStoreMethods )
 	CFIX_FIXTURE_ENTRY( TestCdiagCreateRegistryStoreMethod )
+	CFIX_FIXTURE_ENTRY( TestCdiagCreateRegistryStoreMethodCached )
 CFIX_END_FIXTURE()
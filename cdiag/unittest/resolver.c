@@ -246,10 +246,82 @@ static VOID TestResolveMessages()
 
 }
 
+static VOID TestCachedMessages()
+{
+	PCDIAG_MESSAGE_RESOLVER Res = NULL;
+	WCHAR Buffer[ 512 ];
+	DWORD MsgCode;
+	UINT Round;
+
+	TEST_HR( CdiagCreateMessageResolver( &Res ) );
+	TEST( Res );
+	if ( ! Res ) return;
+
+	//
+	// Repeated resolutions must yield the same result, inserts being
+	// applied on every call.
+	//
+	TEST_HR( Res->RegisterMessageDll( Res, L"cdiag.dll", 0, 0 ) );
+	for ( Round = 0; Round < 3; Round++ )
+	{
+		TEST_HR( Res->ResolveMessage(
+			Res, 0x800481ff, CDIAG_MSGRES_NO_SYSTEM, 
+			Insertions, _countof( Buffer ), Buffer ) );
+		TEST( 0 == wcscmp( Buffer, L"Test=one,two" ) );
+
+		TEST_HR( Res->ResolveMessage(
+			Res, 0x800481ff, CDIAG_MSGRES_RESOLVE_IGNORE_INSERTS, 
+			NULL, _countof( Buffer ), Buffer ) );
+		TEST( 0 == wcscmp( Buffer, L"Test=%1,%2" ) );
+
+		TEST( CDIAG_E_BUFFER_TOO_SMALL == Res->ResolveMessage(
+			Res, 0x800481ff, 0, Insertions, 5, Buffer ) );
+	}
+
+	//
+	// Unregistering must invalidate cached templates...
+	//
+	TEST_HR( Res->UnregisterMessageDll( Res, L"cdiag.dll" ) );
+	TEST( CDIAG_E_UNKNOWN_MESSAGE == Res->ResolveMessage(
+		Res, 0x800481ff, CDIAG_MSGRES_NO_SYSTEM, 
+		Insertions, _countof( Buffer ), Buffer ) );
+
+	//
+	// ...and registering cached misses.
+	//
+	TEST_HR( Res->RegisterMessageDll( Res, L"cdiag.dll", 0, 0 ) );
+	TEST_HR( Res->ResolveMessage(
+		Res, 0x800481ff, CDIAG_MSGRES_NO_SYSTEM, 
+		Insertions, _countof( Buffer ), Buffer ) );
+	TEST( 0 == wcscmp( Buffer, L"Test=one,two" ) );
+
+	//
+	// Exceed cache capacity.
+	//
+	for ( MsgCode = 0; MsgCode < 1024; MsgCode++ )
+	{
+		HRESULT Hr = Res->ResolveMessage(
+			Res, MsgCode, CDIAG_MSGRES_RESOLVE_IGNORE_INSERTS, 
+			NULL, _countof( Buffer ), Buffer );
+		TEST( S_OK == Hr || CDIAG_E_UNKNOWN_MESSAGE == Hr );
+	}
+
+	TEST_HR( Res->ResolveMessage(
+		Res, 2, 0, NULL, _countof( Buffer ), Buffer ) );
+	TEST( 0 == wcsncmp( Buffer, L"The system cannot", 17 ) );
+	TEST_HR( Res->ResolveMessage(
+		Res, 0x800481ff, 0, Insertions, _countof( Buffer ), Buffer ) );
+	TEST( 0 == wcscmp( Buffer, L"Test=one,two" ) );
+
+	TEST_HR( Res->UnregisterMessageDll( Res, L"cdiag.dll" ) );
+	Res->Dereference( Res );
+}
+
 CFIX_BEGIN_FIXTURE( Resolver )
 	CFIX_FIXTURE_ENTRY( TestDelete )
 	CFIX_FIXTURE_ENTRY( TestRegisterUnregisterMessageDll )
 	CFIX_FIXTURE_ENTRY( TestResolveMessageInvalids )
 	CFIX_FIXTURE_ENTRY( TestResolveMessages )
+	CFIX_FIXTURE_ENTRY( TestCachedMessages )
 CFIX_END_FIXTURE()
 
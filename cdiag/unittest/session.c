@@ -36,6 +36,64 @@ static VOID CALLBACK SpecificHdlOutput( PCWSTR Text )
 	SpecificHdlOutputCalls++;
 }
 
+#define ASYNC_PRODUCER_COUNT	4
+#define ASYNC_EVENT_COUNT		1000
+
+static volatile LONG AsyncHdlOutputCalls = 0;
+static HANDLE AsyncHdlGate = NULL;
+
+static VOID CALLBACK AsyncHdlOutput( PCWSTR Text )
+{
+	UNREFERENCED_PARAMETER( Text );
+
+	if ( AsyncHdlGate != NULL )
+	{
+		( VOID ) WaitForSingleObject( AsyncHdlGate, INFINITE );
+	}
+
+	InterlockedIncrement( &AsyncHdlOutputCalls );
+}
+
+typedef struct _ASYNC_PRODUCER
+{
+	CDIAG_SESSION_HANDLE Session;
+	ULONG Failures;
+} ASYNC_PRODUCER, *PASYNC_PRODUCER;
+
+static DWORD CALLBACK AsyncProducerProc( PVOID Param )
+{
+	PASYNC_PRODUCER Producer = ( PASYNC_PRODUCER ) Param;
+	WCHAR LongMessage[ 2048 ];
+	ULONG Index;
+
+	wmemset( LongMessage, L'x', _countof( LongMessage ) - 1 );
+	LongMessage[ _countof( LongMessage ) - 1 ] = UNICODE_NULL;
+
+	for ( Index = 0; Index < ASYNC_EVENT_COUNT; Index++ )
+	{
+		PCDIAG_EVENT_PACKET Pkt;
+
+		//
+		// Every tenth packet requires an overflow block.
+		//
+		if ( FAILED( CdiagBeginEventPacket(
+				CdiagLogEvent,
+				0,
+				CdiagInfoSeverity,
+				0,
+				&Pkt ) ) ||
+			 FAILED( CdiagSetMessageEventPacket(
+				Pkt,
+				( Index % 10 ) == 0 ? LongMessage : L"message" ) ) ||
+			 S_OK != CdiagCommitEventPacket( Producer->Session, Pkt ) )
+		{
+			Producer->Failures++;
+		}
+	}
+
+	return 0;
+}
+
 static VOID TestCreateAndCloseSession()
 {
 	CDIAG_SESSION_HANDLE Ssn;
@@ -163,14 +221,15 @@ static VOID TestCreateAndCloseSession()
 
 static VOID TestHandling()
 {
-	EVENT_PACKET_WITH_DATA Pkt;
+	PCDIAG_EVENT_PACKET Pkt;
 	FILETIME Ft = { 1, 2 };
 	PCDIAG_HANDLER DefHdl;
 	PCDIAG_HANDLER Hdl;
 	CDIAG_SESSION_HANDLE Ssn;
 	DWORD Filter;
+	ULONG Guarded;
 
-	InitializeEventPacket(
+	Pkt = CreateEventPacket(
 		CdiagLogEvent,
 		0,
 		CdiagFatalSeverity,
@@ -185,8 +244,7 @@ static VOID TestHandling()
 		L"Module",
 		L"Function",
 		L"SourceFile",
-		42,
-		&Pkt );
+		42 );
 
 	TEST_HR( CdiagCreateSession( NULL, NULL, &Ssn ) );
 	CFIX_ASSUME( Ssn );
@@ -201,7 +259,9 @@ static VOID TestHandling()
 	//
 	// Handle w/o handlers.
 	//
-	TEST( S_FALSE == CdiagHandleEvent( Ssn, &Pkt.EventPacket ) );
+	TEST( S_FALSE == CdiagHandleEvent( Ssn, Pkt ) );
+	TEST( ! CdiagIsEventEnabled( Ssn, CdiagLogEvent, CdiagFatalSeverity ) );
+	TEST( ! CDIAG_IS_TRACE_ENABLED( Ssn ) );
 
 	//
 	// Install def. hdl. (twice).
@@ -236,11 +296,47 @@ static VOID TestHandling()
 	//
 	// Handle via def. hdl.
 	//
-	TEST( S_OK == CdiagHandleEvent( Ssn, &Pkt.EventPacket ) );
+	TEST( S_OK == CdiagHandleEvent( Ssn, Pkt ) );
 	TEST( DefHdlOutputCalls == 1 );
 	DefHdlOutputCalls = 0;
 
+	TEST( CdiagIsEventEnabled( Ssn, CdiagLogEvent, CdiagFatalSeverity ) );
+	TEST( CDIAG_IS_TRACE_ENABLED( Ssn ) );
+
+	//
+	// An else following the guard binds to the enclosing if.
+	//
+	Guarded = 0;
+	if ( Ssn != NULL )
+		CDIAG_IF_EVENT_ENABLED( Ssn, CdiagLogEvent, CdiagFatalSeverity )
+			Guarded = 1;
+	else
+		Guarded = 2;
+	TEST( Guarded == 1 );
+
+	Guarded = 0;
+	if ( Ssn != NULL )
+		CDIAG_IF_EVENT_ENABLED( 
+			Ssn, 
+			( CDIAG_EVENT_TYPE ) ( CdiagMaxEvent + 1 ), 
+			CdiagFatalSeverity )
+			Guarded = 1;
+	else
+		Guarded = 2;
+	TEST( Guarded == 0 );
 
+	//
+	// Invalid arguments are never enabled.
+	//
+	TEST( ! CdiagIsEventEnabled( NULL, CdiagLogEvent, CdiagFatalSeverity ) );
+	TEST( ! CdiagIsEventEnabled( 
+		Ssn, 
+		( CDIAG_EVENT_TYPE ) ( CdiagMaxEvent + 1 ), 
+		CdiagFatalSeverity ) );
+	TEST( ! CdiagIsEventEnabled( 
+		Ssn, 
+		CdiagLogEvent, 
+		( CDIAG_SEVERITY_LEVEL ) ( CdiagMaxSeverity + 1 ) ) );
 
 	//
 	// Install specific handler #1 (twice).
@@ -262,6 +358,16 @@ static VOID TestHandling()
 		CdiagSessionHandler,
 		CdiagLogEvent,
 		Hdl ) );
+
+	//
+	// Event types are bounded.
+	//
+	TEST( E_INVALIDARG == CdiagSetInformationSession(
+		Ssn,
+		CdiagSessionHandler,
+		CdiagMaxEvent + 1,
+		Hdl ) );
+
 	Hdl->Dereference( Hdl );
 	Hdl = NULL;
 
@@ -289,13 +395,13 @@ static VOID TestHandling()
 	//
 	// Handle one via defhdl, one via specific hdl.
 	//
-	Pkt.EventPacket.Type = CdiagTraceEvent;
-	TEST( S_OK == CdiagHandleEvent( Ssn, &Pkt.EventPacket ) );
+	Pkt->Type = CdiagTraceEvent;
+	TEST( S_OK == CdiagHandleEvent( Ssn, Pkt ) );
 	TEST( DefHdlOutputCalls == 1 );
 	DefHdlOutputCalls = 0;
 
-	Pkt.EventPacket.Type = CdiagLogEvent;
-	TEST( S_OK == CdiagHandleEvent( Ssn, &Pkt.EventPacket ) );
+	Pkt->Type = CdiagLogEvent;
+	TEST( S_OK == CdiagHandleEvent( Ssn, Pkt ) );
 	TEST( SpecificHdlOutputCalls == 1 );
 	SpecificHdlOutputCalls = 0;
 
@@ -322,6 +428,14 @@ static VOID TestHandling()
 		( PVOID* ) &Filter ) );
 	TEST( Filter == 2 );
 
+	//
+	// Only debug log events remain enabled, trace events still go
+	// to the default handler.
+	//
+	TEST( CDIAG_IS_DEBUG_ENABLED( Ssn ) );
+	TEST( ! CdiagIsEventEnabled( Ssn, CdiagLogEvent, CdiagFatalSeverity ) );
+	TEST( CdiagIsEventEnabled( Ssn, CdiagTraceEvent, CdiagFatalSeverity ) );
+
 	//
 	// Get/Set filter of nonex. hdl.
 	//
@@ -341,14 +455,164 @@ static VOID TestHandling()
 	//
 	// Output should be filtered now.
 	//
-	TEST( S_FALSE == CdiagHandleEvent( Ssn, &Pkt.EventPacket ) );
+	TEST( S_FALSE == CdiagCommitEventPacket( Ssn, Pkt ) );
 	TEST( SpecificHdlOutputCalls == 0 );
 
 	TEST_HR( CdiagDereferenceSession( Ssn ) );
 }
 
+static VOID TestAsyncHandling()
+{
+	ASYNC_PRODUCER Producers[ ASYNC_PRODUCER_COUNT ];
+	HANDLE Threads[ ASYNC_PRODUCER_COUNT ];
+	CDIAG_SESSION_HANDLE Ssn;
+	PCDIAG_HANDLER Hdl;
+	DWORD Dropped;
+	ULONG Index;
+
+	TEST( E_INVALIDARG == CdiagCreateAsyncSession( 
+		NULL, NULL, 3, CdiagAsyncBlockOnOverflow, &Ssn ) );
+	TEST( E_INVALIDARG == CdiagCreateAsyncSession( 
+		NULL, NULL, 0, ( CDIAG_ASYNC_OVERFLOW_POLICY ) 2, &Ssn ) );
+
+	//
+	// Synchronous sessions do not drop.
+	//
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Ssn ) );
+	TEST( S_FALSE == CdiagQueryInformationSession(
+		Ssn,
+		CdiagSessionDroppedEvents,
+		0,
+		( PVOID* ) &Dropped ) );
+	TEST( Dropped == 0 );
+	TEST_HR( CdiagFlushSession( Ssn ) );
+	TEST_HR( CdiagDereferenceSession( Ssn ) );
+
+	//
+	// Small ring to make producers block.
+	//
+	TEST_HR( CdiagCreateAsyncSession( 
+		NULL, NULL, 8, CdiagAsyncBlockOnOverflow, &Ssn ) );
+	CFIX_ASSUME( Ssn );
+
+	TEST_HR( CdiagCreateOutputHandler( Ssn, AsyncHdlOutput, &Hdl ) );
+	TEST_HR( CdiagSetInformationSession(
+		Ssn,
+		CdiagSessionDefaultHandler,
+		0,
+		Hdl ) );
+	Hdl->Dereference( Hdl );
+
+	AsyncHdlOutputCalls = 0;
+	for ( Index = 0; Index < ASYNC_PRODUCER_COUNT; Index++ )
+	{
+		Producers[ Index ].Session	= Ssn;
+		Producers[ Index ].Failures	= 0;
+
+		Threads[ Index ] = CreateThread(
+			NULL, 0, AsyncProducerProc, &Producers[ Index ], 0, NULL );
+		CFIX_ASSUME( Threads[ Index ] != NULL );
+	}
+
+	TEST( WAIT_OBJECT_0 == WaitForMultipleObjects(
+		ASYNC_PRODUCER_COUNT,
+		Threads,
+		TRUE,
+		INFINITE ) );
+
+	for ( Index = 0; Index < ASYNC_PRODUCER_COUNT; Index++ )
+	{
+		CloseHandle( Threads[ Index ] );
+		TEST( Producers[ Index ].Failures == 0 );
+	}
+
+	TEST_HR( CdiagFlushSession( Ssn ) );
+	TEST( AsyncHdlOutputCalls == ASYNC_PRODUCER_COUNT * ASYNC_EVENT_COUNT );
+
+	TEST_HR( CdiagQueryInformationSession(
+		Ssn,
+		CdiagSessionDroppedEvents,
+		0,
+		( PVOID* ) &Dropped ) );
+	TEST( Dropped == 0 );
+
+	TEST_HR( CdiagDereferenceSession( Ssn ) );
+}
+
+static VOID TestAsyncDropping()
+{
+	CDIAG_SESSION_HANDLE Ssn;
+	PCDIAG_EVENT_PACKET Pkt;
+	PCDIAG_HANDLER Hdl;
+	ULONG Queued = 0;
+	ULONG Rejected = 0;
+	DWORD Dropped;
+	ULONG Index;
+	HRESULT Hr;
+
+	AsyncHdlGate = CreateEvent( NULL, TRUE, FALSE, NULL );
+	CFIX_ASSUME( AsyncHdlGate != NULL );
+
+	TEST_HR( CdiagCreateAsyncSession( 
+		NULL, NULL, 4, CdiagAsyncDropOnOverflow, &Ssn ) );
+	CFIX_ASSUME( Ssn );
+
+	TEST_HR( CdiagCreateOutputHandler( Ssn, AsyncHdlOutput, &Hdl ) );
+	TEST_HR( CdiagSetInformationSession(
+		Ssn,
+		CdiagSessionDefaultHandler,
+		0,
+		Hdl ) );
+	Hdl->Dereference( Hdl );
+
+	//
+	// The handler is stuck, so the ring must run full.
+	//
+	AsyncHdlOutputCalls = 0;
+	for ( Index = 0; Index < 20; Index++ )
+	{
+		TEST_HR( CdiagBeginEventPacket(
+			CdiagLogEvent,
+			0,
+			CdiagInfoSeverity,
+			0,
+			&Pkt ) );
+		Hr = CdiagCommitEventPacket( Ssn, Pkt );
+		if ( Hr == S_OK )
+		{
+			Queued++;
+		}
+		else
+		{
+			TEST( Hr == S_FALSE );
+			Rejected++;
+		}
+	}
+
+	TEST( Queued <= 4 );
+	TEST( Rejected >= 16 );
+
+	TEST( SetEvent( AsyncHdlGate ) );
+	TEST_HR( CdiagFlushSession( Ssn ) );
+	TEST( AsyncHdlOutputCalls == ( LONG ) Queued );
+
+	TEST_HR( CdiagQueryInformationSession(
+		Ssn,
+		CdiagSessionDroppedEvents,
+		0,
+		( PVOID* ) &Dropped ) );
+	TEST( Dropped == Rejected );
+
+	TEST_HR( CdiagDereferenceSession( Ssn ) );
+
+	CloseHandle( AsyncHdlGate );
+	AsyncHdlGate = NULL;
+}
+
 CFIX_BEGIN_FIXTURE( Session )
 	CFIX_FIXTURE_ENTRY( TestCreateAndCloseSession )
 	CFIX_FIXTURE_ENTRY( TestHandling )
+	CFIX_FIXTURE_ENTRY( TestAsyncHandling )
+	CFIX_FIXTURE_ENTRY( TestAsyncDropping )
 CFIX_END_FIXTURE()
 
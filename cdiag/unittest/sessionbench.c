@@ -0,0 +1,234 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Session dispatch benchmark.
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#define BENCH_EVENT_COUNT	200000
+#define BENCH_MAX_THREADS	8
+
+/*----------------------------------------------------------------------
+ *
+ * Handler doing nothing s.t. the session's lookup dominates.
+ *
+ */
+
+static volatile LONG NullHandlerReferences = 0;
+
+static HRESULT CDIAGCALLTYPE NullHandle(
+	__in PCDIAG_HANDLER This,
+	__in PCDIAG_EVENT_PACKET Packet
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( Packet );
+	return S_OK;
+}
+
+static HRESULT CDIAGCALLTYPE NullSetNextHandler(
+	__in PCDIAG_HANDLER This,
+	__in PCDIAG_HANDLER Handler
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( Handler );
+	return CDIAG_E_CHAINING_NOT_SUPPORTED;
+}
+
+static HRESULT CDIAGCALLTYPE NullGetNextHandler(
+	__in PCDIAG_HANDLER This,
+	__out_opt PCDIAG_HANDLER *Handler
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( Handler );
+	return CDIAG_E_CHAINING_NOT_SUPPORTED;
+}
+
+static VOID CDIAGCALLTYPE NullReference(
+	__in PCDIAG_HANDLER This
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	InterlockedIncrement( &NullHandlerReferences );
+}
+
+static VOID CDIAGCALLTYPE NullDereference(
+	__in PCDIAG_HANDLER This
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	InterlockedDecrement( &NullHandlerReferences );
+}
+
+static CDIAG_HANDLER NullHandler =
+{
+	sizeof( CDIAG_HANDLER ),
+	NullHandle,
+	NullSetNextHandler,
+	NullGetNextHandler,
+	NullReference,
+	NullDereference
+};
+
+/*----------------------------------------------------------------------
+ *
+ * Benchmark.
+ *
+ */
+
+typedef struct _BENCH_THREAD
+{
+	CDIAG_SESSION_HANDLE Session;
+	HANDLE StartEvent;
+	ULONG Failures;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+static DWORD CALLBACK BenchThreadProc( PVOID Param )
+{
+	PBENCH_THREAD Thread = ( PBENCH_THREAD ) Param;
+	PCDIAG_EVENT_PACKET Pkt;
+	ULONG Index;
+
+	if ( FAILED( CdiagBeginEventPacket(
+		CdiagLogEvent,
+		0,
+		CdiagInfoSeverity,
+		ERROR_BAD_EXE_FORMAT,
+		&Pkt ) ) )
+	{
+		Thread->Failures++;
+		return 0;
+	}
+
+	( VOID ) WaitForSingleObject( Thread->StartEvent, INFINITE );
+
+	for ( Index = 0; Index < BENCH_EVENT_COUNT; Index++ )
+	{
+		if ( S_OK != CdiagHandleEvent( Thread->Session, Pkt ) )
+		{
+			Thread->Failures++;
+		}
+	}
+
+	CdiagReleaseEventPacket( Pkt );
+	return 0;
+}
+
+static double RunBenchmark(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in ULONG ThreadCount
+	)
+{
+	BENCH_THREAD Threads[ BENCH_MAX_THREADS ];
+	HANDLE ThreadHandles[ BENCH_MAX_THREADS ];
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	HANDLE StartEvent;
+	ULONG Index;
+
+	CFIX_ASSUME( ThreadCount <= BENCH_MAX_THREADS );
+
+	StartEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	CFIX_ASSUME( StartEvent != NULL );
+
+	for ( Index = 0; Index < ThreadCount; Index++ )
+	{
+		Threads[ Index ].Session	= Session;
+		Threads[ Index ].StartEvent	= StartEvent;
+		Threads[ Index ].Failures	= 0;
+
+		ThreadHandles[ Index ] = CreateThread(
+			NULL, 0, BenchThreadProc, &Threads[ Index ], 0, NULL );
+		CFIX_ASSUME( ThreadHandles[ Index ] != NULL );
+	}
+
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+	TEST( QueryPerformanceCounter( &Start ) );
+	TEST( SetEvent( StartEvent ) );
+
+	TEST( WAIT_OBJECT_0 == WaitForMultipleObjects(
+		ThreadCount,
+		ThreadHandles,
+		TRUE,
+		INFINITE ) );
+	TEST( QueryPerformanceCounter( &Stop ) );
+
+	for ( Index = 0; Index < ThreadCount; Index++ )
+	{
+		CloseHandle( ThreadHandles[ Index ] );
+		TEST( Threads[ Index ].Failures == 0 );
+	}
+
+	CloseHandle( StartEvent );
+
+	return ThreadCount * BENCH_EVENT_COUNT * ( double ) Frequency.QuadPart /
+		( double ) ( Stop.QuadPart - Start.QuadPart );
+}
+
+/*++
+	Routine Description:
+		Measure events per second dispatched by a session when
+		multiple threads raise events concurrently. As handler
+		lookups do not take a lock, throughput should scale with
+		the number of threads as long as there are enough CPUs.
+--*/
+static VOID BenchmarkConcurrentDispatch()
+{
+	CDIAG_SESSION_HANDLE Ssn;
+	SYSTEM_INFO SystemInfo;
+	double SingleThreaded = 0;
+	ULONG ThreadCount;
+
+	TEST_HR( CdiagCreateSession( NULL, NULL, &Ssn ) );
+	TEST_HR( CdiagSetInformationSession(
+		Ssn,
+		CdiagSessionDefaultHandler,
+		0,
+		&NullHandler ) );
+
+	GetSystemInfo( &SystemInfo );
+
+	for ( ThreadCount = 1; ThreadCount <= BENCH_MAX_THREADS; ThreadCount *= 2 )
+	{
+		double EventsPerSecond = RunBenchmark( Ssn, ThreadCount );
+		if ( ThreadCount == 1 )
+		{
+			SingleThreaded = EventsPerSecond;
+		}
+
+		CFIX_LOG(
+			L"%d thread(s), %d CPU(s): %10.0f events/s (%.1fx)",
+			ThreadCount,
+			SystemInfo.dwNumberOfProcessors,
+			EventsPerSecond,
+			EventsPerSecond / SingleThreaded );
+	}
+
+	TEST_HR( CdiagDereferenceSession( Ssn ) );
+	TEST( NullHandlerReferences == 0 );
+}
+
+CFIX_BEGIN_FIXTURE( SessionBenchmark )
+	CFIX_FIXTURE_ENTRY( BenchmarkConcurrentDispatch )
+CFIX_END_FIXTURE()
@@ -0,0 +1,186 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Fuzz test for CdiagpConvertUtf16ToUtf8
+ *
+ * Copyright:
+ *		2007-2009 Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+#include <stdlib.h>
+
+extern HRESULT CDIAGCALLTYPE CdiagpConvertUtf16ToUtf8(
+	__in_ecount( SourceCch ) PCWSTR Source,
+	__in SIZE_T SourceCch,
+	__out_bcount_part( TargetSize, *Written ) PSTR Target,
+	__in SIZE_T TargetSize,
+	__out PSIZE_T Written
+	);
+
+#define FUZZ_ITERATIONS		20000
+#define FUZZ_MAX_CCH		300
+
+static WCHAR RandomChar( 
+	__in WCHAR Low, 
+	__in WCHAR High 
+	)
+{
+	return ( WCHAR ) ( Low + ( ( ( ULONG ) rand() << 15 ) | rand() ) % ( High - Low + 1 ) );
+}
+
+/*++
+	Routine Description:
+		Generate well-formed UTF-16, mixing long ASCII runs (to 
+		exercise the vectorized path) with 2, 3 and 4 byte 
+		sequences.
+--*/
+static ULONG GenerateString(
+	__out_ecount( FUZZ_MAX_CCH ) PWSTR Buffer
+	)
+{
+	ULONG Length = rand() % FUZZ_MAX_CCH;
+	ULONG Index = 0;
+
+	while ( Index < Length )
+	{
+		ULONG RunLength;
+		ULONG Pair;
+
+		switch ( rand() % 5 )
+		{
+		case 0:
+			RunLength = min( Length - Index, ( ULONG ) ( 1 + rand() % 40 ) );
+			while ( RunLength-- > 0 )
+			{
+				Buffer[ Index++ ] = RandomChar( 1, 0x7F );
+			}
+			break;
+
+		case 1:
+			Buffer[ Index++ ] = RandomChar( 0x80, 0x7FF );
+			break;
+
+		case 2:
+			Buffer[ Index++ ] = RandomChar( 0x800, 0xD7FF );
+			break;
+
+		case 3:
+			Buffer[ Index++ ] = RandomChar( 0xE000, 0xFFFF );
+			break;
+
+		default:
+			if ( Index + 2 > Length )
+			{
+				Length = Index;
+				break;
+			}
+
+			Pair = ( ( ( ULONG ) rand() << 15 ) | rand() ) % 0x100000;
+			Buffer[ Index++ ] = ( WCHAR ) ( 0xD800 + ( Pair >> 10 ) );
+			Buffer[ Index++ ] = ( WCHAR ) ( 0xDC00 + ( Pair & 0x3FF ) );
+			break;
+		}
+	}
+
+	return Length;
+}
+
+static void TestFuzzAgainstWideCharToMultiByte()
+{
+	WCHAR Source[ FUZZ_MAX_CCH ];
+	CHAR Expected[ FUZZ_MAX_CCH * 3 ];
+	CHAR Actual[ FUZZ_MAX_CCH * 3 ];
+	UINT Iteration;
+
+	srand( 42 );
+
+	for ( Iteration = 0; Iteration < FUZZ_ITERATIONS; Iteration++ )
+	{
+		ULONG SourceCch = GenerateString( Source );
+		int ExpectedSize;
+		SIZE_T ActualSize;
+
+		ExpectedSize = WideCharToMultiByte(
+			CP_UTF8,
+			0,
+			Source,
+			( int ) SourceCch,
+			Expected,
+			sizeof( Expected ),
+			NULL,
+			NULL );
+		TEST( ExpectedSize > 0 || SourceCch == 0 );
+
+		TEST_HR( CdiagpConvertUtf16ToUtf8(
+			Source,
+			SourceCch,
+			Actual,
+			sizeof( Actual ),
+			&ActualSize ) );
+		TEST( ( SIZE_T ) ExpectedSize == ActualSize );
+		TEST( 0 == memcmp( Expected, Actual, ActualSize ) );
+
+		//
+		// Exact fit must succeed, one byte less must fail.
+		//
+		TEST_HR( CdiagpConvertUtf16ToUtf8(
+			Source,
+			SourceCch,
+			Actual,
+			ExpectedSize,
+			&ActualSize ) );
+		TEST( ( SIZE_T ) ExpectedSize == ActualSize );
+
+		if ( ExpectedSize > 0 )
+		{
+			TEST( CDIAG_E_BUFFER_TOO_SMALL == CdiagpConvertUtf16ToUtf8(
+				Source,
+				SourceCch,
+				Actual,
+				ExpectedSize - 1,
+				&ActualSize ) );
+			TEST( ActualSize == 0 );
+		}
+	}
+}
+
+static void TestUnpairedSurrogates()
+{
+	CHAR Actual[ 16 ];
+	SIZE_T ActualSize;
+
+	TEST_HR( CdiagpConvertUtf16ToUtf8( 
+		L"a\xD800" L"b", 3, Actual, sizeof( Actual ), &ActualSize ) );
+	TEST( ActualSize == 5 );
+	TEST( 0 == memcmp( Actual, "a\xEF\xBF\xBD" "b", 5 ) );
+
+	TEST_HR( CdiagpConvertUtf16ToUtf8( 
+		L"\xDC00\xD800", 2, Actual, sizeof( Actual ), &ActualSize ) );
+	TEST( ActualSize == 6 );
+	TEST( 0 == memcmp( Actual, "\xEF\xBF\xBD\xEF\xBF\xBD", 6 ) );
+
+	TEST_HR( CdiagpConvertUtf16ToUtf8( 
+		L"\xD83D\xDE00", 2, Actual, sizeof( Actual ), &ActualSize ) );
+	TEST( ActualSize == 4 );
+	TEST( 0 == memcmp( Actual, "\xF0\x9F\x98\x80", 4 ) );
+}
+
+CFIX_BEGIN_FIXTURE( Utf8 )
+	CFIX_FIXTURE_ENTRY( TestFuzzAgainstWideCharToMultiByte )
+	CFIX_FIXTURE_ENTRY( TestUnpairedSurrogates )
+CFIX_END_FIXTURE()
@@ -45,9 +45,11 @@ extern HMODULE CfixpModule;
 --*/
 BOOL CfixpSetupFilamentTls();
 BOOL CfixpSetupStackTraceCapturing();
+BOOL CfixpSetupMessageArena();
 
 BOOL CfixpTeardownFilamentTls();
 VOID CfixpTeardownStackTraceCapturing();
+VOID CfixpTeardownMessageArena();
 
 /*----------------------------------------------------------------------
  *
@@ -91,6 +93,11 @@ __inline VOID CfixpInitializeThreadId(
 	Routine Description:
 		Capture the stack trace based on the given CONTEXT.
 
+		When no CONTEXT is given, only return addresses are
+		collected (RtlCaptureStackBackTrace) and dbghelp is not
+		involved. Symbols are resolved later, on demand, by
+		CfixpGetInformationStackframe.
+
 	Parameters:
 		Context		Thread context. If NULL, the current context is
 					used.
@@ -115,6 +122,22 @@ typedef struct _CFIXP_EVENT_WITH_STACKTRACE
 	ULONGLONG __AdditionalFrames[ CFIXP_MAX_STACKFRAMES - 1 ];
 } CFIXP_EVENT_WITH_STACKTRACE, *PCFIXP_EVENT_WITH_STACKTRACE;
 
+struct _CFIXP_FILAMENT;
+
+/*++
+	Routine Description:
+		Decide whether a stack trace should be captured for an event
+		of the given type, based on the filament's flags and the
+		capture policy set by CfixSetStackTraceCapturePolicy.
+
+		Updates the filament's bookkeeping, so call at most once
+		per event.
+--*/
+BOOL CfixpShouldCaptureStackTrace(
+	__in struct _CFIXP_FILAMENT *Filament,
+	__in CFIX_EVENT_TYPE EventType
+	);
+
 HRESULT CFIXCALLTYPE CfixpGetInformationStackframe(
 	__in ULONGLONG Frame,
 	__in SIZE_T ModuleNameCch,
@@ -133,6 +156,18 @@ HRESULT CFIXCALLTYPE CfixpGetInformationStackframe(
  *
  */
 
+//
+// Maximum length of a log message eligible for coalescing, including 
+// NULL terminator.
+//
+#define CFIXP_MAX_LOG_MESSAGE_CCH	512
+
+//
+// Maximum amount of log message text (in bytes) reported per filament.
+// Messages exceeding this budget are dropped and only counted.
+//
+#define CFIXP_LOG_BUDGET_BYTES		( 256 * 1024 )
+
 /*++
 	Structure description:
 		A filament is a set of at least one thread. All thereads
@@ -171,6 +206,59 @@ typedef struct _CFIXP_FILAMENT
 
 	ULONG Flags;
 
+	//
+	// Bookkeeping for the stack trace capture policy.
+	//
+	struct
+	{
+		//
+		// Number of events eligible for a stack trace so far.
+		//
+		volatile LONG EligibleEvents;
+
+		//
+		// Number of stack traces captured so far.
+		//
+		volatile LONG Captured;
+	} StackTraces;
+
+	//
+	// Log rate limiting and coalescing.
+	//
+	struct
+	{
+		//
+		// Lock guarding this sub-struct. Held for bookkeeping only,
+		// never while reporting.
+		//
+		CRITICAL_SECTION Lock;
+
+		//
+		// Amount of message text reported so far, in bytes.
+		//
+		ULONG BytesReported;
+
+		//
+		// Messages dropped because the budget was exhausted.
+		//
+		ULONG DroppedMessages;
+		ULONG DroppedBytes;
+
+		//
+		// Number of messages identical to LastMessage that have been
+		// logged by the same thread and suppressed since LastMessage 
+		// was reported. May be read
+		// without holding the lock.
+		//
+		volatile ULONG RepeatCount;
+
+		//
+		// Last message reported and the thread it was reported on.
+		//
+		CFIX_THREAD_ID LastThreadId;
+		WCHAR LastMessage[ CFIXP_MAX_LOG_MESSAGE_CCH ];
+	} Logs;
+
 	//
 	// Filament local storage.
 	//
@@ -275,3 +363,84 @@ DWORD CfixpExceptionFilter(
 	__out PBOOL AbortRun
 	);
 
+/*++
+	Routine Description:
+		Report any identical log messages that have been coalesced
+		but not yet reported. 
+
+		If Final is TRUE, the number of log messages dropped because
+		the log budget has been exhausted is reported as well. To be
+		called once all child threads have completed, before the 
+		filament is torn down.
+--*/
+VOID CfixpFlushLogsFilament(
+	__in PCFIXP_FILAMENT Filament,
+	__in BOOL Final
+	);
+
+/*----------------------------------------------------------------------
+ *
+ * Message arena.
+ *
+ */
+
+/*++
+	Routine Description:
+		Obtain a mark denoting the current top of the calling
+		thread's message arena.
+--*/
+SIZE_T CfixpGetMarkMessageArena();
+
+/*++
+	Routine Description:
+		Release all messages that have been allocated on the calling
+		thread since the mark was obtained. 
+
+		Marks must be released in reverse order in which they have
+		been obtained. A mark is not valid any more once it, or a
+		mark obtained before it, has been released -- as arena
+		offsets are reused, releasing it would release newer 
+		messages.
+--*/
+VOID CfixpReleaseMessageArena(
+	__in SIZE_T Mark
+	);
+
+/*++
+	Routine Description:
+		Free the calling thread's message arena.
+
+		Only to be called from DllMain.
+--*/
+VOID CfixpFreeMessageArena();
+
+/*++
+	Routine Description:
+		Format a message into the calling thread's message arena.
+		The message is not truncated.
+
+	Return Value:
+		Message or NULL if formatting or allocation failed.
+--*/
+PCWSTR CfixpFormatMessageArena(
+	__in __format_string PCWSTR Format,
+	__in va_list Lst
+	);
+
+PCWSTR CfixpFormatMessageArenaA(
+	__in __format_string PCSTR Format,
+	__in va_list Lst
+	);
+
+/*++
+	Routine Description:
+		Convert an ANSI message to a Unicode message allocated from 
+		the calling thread's message arena.
+
+	Return Value:
+		Message or NULL if conversion or allocation failed.
+--*/
+PCWSTR CfixpConvertMessageArenaA(
+	__in PCSTR Message
+	);
+
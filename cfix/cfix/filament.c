@@ -386,6 +386,7 @@ VOID CfixpInitializeFilament(
 	Filament->Flags				= Flags;
 
 	InitializeCriticalSection( &Filament->ChildThreads.Lock );
+	InitializeCriticalSection( &Filament->Logs.Lock );
 
 	if ( RestoreStorage && ( GetCurrentThreadId() == MainThreadId ) )
 	{
@@ -412,6 +413,7 @@ VOID CfixpDestroyFilament(
 	}
 
 	DeleteCriticalSection( &Filament->ChildThreads.Lock );
+	DeleteCriticalSection( &Filament->Logs.Lock );
 
 	if ( GetCurrentThreadId() == Filament->MainThreadId )
 	{
@@ -50,6 +50,13 @@ BOOL APIENTRY DllMain(
 			return FALSE;
 		}
 
+		if ( ! CfixpSetupMessageArena() )
+		{
+			CfixpTeardownFilamentTls();
+			CfixpTeardownStackTraceCapturing();
+			return FALSE;
+		}
+
 		return TRUE;
 	}
 	else if ( Reason ==  DLL_PROCESS_DETACH )
@@ -57,12 +64,14 @@ BOOL APIENTRY DllMain(
 #ifdef DBG	
 		_CrtDumpMemoryLeaks();
 #endif
+		CfixpTeardownMessageArena();
 		CfixpTeardownStackTraceCapturing();
 		return CfixpTeardownFilamentTls();
 	}
 	else if ( Reason == DLL_THREAD_DETACH )
 	{
 		CfixpCleanupLeakedFilamentForDetachingThread();
+		CfixpFreeMessageArena();
 		return TRUE;
 	}
 	else
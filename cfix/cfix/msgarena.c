@@ -0,0 +1,486 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Per-thread message arena.
+ *
+ *		Formatted messages of arbitrary length are allocated from a
+ *		thread-local arena rather than from fixed-size stack buffers or
+ *		the heap. The arena only grows if a message does not fit into
+ *		the current chunk; releasing the arena to a previously obtained
+ *		mark frees all messages allocated since.
+ *
+ * Copyright:
+ *		2008-2009, Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "cfixp.h"
+
+#pragma warning( push )
+#pragma warning( disable: 6011; disable: 6387 )
+#include <strsafe.h>
+#pragma warning( pop )
+
+//
+// Default size of a chunk. Messages larger than that get a chunk
+// of their own.
+//
+#define CFIXP_ARENA_CHUNK_SIZE	( 8 * 1024 )
+
+//
+// Allocation granularity.
+//
+#define CFIXP_ARENA_ALIGNMENT	sizeof( ULONGLONG )
+
+typedef struct _CFIXP_ARENA_CHUNK
+{
+	//
+	// Next older chunk, NULL for the first chunk.
+	//
+	struct _CFIXP_ARENA_CHUNK *Previous;
+
+	//
+	// Logical offset of Data[ 0 ] within the arena. Offsets grow
+	// monotonically across chunks, which makes marks comparable.
+	//
+	SIZE_T Base;
+
+	//
+	// Size and usage of Data, in bytes.
+	//
+	SIZE_T Size;
+	SIZE_T Used;
+
+	ULONGLONG Data[ ANYSIZE_ARRAY ];
+} CFIXP_ARENA_CHUNK, *PCFIXP_ARENA_CHUNK;
+
+#define CFIXP_ARENA_MESSAGE_SIGNATURE	'gsMA'
+
+//
+// Header preceding each message allocated via the CfixPe* routines.
+// Allows releasing the arena given only the message.
+//
+typedef struct _CFIXP_ARENA_MESSAGE_HEADER
+{
+	//
+	// Mark at which the message has been allocated.
+	//
+	SIZE_T Mark;
+
+	//
+	// Mark past the message. The message may only be released while
+	// End is the current mark, i.e. while it is the topmost 
+	// allocation.
+	//
+	SIZE_T End;
+
+	//
+	// CFIXP_ARENA_MESSAGE_SIGNATURE while the message is live, 
+	// cleared on release.
+	//
+	ULONG Signature;
+
+	ULONGLONG Message[ ANYSIZE_ARRAY ];
+} CFIXP_ARENA_MESSAGE_HEADER, *PCFIXP_ARENA_MESSAGE_HEADER;
+
+//
+// TLS slot holding the topmost chunk of the current thread's arena.
+//
+static DWORD CfixsMessageArenaSlot = TLS_OUT_OF_INDEXES;
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static PCFIXP_ARENA_CHUNK CfixsAllocateChunkMessageArena(
+	__in_opt PCFIXP_ARENA_CHUNK Previous,
+	__in SIZE_T MinimumSize
+	)
+{
+	PCFIXP_ARENA_CHUNK Chunk;
+	SIZE_T Size = max( MinimumSize, CFIXP_ARENA_CHUNK_SIZE );
+
+	Chunk = malloc( FIELD_OFFSET( CFIXP_ARENA_CHUNK, Data ) + Size );
+	if ( Chunk == NULL )
+	{
+		return NULL;
+	}
+
+	Chunk->Previous	= Previous;
+	Chunk->Base		= Previous != NULL
+		? Previous->Base + Previous->Used
+		: 0;
+	Chunk->Size		= Size;
+	Chunk->Used		= 0;
+
+	return Chunk;
+}
+
+static PVOID CfixsAllocateMessageArena(
+	__in SIZE_T Size
+	)
+{
+	PVOID Block;
+	PCFIXP_ARENA_CHUNK Top;
+
+	Size = ( Size + CFIXP_ARENA_ALIGNMENT - 1 ) & ~( CFIXP_ARENA_ALIGNMENT - 1 );
+
+	Top = ( PCFIXP_ARENA_CHUNK ) TlsGetValue( CfixsMessageArenaSlot );
+	if ( Top == NULL || Top->Size - Top->Used < Size )
+	{
+		//
+		// First allocation on this thread or chunk exhausted.
+		//
+		PCFIXP_ARENA_CHUNK NewTop = CfixsAllocateChunkMessageArena( Top, Size );
+		if ( NewTop == NULL )
+		{
+			return NULL;
+		}
+
+		VERIFY( TlsSetValue( CfixsMessageArenaSlot, NewTop ) );
+		Top = NewTop;
+	}
+
+	Block = ( PUCHAR ) Top->Data + Top->Used;
+	Top->Used += Size;
+
+	return Block;
+}
+
+/*++
+	Routine Description:
+		Allocate a message, preceded by a header recording the mark
+		at which the message has been allocated.
+--*/
+static PVOID CfixsAllocateMessageWithHeader(
+	__in SIZE_T Size
+	)
+{
+	PCFIXP_ARENA_MESSAGE_HEADER Header;
+	SIZE_T Mark = CfixpGetMarkMessageArena();
+
+	Header = ( PCFIXP_ARENA_MESSAGE_HEADER ) CfixsAllocateMessageArena(
+		FIELD_OFFSET( CFIXP_ARENA_MESSAGE_HEADER, Message ) + Size );
+	if ( Header == NULL )
+	{
+		return NULL;
+	}
+
+	Header->Mark		= Mark;
+	Header->End			= CfixpGetMarkMessageArena();
+	Header->Signature	= CFIXP_ARENA_MESSAGE_SIGNATURE;
+	return Header->Message;
+}
+
+/*++
+	Routine Description:
+		Check whether a header lies within the allocated part of
+		the calling thread's arena, i.e. whether it can be accessed
+		safely.
+--*/
+static BOOL CfixsIsAllocatedMessageArena(
+	__in PCFIXP_ARENA_MESSAGE_HEADER Header
+	)
+{
+	PCFIXP_ARENA_CHUNK Chunk;
+	PUCHAR Begin = ( PUCHAR ) Header;
+	PUCHAR End = ( PUCHAR ) Header->Message;
+
+	for ( Chunk = ( PCFIXP_ARENA_CHUNK ) TlsGetValue( CfixsMessageArenaSlot );
+		  Chunk != NULL;
+		  Chunk = Chunk->Previous )
+	{
+		if ( Begin >= ( PUCHAR ) Chunk->Data &&
+			 End <= ( PUCHAR ) Chunk->Data + Chunk->Used )
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Privates.
+ *
+ */
+
+BOOL CfixpSetupMessageArena()
+{
+	CfixsMessageArenaSlot = TlsAlloc();
+	return CfixsMessageArenaSlot != TLS_OUT_OF_INDEXES;
+}
+
+VOID CfixpTeardownMessageArena()
+{
+	//
+	// N.B. Arenas of threads other than the current one are leaked.
+	//
+	CfixpFreeMessageArena();
+	VERIFY( TlsFree( CfixsMessageArenaSlot ) );
+}
+
+VOID CfixpFreeMessageArena()
+{
+	PCFIXP_ARENA_CHUNK Chunk;
+
+	Chunk = ( PCFIXP_ARENA_CHUNK ) TlsGetValue( CfixsMessageArenaSlot );
+	while ( Chunk != NULL )
+	{
+		PCFIXP_ARENA_CHUNK Previous = Chunk->Previous;
+		free( Chunk );
+		Chunk = Previous;
+	}
+
+	VERIFY( TlsSetValue( CfixsMessageArenaSlot, NULL ) );
+}
+
+SIZE_T CfixpGetMarkMessageArena()
+{
+	PCFIXP_ARENA_CHUNK Top;
+
+	Top = ( PCFIXP_ARENA_CHUNK ) TlsGetValue( CfixsMessageArenaSlot );
+	return Top != NULL
+		? Top->Base + Top->Used
+		: 0;
+}
+
+VOID CfixpReleaseMessageArena(
+	__in SIZE_T Mark
+	)
+{
+	PCFIXP_ARENA_CHUNK Top;
+
+	Top = ( PCFIXP_ARENA_CHUNK ) TlsGetValue( CfixsMessageArenaSlot );
+	if ( Top == NULL || Mark >= Top->Base + Top->Used )
+	{
+		//
+		// Nothing allocated since, or already released.
+		//
+		return;
+	}
+
+	//
+	// Free all chunks that lie entirely above the mark. The first
+	// chunk is retained s.t. subsequent messages do not require
+	// any allocation.
+	//
+	while ( Top->Previous != NULL && Top->Base >= Mark )
+	{
+		PCFIXP_ARENA_CHUNK Previous = Top->Previous;
+		free( Top );
+		Top = Previous;
+	}
+
+	VERIFY( TlsSetValue( CfixsMessageArenaSlot, Top ) );
+
+	if ( Mark < Top->Base + Top->Used )
+	{
+		Top->Used = Mark > Top->Base ? Mark - Top->Base : 0;
+	}
+}
+
+PCWSTR CfixpFormatMessageArena(
+	__in __format_string PCWSTR Format,
+	__in va_list Lst
+	)
+{
+	int Cch;
+	PWSTR Message;
+
+	Cch = _vscwprintf( Format, Lst );
+	if ( Cch < 0 )
+	{
+		return NULL;
+	}
+
+	Message = ( PWSTR ) CfixsAllocateMessageWithHeader(
+		( Cch + 1 ) * sizeof( WCHAR ) );
+	if ( Message == NULL )
+	{
+		return NULL;
+	}
+
+	( VOID ) StringCchVPrintfW(
+		Message,
+		Cch + 1,
+		Format,
+		Lst );
+
+	return Message;
+}
+
+PCWSTR CfixpConvertMessageArenaA(
+	__in PCSTR AnsiMessage
+	)
+{
+	int Cch;
+	SIZE_T Mark;
+	PWSTR Message;
+
+	Cch = MultiByteToWideChar(
+		CP_ACP,
+		0,
+		AnsiMessage,
+		-1,
+		NULL,
+		0 );
+	if ( Cch == 0 )
+	{
+		return NULL;
+	}
+
+	Mark = CfixpGetMarkMessageArena();
+	Message = ( PWSTR ) CfixsAllocateMessageWithHeader(
+		Cch * sizeof( WCHAR ) );
+	if ( Message == NULL )
+	{
+		return NULL;
+	}
+
+	if ( ! MultiByteToWideChar(
+		CP_ACP,
+		0,
+		AnsiMessage,
+		-1,
+		Message,
+		Cch ) )
+	{
+		CfixpReleaseMessageArena( Mark );
+		return NULL;
+	}
+
+	return Message;
+}
+
+PCWSTR CfixpFormatMessageArenaA(
+	__in __format_string PCSTR Format,
+	__in va_list Lst
+	)
+{
+	PSTR AnsiMessage;
+	int Cch;
+	SIZE_T Mark;
+	PCWSTR Message;
+
+	//
+	// Create ANSI string first, as some of the arguments
+	// may be ANSI.
+	//
+	Cch = _vscprintf( Format, Lst );
+	if ( Cch < 0 )
+	{
+		return NULL;
+	}
+
+	Mark = CfixpGetMarkMessageArena();
+	AnsiMessage = ( PSTR ) CfixsAllocateMessageArena( Cch + 1 );
+	if ( AnsiMessage == NULL )
+	{
+		return NULL;
+	}
+
+	( VOID ) StringCchVPrintfA(
+		AnsiMessage,
+		Cch + 1,
+		Format,
+		Lst );
+
+	//
+	// Convert. The ANSI string remains allocated as part of the
+	// message and is released along with it.
+	//
+	Message = CfixpConvertMessageArenaA( AnsiMessage );
+	if ( Message != NULL )
+	{
+		( ( PCFIXP_ARENA_MESSAGE_HEADER ) CONTAINING_RECORD(
+			Message,
+			CFIXP_ARENA_MESSAGE_HEADER,
+			Message ) )->Mark = Mark;
+	}
+	else
+	{
+		CfixpReleaseMessageArena( Mark );
+	}
+
+	return Message;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Exports.
+ *
+ */
+
+CFIXAPI PCWSTR CFIXCALLTYPE CfixPeFormatMessageW(
+	__in __format_string PCWSTR Format,
+	__in va_list Lst
+	)
+{
+	return CfixpFormatMessageArena( Format, Lst );
+}
+
+CFIXAPI PCWSTR CFIXCALLTYPE CfixPeFormatMessageA(
+	__in __format_string PCSTR Format,
+	__in va_list Lst
+	)
+{
+	return CfixpFormatMessageArenaA( Format, Lst );
+}
+
+CFIXAPI PCWSTR CFIXCALLTYPE CfixPeConvertMessageA(
+	__in PCSTR Message
+	)
+{
+	return CfixpConvertMessageArenaA( Message );
+}
+
+CFIXAPI VOID CFIXCALLTYPE CfixPeReleaseMessage(
+	__in_opt PCWSTR Message
+	)
+{
+	PCFIXP_ARENA_MESSAGE_HEADER Header;
+
+	if ( Message == NULL )
+	{
+		return;
+	}
+
+	Header = CONTAINING_RECORD(
+		Message,
+		CFIXP_ARENA_MESSAGE_HEADER,
+		Message );
+
+	//
+	// Releasing any message but the topmost one would release the
+	// messages allocated after it as well. Refuse and leave the
+	// message to be released when the test routine completes.
+	//
+	if ( ! CfixsIsAllocatedMessageArena( Header ) ||
+		 Header->Signature != CFIXP_ARENA_MESSAGE_SIGNATURE ||
+		 Header->End != CfixpGetMarkMessageArena() )
+	{
+		ASSERT( !"Message released twice or out of order" );
+		return;
+	}
+
+	Header->Signature = 0;
+	CfixpReleaseMessageArena( Header->Mark );
+}
@@ -492,6 +492,7 @@ static HRESULT CfixsRunTestRoutine(
 
 	CFIXP_FILAMENT Filament;
 	PCFIXP_FILAMENT PrevFilament;
+	SIZE_T MessageArenaMark;
 
 	BOOL RoutineRanToCompletion;
 
@@ -537,6 +538,14 @@ static HRESULT CfixsRunTestRoutine(
 		return Hr;
 	}
 
+	//
+	// Messages allocated by this thread during the test routine are
+	// released once the routine has completed. Using a mark rather than
+	// resetting the arena retains messages of an outer test routine
+	// in case of recursion.
+	//
+	MessageArenaMark = CfixpGetMarkMessageArena();
+
 	__try
 	{
 		( Routine )();
@@ -564,6 +573,13 @@ static HRESULT CfixsRunTestRoutine(
 		&Filament,
 		INFINITE );
 
+	//
+	// Report any pending coalesced logs and dropped log counts
+	// before AfterTestCaseFinish is raised.
+	//
+	CfixpFlushLogsFilament( &Filament, TRUE );
+	CfixpReleaseMessageArena( MessageArenaMark );
+
 	//
 	// Now, as all child threads have completed, we can teardown
 	// the filament.
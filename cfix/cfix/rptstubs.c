@@ -32,6 +32,89 @@
 #include <strsafe.h>
 #pragma warning( pop )
 
+/*++
+	Routine Description:
+		Report an event and include a stack trace. 
+		
+		The event structure required to hold a stack trace is rather 
+		large, so it is kept out of the common path where no stack 
+		trace is captured.
+
+	Parameters:
+		Event		- Event to report. The StackTrace member is ignored.
+		Context		- Context to capture the stack trace from. If NULL,
+					  the current context is used.
+--*/
+static __declspec( noinline ) CFIX_REPORT_DISPOSITION CfixsReportEventWithStackTrace(
+	__in PCFIXP_FILAMENT Filament,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_TESTCASE_EXECUTION_EVENT Event,
+	__in_opt CONST PCONTEXT Context
+	)
+{
+	CFIXP_EVENT_WITH_STACKTRACE EventWithStackTrace;
+
+	CopyMemory( 
+		&EventWithStackTrace.Base, 
+		Event, 
+		FIELD_OFFSET( CFIX_TESTCASE_EXECUTION_EVENT, StackTrace ) );
+
+	if ( FAILED( CfixpCaptureStackTrace(
+		Context,
+		&EventWithStackTrace.Base.StackTrace,
+		CFIXP_MAX_STACKFRAMES ) ) )
+	{
+		EventWithStackTrace.Base.StackTrace.FrameCount = 0;
+	}
+
+	return Filament->ExecutionContext->ReportEvent(
+		Filament->ExecutionContext,
+		ThreadId,
+		&EventWithStackTrace.Base );
+}
+
+/*++
+	Routine Description:
+		Report an event, capturing a stack trace if the capture
+		policy demands so.
+
+	Parameters:
+		Event		- Event to report. The StackTrace member is ignored.
+		Context		- Context to capture the stack trace from. If NULL,
+					  the current context is used.
+--*/
+static CFIX_REPORT_DISPOSITION CfixsReportEvent(
+	__in PCFIXP_FILAMENT Filament,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_TESTCASE_EXECUTION_EVENT Event,
+	__in_opt CONST PCONTEXT Context
+	)
+{
+	//
+	// Retain ordering w.r.t. coalesced log messages.
+	//
+	CfixpFlushLogsFilament( Filament, FALSE );
+
+	if ( CfixpShouldCaptureStackTrace( Filament, Event->Type ) )
+	{
+		return CfixsReportEventWithStackTrace(
+			Filament,
+			ThreadId,
+			Event,
+			Context );
+	}
+	else
+	{
+		Event->StackTrace.FrameCount				= 0;
+		Event->StackTrace.GetInformationStackFrame	= NULL;
+
+		return Filament->ExecutionContext->ReportEvent(
+			Filament->ExecutionContext,
+			ThreadId,
+			Event );
+	}
+}
+
 DWORD CfixpExceptionFilter(
 	__in PEXCEPTION_POINTERS ExcpPointers,
 	__in PCFIXP_FILAMENT Filament,
@@ -82,7 +165,7 @@ DWORD CfixpExceptionFilter(
 	else
 	{
 		CFIX_REPORT_DISPOSITION Disp;
-		CFIXP_EVENT_WITH_STACKTRACE Event;
+		CFIX_TESTCASE_EXECUTION_EVENT Event;
 
 		//
 		// Notify.
@@ -92,31 +175,20 @@ DWORD CfixpExceptionFilter(
 			&ThreadId,
 			ExcpPointers );
 
-		//
-		// Capture stacktrace.
-		//
-		if ( ! CfixpFlagOn( Filament->Flags, CFIXP_FILAMENT_FLAG_CAPTURE_STACK_TRACES ) || 
-			FAILED( CfixpCaptureStackTrace(
-				ExcpPointers->ContextRecord,
-				&Event.Base.StackTrace,
-				CFIXP_MAX_STACKFRAMES ) ) )
-		{
-			Event.Base.StackTrace.FrameCount = 0;
-		}
-
 		//
 		// Report unhandled exception.
 		//
-		Event.Base.Type = CfixEventUncaughtException;
+		Event.Type = CfixEventUncaughtException;
 		memcpy( 
-			&Event.Base.Info.UncaughtException,
+			&Event.Info.UncaughtException,
 			ExcpPointers->ExceptionRecord,
 			sizeof( EXCEPTION_RECORD ) );
 
-		Disp = Filament->ExecutionContext->ReportEvent(
-			Filament->ExecutionContext,
+		Disp = CfixsReportEvent(
+			Filament,
 			&ThreadId,
-			&Event.Base );
+			&Event,
+			ExcpPointers->ContextRecord );
 
 		*AbortRun = ( Disp == CfixAbort );
 		if ( Disp == CfixBreak )
@@ -173,7 +245,7 @@ CFIXAPI CFIX_REPORT_DISPOSITION CFIXCALLTYPE CfixPeReportFailedAssertion(
 	)
 {
 	CFIX_REPORT_DISPOSITION Disp;
-	CFIXP_EVENT_WITH_STACKTRACE Event;
+	CFIX_TESTCASE_EXECUTION_EVENT Event;
 	PCFIXP_FILAMENT Filament;
 	BOOL FilamentDerivedFromDefaultFilament;
 	HRESULT Hr;
@@ -210,29 +282,18 @@ CFIXAPI CFIX_REPORT_DISPOSITION CFIXCALLTYPE CfixPeReportFailedAssertion(
 		Filament->MainThreadId,
 		GetCurrentThreadId() );
 	
-	Event.Base.Type								= CfixEventFailedAssertion;
-	Event.Base.Info.FailedAssertion.File		= File;
-	Event.Base.Info.FailedAssertion.Routine		= Routine;
-	Event.Base.Info.FailedAssertion.Line		= Line;
-	Event.Base.Info.FailedAssertion.Expression	= Expression;
-	Event.Base.Info.FailedAssertion.LastError	= LastError;
-
-	//
-	// Capture stacktrace.
-	//
-	if ( ! CfixpFlagOn( Filament->Flags, CFIXP_FILAMENT_FLAG_CAPTURE_STACK_TRACES ) || 
-		 FAILED( CfixpCaptureStackTrace(
-			NULL,
-			&Event.Base.StackTrace,
-			CFIXP_MAX_STACKFRAMES ) ) )
-	{
-		Event.Base.StackTrace.FrameCount = 0;
-	}
-
-	Disp = Filament->ExecutionContext->ReportEvent(
-		Filament->ExecutionContext,
+	Event.Type								= CfixEventFailedAssertion;
+	Event.Info.FailedAssertion.File			= File;
+	Event.Info.FailedAssertion.Routine		= Routine;
+	Event.Info.FailedAssertion.Line			= Line;
+	Event.Info.FailedAssertion.Expression	= Expression;
+	Event.Info.FailedAssertion.LastError	= LastError;
+
+	Disp = CfixsReportEvent(
+		Filament,
 		&ThreadId,
-		&Event.Base );
+		&Event,
+		NULL );
 
 	if ( Disp == CfixBreakAlways )
 	{
@@ -297,25 +358,31 @@ CFIXAPI CFIX_REPORT_DISPOSITION __cdecl CfixPeReportFailedAssertionFormatW(
 	...
 	)
 {
-	WCHAR Buffer[ 256 ] = { 0 };
+	CFIX_REPORT_DISPOSITION Disp;
+	SIZE_T Mark = CfixpGetMarkMessageArena();
+	PCWSTR Message = L"";
 
 	if ( Format != NULL )
 	{
 		va_list lst;
 		va_start( lst, Format );
-		( VOID ) StringCchVPrintfW(
-			Buffer, 
-			_countof( Buffer ),
-			Format,
-			lst );
+		Message = CfixpFormatMessageArena( Format, lst );
 		va_end( lst );
+
+		if ( Message == NULL )
+		{
+			Message = L"(Invalid string)";
+		}
 	}
 
-	return CfixPeReportFailedAssertion(
+	Disp = CfixPeReportFailedAssertion(
 		File,
 		Routine,
 		Line,
-		Buffer );
+		Message );
+
+	CfixpReleaseMessageArena( Mark );
+	return Disp;
 }
 
 CFIXAPI CFIX_REPORT_DISPOSITION __cdecl CfixPeReportFailedAssertionFormatA(
@@ -326,47 +393,31 @@ CFIXAPI CFIX_REPORT_DISPOSITION __cdecl CfixPeReportFailedAssertionFormatA(
 	...
 	)
 {
-	//
-	// Create ANSI string first, as some of the arguments
-	// may be ANSI.
-	//
-	CHAR AnsiBuffer[ 256 ] = { 0 };
-	WCHAR Buffer[ 256 ] = { 0 };
+	CFIX_REPORT_DISPOSITION Disp;
+	SIZE_T Mark = CfixpGetMarkMessageArena();
+	PCWSTR Message = L"";
 
 	if ( Format != NULL )
 	{
 		va_list lst;
 		va_start( lst, Format );
-		( VOID ) StringCchVPrintfA(
-			AnsiBuffer, 
-			_countof( AnsiBuffer ),
-			Format,
-			lst );
+		Message = CfixpFormatMessageArenaA( Format, lst );
 		va_end( lst );
 
-		//
-		// Convert.
-		//
-		if ( ! MultiByteToWideChar(
-			CP_ACP,
-			0,
-			AnsiBuffer,
-			-1,
-			Buffer,
-			_countof( Buffer ) ) )
+		if ( Message == NULL )
 		{
-			( VOID ) StringCchCopy(
-				Buffer,
-				_countof( Buffer ),
-				L"(Invalid string)" );
+			Message = L"(Invalid string)";
 		}
 	}
 
-	return CfixPeReportFailedAssertion(
+	Disp = CfixPeReportFailedAssertion(
 		File,
 		Routine,
 		Line,
-		Buffer );
+		Message );
+
+	CfixpReleaseMessageArena( Mark );
+	return Disp;
 }
 
 CFIXAPI CFIX_REPORT_DISPOSITION CFIXCALLTYPE CfixPeAssertEqualsUlong(
@@ -409,7 +460,7 @@ CFIXAPI VOID CFIXCALLTYPE CfixPeReportInconclusiveness(
 	__in PCWSTR Message
 	)
 {
-	CFIXP_EVENT_WITH_STACKTRACE Event;
+	CFIX_TESTCASE_EXECUTION_EVENT Event;
 	PCFIXP_FILAMENT Filament;
 	BOOL FilamentDerivedFromDefaultFilament;
 	HRESULT Hr;
@@ -444,28 +495,17 @@ CFIXAPI VOID CFIXCALLTYPE CfixPeReportInconclusiveness(
 		Filament->MainThreadId,
 		GetCurrentThreadId() );
 
-	//
-	// Capture stacktrace.
-	//
-	if ( ! CfixpFlagOn( Filament->Flags, CFIXP_FILAMENT_FLAG_CAPTURE_STACK_TRACES ) || 
-		 FAILED( CfixpCaptureStackTrace(
-			NULL,
-			&Event.Base.StackTrace,
-			CFIXP_MAX_STACKFRAMES ) ) )
-	{
-		Event.Base.StackTrace.FrameCount = 0;
-	}
-
 	//
 	// Report inconclusiveness.
 	//
-	Event.Base.Type							= CfixEventInconclusiveness;
-	Event.Base.Info.Inconclusiveness.Message = Message;
+	Event.Type							= CfixEventInconclusiveness;
+	Event.Info.Inconclusiveness.Message	= Message;
 
-	( VOID ) Filament->ExecutionContext->ReportEvent(
-		Filament->ExecutionContext,
+	( VOID ) CfixsReportEvent(
+		Filament,
 		&ThreadId,
-		&Event.Base );
+		&Event,
+		NULL );
 
 	if ( ! FilamentDerivedFromDefaultFilament )
 	{
@@ -495,39 +535,172 @@ CFIXAPI VOID CFIXCALLTYPE CfixPeReportInconclusivenessA(
 	__in PCSTR Message
 	)
 {
-	WCHAR Buffer[ 256 ] = { 0 };
+	PCWSTR UnicodeMessage = L"";
 
 	if ( Message != NULL )
 	{
 		//
-		// Convert.
+		// Convert. As CfixPeReportInconclusiveness does not return,
+		// the message is released when the test routine completes.
 		//
-		if ( ! MultiByteToWideChar(
-			CP_ACP,
-			0,
-			Message,
-			-1,
-			Buffer,
-			_countof( Buffer ) ) )
+		UnicodeMessage = CfixpConvertMessageArenaA( Message );
+		if ( UnicodeMessage == NULL )
 		{
-			( VOID ) StringCchCopy(
-				Buffer,
-				_countof( Buffer ),
-				L"(Invalid string)" );
+			UnicodeMessage = L"(Invalid string)";
 		}
 	}
 
-	CfixPeReportInconclusiveness( Buffer );
+	CfixPeReportInconclusiveness( UnicodeMessage );
 }
 
-static CFIXAPI VOID CfixsPeReportLog(
+/*++
+	Routine Description:
+		Report a log event without applying any rate limiting.
+--*/
+static VOID CfixsReportLogEvent(
+	__in PCFIXP_FILAMENT Filament,
+	__in PCFIX_THREAD_ID ThreadId,
 	__in PCWSTR Message
 	)
 {
 	CFIX_TESTCASE_EXECUTION_EVENT Event;
+
+	//
+	// Logs do not need a stacktrace.
+	//
+	Event.StackTrace.FrameCount = 0;
+
+	//
+	// Report log event.
+	//
+	Event.Type				= CfixEventLog;
+	Event.Info.Log.Message	= Message;
+
+	( VOID ) Filament->ExecutionContext->ReportEvent(
+		Filament->ExecutionContext,
+		ThreadId,
+		&Event );
+}
+
+//
+// Size of a buffer holding a coalesced message.
+//
+#define CFIXS_MAX_REPEATED_LOG_MESSAGE_CCH ( CFIXP_MAX_LOG_MESSAGE_CCH + 16 )
+
+/*++
+	Routine Description:
+		Take coalesced messages, if any, s.t. they can be reported
+		once the lock has been released.
+
+		Lock must be held.
+
+	Return Value:
+		TRUE if Message has to be reported.
+--*/
+static BOOL CfixsDetachRepeatedLogs(
+	__in PCFIXP_FILAMENT Filament,
+	__out_ecount( CFIXS_MAX_REPEATED_LOG_MESSAGE_CCH ) PWSTR Message,
+	__out PCFIX_THREAD_ID ThreadId
+	)
+{
+	if ( Filament->Logs.RepeatCount == 0 )
+	{
+		return FALSE;
+	}
+
+	( VOID ) StringCchPrintf(
+		Message,
+		CFIXS_MAX_REPEATED_LOG_MESSAGE_CCH,
+		L"%s (x%u)",
+		Filament->Logs.LastMessage,
+		Filament->Logs.RepeatCount );
+
+	Filament->Logs.RepeatCount = 0;
+	*ThreadId = Filament->Logs.LastThreadId;
+
+	return TRUE;
+}
+
+VOID CfixpFlushLogsFilament(
+	__in PCFIXP_FILAMENT Filament,
+	__in BOOL Final
+	)
+{
+	WCHAR RepeatedMessage[ CFIXS_MAX_REPEATED_LOG_MESSAGE_CCH ];
+	WCHAR DroppedMessage[ 200 ];
+	CFIX_THREAD_ID RepeatedThreadId;
+	CFIX_THREAD_ID ThreadId;
+	BOOL ReportRepeated;
+	BOOL ReportDropped = FALSE;
+
+	//
+	// This routine runs before every event, so avoid the lock if
+	// there is nothing to flush. Repetitions logged concurrently
+	// by other threads are flushed by a subsequent call.
+	//
+	if ( Filament->Logs.RepeatCount == 0 &&
+		 ( ! Final || Filament->Logs.DroppedMessages == 0 ) )
+	{
+		return;
+	}
+
+	EnterCriticalSection( &Filament->Logs.Lock );
+
+	ReportRepeated = CfixsDetachRepeatedLogs( 
+		Filament, 
+		RepeatedMessage, 
+		&RepeatedThreadId );
+
+	if ( Final && Filament->Logs.DroppedMessages > 0 )
+	{
+		CfixpInitializeThreadId( 
+			&ThreadId,
+			Filament->MainThreadId,
+			GetCurrentThreadId() );
+
+		( VOID ) StringCchPrintf(
+			DroppedMessage,
+			_countof( DroppedMessage ),
+			L"%u log messages (%u bytes) have been dropped because "
+			L"the log budget of %u bytes was exhausted",
+			Filament->Logs.DroppedMessages,
+			Filament->Logs.DroppedBytes,
+			CFIXP_LOG_BUDGET_BYTES );
+
+		Filament->Logs.DroppedMessages	= 0;
+		Filament->Logs.DroppedBytes		= 0;
+
+		ReportDropped = TRUE;
+	}
+
+	LeaveCriticalSection( &Filament->Logs.Lock );
+
+	//
+	// Report outside the lock, reporting may involve I/O.
+	//
+	if ( ReportRepeated )
+	{
+		CfixsReportLogEvent( Filament, &RepeatedThreadId, RepeatedMessage );
+	}
+
+	if ( ReportDropped )
+	{
+		CfixsReportLogEvent( Filament, &ThreadId, DroppedMessage );
+	}
+}
+
+static CFIXAPI VOID CfixsPeReportLog(
+	__in PCWSTR Message
+	)
+{
+	ULONG Bytes;
 	PCFIXP_FILAMENT Filament;
 	HRESULT Hr;
 	CFIX_THREAD_ID ThreadId;
+	WCHAR RepeatedMessage[ CFIXS_MAX_REPEATED_LOG_MESSAGE_CCH ];
+	CFIX_THREAD_ID RepeatedThreadId;
+	BOOL ReportRepeated = FALSE;
+	BOOL ReportMessage = FALSE;
 
 	//
 	// Filament should be in TLS as this routine should only be called
@@ -556,21 +729,70 @@ static CFIXAPI VOID CfixsPeReportLog(
 		Filament->MainThreadId,
 		GetCurrentThreadId() );
 
+	EnterCriticalSection( &Filament->Logs.Lock );
+
 	//
-	// Logs do not need a stacktrace.
+	// Coalesce messages identical to the previous one logged by the
+	// same thread. The first occurrence is reported right away, the 
+	// repetitions are reported as a single 'message (xN)' on behalf 
+	// of that thread once a different message is logged, another 
+	// thread logs, or the test routine completes.
 	//
-	Event.StackTrace.FrameCount = 0;
+	if ( Filament->Logs.LastMessage[ 0 ] != UNICODE_NULL &&
+		 Filament->Logs.LastThreadId.ThreadId == ThreadId.ThreadId &&
+		 0 == wcscmp( Filament->Logs.LastMessage, Message ) )
+	{
+		Filament->Logs.RepeatCount++;
+		goto Cleanup;
+	}
+
+	ReportRepeated = CfixsDetachRepeatedLogs( 
+		Filament, 
+		RepeatedMessage, 
+		&RepeatedThreadId );
 
 	//
-	// Report log event.
+	// Enforce budget.
 	//
-	Event.Type				= CfixEventLog;
-	Event.Info.Log.Message	= Message;
+	Bytes = ( ULONG ) ( wcslen( Message ) + 1 ) * sizeof( WCHAR );
+	if ( Filament->Logs.BytesReported + Bytes > CFIXP_LOG_BUDGET_BYTES )
+	{
+		Filament->Logs.DroppedMessages++;
+		Filament->Logs.DroppedBytes += Bytes;
+		goto Cleanup;
+	}
 
-	( VOID ) Filament->ExecutionContext->ReportEvent(
-		Filament->ExecutionContext,
-		&ThreadId,
-		&Event );
+	Filament->Logs.BytesReported += Bytes;
+
+	//
+	// Messages too long to be retained are not coalesced.
+	//
+	if ( FAILED( StringCchCopy(
+		Filament->Logs.LastMessage,
+		_countof( Filament->Logs.LastMessage ),
+		Message ) ) )
+	{
+		Filament->Logs.LastMessage[ 0 ] = UNICODE_NULL;
+	}
+	Filament->Logs.LastThreadId = ThreadId;
+
+	ReportMessage = TRUE;
+
+Cleanup:
+	LeaveCriticalSection( &Filament->Logs.Lock );
+
+	//
+	// Report outside the lock, reporting may involve I/O.
+	//
+	if ( ReportRepeated )
+	{
+		CfixsReportLogEvent( Filament, &RepeatedThreadId, RepeatedMessage );
+	}
+
+	if ( ReportMessage )
+	{
+		CfixsReportLogEvent( Filament, &ThreadId, Message );
+	}
 }
 
 CFIXAPI VOID __cdecl CfixPeReportLog(
@@ -578,7 +800,8 @@ CFIXAPI VOID __cdecl CfixPeReportLog(
 	...
 	)
 {
-	WCHAR Message[ 512 ] = { 0 };
+	SIZE_T Mark = CfixpGetMarkMessageArena();
+	PCWSTR Message = L"";
 	va_list lst;
 
 	if ( Format != NULL )
@@ -587,15 +810,17 @@ CFIXAPI VOID __cdecl CfixPeReportLog(
 		// Format message.
 		//
 		va_start( lst, Format );
-		( VOID ) StringCchVPrintf(
-			Message, 
-			_countof( Message ),
-			Format,
-			lst );
+		Message = CfixpFormatMessageArena( Format, lst );
 		va_end( lst );
+
+		if ( Message == NULL )
+		{
+			Message = L"(Invalid string)";
+		}
 	}
 
 	CfixsPeReportLog( Message );
+	CfixpReleaseMessageArena( Mark );
 }
 
 CFIXAPI VOID __cdecl CfixPeReportLogA(
@@ -603,8 +828,8 @@ CFIXAPI VOID __cdecl CfixPeReportLogA(
 	...
 	)
 {
-	CHAR AnsiMessage[ 512 ] = { 0 };
-	WCHAR Message[ 512 ] = { 0 };
+	SIZE_T Mark = CfixpGetMarkMessageArena();
+	PCWSTR Message = L"";
 	va_list lst;
 
 	if ( Format != NULL )
@@ -613,30 +838,15 @@ CFIXAPI VOID __cdecl CfixPeReportLogA(
 		// Format message.
 		//
 		va_start( lst, Format );
-		( VOID ) StringCchVPrintfA(
-			AnsiMessage, 
-			_countof( AnsiMessage ),
-			Format,
-			lst );
+		Message = CfixpFormatMessageArenaA( Format, lst );
 		va_end( lst );
 
-		//
-		// Convert.
-		//
-		if ( ! MultiByteToWideChar(
-			CP_ACP,
-			0,
-			AnsiMessage,
-			-1,
-			Message,
-			_countof( Message ) ) )
+		if ( Message == NULL )
 		{
-			( VOID ) StringCchCopy(
-				Message,
-				_countof( Message ),
-				L"(Invalid string)" );
+			Message = L"(Invalid string)";
 		}
 	}
 	
 	CfixsPeReportLog( Message );
+	CfixpReleaseMessageArena( Mark );
 }
\ No newline at end of file
@@ -118,6 +118,37 @@ typedef struct _CFIXP_DBGHELP
 
 static CFIXP_DBGHELP CfixsDbghelp = { 0 };
 
+//
+// Capture policy, see CfixSetStackTraceCapturePolicy.
+//
+static volatile CFIX_STACKTRACE_CAPTURE_POLICY CfixsCapturePolicy = 
+{
+	sizeof( CFIX_STACKTRACE_CAPTURE_POLICY ),
+	0,
+	0,
+	0
+};
+
+typedef USHORT ( WINAPI *CFIXP_RTLCAPTURESTACKBACKTRACE_PROC )(
+	__in ULONG FramesToSkip,
+	__in ULONG FramesToCapture,
+	__out PVOID *BackTrace,
+	__out_opt PULONG BackTraceHash
+	);
+
+//
+// RtlCaptureStackBackTrace, if available. Unlike StackWalk64, this 
+// routine does not depend on dbghelp and is thread-safe, so it can be 
+// used without acquiring CfixsDbgHelpLock.
+//
+static CFIXP_RTLCAPTURESTACKBACKTRACE_PROC CfixsRtlCaptureStackBackTrace = NULL;
+
+//
+// On Windows XP/2003, FramesToSkip + FramesToCapture must be less
+// than 63.
+//
+#define CFIXP_MAX_BACKTRACE_FRAMES 62
+
 /*------------------------------------------------------------------------------
  *
  * Initialization/Teardown - called by DllMain.
@@ -126,7 +157,22 @@ static CFIXP_DBGHELP CfixsDbghelp = { 0 };
 
 BOOL CfixpSetupStackTraceCapturing()
 {
+	HMODULE Kernel32;
+
 	InitializeCriticalSection( &CfixsDbgHelpLock );
+
+	//
+	// N.B. kernel32 is always loaded, so using GetModuleHandle in 
+	// DllMain is safe. If the export is missing (Windows 2000), 
+	// captures fall back to using StackWalk64.
+	//
+	Kernel32 = GetModuleHandle( L"kernel32.dll" );
+	if ( Kernel32 != NULL )
+	{
+		CfixsRtlCaptureStackBackTrace = ( CFIXP_RTLCAPTURESTACKBACKTRACE_PROC )
+			GetProcAddress( Kernel32, "RtlCaptureStackBackTrace" );
+	}
+
 	return TRUE;
 }
 
@@ -229,6 +275,51 @@ static HRESULT CfixsLazyInitializeDbgHelp()
 	}
 }
 
+/*++
+	Routine Description:
+		Capture return addresses of the current thread's stack
+		using RtlCaptureStackBackTrace. Neither dbghelp nor
+		CfixsDbgHelpLock are used; symbols are resolved lazily
+		by CfixpGetInformationStackframe.
+
+	Return Value:
+		Number of frames captured. 0 if the stack could not be
+		walked, in which case the caller should fall back to 
+		StackWalk64.
+--*/
+static __declspec( noinline ) ULONG CfixsCaptureStackBackTrace(
+	__in PCFIX_STACKTRACE StackTrace,
+	__in UINT MaxFrames 
+	)
+{
+	PVOID BackTrace[ CFIXP_MAX_BACKTRACE_FRAMES ];
+	ULONG FramesToCapture;
+	USHORT FrameCount;
+	USHORT Index;
+
+	ASSERT( CfixsRtlCaptureStackBackTrace != NULL );
+
+	//
+	// Skip this routine's frame s.t. the trace starts at 
+	// CfixpCaptureStackTrace - just as the StackWalk64-based
+	// trace does.
+	//
+	FramesToCapture = min( MaxFrames, CFIXP_MAX_BACKTRACE_FRAMES - 1 );
+	FrameCount = CfixsRtlCaptureStackBackTrace(
+		1,
+		FramesToCapture,
+		BackTrace,
+		NULL );
+
+	for ( Index = 0; Index < FrameCount; Index++ )
+	{
+		StackTrace->Frames[ Index ] = ( ULONGLONG ) ( ULONG_PTR ) BackTrace[ Index ];
+	}
+
+	StackTrace->FrameCount = FrameCount;
+	return FrameCount;
+}
+
 #ifdef _M_IX86
 	//
 	// Disable global optimization and ignore /GS waning caused by 
@@ -252,6 +343,18 @@ HRESULT CfixpCaptureStackTrace(
 	ASSERT( StackTrace );
 	ASSERT( MaxFrames > 0 );
 
+	StackTrace->GetInformationStackFrame = CfixpGetInformationStackframe;
+
+	if ( InitialContext == NULL && 
+		 CfixsRtlCaptureStackBackTrace != NULL &&
+		 CfixsCaptureStackBackTrace( StackTrace, MaxFrames ) > 0 )
+	{
+		//
+		// Fast path - no need to serialize on CfixsDbgHelpLock.
+		//
+		return S_OK;
+	}
+
 	if ( InitialContext == NULL )
 	{
 		//
@@ -317,7 +420,6 @@ HRESULT CfixpCaptureStackTrace(
 #endif
 
 	StackTrace->FrameCount = 0;
-	StackTrace->GetInformationStackFrame = CfixpGetInformationStackframe;
 
 	//
 	// Dbghelp is is singlethreaded.
@@ -375,6 +477,57 @@ HRESULT CfixpCaptureStackTrace(
 	#pragma optimize( "g", on )
 #endif
 
+BOOL CfixpShouldCaptureStackTrace(
+	__in PCFIXP_FILAMENT Filament,
+	__in CFIX_EVENT_TYPE EventType
+	)
+{
+	LONG EventNumber;
+	ULONG SamplingInterval;
+	ULONG MaxStackTraces;
+
+	ASSERT( Filament );
+
+	if ( ! CfixpFlagOn( Filament->Flags, CFIXP_FILAMENT_FLAG_CAPTURE_STACK_TRACES ) ||
+		 EventType == CfixEventLog )
+	{
+		return FALSE;
+	}
+	
+	if ( CfixpFlagOn( CfixsCapturePolicy.Flags, CFIX_STACKTRACE_CAPTURE_FAILURES_ONLY ) &&
+		 EventType == CfixEventInconclusiveness )
+	{
+		return FALSE;
+	}
+
+	//
+	// N.B. The policy may be changed concurrently, so read each
+	// field once.
+	//
+	SamplingInterval	= CfixsCapturePolicy.SamplingInterval;
+	MaxStackTraces		= CfixsCapturePolicy.MaxStackTracesPerTestCase;
+
+	//
+	// N.B. Child threads share the filament, so use interlocked 
+	// operations.
+	//
+	EventNumber = InterlockedIncrement( &Filament->StackTraces.EligibleEvents );
+	if ( SamplingInterval > 1 &&
+		 ( ( ULONG ) EventNumber - 1 ) % SamplingInterval != 0 )
+	{
+		return FALSE;
+	}
+
+	if ( MaxStackTraces > 0 &&
+		 ( ULONG ) InterlockedIncrement( &Filament->StackTraces.Captured ) > 
+			MaxStackTraces )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 HRESULT CFIXCALLTYPE CfixpGetInformationStackframe(
 	__in ULONGLONG Frame,
 	__in SIZE_T ModuleNameCch,
@@ -412,7 +565,7 @@ HRESULT CFIXCALLTYPE CfixpGetInformationStackframe(
 	Hr = CfixsLazyInitializeDbgHelp();
 	if ( FAILED( Hr ) )
 	{
-		return Hr;
+		goto Cleanup;
 	}
 
 	//
@@ -497,4 +650,85 @@ Cleanup:
 	LeaveCriticalSection( &CfixsDbgHelpLock );
 
 	return Hr;
-}
\ No newline at end of file
+}
+
+/*------------------------------------------------------------------------------
+ *
+ * Exports.
+ *
+ */
+
+CFIXAPI HRESULT CFIXCALLTYPE CfixSetStackTraceCapturePolicy(
+	__in_opt PCFIX_STACKTRACE_CAPTURE_POLICY Policy
+	)
+{
+	CFIX_STACKTRACE_CAPTURE_POLICY NewPolicy;
+
+	if ( Policy == NULL )
+	{
+		ZeroMemory( &NewPolicy, sizeof( CFIX_STACKTRACE_CAPTURE_POLICY ) );
+		NewPolicy.SizeOfStruct = sizeof( CFIX_STACKTRACE_CAPTURE_POLICY );
+	}
+	else if ( Policy->SizeOfStruct != sizeof( CFIX_STACKTRACE_CAPTURE_POLICY ) ||
+			  Policy->Flags > CFIX_STACKTRACE_CAPTURE_FAILURES_ONLY )
+	{
+		return E_INVALIDARG;
+	}
+	else
+	{
+		NewPolicy = *Policy;
+	}
+
+	//
+	// N.B. Tests may be running on other threads, so update each
+	// field atomically.
+	//
+	InterlockedExchange( 
+		( volatile LONG* ) &CfixsCapturePolicy.Flags, 
+		( LONG ) NewPolicy.Flags );
+	InterlockedExchange( 
+		( volatile LONG* ) &CfixsCapturePolicy.SamplingInterval, 
+		( LONG ) NewPolicy.SamplingInterval );
+	InterlockedExchange( 
+		( volatile LONG* ) &CfixsCapturePolicy.MaxStackTracesPerTestCase, 
+		( LONG ) NewPolicy.MaxStackTracesPerTestCase );
+
+	return S_OK;
+}
+
+//
+// FNV-1a parameters (32 bit).
+//
+#define CFIXP_FNV_OFFSET_BASIS	2166136261UL
+#define CFIXP_FNV_PRIME			16777619UL
+
+CFIXAPI ULONG CFIXCALLTYPE CfixHashStackTrace(
+	__in PCFIX_STACKTRACE StackTrace
+	)
+{
+	ULONG FrameIndex;
+	ULONG Hash = CFIXP_FNV_OFFSET_BASIS;
+
+	if ( StackTrace == NULL || StackTrace->FrameCount == 0 )
+	{
+		return 0;
+	}
+
+	for ( FrameIndex = 0; FrameIndex < StackTrace->FrameCount; FrameIndex++ )
+	{
+		ULONGLONG Frame = StackTrace->Frames[ FrameIndex ];
+		ULONG ByteIndex;
+
+		for ( ByteIndex = 0; ByteIndex < sizeof( ULONGLONG ); ByteIndex++ )
+		{
+			Hash ^= ( ULONG ) ( Frame & 0xFF );
+			Hash *= CFIXP_FNV_PRIME;
+			Frame >>= 8;
+		}
+	}
+
+	//
+	// Reserve 0 for empty traces.
+	//
+	return Hash == 0 ? 1 : Hash;
+}
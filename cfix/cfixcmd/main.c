@@ -101,6 +101,10 @@ static VOID CfixcmdsPrintUsage(
 		L"    -nologo          Do not display logo\n"
 		L"    -td              Disable stack trace capturing\n"
 		L"    -ts              Omit source information in stack traces\n"
+		L"    -tf              Capture stack traces for failures only, not for\n"
+		L"                     inconclusive tests\n"
+		L"    -tn <count>      Capture at most <count> stack traces per test case\n"
+		L"    -tk <interval>   Capture a stack trace for every <interval>th event only\n"
 		L"    -eventdll        Event DLL to use. Default is cfixcons.dll (Console output)\n"
 		L"    -eventdlloptions Event DLL-specific options.\n"
 		L"\n"
@@ -28,6 +28,7 @@
 #define CDIAGLITE
 #include <cdiag.h>
 #include <cfixevnt.h>
+#include <hashtable.h>
 #include <crtdbg.h>
 
 #pragma warning( push )
@@ -37,6 +38,47 @@
 
 #define ASSERT _ASSERTE
 
+#define CFIXCONS_MAX_REPORTER_NAME_CCH 200
+
+/*++
+	Structure Description:
+		Interned stack trace. Stack traces are identified by their
+		raw frame addresses; each distinct trace is symbolized and
+		printed only once.
+--*/
+typedef struct _CFIXCONS_INTERNED_STACKTRACE
+{
+	union
+	{
+		//
+		// Hash as computed by CfixHashStackTrace.
+		//
+		ULONG_PTR Hash;
+		JPHT_HASHTABLE_ENTRY HashtableEntry;
+	} Key;
+
+	//
+	// Number used to refer to this trace in the output.
+	//
+	ULONG Id;
+
+	//
+	// Number of failures reported with this stack trace.
+	//
+	ULONG FailureCount;
+
+	//
+	// Module.Fixture.TestCase of first failure.
+	//
+	WCHAR FirstReportedBy[ CFIXCONS_MAX_REPORTER_NAME_CCH ];
+
+	ULONG FrameCount;
+	ULONGLONG Frames[ ANYSIZE_ARRAY ];
+} CFIXCONS_INTERNED_STACKTRACE, *PCFIXCONS_INTERNED_STACKTRACE;
+
+C_ASSERT( FIELD_OFFSET( CFIXCONS_INTERNED_STACKTRACE, Key.Hash ) ==
+		  FIELD_OFFSET( CFIXCONS_INTERNED_STACKTRACE, Key.HashtableEntry.Key ) );
+
 typedef struct _CFIXCONS_EVENT_SINK
 {
 	CFIX_EVENT_SINK Base;
@@ -55,15 +97,232 @@ typedef struct _CFIXCONS_EVENT_SINK
 		ULONG FailureCount;
 		ULONG InconclusiveCount;
 	} CurrentTestCase;
+
+	struct
+	{
+		//
+		// Lock guarding this sub-struct.
+		//
+		CRITICAL_SECTION Lock;
+
+		//
+		// Interned stack traces.
+		//	Key:	Hash of raw frames
+		//	Value:	PCFIXCONS_INTERNED_STACKTRACE
+		//
+		JPHT_HASHTABLE Table;
+
+		ULONG NextId;
+	} StackTraces;
 } CFIXCONS_EVENT_SINK, *PCFIXCONS_EVENT_SINK;
 
 
+/*----------------------------------------------------------------------
+ *
+ * Hashtable Callbacks.
+ *
+ */
+
+static ULONG CfixconssHashStackTrace(
+	__in ULONG_PTR Key
+	)
+{
+	//
+	// N.B. Key already is a hash.
+	//
+	return ( ULONG ) Key;
+}
+
+static BOOLEAN CfixconssEqualsStackTrace(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+static PVOID CfixconssAllocateHashtableMemory(
+	__in SIZE_T Size 
+	)
+{
+	return malloc( Size );
+}
+
+static VOID CfixconssFreeHashtableMemory(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static VOID CfixconssSummarizeStackTraceCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PCFIXCONS_INTERNED_STACKTRACE Trace;
+	PBOOL HeaderPrinted = ( PBOOL ) Context;
+	
+	UNREFERENCED_PARAMETER( Hashtable );
+	ASSERT( HeaderPrinted );
+	__assume( HeaderPrinted );
+
+	Trace = CONTAINING_RECORD(
+		Entry,
+		CFIXCONS_INTERNED_STACKTRACE,
+		Key.HashtableEntry );
+
+	if ( Trace->FailureCount > 1 )
+	{
+		if ( ! *HeaderPrinted )
+		{
+			wprintf( L"\nFailures sharing a stack trace:\n" );
+			*HeaderPrinted = TRUE;
+		}
+
+		wprintf(
+			L"                 %d failures share stack trace #%d "
+			L"(first reported by %s)\n",
+			Trace->FailureCount,
+			Trace->Id,
+			Trace->FirstReportedBy );
+	}
+}
+
+static VOID CfixconssDeleteStackTraceCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Unused
+	)
+{
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	
+	UNREFERENCED_PARAMETER( Unused );
+
+	JphtRemoveEntryHashtable(
+		Hashtable,
+		Entry->Key,
+		&OldEntry );
+
+	ASSERT( Entry == OldEntry );
+
+	free( CONTAINING_RECORD(
+		Entry,
+		CFIXCONS_INTERNED_STACKTRACE,
+		Key.HashtableEntry ) );
+}
+
 /*----------------------------------------------------------------------
  *
  * Helpers.
  *
  */
 
+/*++
+	Routine Description:
+		Look up the stack trace among the interned traces and
+		record the failure. If the trace has not been seen before,
+		it is interned.
+
+	Parameters:
+		Trace			- Interned trace. NULL if the trace could not
+						  be interned - it should then be printed in 
+						  full.
+		FirstOccurrence	- TRUE iff the trace has not been seen before.
+--*/
+static VOID CfixconssInternStackTrace(
+	__in PCFIXCONS_EVENT_SINK Sink,
+	__in PCFIX_STACKTRACE StackTrace,
+	__in PCWSTR ModuleBaseName,
+	__in PCWSTR FixtureName,
+	__in PCWSTR TestCaseName,
+	__out PCFIXCONS_INTERNED_STACKTRACE *Trace,
+	__out PBOOL FirstOccurrence
+	)
+{
+	PJPHT_HASHTABLE_ENTRY Entry;
+	ULONG Hash;
+	PCFIXCONS_INTERNED_STACKTRACE NewTrace;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+
+	ASSERT( StackTrace->FrameCount > 0 );
+
+	*Trace			= NULL;
+	*FirstOccurrence	= TRUE;
+
+	Hash = CfixHashStackTrace( StackTrace );
+
+	EnterCriticalSection( &Sink->StackTraces.Lock );
+
+	Entry = JphtGetEntryHashtable( &Sink->StackTraces.Table, Hash );
+	if ( Entry != NULL )
+	{
+		PCFIXCONS_INTERNED_STACKTRACE ExistingTrace = CONTAINING_RECORD(
+			Entry,
+			CFIXCONS_INTERNED_STACKTRACE,
+			Key.HashtableEntry );
+		
+		if ( ExistingTrace->FrameCount == StackTrace->FrameCount &&
+			 0 == memcmp( 
+				ExistingTrace->Frames, 
+				StackTrace->Frames, 
+				StackTrace->FrameCount * sizeof( ULONGLONG ) ) )
+		{
+			ExistingTrace->FailureCount++;
+
+			*Trace			= ExistingTrace;
+			*FirstOccurrence	= FALSE;
+		}
+		else
+		{
+			//
+			// Hash collision - do not intern this trace, it will 
+			// be printed in full.
+			//
+		}
+
+		goto Cleanup;
+	}
+
+	NewTrace = malloc( 
+		FIELD_OFFSET( CFIXCONS_INTERNED_STACKTRACE, Frames ) + 
+		StackTrace->FrameCount * sizeof( ULONGLONG ) );
+	if ( NewTrace == NULL )
+	{
+		goto Cleanup;
+	}
+
+	NewTrace->Key.Hash		= Hash;
+	NewTrace->Id			= ++Sink->StackTraces.NextId;
+	NewTrace->FailureCount	= 1;
+	NewTrace->FrameCount	= StackTrace->FrameCount;
+
+	CopyMemory( 
+		NewTrace->Frames, 
+		StackTrace->Frames, 
+		StackTrace->FrameCount * sizeof( ULONGLONG ) );
+
+	( VOID ) StringCchPrintf(
+		NewTrace->FirstReportedBy,
+		_countof( NewTrace->FirstReportedBy ),
+		L"%s.%s.%s",
+		ModuleBaseName,
+		FixtureName,
+		TestCaseName );
+
+	JphtPutEntryHashtable(
+		&Sink->StackTraces.Table,
+		&NewTrace->Key.HashtableEntry,
+		&OldEntry );
+	ASSERT( OldEntry == NULL );
+
+	*Trace = NewTrace;
+
+Cleanup:
+	LeaveCriticalSection( &Sink->StackTraces.Lock );
+}
+
 static VOID CfixconssFormatStackTrace(
 	__in PCFIX_STACKTRACE StackTrace,
 	__in BOOL ShowSourceInformation,
@@ -172,6 +431,23 @@ static VOID CfixconssDereference(
 
 	if ( 0 == InterlockedDecrement( &Sink->ReferenceCount ) )
 	{
+		BOOL HeaderPrinted = FALSE;
+
+		//
+		// End of run - report which failures had a common cause.
+		//
+		JphtEnumerateEntries(
+			&Sink->StackTraces.Table,
+			CfixconssSummarizeStackTraceCallback,
+			&HeaderPrinted );
+
+		JphtEnumerateEntries(
+			&Sink->StackTraces.Table,
+			CfixconssDeleteStackTraceCallback,
+			NULL );
+		JphtDeleteHashtable( &Sink->StackTraces.Table );
+		DeleteCriticalSection( &Sink->StackTraces.Lock );
+
 		Sink->Resolver->Dereference( Sink->Resolver );
 		free( Sink );
 	}
@@ -230,11 +506,50 @@ static VOID CfixconssReportEvent(
 	if ( Event->StackTrace.FrameCount > 0 &&
 		 Event->StackTrace.GetInformationStackFrame != NULL )
 	{
-		CfixconssFormatStackTrace( 
+		PCFIXCONS_INTERNED_STACKTRACE Trace;
+		BOOL FirstOccurrence;
+
+		CfixconssInternStackTrace(
+			Sink,
 			&Event->StackTrace,
-			Sink->Flags & CFIX_EVENT_SINK_FLAG_SHOW_STACKTRACE_SOURCE_INFORMATION,
-			StackTraceBuffer,
-			_countof( StackTraceBuffer ) );
+			ModuleBaseName,
+			FixtureName,
+			TestCaseName,
+			&Trace,
+			&FirstOccurrence );
+
+		if ( FirstOccurrence )
+		{
+			if ( Trace != NULL )
+			{
+				( VOID ) StringCchPrintf(
+					StackTraceBuffer,
+					_countof( StackTraceBuffer ),
+					L"                 Stack trace #%d:\n",
+					Trace->Id );
+			}
+
+			CfixconssFormatStackTrace( 
+				&Event->StackTrace,
+				Sink->Flags & CFIX_EVENT_SINK_FLAG_SHOW_STACKTRACE_SOURCE_INFORMATION,
+				StackTraceBuffer,
+				_countof( StackTraceBuffer ) );
+		}
+		else
+		{
+			//
+			// Symbolizing and printing the same trace again is 
+			// pointless - refer to the first occurrence instead.
+			//
+			ASSERT( Trace != NULL );
+			__assume( Trace != NULL );
+
+			( VOID ) StringCchPrintf(
+				StackTraceBuffer,
+				_countof( StackTraceBuffer ),
+				L"                 Stack trace #%d (see above)\n",
+				Trace->Id );
+		}
 	}
 
 
@@ -473,6 +788,26 @@ CFIXAPI HRESULT CFIXCALLTYPE CreateEventSink(
 
 	ZeroMemory( NewSink, sizeof( CFIXCONS_EVENT_SINK ) );
 
+	if ( ! JphtInitializeHashtable(
+		&NewSink->StackTraces.Table,
+		CfixconssAllocateHashtableMemory,
+		CfixconssFreeHashtableMemory,
+		CfixconssHashStackTrace,
+		CfixconssEqualsStackTrace,
+		31 ) )
+	{
+		free( NewSink );
+		return E_OUTOFMEMORY;
+	}
+
+	//
+	// The number of distinct stack traces is unbounded.
+	//
+	JphtSetLoadFactorsHashtable(
+		&NewSink->StackTraces.Table,
+		JPHT_DEFAULT_GROW_LOAD_FACTOR,
+		JPHT_DEFAULT_SHRINK_LOAD_FACTOR );
+
 	NewSink->ReferenceCount						= 1;
 	NewSink->Flags								= Flags;
 	NewSink->CurrentTestCase.FailureCount		= 0;
@@ -481,10 +816,13 @@ CFIXAPI HRESULT CFIXCALLTYPE CreateEventSink(
 	Hr = CdiagCreateMessageResolver( &NewSink->Resolver );
 	if ( FAILED( Hr ) )
 	{
+		JphtDeleteHashtable( &NewSink->StackTraces.Table );
 		free( NewSink );
 		return Hr;
 	}
 
+	InitializeCriticalSection( &NewSink->StackTraces.Lock );
+
 	NewSink->Base.Version				= CFIX_EVENT_SINK_VERSION;
 	NewSink->Base.ReportEvent			= CfixconssReportEvent;
 	NewSink->Base.BeforeFixtureStart	= CfixconssBeforeFixtureStart;
@@ -95,6 +95,13 @@ typedef struct _CFIXRUN_OPTIONS
 	BOOL DisableStackTraces;
 	BOOL OmitSourceInfoInStackTrace;
 
+	//
+	// Stack trace capture policy.
+	//
+	BOOL StackTracesForFailuresOnly;
+	PCWSTR MaxStackTracesPerTestCase;
+	PCWSTR StackTraceSamplingInterval;
+
 	PCWSTR EventDll;
 	PCWSTR EventDllOptions;
 	
@@ -23,6 +23,7 @@
 #include "cfixrunp.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 #pragma warning( push )
 #pragma warning( disable: 6011; disable: 6387 )
@@ -57,6 +58,28 @@ static int CfixcmdsPrintConsoleAndDebug(
 	return wprintf( L"%s", Buffer );;
 }
 
+/*++
+	Routine Description:
+		Check whether a value is a decimal number that fits into
+		a ULONG. Unlike wcstoul, signs and whitespace are rejected.
+--*/
+static BOOL CfixrunsIsValidNumber(
+	__in PCWSTR Value
+	)
+{
+	PWSTR End;
+
+	if ( Value[ 0 ] < L'0' || Value[ 0 ] > L'9' )
+	{
+		return FALSE;
+	}
+
+	errno = 0;
+	( VOID ) wcstoul( Value, &End, 10 );
+
+	return *End == UNICODE_NULL && errno != ERANGE;
+}
+
 BOOL CfixrunParseCommandLine(
 	__in UINT Argc,
 	__in PCWSTR *Argv,
@@ -245,6 +268,21 @@ BOOL CfixrunParseCommandLine(
 				Options->DisableStackTraces = TRUE;
 				State = StateExpectAny;
 			}
+			else if ( 0 == wcscmp( FlagName, L"tf" ) )
+			{
+				Options->StackTracesForFailuresOnly = TRUE;
+				State = StateExpectAny;
+			}
+			else if ( 0 == wcscmp( FlagName, L"tn" ) )
+			{
+				Value = &Options->MaxStackTracesPerTestCase;
+				State = StateExpectValue;
+			}
+			else if ( 0 == wcscmp( FlagName, L"tk" ) )
+			{
+				Value = &Options->StackTraceSamplingInterval;
+				State = StateExpectValue;
+			}
 			else
 			{
 				Options->PrintConsole( L"Unknown flag '%s'\n", Argv[ ArgIndex ] );
@@ -268,6 +306,21 @@ BOOL CfixrunParseCommandLine(
 		}
 	}
 
+	if ( Options->MaxStackTracesPerTestCase != NULL &&
+		 ! CfixrunsIsValidNumber( Options->MaxStackTracesPerTestCase ) )
+	{
+		Options->PrintConsole( L"Invalid value '%s' for -tn\n", 
+			Options->MaxStackTracesPerTestCase );
+		return FALSE;
+	}
+	else if ( Options->StackTraceSamplingInterval != NULL &&
+		 ! CfixrunsIsValidNumber( Options->StackTraceSamplingInterval ) )
+	{
+		Options->PrintConsole( L"Invalid value '%s' for -tk\n", 
+			Options->StackTraceSamplingInterval );
+		return FALSE;
+	}
+
 	if ( Options->InputFileType == CfixrunInputRequiresSpawn )
 	{
 		if ( Options->EnableKernelFeatures )
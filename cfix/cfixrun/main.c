@@ -88,6 +88,29 @@ Cleanup:
 	return Hr;
 }
 
+static HRESULT CfixrunsSetStackTraceCapturePolicy(
+	__in PCFIXRUN_OPTIONS Options
+	)
+{
+	CFIX_STACKTRACE_CAPTURE_POLICY Policy;
+
+	//
+	// Values have been validated by CfixrunParseCommandLine.
+	//
+	Policy.SizeOfStruct					= sizeof( CFIX_STACKTRACE_CAPTURE_POLICY );
+	Policy.Flags						= Options->StackTracesForFailuresOnly
+		? CFIX_STACKTRACE_CAPTURE_FAILURES_ONLY
+		: 0;
+	Policy.MaxStackTracesPerTestCase	= Options->MaxStackTracesPerTestCase
+		? wcstoul( Options->MaxStackTracesPerTestCase, NULL, 10 )
+		: 0;
+	Policy.SamplingInterval				= Options->StackTraceSamplingInterval
+		? wcstoul( Options->StackTraceSamplingInterval, NULL, 10 )
+		: 0;
+
+	return CfixSetStackTraceCapturePolicy( &Policy );
+}
+
 static HRESULT CfixrunsMainWorker(
 	__in PCFIXRUN_STATE State,
 	__out PDWORD ExitCode
@@ -150,6 +173,16 @@ static HRESULT CfixrunsMainWorker(
 			State,
 			&ExecCtx,
 			&InnerExecCtx );
+		if ( SUCCEEDED( Hr ) )
+		{
+			Hr = CfixrunsSetStackTraceCapturePolicy( State->Options );
+			if ( FAILED( Hr ) )
+			{
+				*ExitCode = CFIXRUN_EXIT_FAILURE;
+				ExecCtx->Dereference( ExecCtx );
+			}
+		}
+
 		if ( SUCCEEDED( Hr ) )
 		{
 			CFIXRUN_STATISTICS Statistics;
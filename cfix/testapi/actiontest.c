@@ -1412,6 +1412,44 @@ static void TestAutoJoinAfterInconclusiveOnAutoRegisteredThread()
 	Module->Routines.Dereference( Module );
 }
 
+static void TestLogCoalescingAndBudget()
+{
+	PCFIX_ACTION Action;
+	TEST_EXECUTUTION_CONTEXT Ctx = TEXT_EXECUTION_CONTEXT_INITIALIZER;
+	PCFIX_FIXTURE Fixture;
+	PCFIX_TEST_MODULE Module;
+
+	CFIX_ASSERT( GetFixture( 
+		L"testlib6.dll", 
+		L"LogCoalescingAndBudget", 
+		&Module, 
+		&Fixture ) );
+
+	CreateSequenceActionForFixture( Fixture, 1, &Action );
+
+	Ctx.ExpectedMainThreadId = GetCurrentThreadId();
+	Ctx.Disp = CfixContinue;
+
+	TEST_HR( Action->Run( Action, &Ctx.Base ) );
+
+	//
+	// LogRepeatedly: 3 logs after coalescing.
+	// LogRepeatedlyOnTwoThreads: 4 logs, repetitions on different
+	// threads are not coalesced.
+	// LogExceedingBudget: 262 messages of 1000 bytes fit into the
+	// budget, plus one report about the dropped messages.
+	//
+	TEST( Ctx.Events[ CfixEventLog ]				== 3 + 4 + 262 + 1 );
+	TEST( Ctx.AfterTestCaseFinishCalls				== 3 );
+	TEST( Ctx.Events[ CfixEventFailedAssertion ]	== 0 );
+	TEST( Ctx.CaseRanToCompletion );
+
+	Action->Dereference( Action );
+	TEST( Ctx.RefCount == 0 );
+
+	Module->Routines.Dereference( Module );
+}
+
 CFIX_BEGIN_FIXTURE(SequenceActionEventHandling)
 	CFIX_FIXTURE_ENTRY(TestSequenceOfSetupAndTearDown)
 	CFIX_FIXTURE_ENTRY(TestSequenceOfSetupSuccessfulTestsAndTearDown)
@@ -1420,6 +1458,7 @@ CFIX_BEGIN_FIXTURE(SequenceActionEventHandling)
 	CFIX_FIXTURE_ENTRY(TestSequenceOfTestsFailingWithAssertions)
 	CFIX_FIXTURE_ENTRY(TestSequenceOfFailingTeardown)
 	CFIX_FIXTURE_ENTRY(TestSequenceOfFailingSetupLeadsToTeardownsBeingSkipped)
+	CFIX_FIXTURE_ENTRY(TestLogCoalescingAndBudget)
 CFIX_END_FIXTURE()
 
 CFIX_BEGIN_FIXTURE(BasicEventHandling)
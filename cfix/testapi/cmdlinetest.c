@@ -122,6 +122,31 @@ void TestCmdLineParser()
 	TEST( 0 == wcscmp( Options.InputFile, L"foo.dll" ) );
 	TEST( 0 == wcscmp( Options.EventDll, L"ev.dll" ) );
 	TEST( 0 == wcscmp( Options.EventDllOptions, L"a b" ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ParseCommandLine( L"runtest -tf -tn 5 -tk 3 foo.dll", &Options ) );
+	TEST( 0 == wcscmp( Options.InputFile, L"foo.dll" ) );
+	TEST( Options.StackTracesForFailuresOnly );
+	TEST( 0 == wcscmp( Options.MaxStackTracesPerTestCase, L"5" ) );
+	TEST( 0 == wcscmp( Options.StackTraceSamplingInterval, L"3" ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ParseCommandLine( L"runtest -tn 0 -tk 4294967295 foo.dll", &Options ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ! ParseCommandLine( L"runtest -tn foo.dll", &Options ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ! ParseCommandLine( L"runtest -tn abc foo.dll", &Options ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ! ParseCommandLine( L"runtest -tn 5x foo.dll", &Options ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ! ParseCommandLine( L"runtest -tk 4294967296 foo.dll", &Options ) );
+
+	ZeroMemory( &Options, sizeof( CFIXRUN_OPTIONS ) );
+	TEST( ! ParseCommandLine( L"runtest -tk \"\" foo.dll", &Options ) );
 }
 
 CFIX_BEGIN_FIXTURE(CmdLineParser)
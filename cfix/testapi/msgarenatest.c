@@ -0,0 +1,140 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Test per-thread message arena.
+ *
+ * Copyright:
+ *		2008-2009, Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include "test.h"
+
+static PCWSTR FormatArenaMessageW(
+	__in __format_string PCWSTR Format,
+	...
+	)
+{
+	PCWSTR Message;
+	va_list Lst;
+
+	va_start( Lst, Format );
+	Message = CfixPeFormatMessageW( Format, Lst );
+	va_end( Lst );
+
+	return Message;
+}
+
+static PCWSTR FormatArenaMessageA(
+	__in __format_string PCSTR Format,
+	...
+	)
+{
+	PCWSTR Message;
+	va_list Lst;
+
+	va_start( Lst, Format );
+	Message = CfixPeFormatMessageA( Format, Lst );
+	va_end( Lst );
+
+	return Message;
+}
+
+static void TestFormatShortMessages()
+{
+	PCWSTR Message1;
+	PCWSTR Message2;
+
+	Message1 = FormatArenaMessageW( L"%s-%d", L"foo", 42 );
+	TEST( Message1 != NULL );
+	TEST( 0 == wcscmp( Message1, L"foo-42" ) );
+
+	Message2 = FormatArenaMessageA( "%s-%S", "bar", L"baz" );
+	TEST( Message2 != NULL );
+	TEST( 0 == wcscmp( Message2, L"bar-baz" ) );
+
+	//
+	// Message1 is still intact.
+	//
+	TEST( 0 == wcscmp( Message1, L"foo-42" ) );
+
+	CfixPeReleaseMessage( Message2 );
+	CfixPeReleaseMessage( Message1 );
+
+	//
+	// Memory is reused after release.
+	//
+	Message2 = FormatArenaMessageW( L"%s", L"again" );
+	TEST( Message2 == Message1 );
+	CfixPeReleaseMessage( Message2 );
+
+	CfixPeReleaseMessage( NULL );
+}
+
+static void TestFormatLongMessages()
+{
+	PCWSTR Message;
+	PCWSTR Converted;
+	PCWSTR Long;
+	PSTR AnsiPadding;
+	PWSTR Padding;
+
+	//
+	// Messages exceeding a chunk must not be truncated.
+	//
+	Padding = ( PWSTR ) malloc( 20000 * sizeof( WCHAR ) );
+	AnsiPadding = ( PSTR ) malloc( 20000 );
+	CFIX_ASSUME( Padding != NULL && AnsiPadding != NULL );
+
+	wmemset( Padding, L'x', 19999 );
+	Padding[ 19999 ] = UNICODE_NULL;
+	memset( AnsiPadding, 'y', 19999 );
+	AnsiPadding[ 19999 ] = '\0';
+
+	Long = FormatArenaMessageW( L"[%s]", Padding );
+	TEST( Long != NULL );
+	TEST_EQ( 20001, ( DWORD ) wcslen( Long ) );
+	TEST( Long[ 0 ] == L'[' && Long[ 20000 ] == L']' );
+
+	Message = FormatArenaMessageA( "<%s>", AnsiPadding );
+	TEST( Message != NULL );
+	TEST_EQ( 20001, ( DWORD ) wcslen( Message ) );
+	TEST( Message[ 1 ] == L'y' && Message[ 20000 ] == L'>' );
+
+	Converted = CfixPeConvertMessageA( AnsiPadding );
+	TEST( Converted != NULL );
+	TEST_EQ( 19999, ( DWORD ) wcslen( Converted ) );
+
+	//
+	// Messages must be released in reverse order.
+	//
+	CfixPeReleaseMessage( Converted );
+	CfixPeReleaseMessage( Message );
+	CfixPeReleaseMessage( Long );
+
+	//
+	// Long messages can be reported without truncation.
+	//
+	CFIX_LOG( L"%s", Padding );
+
+	free( Padding );
+	free( AnsiPadding );
+}
+
+CFIX_BEGIN_FIXTURE( MessageArena )
+	CFIX_FIXTURE_ENTRY(TestFormatShortMessages)
+	CFIX_FIXTURE_ENTRY(TestFormatLongMessages)
+CFIX_END_FIXTURE()
@@ -0,0 +1,396 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Stack trace hashing and capture policy tests, capturing
+ *		throughput measurement for many threads failing at the 
+ *		same time.
+ *
+ * Copyright:
+ *		2008-2009, Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+//
+// Must match testlib6's AssertConcurrentlyOnRegisteredThreads.
+//
+#define CONCURRENT_FAILING_THREADS		16
+#define ASSERTIONS_PER_FAILING_THREAD	1000
+
+typedef struct _BENCH_EXECUTION_CONTEXT
+{
+	CFIX_EXECUTION_CONTEXT Base;
+
+	volatile LONG FailedAssertions;
+	volatile LONG EventsWithStackTrace;
+	volatile LONG OtherEvents;
+} BENCH_EXECUTION_CONTEXT, *PBENCH_EXECUTION_CONTEXT;
+
+static CFIX_REPORT_DISPOSITION BenchQueryDefaultDisposition(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in CFIX_EVENT_TYPE EventType
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( EventType );
+	return CfixContinue;
+}
+
+static CFIX_REPORT_DISPOSITION BenchReportEvent(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_TESTCASE_EXECUTION_EVENT Event
+	)
+{
+	PBENCH_EXECUTION_CONTEXT Ctx = ( PBENCH_EXECUTION_CONTEXT ) This;
+
+	UNREFERENCED_PARAMETER( ThreadId );
+
+	//
+	// N.B. Called concurrently - keep this as cheap as possible
+	// in order not to distort the measurement.
+	//
+	if ( Event->Type == CfixEventFailedAssertion )
+	{
+		InterlockedIncrement( &Ctx->FailedAssertions );
+		if ( Event->StackTrace.FrameCount > 0 )
+		{
+			InterlockedIncrement( &Ctx->EventsWithStackTrace );
+		}
+	}
+	else
+	{
+		InterlockedIncrement( &Ctx->OtherEvents );
+	}
+
+	return CfixContinue;
+}
+
+static HRESULT BenchBeforeFixtureStart(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_FIXTURE Fixture
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( Fixture );
+	return S_OK;
+}
+
+static VOID BenchAfterFixtureFinish(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_FIXTURE Fixture,
+	__in BOOL RanToCompletion
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( Fixture );
+	UNREFERENCED_PARAMETER( RanToCompletion );
+}
+
+static HRESULT BenchBeforeTestCaseStart(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_TEST_CASE TestCase
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( TestCase );
+	return S_OK;
+}
+
+static VOID BenchAfterTestCaseFinish(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PCFIX_TEST_CASE TestCase,
+	__in BOOL RanToCompletion
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( TestCase );
+	UNREFERENCED_PARAMETER( RanToCompletion );
+}
+
+static HRESULT BenchCreateChildThread(
+	__in struct _CFIX_EXECUTION_CONTEXT *This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__out PVOID *Context
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( Context );
+	return S_OK;
+}
+
+static VOID BenchBeforeChildThreadStart(
+	__in struct _CFIX_EXECUTION_CONTEXT *This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__out PVOID *Context
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( Context );
+}
+
+static VOID BenchAfterChildThreadFinish(
+	__in struct _CFIX_EXECUTION_CONTEXT *This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__out PVOID *Context
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( Context );
+}
+
+static VOID BenchOnUnhandledException(
+	__in PCFIX_EXECUTION_CONTEXT This,
+	__in PCFIX_THREAD_ID ThreadId,
+	__in PEXCEPTION_POINTERS ExcpPointers
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+	UNREFERENCED_PARAMETER( ThreadId );
+	UNREFERENCED_PARAMETER( ExcpPointers );
+	CFIX_ASSERT( !"Unexpected exception" );
+}
+
+static VOID BenchReference(
+	__in struct _CFIX_EXECUTION_CONTEXT *This
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+}
+
+static VOID BenchDereference(
+	__in struct _CFIX_EXECUTION_CONTEXT *This
+	)
+{
+	UNREFERENCED_PARAMETER( This );
+}
+
+static void RunConcurrentAssertions(
+	__out PBENCH_EXECUTION_CONTEXT Ctx,
+	__out double *Seconds
+	)
+{
+	PCFIX_ACTION Action;
+	LARGE_INTEGER Frequency;
+	PCFIX_FIXTURE Fixture = NULL;
+	ULONG Index;
+	PCFIX_TEST_MODULE Module;
+	WCHAR Path[ MAX_PATH ];
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+
+	ZeroMemory( Ctx, sizeof( BENCH_EXECUTION_CONTEXT ) );
+	Ctx->Base.Version					= CFIX_TEST_CONTEXT_VERSION;
+	Ctx->Base.ReportEvent				= BenchReportEvent;
+	Ctx->Base.QueryDefaultDisposition	= BenchQueryDefaultDisposition;
+	Ctx->Base.BeforeFixtureStart		= BenchBeforeFixtureStart;
+	Ctx->Base.AfterFixtureFinish		= BenchAfterFixtureFinish;
+	Ctx->Base.BeforeTestCaseStart		= BenchBeforeTestCaseStart;
+	Ctx->Base.AfterTestCaseFinish		= BenchAfterTestCaseFinish;
+	Ctx->Base.CreateChildThread			= BenchCreateChildThread;
+	Ctx->Base.BeforeChildThreadStart	= BenchBeforeChildThreadStart;
+	Ctx->Base.AfterChildThreadFinish	= BenchAfterChildThreadFinish;
+	Ctx->Base.OnUnhandledException		= BenchOnUnhandledException;
+	Ctx->Base.Reference					= BenchReference;
+	Ctx->Base.Dereference				= BenchDereference;
+
+	if ( IsDebuggerPresent() )
+	{
+		//
+		// Stack traces are never captured when running in a debugger.
+		//
+		CFIX_INCONCLUSIVE( L"Benchmark requires debugger to be detached" );
+	}
+
+	TEST( GetModuleFileName( ModuleHandle, Path, _countof( Path ) ) );
+	TEST( PathRemoveFileSpec( Path ) );
+	TEST( PathAppend( Path, L"testlib6.dll" ) );
+
+	TEST_HR( CfixCreateTestModuleFromPeImage( Path, &Module ) );
+	for ( Index = 0; Index < Module->FixtureCount; Index++ )
+	{
+		if ( 0 == wcscmp(
+			Module->Fixtures[ Index ]->Name,
+			L"AssertConcurrentlyOnRegisteredThreads" ) )
+		{
+			Fixture = Module->Fixtures[ Index ];
+		}
+	}
+	CFIX_ASSUME( Fixture != NULL );
+
+	TEST_HR( CfixCreateFixtureExecutionAction(
+		Fixture,
+		CFIX_FIXTURE_EXECUTION_CAPTURE_STACK_TRACES,
+		( ULONG ) -1,
+		&Action ) );
+
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+	TEST( QueryPerformanceCounter( &Start ) );
+
+	TEST_HR( Action->Run( Action, &Ctx->Base ) );
+
+	TEST( QueryPerformanceCounter( &Stop ) );
+
+	TEST_EQ(
+		CONCURRENT_FAILING_THREADS * ASSERTIONS_PER_FAILING_THREAD,
+		( DWORD ) Ctx->FailedAssertions );
+	TEST_EQ( 0, ( DWORD ) Ctx->OtherEvents );
+
+	*Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+		( double ) Frequency.QuadPart;
+
+	Action->Dereference( Action );
+	Module->Routines.Dereference( Module );
+}
+
+static void TestStackTraceCaptureThroughput()
+{
+	BENCH_EXECUTION_CONTEXT Ctx;
+	double Seconds;
+
+	RunConcurrentAssertions( &Ctx, &Seconds );
+
+	TEST_EQ( ( DWORD ) Ctx.FailedAssertions, ( DWORD ) Ctx.EventsWithStackTrace );
+
+	CFIX_LOG(
+		L"%d threads: %d stack traces in %d ms (%d captures/s)",
+		CONCURRENT_FAILING_THREADS,
+		Ctx.EventsWithStackTrace,
+		( ULONG ) ( Seconds * 1000 ),
+		( ULONG ) ( Seconds > 0 ? Ctx.EventsWithStackTrace / Seconds : 0 ) );
+}
+
+static void TestStackTraceCapturePolicy()
+{
+	BENCH_EXECUTION_CONTEXT Ctx;
+	CFIX_STACKTRACE_CAPTURE_POLICY Policy;
+	double Seconds;
+
+	//
+	// Invalid policies.
+	//
+	ZeroMemory( &Policy, sizeof( CFIX_STACKTRACE_CAPTURE_POLICY ) );
+	TEST( E_INVALIDARG == CfixSetStackTraceCapturePolicy( &Policy ) );
+
+	Policy.SizeOfStruct	= sizeof( CFIX_STACKTRACE_CAPTURE_POLICY );
+	Policy.Flags		= 0xF0;
+	TEST( E_INVALIDARG == CfixSetStackTraceCapturePolicy( &Policy ) );
+
+	//
+	// All assertions share a single filament, so the limit applies
+	// across all threads.
+	//
+	Policy.Flags						= CFIX_STACKTRACE_CAPTURE_FAILURES_ONLY;
+	Policy.MaxStackTracesPerTestCase	= 10;
+	Policy.SamplingInterval				= 0;
+	TEST_HR( CfixSetStackTraceCapturePolicy( &Policy ) );
+
+	RunConcurrentAssertions( &Ctx, &Seconds );
+	TEST_EQ( 10, ( DWORD ) Ctx.EventsWithStackTrace );
+
+	//
+	// 1-in-100 sampling.
+	//
+	Policy.MaxStackTracesPerTestCase	= 0;
+	Policy.SamplingInterval				= 100;
+	TEST_HR( CfixSetStackTraceCapturePolicy( &Policy ) );
+
+	RunConcurrentAssertions( &Ctx, &Seconds );
+	TEST_EQ(
+		CONCURRENT_FAILING_THREADS * ASSERTIONS_PER_FAILING_THREAD / 100,
+		( DWORD ) Ctx.EventsWithStackTrace );
+
+	CFIX_LOG(
+		L"%d threads: %d sampled stack traces in %d ms",
+		CONCURRENT_FAILING_THREADS,
+		Ctx.EventsWithStackTrace,
+		( ULONG ) ( Seconds * 1000 ) );
+
+	//
+	// Restore default.
+	//
+	TEST_HR( CfixSetStackTraceCapturePolicy( NULL ) );
+
+	RunConcurrentAssertions( &Ctx, &Seconds );
+	TEST_EQ( ( DWORD ) Ctx.FailedAssertions, ( DWORD ) Ctx.EventsWithStackTrace );
+}
+
+typedef struct _TEST_STACKTRACE
+{
+	CFIX_STACKTRACE Base;
+	ULONGLONG __AdditionalFrames[ 3 ];
+} TEST_STACKTRACE, *PTEST_STACKTRACE;
+
+static void TestHashStackTrace()
+{
+	TEST_STACKTRACE Trace1;
+	TEST_STACKTRACE Trace2;
+	ULONG Hash1;
+
+	ZeroMemory( &Trace1, sizeof( TEST_STACKTRACE ) );
+	ZeroMemory( &Trace2, sizeof( TEST_STACKTRACE ) );
+
+	TEST( 0 == CfixHashStackTrace( NULL ) );
+	TEST( 0 == CfixHashStackTrace( &Trace1.Base ) );
+
+	Trace1.Base.FrameCount	= 4;
+	Trace1.Base.Frames[ 0 ]	= 0x10001000;
+	Trace1.Base.Frames[ 1 ]	= 0x10002000;
+	Trace1.Base.Frames[ 2 ]	= 0x7FFF00003000ULL;
+	Trace1.Base.Frames[ 3 ]	= 0x10004000;
+
+	Hash1 = CfixHashStackTrace( &Trace1.Base );
+	TEST( Hash1 != 0 );
+
+	//
+	// Same frames, different resolver -> same hash.
+	//
+	CopyMemory( &Trace2, &Trace1, sizeof( TEST_STACKTRACE ) );
+	Trace2.Base.GetInformationStackFrame = NULL;
+	TEST( Hash1 == CfixHashStackTrace( &Trace2.Base ) );
+
+	//
+	// Order and count matter.
+	//
+	Trace2.Base.Frames[ 0 ]	= 0x10002000;
+	Trace2.Base.Frames[ 1 ]	= 0x10001000;
+	TEST( Hash1 != CfixHashStackTrace( &Trace2.Base ) );
+
+	CopyMemory( &Trace2, &Trace1, sizeof( TEST_STACKTRACE ) );
+	Trace2.Base.FrameCount = 3;
+	TEST( Hash1 != CfixHashStackTrace( &Trace2.Base ) );
+	TEST( 0 != CfixHashStackTrace( &Trace2.Base ) );
+}
+
+CFIX_BEGIN_FIXTURE(StackTraceHashing)
+	CFIX_FIXTURE_ENTRY(TestHashStackTrace)
+CFIX_END_FIXTURE()
+
+CFIX_BEGIN_FIXTURE(StackTraceCaptureBenchmark)
+	CFIX_FIXTURE_ENTRY(TestStackTraceCaptureThroughput)
+	CFIX_FIXTURE_ENTRY(TestStackTraceCapturePolicy)
+CFIX_END_FIXTURE()
@@ -0,0 +1,91 @@
+/*----------------------------------------------------------------------
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * Copyright:
+ *		2008-2009, Johannes Passing (passing at users.sourceforge.net)
+ *
+ * This file is part of cfix.
+ *
+ * cfix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cfix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cfixcc.h>
+
+using cfixcc::FormattedMessage;
+using cfixcc::StaticMessage;
+
+static FormattedMessage* SurvivingMessage;
+
+static void DestroyOutOfOrder()
+{
+	FormattedMessage* First = new FormattedMessage( L"%s-%d", L"first", 1 );
+	FormattedMessage* Second = new FormattedMessage( "%s-%d", "second", 2 );
+	StaticMessage* Third = new StaticMessage( "third" );
+
+	delete First;
+
+	{
+		FormattedMessage Fourth( L"%s", L"fourth" );
+		CFIXCC_ASSERT_EQUALS( 
+			std::wstring( L"fourth" ), 
+			std::wstring( Fourth.GetMessage() ) );
+	}
+
+	CFIXCC_ASSERT_EQUALS( 
+		std::wstring( L"second-2" ), 
+		std::wstring( Second->GetMessage() ) );
+	delete Second;
+
+	CFIXCC_ASSERT_EQUALS( 
+		std::wstring( L"third" ), 
+		std::wstring( Third->GetMessage() ) );
+	delete Third;
+}
+
+static void FormatLongMessage()
+{
+	std::wstring Long( 1000, L'x' );
+	FormattedMessage Message( L"%s", Long.c_str() );
+
+	CFIXCC_ASSERT_EQUALS( Long, std::wstring( Message.GetMessage() ) );
+}
+
+static void CreateSurvivingMessage()
+{
+	SurvivingMessage = new FormattedMessage( L"%s", L"survivor" );
+}
+
+static void CheckSurvivingMessage()
+{
+	//
+	// Arena allocations of the previous test case have been 
+	// released and reused by now.
+	//
+	FormattedMessage Other( L"%s", L"other" );
+
+	CFIXCC_ASSERT( SurvivingMessage != NULL );
+	CFIXCC_ASSERT_EQUALS( 
+		std::wstring( L"survivor" ), 
+		std::wstring( SurvivingMessage->GetMessage() ) );
+
+	delete SurvivingMessage;
+	SurvivingMessage = NULL;
+}
+
+CFIX_BEGIN_FIXTURE( Messages )
+	CFIX_FIXTURE_ENTRY( DestroyOutOfOrder )
+	CFIX_FIXTURE_ENTRY( FormatLongMessage )
+	CFIX_FIXTURE_ENTRY( CreateSurvivingMessage )
+	CFIX_FIXTURE_ENTRY( CheckSurvivingMessage )
+CFIX_END_FIXTURE()
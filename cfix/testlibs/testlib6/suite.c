@@ -67,6 +67,73 @@ static VOID SuccTestWithLog()
 	CFIX_LOG( L"%s with %x", L"log", 0xbabe );
 }
 
+static VOID LogRepeatedly()
+{
+	ULONG Index;
+
+	//
+	// Reported as 'same', 'same (x99)', 'other'.
+	//
+	for ( Index = 0; Index < 100; Index++ )
+	{
+		CFIX_LOG( L"same" );
+	}
+
+	CFIX_LOG( L"other" );
+}
+
+static DWORD CALLBACK LogRepeatedlyThreadProc(
+	__in PVOID Unused
+	)
+{
+	UNREFERENCED_PARAMETER( Unused );
+
+	CFIX_LOG( L"same" );
+	CFIX_LOG( L"same" );
+	return 0;
+}
+
+static VOID LogRepeatedlyOnTwoThreads()
+{
+	HANDLE Thr;
+
+	//
+	// Coalesced per thread, so reported as 'same' (main), 'same' 
+	// (child), 'same (x1)' (child), 'same' (main).
+	//
+	CFIX_LOG( L"same" );
+
+	Thr = CfixCreateThread(
+		NULL,
+		0,
+		LogRepeatedlyThreadProc,
+		NULL,
+		0,
+		NULL );
+	CFIX_ASSUME( Thr != NULL );
+	WaitForSingleObject( Thr, INFINITE );
+	CFIX_ASSERT( CloseHandle( Thr ) );
+
+	CFIX_LOG( L"same" );
+}
+
+static VOID LogExceedingBudget()
+{
+	WCHAR Padding[ 496 ];
+	ULONG Index;
+
+	//
+	// 600 distinct messages of 500 WCHARs (incl. terminator) each.
+	//
+	wmemset( Padding, L'x', _countof( Padding ) - 1 );
+	Padding[ _countof( Padding ) - 1 ] = UNICODE_NULL;
+
+	for ( Index = 0; Index < 600; Index++ )
+	{
+		CFIX_LOG( L"%04u%s", Index, Padding );
+	}
+}
+
 static VOID Throw()
 {
 	RaiseException(
@@ -139,6 +206,12 @@ CFIX_BEGIN_FIXTURE(SetupSucFailInconThrowTearDown)
 	CFIX_FIXTURE_SETUP(Setup)
 CFIX_END_FIXTURE()
 
+CFIX_BEGIN_FIXTURE(LogCoalescingAndBudget)
+	CFIX_FIXTURE_ENTRY(LogRepeatedly)
+	CFIX_FIXTURE_ENTRY(LogRepeatedlyOnTwoThreads)
+	CFIX_FIXTURE_ENTRY(LogExceedingBudget)
+CFIX_END_FIXTURE()
+
 CFIX_BEGIN_FIXTURE(AbortMeBecauseOfUnhandledExcp)
 	CFIX_FIXTURE_ENTRY(Throw)
 CFIX_END_FIXTURE()
@@ -381,3 +381,70 @@ CFIX_END_FIXTURE()
 CFIX_BEGIN_FIXTURE(ThrowOnAnonymousThread)
 	CFIX_FIXTURE_ENTRY(ThrowOnAnonymousThread)
 CFIX_END_FIXTURE()
+
+/*----------------------------------------------------------------------
+ * Many threads failing at the same time. Used by testapi to measure
+ * stack trace capturing throughput - the execution context is expected 
+ * to return CfixContinue s.t. each thread runs through all assertions.
+ */
+
+#define CONCURRENT_FAILING_THREADS		16
+#define ASSERTIONS_PER_FAILING_THREAD	1000
+
+DWORD RepeatedlyAssertThreadProc( __in PVOID StartEvent )
+{
+	ULONG Index;
+
+	WaitForSingleObject( ( HANDLE ) StartEvent, INFINITE );
+
+	for ( Index = 0; Index < ASSERTIONS_PER_FAILING_THREAD; Index++ )
+	{
+		CFIX_ASSERT( !"Concurrent failure" );
+	}
+
+	return 0;
+}
+
+void AssertConcurrentlyOnRegisteredThreads()
+{
+	HANDLE StartEvent;
+	HANDLE Threads[ CONCURRENT_FAILING_THREADS ];
+	ULONG Index;
+
+	StartEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	CFIX_ASSUME( StartEvent != NULL );
+
+	for ( Index = 0; Index < _countof( Threads ); Index++ )
+	{
+		Threads[ Index ] = CfixCreateThread(
+			NULL,
+			0,
+			RepeatedlyAssertThreadProc,
+			StartEvent,
+			0,
+			NULL );
+		CFIX_ASSUME( Threads[ Index ] != NULL );
+	}
+
+	//
+	// Release all threads at once.
+	//
+	CFIX_ASSERT( SetEvent( StartEvent ) );
+
+	WaitForMultipleObjects( 
+		_countof( Threads ), 
+		Threads, 
+		TRUE, 
+		INFINITE );
+
+	for ( Index = 0; Index < _countof( Threads ); Index++ )
+	{
+		CFIX_ASSERT( CloseHandle( Threads[ Index ] ) );
+	}
+
+	CFIX_ASSERT( CloseHandle( StartEvent ) );
+}
+
+CFIX_BEGIN_FIXTURE(AssertConcurrentlyOnRegisteredThreads)
+	CFIX_FIXTURE_ENTRY(AssertConcurrentlyOnRegisteredThreads)
+CFIX_END_FIXTURE()
@@ -26,6 +26,8 @@
 #include <cfixkr.h>
 #include <cfixpe.h>
 #include <hashtable.h>
+#include <concurrenthashtable.h>
+#include <slab.h>
 
 #define CFIXKR_POOL_TAG 'xifC'
 
@@ -58,6 +60,16 @@ PVOID CfixkrpAllocateNonpagedHashtableMemory(
 	__in SIZE_T Size 
 	);
 
+/*++
+	Routine Description:
+		Allocate nonpaged memory for a slab allocator. Unlike
+		CfixkrpAllocateNonpagedHashtableMemory, may be called at
+		DISPATCH_LEVEL, i.e. while holding a spin lock.
+--*/
+PVOID CfixkrpAllocateNonpagedSlabMemory(
+	__in SIZE_T Size 
+	);
+
 VOID CfixkrpFreeHashtableMemory(
 	__in PVOID Mem
 	);
@@ -508,16 +520,19 @@ typedef struct _CFIXKRP_FILAMENT
 typedef struct _CFIXKRP_FILAMENT_REGISTRY
 {
 	//
-	// Lock guarding the hashtable.
+	// Table mapping threads to filaments. Lookups are lock-free.
 	//
-	// N.B. Uses non-default IRQL.
+	// N.B. All accesses are performed at SYNCH_LEVEL.
 	//
-	KSPIN_LOCK Lock;
+	JPHT_CONCURRENT_HASHTABLE Table;
 
 	//
-	// Table mapping threads to filaments.
+	// Allocator for table entries, nonpaged.
+	//
+	// N.B. Guarded by EntriesLock.
 	//
-	JPHT_HASHTABLE Table;
+	KSPIN_LOCK EntriesLock;
+	JPHT_SLAB_ALLOCATOR Entries;
 } CFIXKRP_FILAMENT_REGISTRY, *PCFIXKRP_FILAMENT_REGISTRY;
 
 /*++
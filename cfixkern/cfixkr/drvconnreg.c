@@ -21,7 +21,8 @@
  * along with cfix.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <wdm.h>
-#include <hashtable.h>
+#include <typedhashtable.h>
+#include <slab.h>
 #include "cfixkrp.h"
 
 typedef struct _CFIXKRP_DRVCONN_REGISTRATION
@@ -60,7 +61,12 @@ typedef struct _CFIXKRP_DRVCONN_REGISTRY
 	JPHT_HASHTABLE Connections;
 
 	//
-	// Lock guarding the hashtable.
+	// Allocator for CFIXKRP_DRVCONN_REGISTRATIONs, paged.
+	//
+	JPHT_SLAB_ALLOCATOR Registrations;
+
+	//
+	// Lock guarding the hashtable and the allocator.
 	//
 	ERESOURCE Lock;
 
@@ -112,6 +118,15 @@ static BOOLEAN CfixkrsEqualsRegistration(
 	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
 }
 
+//
+// Specialized lookup routines, avoid indirect calls to the routines
+// above.
+//
+JPHT_DEFINE_TYPED_HASHTABLE(
+	CfixkrsConnection,
+	CfixkrsHashRegistration,
+	CfixkrsEqualsRegistration )
+
 static VOID CfixkrsDeleteRegistrationHashtableCallback(
 	__in PJPHT_HASHTABLE Hashtable,
 	__in PJPHT_HASHTABLE_ENTRY Entry,
@@ -119,23 +134,20 @@ static VOID CfixkrsDeleteRegistrationHashtableCallback(
 	)
 {
 	PJPHT_HASHTABLE_ENTRY OldEntry;
-	PCFIXKRP_DRVCONN_REGISTRATION Registration;
 	
 	UNREFERENCED_PARAMETER( Unused );
 
-	JphtRemoveEntryHashtable(
+	CfixkrsConnectionRemoveEntryHashtable(
 		Hashtable,
 		Entry->Key,
 		&OldEntry );
 
 	ASSERT( Entry == OldEntry );
 
-	Registration = CONTAINING_RECORD(
-		Entry,
-		CFIXKRP_DRVCONN_REGISTRATION,
-		Key.HashtableEntry );
-
-	CfixkrpFreeHashtableMemory( Registration );
+	//
+	// N.B. The registration itself is released along with the
+	// allocator.
+	//
 }
 
 static VOID CfixkrsEnlistConnectionHashtableCallback(
@@ -190,18 +202,23 @@ NTSTATUS CfixkrpInitializeDriverConnectionRegistry()
 	//
 	// Initialize hashtable.
 	//
-	if ( ! JphtInitializeHashtable(
+	if ( ! CfixkrsConnectionInitializeHashtable(
 		&CfixkrsDriverConnectionRegistry.Connections,
 		CfixkrpAllocatePagedHashtableMemory,
 		CfixkrpFreeHashtableMemory,
-		CfixkrsHashRegistration,
-		CfixkrsEqualsRegistration,
 		31 ) )
 	{
 		( VOID ) ExDeleteResourceLite( &CfixkrsDriverConnectionRegistry.Lock );
 		return STATUS_NO_MEMORY;
 	}
 
+	JphtInitializeSlabAllocator(
+		&CfixkrsDriverConnectionRegistry.Registrations,
+		CfixkrpAllocatePagedHashtableMemory,
+		CfixkrpFreeHashtableMemory,
+		sizeof( CFIXKRP_DRVCONN_REGISTRATION ),
+		0 );
+
 	CfixkrsDriverConnectionRegistry.TornDown = FALSE;
 
 	return STATUS_SUCCESS;
@@ -236,6 +253,7 @@ VOID CfixkrpTeardownDriverConnectionRegistry()
 		NULL );
 
 	JphtDeleteHashtable( &CfixkrsDriverConnectionRegistry.Connections );
+	JphtDeleteSlabAllocator( &CfixkrsDriverConnectionRegistry.Registrations );
 	Status = ExDeleteResourceLite( &CfixkrsDriverConnectionRegistry.Lock );
 	ASSERT( NT_SUCCESS( Status ) );
 }
@@ -253,12 +271,16 @@ NTSTATUS CfixkrpRegisterDriverConnection(
 	ASSERT( Connection );
 	ASSERT( ! CfixkrsDriverConnectionRegistry.TornDown );
 
-	Registration = ExAllocatePoolWithTag( 
-		PagedPool, 
-		sizeof( CFIXKRP_DRVCONN_REGISTRATION ), 
-		CFIXKR_POOL_TAG );
+	KeEnterCriticalRegion();
+	ExAcquireResourceExclusiveLite(
+		&CfixkrsDriverConnectionRegistry.Lock, TRUE );
+
+	Registration = ( PCFIXKRP_DRVCONN_REGISTRATION ) JphtAllocateSlabObject(
+		&CfixkrsDriverConnectionRegistry.Registrations );
 	if ( ! Registration )
 	{
+		ExReleaseResourceLite( &CfixkrsDriverConnectionRegistry.Lock );
+		KeLeaveCriticalRegion();
 		return STATUS_NO_MEMORY;
 	}
 
@@ -270,11 +292,7 @@ NTSTATUS CfixkrpRegisterDriverConnection(
 	Registration->Key.LoadAddress	= ( ULONG_PTR ) LoadAddress;
 	Registration->Connection		= Connection;
 
-	KeEnterCriticalRegion();
-	ExAcquireResourceExclusiveLite(
-		&CfixkrsDriverConnectionRegistry.Lock, TRUE );
-
-	JphtPutEntryHashtable(
+	CfixkrsConnectionPutEntryHashtable(
 		&CfixkrsDriverConnectionRegistry.Connections,
 		&Registration->Key.HashtableEntry,
 		&OldEntry );
@@ -309,7 +327,7 @@ NTSTATUS CfixkrpUnregisterDriverConnection(
 	ExAcquireResourceExclusiveLite(
 		&CfixkrsDriverConnectionRegistry.Lock, TRUE );
 
-	JphtRemoveEntryHashtable( 
+	CfixkrsConnectionRemoveEntryHashtable( 
 		&CfixkrsDriverConnectionRegistry.Connections,
 		( ULONG_PTR ) LoadAddress,
 		&Entry );
@@ -323,7 +341,9 @@ NTSTATUS CfixkrpUnregisterDriverConnection(
 		//
 		// N.B. Connection pointer is weak, so no need to dereference here.
 		//
-		CfixkrpFreeHashtableMemory( Registration );
+		JphtFreeSlabObject( 
+			&CfixkrsDriverConnectionRegistry.Registrations,
+			Registration );
 	}
 
 	ExReleaseResourceLite( &CfixkrsDriverConnectionRegistry.Lock );
@@ -351,7 +371,7 @@ NTSTATUS CfixkrpLookupDriverConnection(
 	KeEnterCriticalRegion();
 	ExAcquireResourceSharedLite(
 		&CfixkrsDriverConnectionRegistry.Lock, TRUE );
-	Entry = JphtGetEntryHashtable( 
+	Entry = CfixkrsConnectionGetEntryHashtable( 
 		&CfixkrsDriverConnectionRegistry.Connections,
 		( ULONG_PTR ) DriverLoadAddress );
 	if ( Entry != NULL )
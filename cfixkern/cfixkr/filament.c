@@ -22,7 +22,7 @@
  */
 
 #include <wdm.h>
-#include <hashtable.h>
+#include <concurrenthashtable.h>
 #include "cfixkrp.h"
 #include <stdlib.h>
 
@@ -73,22 +73,25 @@ static BOOLEAN CfixkrsEqualsFilamentEntry(
 }
 
 
-static VOID CfixkrsAcquireLockFilamentRegistry( 
-	__in PCFIXKRP_FILAMENT_REGISTRY Registry,
+/*++
+	Routine Description:
+		Raise IRQL before accessing the registry's table.
+
+		N.B. The table uses spinlocks and spins waiting for readers
+		when synchronizing, so neither readers nor writers may be
+		preempted.
+--*/
+static VOID CfixkrsEnterFilamentRegistry( 
 	__out PKIRQL OldIrql	
 	)
 {
 	KeRaiseIrql( SYNCH_LEVEL, OldIrql );
-	KeAcquireSpinLockAtDpcLevel( 
-		&Registry->Lock );
 }
 
-static VOID CfixkrsReleaseLockFilamentRegistry( 
-	__in PCFIXKRP_FILAMENT_REGISTRY Registry,
+static VOID CfixkrsLeaveFilamentRegistry( 
 	__in KIRQL OldIrql
 	)
 {
-	KeReleaseSpinLockFromDpcLevel( &Registry->Lock );
 	KeLowerIrql( OldIrql );
 }
 
@@ -98,6 +101,33 @@ static VOID CfixkrsReleaseLockFilamentRegistry(
  *
  */
 
+static PCFIXKRP_FILAMENT_ENTRY CfixkrsAllocateFilamentEntry(
+	__in PCFIXKRP_FILAMENT_REGISTRY Registry
+	)
+{
+	PCFIXKRP_FILAMENT_ENTRY Entry;
+	KIRQL OldIrql;
+
+	KeAcquireSpinLock( &Registry->EntriesLock, &OldIrql );
+	Entry = ( PCFIXKRP_FILAMENT_ENTRY ) 
+		JphtAllocateSlabObject( &Registry->Entries );
+	KeReleaseSpinLock( &Registry->EntriesLock, OldIrql );
+
+	return Entry;
+}
+
+static VOID CfixkrsFreeFilamentEntry(
+	__in PCFIXKRP_FILAMENT_REGISTRY Registry,
+	__in PCFIXKRP_FILAMENT_ENTRY Entry
+	)
+{
+	KIRQL OldIrql;
+
+	KeAcquireSpinLock( &Registry->EntriesLock, &OldIrql );
+	JphtFreeSlabObject( &Registry->Entries, Entry );
+	KeReleaseSpinLock( &Registry->EntriesLock, OldIrql );
+}
+
 #pragma warning( push )
 #pragma warning( disable: 6386 )	// False buffer overflow warning.
 
@@ -147,7 +177,7 @@ NTSTATUS CfixkrpInitializeFilamentRegistry(
 	//
 	// Initialize hashtable.
 	//
-	if ( ! JphtInitializeHashtable(
+	if ( ! JphtInitializeConcurrentHashtable(
 		&Registry->Table,
 		CfixkrpAllocateNonpagedHashtableMemory,
 		CfixkrpFreeHashtableMemory,
@@ -158,7 +188,13 @@ NTSTATUS CfixkrpInitializeFilamentRegistry(
 		return STATUS_NO_MEMORY;
 	}
 
-	KeInitializeSpinLock( &Registry->Lock );
+	KeInitializeSpinLock( &Registry->EntriesLock );
+	JphtInitializeSlabAllocator(
+		&Registry->Entries,
+		CfixkrpAllocateNonpagedSlabMemory,
+		CfixkrpFreeHashtableMemory,
+		sizeof( CFIXKRP_FILAMENT_ENTRY ),
+		0 );
 
 	return STATUS_SUCCESS;
 }
@@ -173,8 +209,11 @@ VOID CfixkrpDeleteFilamentRegistry(
 	// If a routine was still active, deleting this object
 	// would be an invalid operation.
 	//
-	ASSERT( JphtGetEntryCountHashtable( &Registry->Table ) == 0 );
-	JphtDeleteHashtable( &Registry->Table );
+	ASSERT( JphtGetEntryCountConcurrentHashtable( &Registry->Table ) == 0 );
+	JphtDeleteConcurrentHashtable( &Registry->Table );
+
+	ASSERT( JphtGetObjectCountSlabAllocator( &Registry->Entries ) == 0 );
+	JphtDeleteSlabAllocator( &Registry->Entries );
 }
 
 /*----------------------------------------------------------------------
@@ -225,10 +264,7 @@ NTSTATUS CfixkrpSetCurrentFilament(
 	ASSERT( Filament );
 	ASSERT( KeGetCurrentIrql() == PASSIVE_LEVEL );
 
-	Entry = ExAllocatePoolWithTag( 
-		NonPagedPool, 
-		sizeof( CFIXKRP_FILAMENT_ENTRY ), 
-		CFIXKR_POOL_TAG );
+	Entry = CfixkrsAllocateFilamentEntry( Registry );
 	if ( Entry == NULL )
 	{
 		return STATUS_NO_MEMORY;
@@ -244,7 +280,7 @@ NTSTATUS CfixkrpSetCurrentFilament(
 			PsGetCurrentThread() );
 		if ( ! NT_SUCCESS( Status ) )
 		{
-			ExFreePoolWithTag( Entry, CFIXKR_POOL_TAG );
+			CfixkrsFreeFilamentEntry( Registry, Entry );
 			return Status;
 		}
 	}
@@ -256,12 +292,12 @@ NTSTATUS CfixkrpSetCurrentFilament(
 	Entry->Key.Thread	= KeGetCurrentThread();
 	Entry->Filament		= Filament;
 
-	CfixkrsAcquireLockFilamentRegistry( Registry, &OldIrql );
-	JphtPutEntryHashtable(
+	CfixkrsEnterFilamentRegistry( &OldIrql );
+	JphtPutEntryConcurrentHashtable(
 		&Registry->Table,
 		&Entry->Key.HashtableEntry,
 		&OldEntry );
-	CfixkrsReleaseLockFilamentRegistry( Registry, OldIrql );
+	CfixkrsLeaveFilamentRegistry( OldIrql );
 
 	//
 	// If OldEntry != NULL, we must have enetered a recusion, which
@@ -283,12 +319,17 @@ VOID CfixkrpResetCurrentFilament(
 	ASSERT( Registry );
 	ASSERT( KeGetCurrentIrql() <= DISPATCH_LEVEL );
 
-	CfixkrsAcquireLockFilamentRegistry( Registry, &OldIrql );
-	JphtRemoveEntryHashtable( 
+	CfixkrsEnterFilamentRegistry( &OldIrql );
+	JphtRemoveEntryConcurrentHashtable( 
 		&Registry->Table,
 		( ULONG_PTR ) KeGetCurrentThread(),
 		&Entry );
-	CfixkrsReleaseLockFilamentRegistry( Registry, OldIrql );
+
+	//
+	// Other threads' lookups may still be traversing the entry.
+	//
+	JphtSynchronizeConcurrentHashtable( &Registry->Table );
+	CfixkrsLeaveFilamentRegistry( OldIrql );
 
 	ASSERT( Entry != NULL );
 
@@ -297,7 +338,7 @@ VOID CfixkrpResetCurrentFilament(
 		CFIXKRP_FILAMENT_ENTRY,
 		Key.HashtableEntry );
 
-	ExFreePoolWithTag( FilamentEntry, CFIXKR_POOL_TAG );
+	CfixkrsFreeFilamentEntry( Registry, FilamentEntry );
 
 	//
 	// N.B. Resetting the filament does not impact the child handle
@@ -312,15 +353,24 @@ PCFIXKRP_FILAMENT CfixkrpGetCurrentFilament(
 {
 	PJPHT_HASHTABLE_ENTRY Entry;
 	KIRQL OldIrql;
+	ULONG Epoch;
 	PCFIXKRP_FILAMENT_ENTRY FilamentEntry;
 
 	ASSERT( Registry );
 
-	CfixkrsAcquireLockFilamentRegistry( Registry, &OldIrql );
-	Entry = JphtGetEntryHashtable( 
+	CfixkrsEnterFilamentRegistry( &OldIrql );
+	Epoch = JphtEnterReadConcurrentHashtable( &Registry->Table );
+	Entry = JphtGetEntryConcurrentHashtable( 
 		&Registry->Table,
 		( ULONG_PTR ) KeGetCurrentThread() );
-	CfixkrsReleaseLockFilamentRegistry( Registry, OldIrql );
+	JphtLeaveReadConcurrentHashtable( &Registry->Table, Epoch );
+	CfixkrsLeaveFilamentRegistry( OldIrql );
+
+	//
+	// N.B. The entry belongs to the current thread and is only
+	// removed by the current thread, so it remains valid after
+	// leaving the read section.
+	//
 
 	if ( Entry != NULL )
 	{
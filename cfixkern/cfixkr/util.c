@@ -58,6 +58,14 @@ PVOID CfixkrpAllocateNonpagedHashtableMemory(
 	return ExAllocatePoolWithTag( NonPagedPool, Size, CFIXKR_POOL_TAG );
 }
 
+PVOID CfixkrpAllocateNonpagedSlabMemory(
+	__in SIZE_T Size 
+	)
+{
+	ASSERT( KeGetCurrentIrql() <= DISPATCH_LEVEL );
+	return ExAllocatePoolWithTag( NonPagedPool, Size, CFIXKR_POOL_TAG );
+}
+
 VOID CfixkrpFreeHashtableMemory(
 	__in PVOID Mem
 	)
@@ -308,7 +308,6 @@ namespace cfixwu
 			int
 			)
 		{
-			MessageString[ 0 ] = L'\0';
 		}
 
 		WinunitMessage(
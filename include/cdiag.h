@@ -64,6 +64,54 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagGetModuleVersion(
 	__out PCDIAG_MODULE_VERSION Version 
 	);
 
+/*----------------------------------------------------------------------
+ *
+ * Memory allocation
+ *
+ */
+
+/*++
+	Number of size classes: 8 pooled classes (16 to 2048 bytes)
+	plus one class for larger allocations.
+--*/
+#define CDIAG_ALLOCATION_CLASSES 9
+
+typedef struct _CDIAG_ALLOCATION_CLASS_STATISTICS
+{
+	/*++
+		Largest allocation served by this class. 0 for the class
+		of allocations that are too large to be pooled.
+	--*/
+	ULONG BlockSize;
+
+	ULONGLONG Allocations;
+	ULONGLONG Frees;
+
+	/*++
+		Bytes requested, not including pooling overhead.
+	--*/
+	ULONGLONG BytesAllocated;
+	ULONGLONG BytesFreed;
+} CDIAG_ALLOCATION_CLASS_STATISTICS, *PCDIAG_ALLOCATION_CLASS_STATISTICS;
+
+typedef struct _CDIAG_ALLOCATION_STATISTICS
+{
+	CDIAG_ALLOCATION_CLASS_STATISTICS Classes[ CDIAG_ALLOCATION_CLASSES ];
+} CDIAG_ALLOCATION_STATISTICS, *PCDIAG_ALLOCATION_STATISTICS;
+
+/*++
+	Routine Description:
+		Query statistics about the memory used by cdiag. Counters
+		are cumulative since the module was loaded. While other
+		threads are allocating, the result is not an exact snapshot.
+
+	Parameters:
+		Statistics	- Result.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagQueryAllocationStatistics(
+	__out PCDIAG_ALLOCATION_STATISTICS Statistics
+	);
+
 /*----------------------------------------------------------------------
  *
  * Configuration store
@@ -357,6 +405,13 @@ typedef struct _CDIAG_CONFIGURATION_STORE
 #define CDIAG_CFGS_ACCESS_WRITE_MACHINE	0x8
 #define CDIAG_CFGS_ACCESS_ALL				0xF
 
+//
+// Keep a snapshot of all readable settings in memory s.t. reads
+// neither take locks nor touch the underlying store. The snapshot
+// is refreshed whenever the underlying store changes.
+//
+#define CDIAG_CFGS_CACHE_SETTINGS			0x10
+
 /*++
 	Routine Description:
 		Return the default implementation of the configuration
@@ -370,7 +425,8 @@ typedef struct _CDIAG_CONFIGURATION_STORE
 						be used, depending on the flags to the
 						ReadXxx and WriteXxx methods.
 		AccessMode		Combination of CDIAG_CFGS_ACCESS_* indicating
-						the desired access to the store
+						the desired access to the store, optionally
+						combined with CDIAG_CFGS_CACHE_SETTINGS.
 		Store			Result. The methods of the object are threadsafe.
 						Call Store->Delete to free the object.
 						Note that the resultant struct may be larger
@@ -382,6 +438,53 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateRegistryStore(
 	__out PCDIAG_CONFIGURATION_STORE *Store
 	);
 
+/*++
+	Routine Description:
+		Return an implementation of the configuration store which 
+		stores the settings in UTF-8 encoded INI files, one per 
+		scope:
+
+			; Comment
+			[Group]
+			DwordSetting=dword:42
+			StringSetting=sz:Text
+			MultiStringSetting=multi_sz:First\0Second
+
+		Within string values, '\\', '\r', '\n' and '\0' (multi_sz 
+		only) are escape sequences.
+
+		All settings are held in memory, i.e. the store always
+		behaves as if CDIAG_CFGS_CACHE_SETTINGS had been specified.
+		Changes made to the files by other processes are picked up
+		automatically.
+
+		The returned object has to be released by calling its Delete
+		method.
+
+	Parameters:
+		GlobalFilePath	Path of file holding global settings. May
+						be NULL if AccessMode does not include any
+						of the CDIAG_CFGS_ACCESS_*_MACHINE flags.
+		UserFilePath	Path of file holding user settings. May
+						be NULL if AccessMode does not include any
+						of the CDIAG_CFGS_ACCESS_*_USER flags.
+		AccessMode		Combination of CDIAG_CFGS_ACCESS_* indicating
+						the desired access to the store.
+		Store			Result. The methods of the object are threadsafe.
+						Call Store->Delete to free the object.
+
+	Returns:
+		S_OK on success
+		CDIAG_E_INVALID_CONFIGURATION_FILE if a file is malformed
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateIniFileStore(
+	__in_opt PCWSTR GlobalFilePath,
+	__in_opt PCWSTR UserFilePath,
+	__in DWORD AccessMode,
+	__out PCDIAG_CONFIGURATION_STORE *Store
+	);
+
 
 
 
@@ -482,6 +585,11 @@ typedef struct _CDIAG_MESSAGE_RESOLVER
 			If CDIAG_MSGRES_STRIP_NEWLINES is specified, any CRs and 
 			LFs are replaced by spaces.
 
+			Message templates are cached - repeatedly resolving the
+			same message does not involve querying the DLLs again. 
+			The cache is flushed whenever a DLL is registered or
+			unregistered.
+
 		Parameters:
 			This				Pointer to self.
 			MessageId			Message id, HRESULT, NTSTATUS or Win32
@@ -1019,6 +1127,53 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateOutputHandler(
 	__out PCDIAG_HANDLER *Handler
 	);
 
+#define CDIAG_OUTPUT_DEFAULT_BUFFER_CCH	( 8 * 1024 )
+
+/*++
+	Routine Description:
+		Create a handler that outputs information via the specified
+		callback, coalescing multiple events into a single call.
+		Each event in a batch is terminated by a newline.
+
+		This saves a call per event to expensive output routines --
+		kernel32!OutputDebugString in particular is slow while a 
+		debugger is attached.
+
+		The batch is passed to the callback when
+		 - it runs full,
+		 - FlushInterval has elapsed,
+		 - an event of severity CdiagFatalSeverity is handled,
+		 - the handler is deleted.
+
+		If FlushInterval is non-zero, the callback is invoked on a
+		thread pool thread unless the batch runs full. Calls are
+		serialized.
+
+		The handler must not be deleted from within DllMain.
+
+	Parameters:
+		Session				Session Handler is to be used in.
+		OutputRoutine		Callback.
+		BufferCch			Size of batch in characters, 0 to use
+							CDIAG_OUTPUT_DEFAULT_BUFFER_CCH. Small
+							values are rounded up to hold at least
+							one event.
+		FlushInterval		Interval in milliseconds, 0 to only
+							flush on the other conditions.
+		Handler				Handler object.
+
+	Returns:
+		S_OK on success
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBatchingOutputHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in CDIAG_OUTPUT_ROUTINE OutputRoutine,
+	__in ULONG BufferCch,
+	__in ULONG FlushInterval,
+	__out PCDIAG_HANDLER *Handler
+	);
+
 typedef enum 
 {
 	CdiagEncodingUtf16,
@@ -1046,6 +1201,211 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateTextFileHandler(
 	__out PCDIAG_HANDLER *Handler
 	);
 
+#define CDIAG_TEXTFILE_DEFAULT_BUFFER_SIZE	( 64 * 1024 )
+
+/*++
+	Routine Description:
+		Create a handler that outputs information to a textfile
+		and buffers output in memory.
+
+		The buffer is written to the file when
+		 - it runs full,
+		 - FlushInterval has elapsed,
+		 - an event of severity CdiagFatalSeverity is handled,
+		 - the handler is deleted, i.e. at the latest when the
+		   session it is used in is torn down.
+
+		If FlushInterval is non-zero, the buffer is written on a
+		thread pool thread, so threads handling events do not wait
+		for disk I/O unless the buffer runs full. Errors encountered
+		on that thread are reported by the next call to Handle.
+
+		The handler must not be deleted from within DllMain.
+
+	Parameters:
+		Session				Session Handler is to be used in.
+		FilePath			Output file.
+		BufferSize			Size of buffer in bytes, 0 to use
+							CDIAG_TEXTFILE_DEFAULT_BUFFER_SIZE.
+		FlushInterval		Interval in milliseconds, 0 to only
+							flush on the other conditions.
+		Handler				Handler object.
+
+	Returns:
+		S_OK on success
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBufferedTextFileHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in PCWSTR FilePath,
+	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__in ULONG BufferSize,
+	__in ULONG FlushInterval,
+	__out PCDIAG_HANDLER *Handler
+	);
+
+//
+// Compress completed segments.
+//
+#define CDIAG_TEXTFILE_ROTATION_COMPRESS	1
+
+typedef struct _CDIAG_TEXTFILE_ROTATION
+{
+	//
+	// Rotate once the file has grown to this many bytes, 0 for 
+	// no limit.
+	//
+	ULONGLONG MaxFileSize;
+
+	//
+	// Rotate once the file has been written to for this many
+	// seconds, 0 for no limit.
+	//
+	ULONG MaxAge;
+
+	//
+	// Number of completed segments to retain, 0 to retain all.
+	//
+	ULONG MaxSegments;
+
+	//
+	// CDIAG_TEXTFILE_ROTATION_* flags.
+	//
+	ULONG Flags;
+} CDIAG_TEXTFILE_ROTATION, *PCDIAG_TEXTFILE_ROTATION;
+
+/*++
+	Routine Description:
+		Create a handler that outputs information to a textfile,
+		optionally buffering output like 
+		CdiagCreateBufferedTextFileHandler, and rotates the file
+		according to a policy.
+
+		Output always goes to FilePath. Once the file has grown too
+		large or too old, it is renamed to FilePath.<n>, <n> being
+		a sequence number that continues where earlier handlers for
+		the same path left off, and output continues in a new file.
+		Threads handling events only wait for renaming and reopening
+		the file.
+
+		Rotation is checked whenever data is written to the file.
+		In buffered mode, a file may therefore exceed MaxFileSize 
+		by up to a buffer's worth of data, and a file not written
+		to is not rotated, however old.
+
+		Completed segments are compressed and pruned on a 
+		background thread. Compressed segments are named 
+		FilePath.<n>.lz4 and are LZ4 frames, which can be read
+		incrementally and decompressed with the lz4 tool. Errors
+		encountered on that thread are reported by the next call 
+		to Handle.
+
+		The handler must not be deleted from within DllMain.
+
+	Parameters:
+		Session				Session Handler is to be used in.
+		FilePath			Output file.
+		BufferSize			Size of buffer in bytes, 0 for
+							unbuffered output.
+		FlushInterval		Interval in milliseconds, see
+							CdiagCreateBufferedTextFileHandler.
+		Rotation			Rotation policy. At least one of 
+							MaxFileSize and MaxAge must be non-zero.
+		Handler				Handler object.
+
+	Returns:
+		S_OK on success
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateRotatingTextFileHandler(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in PCWSTR FilePath,
+	__in CDIAG_TEXTFILE_ENCODING Encoding,
+	__in ULONG BufferSize,
+	__in ULONG FlushInterval,
+	__in PCDIAG_TEXTFILE_ROTATION Rotation,
+	__out PCDIAG_HANDLER *Handler
+	);
+
+#define CDIAG_BINARYFILE_DEFAULT_SIZE	( 16 * 1024 * 1024 )
+
+/*++
+	Routine Description:
+		Create a handler that copies event packets, unformatted, 
+		into a memory-mapped file used as a ring buffer. Once the
+		file is full, the oldest events are overwritten.
+
+		Handling an event involves neither formatting, locking nor
+		system calls, which makes the handler suitable for high
+		volume events such as traces. As the file is memory-mapped,
+		events handled before the process crashes are retained.
+
+		If the file exists and has been written by a handler of the
+		same size, writing continues after the events it contains.
+		Otherwise, the file is overwritten.
+
+		Use CdiagReadBinaryFile or the cdiagdump tool to read
+		the file.
+
+	Parameters:
+		FilePath			Output file.
+		FileSize			Maximum file size in bytes, 0 to use
+							CDIAG_BINARYFILE_DEFAULT_SIZE. The 
+							usable size is rounded down to a power 
+							of two, with a minimum of 256 KB.
+		Handler				Handler object.
+
+	Returns:
+		S_OK on success
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateBinaryFileHandler(
+	__in PCWSTR FilePath,
+	__in ULONG FileSize,
+	__out PCDIAG_HANDLER *Handler
+	);
+
+/*++
+	Routine Description:
+		Callback invoked by CdiagReadBinaryFile.
+
+	Parameters:
+		Packet				Packet. Only valid for the duration
+							of the call.
+		Context				Context passed to CdiagReadBinaryFile.
+
+	Returns:
+		TRUE to continue, FALSE to stop reading.
+--*/
+typedef BOOL ( CDIAGCALLTYPE * CDIAG_BINARYFILE_CALLBACK ) (
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_opt PVOID Context
+	);
+
+/*++
+	Routine Description:
+		Read the events contained in a file written by a binary 
+		file handler, oldest first. Events that were being written
+		when the writing process was terminated are skipped, as are
+		events whose offsets or insertion string count are invalid.
+
+	Parameters:
+		FilePath			File to read.
+		Callback			Callback to invoke for each event.
+		Context				Context to pass to callback.
+
+	Returns:
+		S_OK on success
+		CDIAG_E_INVALID_BINARY_FILE if the file has not been
+			written by a binary file handler.
+		(any HRESULT) for unexpected errors
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagReadBinaryFile(
+	__in PCWSTR FilePath,
+	__in CDIAG_BINARYFILE_CALLBACK Callback,
+	__in_opt PVOID Context
+	);
+
 ///*----------------------------------------------------------------------
 // *
 // * Session Configuration
@@ -1185,17 +1545,70 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateSession(
 	__out CDIAG_SESSION_HANDLE *Session
 	);
 
+typedef enum _CDIAG_ASYNC_OVERFLOW_POLICY
+{
+	//
+	// Drop events while the queue is full.
+	//
+	CdiagAsyncDropOnOverflow	= 0,
+
+	//
+	// Block the caller until space becomes available.
+	//
+	CdiagAsyncBlockOnOverflow	= 1,
+	CdiagAsyncMaxOverflowPolicy	= 1
+} CDIAG_ASYNC_OVERFLOW_POLICY;
+
+#define CDIAG_SESSION_DEFAULT_SLOT_COUNT	256
+
+/*++
+	Routine Description:
+		Create a new session that dispatches events asynchronously.
+		CdiagHandleEvent copies the packet into a queue of 
+		fixed-size slots and returns, a worker thread owned by the 
+		session then passes the event to the handler. Packets 
+		exceeding the slot size are copied to the heap.
+
+		Events raised on the worker thread, i.e. by handlers, are
+		dispatched synchronously.
+
+		When the session is deleted, all queued events are handled
+		first. The session therefore must not be deleted from within
+		DllMain or from a handler.
+
+	Parameters:
+		Formatter		Formatter to use. If NULL, the default formatter
+						will be used.
+		Resolver		Resolver to use. If NULL, the default resolver
+						will be used.
+		SlotCount		Capacity of the queue, must be a power of 2.
+						0 to use CDIAG_SESSION_DEFAULT_SLOT_COUNT.
+		Policy			How to treat events while the queue is full.
+		Session			Session handle.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCreateAsyncSession(
+	__in_opt PCDIAG_FORMATTER Formatter,
+	__in_opt PCDIAG_MESSAGE_RESOLVER Resolver,
+	__in ULONG SlotCount,
+	__in CDIAG_ASYNC_OVERFLOW_POLICY Policy,
+	__out CDIAG_SESSION_HANDLE *Session
+	);
+
 /*++
 	Routine Description:
 		Handle an event.
 
+		For sessions created by CdiagCreateAsyncSession, the event 
+		is queued and the packet may be reused as soon as the
+		routine returns. The handler's result is not reported.
+
 	Parameters:
 		Session			Session handle.
 		Packet			Event to handle.
 
 	Return Values:
 		S_OK on success.
-		S_FALSE if filtered.
+		S_FALSE if filtered or dropped.
 		(any other failure HRESULT)
 --*/
 CDIAGAPI HRESULT CDIAGCALLTYPE CdiagHandleEvent(
@@ -1203,6 +1616,80 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagHandleEvent(
 	__in PCDIAG_EVENT_PACKET Packet
 	);
 
+/*++
+	Routine Description:
+		Check whether an event of the given type and severity would
+		be passed to a handler, i.e. whether a handler is registered
+		for the type (or a default handler is) and its severity 
+		filter admits the severity.
+
+		The check does not take any locks and is cheap enough to
+		be performed before constructing a packet. The result 
+		reflects the registrations at the time of the call -- an
+		event may still be filtered by CdiagHandleEvent if handlers
+		or filters are changed concurrently.
+
+	Parameters:
+		Session			Session handle.
+		Type			Event type.
+		Severity		Event severity.
+
+	Return Values:
+		TRUE if the event would be handled.
+		FALSE if it would be filtered or arguments are invalid.
+--*/
+CDIAGAPI BOOL CDIAGCALLTYPE CdiagIsEventEnabled(
+	__in CDIAG_SESSION_HANDLE Session,
+	__in CDIAG_EVENT_TYPE Type,
+	__in CDIAG_SEVERITY_LEVEL Severity
+	);
+
+//
+// Guards for call sites, which skip formatting and packet 
+// construction if the event would be filtered anyway:
+//
+//	CDIAG_IF_EVENT_ENABLED( Session, CdiagLogEvent, CdiagDebugSeverity )
+//	{
+//		...build and commit packet...
+//	}
+//
+// CDIAG_IF_EVENT_ENABLED expands to an if/else with an empty then
+// branch, so an else following the guarded statement binds to the
+// caller's if rather than to the guard.
+//
+#define CDIAG_IS_EVENT_ENABLED( Session, Type, Severity ) \
+	CdiagIsEventEnabled( ( Session ), ( Type ), ( Severity ) )
+
+#define CDIAG_IS_TRACE_ENABLED( Session ) \
+	CDIAG_IS_EVENT_ENABLED( Session, CdiagTraceEvent, CdiagTraceSeverity )
+
+#define CDIAG_IS_DEBUG_ENABLED( Session ) \
+	CDIAG_IS_EVENT_ENABLED( Session, CdiagLogEvent, CdiagDebugSeverity )
+
+#define CDIAG_IF_EVENT_ENABLED( Session, Type, Severity )				\
+	if ( ! CDIAG_IS_EVENT_ENABLED( Session, Type, Severity ) )			\
+	{																	\
+	}																	\
+	else
+
+/*++
+	Routine Description:
+		Wait until all events queued so far have been handled. 
+		Returns immediately for synchronous sessions.
+
+		Must not be called from a handler.
+
+	Parameters:
+		Session			Session handle.
+
+	Return Values:
+		S_OK on success.
+		(any other failure HRESULT)
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagFlushSession(
+	__in CDIAG_SESSION_HANDLE Session
+	);
+
 
 typedef enum _CDIAG_SESSION_INFO_CLASS
 {
@@ -1245,7 +1732,15 @@ typedef enum _CDIAG_SESSION_INFO_CLASS
 	//		Value is of type PCDIAG_FORMATTER.
 	//
 	CdiagSessionFormatter		= 4,
-	CdiagSessionMaxClass		= 4
+
+	//
+	// Number of events dropped by an asynchronous session.
+	//  Query only:
+	//		EventType is ignored.
+	//		Value is of type PDWORD.
+	//
+	CdiagSessionDroppedEvents	= 5,
+	CdiagSessionMaxClass		= 5
 } CDIAG_SESSION_INFO_CLASS;
 
 /*++
@@ -1299,6 +1794,125 @@ CDIAGAPI HRESULT CDIAGCALLTYPE CdiagDereferenceSession(
 	__in CDIAG_SESSION_HANDLE Session
 	);
 
+/*----------------------------------------------------------------------
+ *
+ * Event packet builder
+ *
+ * Builds self-relative event packets in a per-thread arena, avoiding
+ * heap allocations. A packet is begun, strings and debug information
+ * are appended, and it is then either passed to CdiagCommitEventPacket
+ * or handled by other means and released.
+ *
+ * Packets may be nested, i.e. a packet may be begun while another
+ * packet is being built or handled on the same thread (e.g. from 
+ * within a handler). Only the packet begun last may be extended,
+ * however, and releasing a packet also releases all packets begun 
+ * after it. Packets must not be used on other threads.
+ *
+ */
+
+/*++
+	Routine Description:
+		Begin a new packet. ProcessorMode, ProcessId, ThreadId and
+		Timestamp are initialized to describe the current thread, 
+		all offsets are initialized to 0. Members not covered by
+		the routines below may be set directly.
+
+	Parameters:
+		Type, Flags, Severity, Code - see CDIAG_EVENT_PACKET.
+		Packet		- Result. Must be released.
+
+	Return Values:
+		S_OK on success.
+		CDIAG_E_BUFFER_TOO_SMALL if the arena is exhausted.
+		(any other failure HRESULT)
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagBeginEventPacket(
+	__in CDIAG_EVENT_TYPE Type,
+	__in USHORT Flags,
+	__in CDIAG_SEVERITY_LEVEL Severity,
+	__in DWORD Code,
+	__out PCDIAG_EVENT_PACKET *Packet
+	);
+
+/*++
+	Routine Description:
+		Append a string and set MachineOffset, MessageOffset
+		or the next insertion string offset, respectively.
+
+	Return Values:
+		S_OK on success.
+		CDIAG_E_BUFFER_TOO_SMALL if the packet would exceed its 
+			maximum size or CDIAG_EVENT_PACKET_MAX_INSERTION_STRINGS
+			would be exceeded.
+		E_INVALIDARG if the packet is not the packet begun last.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetMachineEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR Machine
+	);
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetMessageEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR Message
+	);
+
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagAddInsertionStringEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in PCWSTR String
+	);
+
+/*++
+	Routine Description:
+		Append a CDIAG_DEBUG_INFO structure and set DebugInfoOffset.
+		Strings that are NULL yield an offset of 0.
+
+	Return Values:
+		See CdiagSetMessageEventPacket.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetDebugInfoEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_opt PCWSTR Module,
+	__in_opt PCWSTR FunctionName,
+	__in_opt PCWSTR SourceFile,
+	__in ULONG SourceLine
+	);
+
+/*++
+	Routine Description:
+		Append a custom data blob and set CustomData.
+
+	Return Values:
+		See CdiagSetMessageEventPacket.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagSetCustomDataEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet,
+	__in_bcount(Length) CONST VOID *Data,
+	__in DWORD Length
+	);
+
+/*++
+	Routine Description:
+		Release a packet and all packets begun after it, making
+		their space available for reuse.
+--*/
+CDIAGAPI VOID CDIAGCALLTYPE CdiagReleaseEventPacket(
+	__in PCDIAG_EVENT_PACKET Packet
+	);
+
+/*++
+	Routine Description:
+		Handle the event (see CdiagHandleEvent) and release 
+		the packet.
+
+	Return Values:
+		See CdiagHandleEvent.
+--*/
+CDIAGAPI HRESULT CDIAGCALLTYPE CdiagCommitEventPacket(
+	__in_opt CDIAG_SESSION_HANDLE Session,
+	__in PCDIAG_EVENT_PACKET Packet
+	);
+
 //// non-addrefed ptr -> valid only on thread, need to addref else
 //CDIAG_SESSION_HANDLE CDIAGCALLTYPE CdiagGetDefaultSession();
 //
@@ -127,6 +127,24 @@
 //
 #define CDIAG_E_NO_VERSION_INFO          ((HRESULT)0x80048107L)
 
+//
+// MessageId: CDIAG_E_INVALID_BINARY_FILE
+//
+// MessageText:
+//
+// The file is not a valid binary trace file
+//
+#define CDIAG_E_INVALID_BINARY_FILE      ((HRESULT)0x80048108L)
+
+//
+// MessageId: CDIAG_E_INVALID_CONFIGURATION_FILE
+//
+// MessageText:
+//
+// The configuration file is malformed
+//
+#define CDIAG_E_INVALID_CONFIGURATION_FILE ((HRESULT)0x80048109L)
+
 //
 // MessageId: CDIAG_E_TEST
 //
@@ -202,6 +202,55 @@ CFIXREPORTAPI VOID __cdecl CfixPeReportLogA(
 	...
 	);
 
+#ifndef CFIX_KERNELMODE
+#include <stdarg.h>
+
+/*++
+	Routine Description:
+		Format a message of arbitrary length. The message is allocated
+		from a per-thread arena and remains valid until it is released
+		via CfixPeReleaseMessage or until the current test routine 
+		completes, whichever comes first.
+
+		Messages must be released in reverse order of creation, i.e.
+		only the message allocated last on the thread may be released.
+		Releasing any other message, or releasing a message twice, 
+		raises an assertion in debug builds and is ignored otherwise;
+		the message is then released when the test routine completes.
+
+	Return Value:
+		Message or NULL on failure.
+--*/
+CFIXREPORTAPI PCWSTR CFIXCALLTYPE CfixPeFormatMessageW(
+	__in __format_string PCWSTR Format,
+	__in va_list Lst
+	);
+
+CFIXREPORTAPI PCWSTR CFIXCALLTYPE CfixPeFormatMessageA(
+	__in __format_string PCSTR Format,
+	__in va_list Lst
+	);
+
+/*++
+	Routine Description:
+		Convert an ANSI message. See CfixPeFormatMessageW for
+		lifetime rules.
+--*/
+CFIXREPORTAPI PCWSTR CFIXCALLTYPE CfixPeConvertMessageA(
+	__in PCSTR Message
+	);
+
+/*++
+	Routine Description:
+		Release a message obtained from CfixPeFormatMessage[A|W] or
+		CfixPeConvertMessageA. See CfixPeFormatMessageW for ordering
+		requirements.
+--*/
+CFIXREPORTAPI VOID CFIXCALLTYPE CfixPeReleaseMessage(
+	__in_opt PCWSTR Message
+	);
+#endif // CFIX_KERNELMODE
+
 /*----------------------------------------------------------------------
  *
  * Normal assertions.
@@ -95,6 +95,23 @@ typedef struct _CFIX_TESTCASE_EXECUTION_EVENT
 	CFIX_STACKTRACE StackTrace;
 } CFIX_TESTCASE_EXECUTION_EVENT, *PCFIX_TESTCASE_EXECUTION_EVENT;
 
+/*++
+	Routine Description:
+		Compute a hash over the raw frame addresses of a stack trace.
+		Symbolic information is not taken into account, so the hash
+		is cheap to compute and can be used to intern stack traces 
+		and to group failures sharing the same stack trace.
+
+		As for any hash, equal values do not guarantee equal traces -
+		compare the Frames arrays to be sure.
+
+	Return Value:
+		Hash value, 0 iff the stack trace is empty.
+--*/
+CFIXAPI ULONG CFIXCALLTYPE CfixHashStackTrace(
+	__in PCFIX_STACKTRACE StackTrace
+	);
+
 /*++
 	Structure Description:
 		Defines the interface of an execution context object.
@@ -571,6 +588,60 @@ CFIXAPI BOOL CFIXCALLTYPE CfixklIsWow64Process(
 //
 #define CFIX_FIXTURE_EXECUTION_CAPTURE_STACK_TRACES					256
 
+//
+// Only capture stack traces for failed assertions and unhandled 
+// exceptions, not for inconclusiveness reports.
+//
+#define CFIX_STACKTRACE_CAPTURE_FAILURES_ONLY						1
+
+/*++
+	Structure Description:
+		Policy determining for which events stack traces are captured
+		if CFIX_FIXTURE_EXECUTION_CAPTURE_STACK_TRACES is in effect.
+		
+		Log events never carry a stack trace.
+--*/
+typedef struct _CFIX_STACKTRACE_CAPTURE_POLICY
+{
+	//
+	// Set to sizeof( CFIX_STACKTRACE_CAPTURE_POLICY ).
+	//
+	ULONG SizeOfStruct;
+
+	//
+	// 0 or combination of CFIX_STACKTRACE_CAPTURE_* flags.
+	//
+	ULONG Flags;
+
+	//
+	// Maximum number of stack traces to capture per test routine
+	// (setup, teardown or test case). 0 means no limit.
+	//
+	ULONG MaxStackTracesPerTestCase;
+
+	//
+	// Only capture a stack trace for every n-th eligible event
+	// of a test routine, starting with the first. 0 and 1 both 
+	// mean every event.
+	//
+	ULONG SamplingInterval;
+} CFIX_STACKTRACE_CAPTURE_POLICY, *PCFIX_STACKTRACE_CAPTURE_POLICY;
+
+/*++
+	Routine Description:
+		Set the policy to use for all subsequent test runs. The 
+		default policy is to capture stack traces for all events 
+		other than log events.
+
+		Must not be called while a test run is in progress.
+
+	Parameters:
+		Policy		- Policy to use. NULL resets to the default.
+--*/
+CFIXAPI HRESULT CFIXCALLTYPE CfixSetStackTraceCapturePolicy(
+	__in_opt PCFIX_STACKTRACE_CAPTURE_POLICY Policy
+	);
+
 /*++
 	Routine Description:
 		Creates an action that executes sn entire fixture.
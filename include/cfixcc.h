@@ -378,6 +378,28 @@ namespace cfixcc
 		const Message& operator=( const Message& );
 	};
 
+	/*++
+		Routine Description:
+			Copy a message obtained from the per-thread message arena
+			and release it. As the message is the topmost allocation,
+			releasing it immediately is always valid.
+	--*/
+	inline void CopyArenaMessage(
+		__in_opt PCWSTR ArenaMessage,
+		__out std::wstring& Target
+		)
+	{
+		if ( ArenaMessage == NULL )
+		{
+			Target = L"(Invalid string)";
+		}
+		else
+		{
+			Target = ArenaMessage;
+			CfixPeReleaseMessage( ArenaMessage );
+		}
+	}
+
 	/*++
 		Class Description:
 			Encapsulates a statically allocated assertion message.
@@ -386,14 +408,13 @@ namespace cfixcc
 	{
 	private:
 		PCWSTR MessageString;
-		BOOL Allocated;
+		std::wstring ConvertedString;
 
 	public:
 		StaticMessage( 
 			__in PCWSTR String 
 			) 
 			: MessageString( String )
-			, Allocated( FALSE )
 		{
 		}
 
@@ -401,25 +422,11 @@ namespace cfixcc
 			__in PCSTR AnsiString 
 			) 
 			: MessageString( NULL )
-			, Allocated( TRUE )
 		{
-			size_t Len = strlen( AnsiString ) + 1;
-			WCHAR* Buffer = new WCHAR[ Len ];
-			if ( ! MultiByteToWideChar(
-				CP_ACP,
-				0,
-				AnsiString,
-				-1,
-				Buffer,
-				( int ) Len ) )
-			{
-				delete [] Buffer;
-				MessageString = NULL;
-			}
-			else
-			{
-				MessageString = Buffer;
-			}
+			CopyArenaMessage( 
+				CfixPeConvertMessageA( AnsiString ), 
+				ConvertedString );
+			MessageString = ConvertedString.c_str();
 		}
 
 		virtual PCWSTR GetMessage() const
@@ -427,14 +434,6 @@ namespace cfixcc
 			return MessageString;
 		}
 
-		virtual ~StaticMessage()
-		{
-			if ( Allocated )
-			{
-				delete [] MessageString;
-			}
-		}
-
 	private:
 		StaticMessage( const StaticMessage& );
 		const StaticMessage& operator=( const StaticMessage& );
@@ -444,6 +443,11 @@ namespace cfixcc
 		Class Description:
 			Encapsulates an assertion message that may be created
 			using printf-like formatting. 
+			
+			The message is not truncated. It is formatted in the 
+			per-thread message arena and then copied, so instances
+			may be destroyed in any order and may outlive the test
+			case.
 	--*/
 	class FormattedMessage : public Message
 	{
@@ -452,18 +456,16 @@ namespace cfixcc
 		const FormattedMessage& operator=( const FormattedMessage& );
 
 	protected:
-		WCHAR MessageString[ 256 ];
+		std::wstring MessageString;
 
 		void Initialize( 
 			__in __format_string PCWSTR Format,
 			__in va_list Lst
 			)
 		{
-			( VOID ) StringCchVPrintfW(
-				MessageString, 
-				_countof( MessageString ),
-				Format,
-				Lst );
+			CopyArenaMessage( 
+				CfixPeFormatMessageW( Format, Lst ), 
+				MessageString );
 		}
 
 		void Initialize( 
@@ -471,34 +473,13 @@ namespace cfixcc
 			__in va_list Lst
 			)
 		{
-			CHAR AnsiString[ 256 ];
-
-			//
-			// Create ANSI string first, as some of the arguments
-			// may be ANSI.
-			//
-			( VOID ) StringCchVPrintfA(
-				AnsiString, 
-				_countof( AnsiString ),
-				Format,
-				Lst );
-
 			//
-			// Convert.
+			// Some of the arguments may be ANSI, so the message is
+			// formatted as ANSI and converted.
 			//
-			if ( ! MultiByteToWideChar(
-				CP_ACP,
-				0,
-				AnsiString,
-				-1,
-				MessageString,
-				_countof( MessageString ) ) )
-			{
-				( VOID ) StringCchCopyW(
-					MessageString,
-					_countof( MessageString ),
-					L"(Invalid string)" );
-			}
+			CopyArenaMessage( 
+				CfixPeFormatMessageA( Format, Lst ), 
+				MessageString );
 		}
 
 		FormattedMessage()
@@ -546,7 +527,7 @@ namespace cfixcc
 
 		virtual PCWSTR GetMessage() const
 		{
-			return MessageString;
+			return MessageString.c_str();
 		}
 	};
 
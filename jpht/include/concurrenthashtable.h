@@ -0,0 +1,277 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Concurrent hashtable routines.
+ *
+ *		Writers (put/remove) synchronize on a fixed number of lock
+ *		stripes, each guarding a subset of the buckets. Lookups do not
+ *		take any locks: Bucket chains are singly linked and modified
+ *		such that a concurrent reader always observes a consistent
+ *		chain.
+ *
+ *		Lookups must be performed within a read section
+ *		(JphtEnterReadConcurrentHashtable). Entries removed or replaced
+ *		may still be referenced by readers until all read sections
+ *		entered before the removal have been left. Before freeing or
+ *		reusing a removed entry, the caller thus has to call
+ *		JphtSynchronizeConcurrentHashtable, which waits for these
+ *		readers (epoch-based reclamation, see epoch.h).
+ *
+ *		The number of buckets is fixed. Memory is only allocated and
+ *		freed by JphtInitializeConcurrentHashtable and
+ *		JphtDeleteConcurrentHashtable.
+ *
+ *		Locks are spinlocks - in kernel mode, callers have to raise
+ *		IRQL to at least DISPATCH_LEVEL before entering a read section,
+ *		modifying the hashtable or synchronizing.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include "epoch.h"
+
+//
+// Number of lock stripes.
+//
+#define JPHT_CONCURRENT_STRIPE_COUNT 16
+
+typedef struct _JPHT_CONCURRENT_HASHTABLE_STRIPE
+{
+	volatile LONG Lock;
+
+	//
+	// Avoid false sharing between stripes.
+	//
+	LONG Padding[ 15 ];
+} JPHT_CONCURRENT_HASHTABLE_STRIPE, *PJPHT_CONCURRENT_HASHTABLE_STRIPE;
+
+typedef struct _JPHT_CONCURRENT_HASHTABLE_BUCKET
+{
+	//
+	// First entry, linked via ListEntry.Flink. NULL-terminated.
+	// ListEntry.Blink is not used.
+	//
+	PLIST_ENTRY volatile First;
+} JPHT_CONCURRENT_HASHTABLE_BUCKET, *PJPHT_CONCURRENT_HASHTABLE_BUCKET;
+
+typedef struct _JPHT_CONCURRENT_HASHTABLE
+{
+	struct
+	{
+		JPHT_ALLOCATE_ROUTINE Allocate;
+		JPHT_FREE_ROUTINE Free;
+		JPHT_HASH_ROUTINE Hash;
+		JPHT_EQUALS_ROUTINE Equals;
+
+		//
+		// Called while waiting for readers, NULL to spin. See
+		// JphtSetYieldRoutineConcurrentHashtable.
+		//
+		JPHT_YIELD_ROUTINE Yield;
+	} Routines;
+
+	struct
+	{
+		volatile LONG EntryCount;
+		ULONG BucketCount;
+		PJPHT_CONCURRENT_HASHTABLE_BUCKET Buckets;
+		PJPHT_CONCURRENT_HASHTABLE_STRIPE Stripes;
+	} Data;
+
+	JPHT_EPOCH Reclamation;
+} JPHT_CONCURRENT_HASHTABLE, *PJPHT_CONCURRENT_HASHTABLE;
+
+/*++
+	Routine Description:
+		Determine number of entries in hashtable.
+--*/
+#define JphtGetEntryCountConcurrentHashtable( ht ) \
+	( ( ULONG ) ( ht )->Data.EntryCount )
+
+/*++
+	Routine Description:
+		Determine number of buckets in hashtable.
+--*/
+#define JphtGetBucketCountConcurrentHashtable( ht ) \
+	( ( ht )->Data.BucketCount )
+
+/*++
+	Routine Description:
+		Set the routine JphtSynchronizeConcurrentHashtable calls
+		while waiting for readers. By default, it spins, which is
+		required when synchronizing at raised IRQL. User mode 
+		callers should set a routine that yields the processor.
+--*/
+#define JphtSetYieldRoutineConcurrentHashtable( ht, Routine ) \
+	( ( ht )->Routines.Yield = ( Routine ) )
+
+/*++
+	Routine Description:
+		Initialize hashtable structure and allocate memory
+		for holding buckets and lock stripes.
+
+		The Allocate routine will be called.
+
+	Return Value:
+		TRUE on success.
+		FALSE if memory allocation failed.
+--*/
+BOOLEAN JphtInitializeConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in JPHT_HASH_ROUTINE Hash,
+	__in JPHT_EQUALS_ROUTINE Equals,
+	__in ULONG BucketCount
+	);
+
+/*++
+	Routine Description:
+		Free resources associated with this hashtable.
+
+		Note: The hashtable is assumed to be empty and not to be
+		used concurrently. See JphtDeleteHashtable.
+
+		The Free routine will be called.
+--*/
+VOID JphtDeleteConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	);
+
+/*++
+	Routine Description:
+		Enter a read section. Read sections should be short as
+		JphtSynchronizeConcurrentHashtable waits until all readers
+		have left.
+
+		Read sections may be nested, but
+		JphtSynchronizeConcurrentHashtable must not be called
+		from within a read section.
+
+	Return Value:
+		Epoch to be passed to JphtLeaveReadConcurrentHashtable.
+--*/
+ULONG JphtEnterReadConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	);
+
+/*++
+	Routine Description:
+		Leave a read section. Entries obtained within the read section
+		must not be accessed afterwards unless the caller
+		guarantees their lifetime otherwise.
+--*/
+VOID JphtLeaveReadConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG Epoch
+	);
+
+/*++
+	Routine Description:
+		Wait until all read sections entered before this call have
+		been left. Afterwards, entries removed from the hashtable
+		before the call are no longer referenced by any reader and
+		may be freed.
+
+		No locks except for an internal one serializing
+		synchronizations are held while waiting.
+--*/
+VOID JphtSynchronizeConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	);
+
+/*++
+	Routine Description:
+		Put entry into hashtable. If an entry with the same
+		key existed, it is returned vis OldEntry. Before freeing
+		OldEntry, the caller has to call
+		JphtSynchronizeConcurrentHashtable.
+
+		May be called concurrently with any other routine except
+		for JphtDeleteConcurrentHashtable.
+
+		The Hash and Equals routines will be called.
+--*/
+VOID JphtPutEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	);
+
+/*++
+	Routine Description:
+		Retrieve entry from hashtable. Must be called within a
+		read section.
+
+		The Hash and Equals routines will be called.
+
+	Return Value:
+		Entry or NULL of not found.
+--*/
+PJPHT_HASHTABLE_ENTRY JphtGetEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG_PTR Key
+	);
+
+/*++
+	Routine Description:
+		Remove entry from hashtable. If found, the entry is returned
+		via OldEntry. Before freeing OldEntry, the caller has to call
+		JphtSynchronizeConcurrentHashtable.
+
+		The Hash and Equals routines will be called.
+--*/
+VOID JphtRemoveEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	);
+
+/*++
+	Routine Description:
+		Called by JphtEnumerateEntriesConcurrentHashtable for each
+		entry.
+
+		Note that it is allowed to call
+		JphtRemoveEntryConcurrentHashtable( Hashtable, Entry->Key, ... )
+		from within this callback.
+--*/
+typedef VOID ( * JPHT_CONCURRENT_ENUM_CALLBACK ) (
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	);
+
+/*++
+	Routine Description:
+		Enumerate all entries in hashtable and call Callback
+		for each item encountered. Entries put or removed
+		concurrently may or may not be encountered.
+
+		The caller must either be within a read section or
+		guarantee that entries are not freed concurrently. The
+		callback itself may free the current entry after removing
+		it if there are no concurrent readers, e.g. during teardown.
+--*/
+VOID JphtEnumerateEntriesConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in JPHT_CONCURRENT_ENUM_CALLBACK Callback,
+	__in_opt PVOID Context
+	);
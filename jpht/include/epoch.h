@@ -0,0 +1,124 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Epoch-based reclamation.
+ *
+ *		Readers access shared data without taking locks, but do so
+ *		within a read section. A writer replacing or removing data
+ *		calls JphtSynchronizeEpoch before freeing it, which waits
+ *		until all read sections entered before the call have been
+ *		left.
+ *
+ *		Readers are counted per epoch, using two counters: a 
+ *		synchronization advances the epoch s.t. new readers are 
+ *		accounted separately and then waits for the counter of
+ *		the previous epoch to drain.
+ *
+ *		A JPHT_EPOCH may be initialized by zeroing.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _JPHT_EPOCH
+{
+	//
+	// Current epoch.
+	//
+	volatile LONG Epoch;
+
+	//
+	// Number of readers in even and odd epochs.
+	//
+	volatile LONG Readers[ 2 ];
+
+	//
+	// Serializes JphtSynchronizeEpoch.
+	//
+	volatile LONG Lock;
+} JPHT_EPOCH, *PJPHT_EPOCH;
+
+/*++
+	Routine Description:
+		Called by JphtSynchronizeEpoch while waiting. In kernel 
+		mode, synchronizing typically happens at raised IRQL, where
+		the only option is to spin. In user mode, readers may be
+		preempted, so the routine should yield the processor,
+		e.g. by calling SwitchToThread.
+--*/
+typedef VOID ( * JPHT_YIELD_ROUTINE ) ( VOID );
+
+/*++
+	Routine Description:
+		Initialize epoch structure.
+--*/
+VOID JphtInitializeEpoch(
+	__in PJPHT_EPOCH Epoch
+	);
+
+/*++
+	Routine Description:
+		Enter a read section. Read sections should be short as
+		JphtSynchronizeEpoch waits until all readers have left.
+
+		Read sections may be nested, but JphtSynchronizeEpoch
+		must not be called from within a read section.
+
+	Return Value:
+		Epoch to be passed to JphtLeaveReadEpoch.
+--*/
+ULONG JphtEnterReadEpoch(
+	__in PJPHT_EPOCH Epoch
+	);
+
+/*++
+	Routine Description:
+		Leave a read section. Data obtained within the read section
+		must not be accessed afterwards unless the caller
+		guarantees its lifetime otherwise.
+--*/
+VOID JphtLeaveReadEpoch(
+	__in PJPHT_EPOCH Epoch,
+	__in ULONG ReaderEpoch
+	);
+
+/*++
+	Routine Description:
+		Wait until all read sections entered before this call have
+		been left. Afterwards, data unpublished before the call is 
+		no longer referenced by any reader and may be freed.
+
+		No locks except for an internal one serializing
+		synchronizations are held while waiting.
+
+	Parameters:
+		Epoch		Epoch structure.
+		Yield		Routine to call while waiting, NULL to spin.
+--*/
+VOID JphtSynchronizeEpoch(
+	__in PJPHT_EPOCH Epoch,
+	__in_opt JPHT_YIELD_ROUTINE Yield
+	);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,16 @@
  *		concurrent read access are allowed, the user must avoid
  *		performing concurrent modifications on the hashtable.
  *
+ *		If load factors have been set (JphtSetLoadFactorsHashtable),
+ *		the hashtable grows and shrinks automatically. Resizing is
+ *		performed incrementally: While a resize is in progress, each 
+ *		put and remove operation migrates a few buckets from the old 
+ *		to the new bucket array, so no single operation pays for 
+ *		rehashing the entire table.
+ *
+ *		See typedhashtable.h for put/get/remove routines that call
+ *		the Hash and Equals routines directly.
+ *
  * Copyright:
  *		Johannes Passing (johannes.passing@googlemail.com)
  *
@@ -26,6 +36,10 @@
 
 #pragma once
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct _JPHT_HASHTABLE_BUCKET
 {
 	LIST_ENTRY EntryListHead;
@@ -89,9 +103,43 @@ typedef struct _JPHT_HASHTABLE
 		ULONG EntryCount;
 		ULONG BucketCount;
 		PJPHT_HASHTABLE_BUCKET Buckets;
+
+		//
+		// Number of enumerations in progress. No buckets are
+		// migrated while the hashtable is being enumerated.
+		//
+		ULONG ActiveEnumerations;
 	} Data;
+
+	//
+	// Buckets not yet migrated during an incremental resize.
+	// Buckets is NULL if no resize is in progress.
+	//
+	struct
+	{
+		ULONG BucketCount;
+		ULONG NextBucket;
+		PJPHT_HASHTABLE_BUCKET Buckets;
+	} Migration;
+
+	//
+	// Load factors, in percent of entries per bucket. 0 disables
+	// automatic growing/shrinking, respectively.
+	//
+	struct
+	{
+		ULONG GrowLoadFactor;
+		ULONG ShrinkLoadFactor;
+		ULONG MinimumBucketCount;
+	} Policy;
 } JPHT_HASHTABLE, *PJPHT_HASHTABLE;
 
+//
+// Reasonable defaults for JphtSetLoadFactorsHashtable.
+//
+#define JPHT_DEFAULT_GROW_LOAD_FACTOR	200
+#define JPHT_DEFAULT_SHRINK_LOAD_FACTOR	50
+
 /*++
 	Routine Description:
 		Determine number of entries in hashtable.
@@ -111,6 +159,9 @@ typedef struct _JPHT_HASHTABLE
 		Initialize hashtable structure and allocate memory
 		for holding buckets.
 
+		The hashtable is not resized automatically unless
+		JphtSetLoadFactorsHashtable is called.
+
 		The Allocate routine will be called.
 
 	Return Value:
@@ -126,6 +177,35 @@ BOOLEAN JphtInitializeHashtable(
 	__in ULONG InitialBucketCount
 	);
 
+/*++
+	Routine Description:
+		Enable automatic, incremental resizing.
+
+		The hashtable is grown if the number of entries exceeds
+		GrowLoadFactor percent of the number of buckets, and shrunk 
+		if it falls below ShrinkLoadFactor percent. The hashtable 
+		is never shrunk below its initial bucket count.
+
+		Resizing requires memory to be allocated during put and 
+		remove operations. If the Allocate routine fails, the 
+		hashtable continues to operate at its current size. Do not 
+		enable resizing if the Allocate routine may not be called
+		in the context of these operations, e.g. at raised IRQL.
+
+	Parameters:
+		Hashtable
+		GrowLoadFactor		- Load factor in percent. 0 disables 
+							  growing.
+		ShrinkLoadFactor	- Load factor in percent. 0 disables 
+							  shrinking. Must be less than half of 
+							  GrowLoadFactor.
+--*/
+VOID JphtSetLoadFactorsHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG GrowLoadFactor,
+	__in ULONG ShrinkLoadFactor
+	);
+
 /*++
 	Routine Description:
 		Free resources associated with this hashtable.
@@ -159,7 +239,8 @@ VOID JphtDeleteHashtable(
 		valid until the entry is explicitly removed from the 
 		hashtable.
 
-		The Hash and Equals routines will be called.
+		The Hash and Equals routines will be called. If load factors
+		have been set, the Allocate and Free routines may be called.
 
 	Parameters:
 		Hashtable
@@ -190,13 +271,38 @@ PJPHT_HASHTABLE_ENTRY JphtGetEntryHashtable(
 	__in ULONG_PTR Key 
 	);
 
+/*++
+	Routine Description:
+		Retrieve multiple entries from hashtable. Equivalent to
+		calling JphtGetEntryHashtable for each key, but faster for 
+		large tables: Keys are processed in groups - all keys of a 
+		group are hashed and their buckets and first entries are
+		prefetched before the lookups are performed, so that 
+		cache misses overlap.
+
+		The Hash and Equals routines will be called.
+
+	Parameters:
+		Hashtable
+		Keys		- Keys to look up.
+		Count		- Number of elements in Keys and Entries.
+		Entries		- Receives entry or NULL for each key.
+--*/
+VOID JphtGetEntriesHashtableBatch(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in_ecount( Count ) CONST ULONG_PTR *Keys,
+	__in ULONG Count,
+	__out_ecount( Count ) PJPHT_HASHTABLE_ENTRY *Entries
+	);
+
 
 /*++
 	Routine Description:
 		Remove entry from hashtable. If found, the entry is returned
 		via OldEntry. The caller must free the associated resources.
 
-		The Hash and Equals routines will be called.
+		The Hash and Equals routines will be called. If load factors
+		have been set, the Allocate and Free routines may be called.
 
 	Parameters:
 		Hashtable
@@ -247,9 +353,11 @@ VOID JphtEnumerateEntries(
 
 /*++
 	Routine Description:
-		Resize and rehash hashtable.
+		Resize and rehash hashtable. Unlike automatic resizing, 
+		all entries are migrated immediately. An incremental
+		resize in progress is completed first.
 
-		The Free and Allocate routines will be called.
+		The Hash, Free and Allocate routines will be called.
 	
 	Parameters:
 		Hashtable
@@ -264,3 +372,7 @@ BOOLEAN JphtResize(
 	__in PJPHT_HASHTABLE Hashtable,
 	__in ULONG NewBucketCount
 	);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
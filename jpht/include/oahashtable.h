@@ -0,0 +1,239 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Open addressing hashtable routines.
+ *
+ *		The open addressing hashtable uses Robin Hood hashing with
+ *		backward shift deletion. Keys and hash values are stored inline
+ *		in the slot array next to the entry pointer, so lookups
+ *		usually touch a single cache line and only call the Equals
+ *		routine if the hash values match.
+ *
+ *		The API mirrors the one of the chained hashtable (hashtable.h)
+ *		and uses the same entry structure and routine types. Switching
+ *		a user between both implementations thus only requires changing
+ *		the type of the table and the names of the routines called.
+ *		The ListEntry member of JPHT_HASHTABLE_ENTRY is not used.
+ *
+ *		Note that no internal locking is performed, i.e. while
+ *		concurrent read access are allowed, the user must avoid
+ *		performing concurrent modifications on the hashtable.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#pragma once
+
+#include "hashtable.h"
+
+typedef struct _JPHT_OA_HASHTABLE_SLOT
+{
+	//
+	// Key of entry, copied from Entry->Key.
+	//
+	ULONG_PTR Key;
+
+	//
+	// Entry, NULL if slot is free.
+	//
+	PJPHT_HASHTABLE_ENTRY Entry;
+
+	//
+	// Cached result of the Hash routine for Key.
+	//
+	ULONG Hash;
+	ULONG Reserved;
+} JPHT_OA_HASHTABLE_SLOT, *PJPHT_OA_HASHTABLE_SLOT;
+
+typedef struct _JPHT_OA_HASHTABLE
+{
+	struct
+	{
+		JPHT_ALLOCATE_ROUTINE Allocate;
+		JPHT_FREE_ROUTINE Free;
+		JPHT_HASH_ROUTINE Hash;
+		JPHT_EQUALS_ROUTINE Equals;
+	} Routines;
+
+	struct
+	{
+		ULONG EntryCount;
+
+		//
+		// Number of slots, always a power of 2.
+		//
+		ULONG SlotCount;
+		PJPHT_OA_HASHTABLE_SLOT Slots;
+	} Data;
+} JPHT_OA_HASHTABLE, *PJPHT_OA_HASHTABLE;
+
+/*++
+	Routine Description:
+		Determine number of entries in hashtable.
+--*/
+#define JphtGetEntryCountOaHashtable( ht ) \
+	( ( ht )->Data.EntryCount )
+
+/*++
+	Routine Description:
+		Determine number of slots in hashtable.
+--*/
+#define JphtGetSlotCountOaHashtable( ht ) \
+	( ( ht )->Data.SlotCount )
+
+/*++
+	Routine Description:
+		Initialize hashtable structure and allocate memory
+		for holding slots.
+
+		The Allocate routine will be called.
+
+	Parameters:
+		InitialSlotCount	- Number of slots. Rounded up to the
+							  next power of 2.
+
+	Return Value:
+		TRUE on success.
+		FALSE if memory allocation failed.
+--*/
+BOOLEAN JphtInitializeOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in JPHT_HASH_ROUTINE Hash,
+	__in JPHT_EQUALS_ROUTINE Equals,
+	__in ULONG InitialSlotCount
+	);
+
+/*++
+	Routine Description:
+		Free resources associated with this hashtable.
+
+		Note: The hashtable is assumed to be empty! See
+		JphtDeleteHashtable.
+
+		The Free routine will be called.
+--*/
+VOID JphtDeleteOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable
+	);
+
+/*++
+	Routine Description:
+		Put entry into hashtable. If an entry with the same
+		key existed, it is returned vis OldEntry. The caller
+		must free the associated resources.
+
+		The entry memory must remain valid until the entry is
+		explicitly removed from the hashtable. The key must not
+		be changed while the entry is part of the hashtable.
+
+		If the load factor would exceed 7/8, the hashtable is grown.
+
+		The Hash and Equals routines will be called. The Allocate
+		and Free routines may be called.
+
+	Parameters:
+		Hashtable
+		Entry		- entry to insert.
+		OldEntry	- overwritten entry if any.
+
+	Return Value:
+		TRUE on success.
+		FALSE if the hashtable is full and could not be grown. The
+			  entry has not been inserted.
+--*/
+BOOLEAN JphtPutEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	);
+
+/*++
+	Routine Description:
+		Retrieve entry from hashtable.
+
+		The Hash and Equals routines will be called.
+
+	Return Value:
+		Entry or NULL of not found.
+--*/
+PJPHT_HASHTABLE_ENTRY JphtGetEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key
+	);
+
+/*++
+	Routine Description:
+		Remove entry from hashtable. If found, the entry is returned
+		via OldEntry. The caller must free the associated resources.
+
+		The Hash and Equals routines will be called.
+--*/
+VOID JphtRemoveEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	);
+
+/*++
+	Routine Description:
+		Called by JphtEnumerateEntriesOaHashtable for each entry.
+
+		Note that it is allowed to call
+		JphtRemoveEntryOaHashtable( Hashtable, Entry->Key, ... )
+		from within this callback.
+--*/
+typedef VOID ( * JPHT_OA_ENUM_CALLBACK ) (
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	);
+
+/*++
+	Routine Description:
+		Enumerate all entries in hashtable and call Callback
+		for each item encountered.
+--*/
+VOID JphtEnumerateEntriesOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in JPHT_OA_ENUM_CALLBACK Callback,
+	__in_opt PVOID Context
+	);
+
+/*++
+	Routine Description:
+		Resize and rehash hashtable. The Hash routine is not called
+		as hash values are cached.
+
+		The Free and Allocate routines will be called.
+
+	Parameters:
+		Hashtable
+		NewSlotCount	- new number of slots. Rounded up to the next
+						  power of 2.
+
+	Return Value:
+		TRUE on success.
+		FALSE if memory allocation failed or NewSlotCount is too
+			  small to hold all entries. The hashtable is left in
+			  the previous state.
+--*/
+BOOLEAN JphtResizeOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG NewSlotCount
+	);
@@ -0,0 +1,181 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Slab allocator for hashtable entries.
+ *
+ *		Hashtables do not allocate entries themselves - entries are
+ *		embedded in structures allocated by the user. A slab allocator
+ *		carves such fixed-size structures from larger, contiguous
+ *		blocks (slabs) obtained from the JPHT_ALLOCATE_ROUTINE and
+ *		keeps freed structures on a free list for reuse.
+ *
+ *		Compared to allocating each structure from the heap or pool,
+ *		entries of a hashtable end up on fewer pages, which benefits
+ *		enumeration and teardown, and allocating and freeing only
+ *		consists of popping/pushing the free list in most cases.
+ *
+ *		Slabs are only released by JphtDeleteSlabAllocator. Objects
+ *		still allocated at that point are released implicitly, so
+ *		a teardown does not need to free each object individually.
+ *
+ *		As with the hashtable, no internal locking is performed -
+ *		the user must serialize all calls. In kernel mode, the IRQL
+ *		restrictions of the Allocate routine apply to
+ *		JphtAllocateSlabObject, the ones of the Free routine to
+ *		JphtDeleteSlabAllocator. JphtFreeSlabObject does not call
+ *		any routine. Whether objects are paged or nonpaged is thus
+ *		solely determined by the Allocate routine.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#pragma once
+
+#include "hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Default slab size - one page on all supported architectures.
+//
+#define JPHT_DEFAULT_SLAB_SIZE 4096
+
+//
+// Free object, linked into the free list.
+//
+typedef struct _JPHT_SLAB_FREE_OBJECT
+{
+	struct _JPHT_SLAB_FREE_OBJECT *Next;
+} JPHT_SLAB_FREE_OBJECT, *PJPHT_SLAB_FREE_OBJECT;
+
+//
+// Header at the start of each slab, objects follow.
+//
+typedef struct _JPHT_SLAB_HEADER
+{
+	struct _JPHT_SLAB_HEADER *Next;
+} JPHT_SLAB_HEADER, *PJPHT_SLAB_HEADER;
+
+typedef struct _JPHT_SLAB_ALLOCATOR
+{
+	struct
+	{
+		JPHT_ALLOCATE_ROUTINE Allocate;
+		JPHT_FREE_ROUTINE Free;
+	} Routines;
+
+	struct
+	{
+		//
+		// Size of an object, rounded up to the allocation alignment.
+		//
+		SIZE_T ObjectSize;
+
+		//
+		// Offset of first object within slab.
+		//
+		SIZE_T HeaderSize;
+
+		SIZE_T SlabSize;
+		ULONG ObjectsPerSlab;
+	} Geometry;
+
+	struct
+	{
+		PJPHT_SLAB_HEADER Slabs;
+		PJPHT_SLAB_FREE_OBJECT FreeList;
+
+		ULONG SlabCount;
+
+		//
+		// Number of objects currently allocated.
+		//
+		ULONG ObjectCount;
+	} Data;
+} JPHT_SLAB_ALLOCATOR, *PJPHT_SLAB_ALLOCATOR;
+
+/*++
+	Routine Description:
+		Determine number of objects currently allocated.
+--*/
+#define JphtGetObjectCountSlabAllocator( sa ) \
+	( ( sa )->Data.ObjectCount )
+
+/*++
+	Routine Description:
+		Determine number of slabs allocated.
+--*/
+#define JphtGetSlabCountSlabAllocator( sa ) \
+	( ( sa )->Data.SlabCount )
+
+/*++
+	Routine Description:
+		Initialize allocator structure. No memory is allocated.
+
+	Parameters:
+		Allocate	- Routine used to allocate slabs.
+		Free		- Routine used to free slabs.
+		ObjectSize	- Size of objects to be allocated.
+		SlabSize	- Size of each slab. If 0 or too small to hold a
+					  single object, JPHT_DEFAULT_SLAB_SIZE or the
+					  minimum size required is used, respectively.
+--*/
+VOID JphtInitializeSlabAllocator(
+	__in PJPHT_SLAB_ALLOCATOR Allocator,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in SIZE_T ObjectSize,
+	__in SIZE_T SlabSize
+	);
+
+/*++
+	Routine Description:
+		Free all slabs. Objects still allocated become invalid.
+
+		The Free routine will be called.
+--*/
+VOID JphtDeleteSlabAllocator(
+	__in PJPHT_SLAB_ALLOCATOR Allocator
+	);
+
+/*++
+	Routine Description:
+		Allocate an object. The object's memory is not initialized.
+
+		The Allocate routine may be called.
+
+	Return Value:
+		Object or NULL if memory allocation failed.
+--*/
+PVOID JphtAllocateSlabObject(
+	__in PJPHT_SLAB_ALLOCATOR Allocator
+	);
+
+/*++
+	Routine Description:
+		Free an object previously allocated from this allocator.
+--*/
+VOID JphtFreeSlabObject(
+	__in PJPHT_SLAB_ALLOCATOR Allocator,
+	__in PVOID Object
+	);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
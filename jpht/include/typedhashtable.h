@@ -0,0 +1,351 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Type-specialized hashtable routines.
+ *
+ *		The generic routines (hashtable.h) call the Hash and Equals
+ *		routines indirectly. For cheap routines, e.g. for integer keys,
+ *		the indirect calls dominate the cost of a lookup. The
+ *		specializations defined here call the routines directly,
+ *		allowing the compiler to inline them.
+ *
+ *		Specialized put, get and remove routines operate on a plain
+ *		JPHT_HASHTABLE and have the same semantics as their generic
+ *		counterparts, including incremental resizing. All other generic
+ *		routines (JphtDeleteHashtable, JphtEnumerateEntries, etc.)
+ *		may be used on a specialized hashtable, and generic and
+ *		specialized routines may be mixed freely.
+ *
+ *		C:
+ *			JPHT_DEFINE_TYPED_HASHTABLE( Prefix, Hash, Equals )
+ *
+ *			defines the static routines
+ *
+ *			Prefix##InitializeHashtable
+ *			Prefix##PutEntryHashtable
+ *			Prefix##GetEntryHashtable
+ *			Prefix##RemoveEntryHashtable
+ *
+ *			Hash and Equals must be routines of type JPHT_HASH_ROUTINE
+ *			and JPHT_EQUALS_ROUTINE defined before the macro is used.
+ *
+ *		C++:
+ *			JphtTypedHashtable< Traits >
+ *
+ *			provides the same routines as static members, Traits must
+ *			provide static Hash and Equals routines.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#pragma once
+
+#include "hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*----------------------------------------------------------------------
+ *
+ * Internals shared by generic and specialized routines. Do not use
+ * directly.
+ *
+ */
+
+/*++
+	Routine Description:
+		Continue a resize in progress or start a new one if the
+		load factor is out of bounds. Called before each
+		modification.
+--*/
+VOID JphtpMaintainHashtable(
+	__in PJPHT_HASHTABLE Hashtable
+	);
+
+/*++
+	Routine Description:
+		Get the bucket of the old bucket array a key with the
+		given hash lives in, if this bucket has not been migrated
+		yet.
+
+	Return Value:
+		Bucket or NULL if no resize is in progress or the bucket has
+		already been migrated.
+--*/
+static __inline PJPHT_HASHTABLE_BUCKET JphtpGetUnmigratedBucketHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG Hash
+	)
+{
+	ULONG BucketIndex;
+
+	if ( Hashtable->Migration.Buckets == NULL )
+	{
+		return NULL;
+	}
+
+	BucketIndex = Hash % Hashtable->Migration.BucketCount;
+	if ( BucketIndex < Hashtable->Migration.NextBucket )
+	{
+		return NULL;
+	}
+	else
+	{
+		return &Hashtable->Migration.Buckets[ BucketIndex ];
+	}
+}
+
+static __inline VOID JphtpUnlinkEntryHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry
+	)
+{
+	Entry->ListEntry.Blink->Flink = Entry->ListEntry.Flink;
+	Entry->ListEntry.Flink->Blink = Entry->ListEntry.Blink;
+	Hashtable->Data.EntryCount--;
+}
+
+static __inline VOID JphtpLinkEntryHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_BUCKET Bucket,
+	__in PJPHT_HASHTABLE_ENTRY Entry
+	)
+{
+	Entry->ListEntry.Flink = Bucket->EntryListHead.Flink;
+	Entry->ListEntry.Blink = &Bucket->EntryListHead;
+	Bucket->EntryListHead.Flink->Blink = &Entry->ListEntry;
+	Bucket->EntryListHead.Flink = &Entry->ListEntry;
+	Hashtable->Data.EntryCount++;
+}
+
+#define JPHTP_TYPED_FIND_ENTRY_BUCKET( Bucket, KeyToFind, Equals, Result ) \
+	{																	\
+		PLIST_ENTRY ListEntry_ = ( Bucket )->EntryListHead.Flink;		\
+		while ( ListEntry_ != &( Bucket )->EntryListHead )				\
+		{																\
+			PJPHT_HASHTABLE_ENTRY Candidate_ = CONTAINING_RECORD(		\
+				ListEntry_, JPHT_HASHTABLE_ENTRY, ListEntry );			\
+			if ( Equals( Candidate_->Key, ( KeyToFind ) ) )				\
+			{															\
+				( Result ) = Candidate_;								\
+				break;													\
+			}															\
+			ListEntry_ = ListEntry_->Flink;								\
+		}																\
+	}
+
+//
+// Bodies of specialized routines. Parameter names match those of
+// the generic routines.
+//
+
+#define JPHTP_TYPED_GET_ENTRY_BODY( Hash, Equals )						\
+	{																	\
+		ULONG Hash_ = Hash( Key );										\
+		PJPHT_HASHTABLE_BUCKET Bucket_;									\
+		PJPHT_HASHTABLE_ENTRY Entry_ = NULL;							\
+																		\
+		Bucket_ = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash_ );	\
+		if ( Bucket_ != NULL )											\
+		{																\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET( Bucket_, Key, Equals, Entry_ );	\
+		}																\
+																		\
+		if ( Entry_ == NULL )											\
+		{																\
+			Bucket_ = &Hashtable->Data.Buckets[							\
+				Hash_ % Hashtable->Data.BucketCount ];					\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET( Bucket_, Key, Equals, Entry_ );	\
+		}																\
+																		\
+		return Entry_;													\
+	}
+
+#define JPHTP_TYPED_PUT_ENTRY_BODY( Hash, Equals )						\
+	{																	\
+		ULONG Hash_;													\
+		PJPHT_HASHTABLE_BUCKET Bucket_;									\
+		PJPHT_HASHTABLE_ENTRY Existing_ = NULL;							\
+																		\
+		JphtpMaintainHashtable( Hashtable );							\
+																		\
+		Hash_ = Hash( Entry->Key );										\
+		Bucket_ = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash_ );	\
+		if ( Bucket_ != NULL )											\
+		{																\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET(								\
+				Bucket_, Entry->Key, Equals, Existing_ );				\
+		}																\
+																		\
+		Bucket_ = &Hashtable->Data.Buckets[								\
+			Hash_ % Hashtable->Data.BucketCount ];						\
+		if ( Existing_ == NULL )										\
+		{																\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET(								\
+				Bucket_, Entry->Key, Equals, Existing_ );				\
+		}																\
+																		\
+		if ( Existing_ != NULL )										\
+		{																\
+			JphtpUnlinkEntryHashtable( Hashtable, Existing_ );			\
+		}																\
+																		\
+		*OldEntry = Existing_;											\
+		JphtpLinkEntryHashtable( Hashtable, Bucket_, Entry );			\
+	}
+
+#define JPHTP_TYPED_REMOVE_ENTRY_BODY( Hash, Equals )					\
+	{																	\
+		ULONG Hash_;													\
+		PJPHT_HASHTABLE_BUCKET Bucket_;									\
+		PJPHT_HASHTABLE_ENTRY Entry_ = NULL;							\
+																		\
+		JphtpMaintainHashtable( Hashtable );							\
+																		\
+		Hash_ = Hash( Key );											\
+		Bucket_ = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash_ );	\
+		if ( Bucket_ != NULL )											\
+		{																\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET( Bucket_, Key, Equals, Entry_ );	\
+		}																\
+																		\
+		if ( Entry_ == NULL )											\
+		{																\
+			Bucket_ = &Hashtable->Data.Buckets[							\
+				Hash_ % Hashtable->Data.BucketCount ];					\
+			JPHTP_TYPED_FIND_ENTRY_BUCKET( Bucket_, Key, Equals, Entry_ );	\
+		}																\
+																		\
+		if ( Entry_ != NULL )											\
+		{																\
+			JphtpUnlinkEntryHashtable( Hashtable, Entry_ );				\
+		}																\
+																		\
+		if ( OldEntry )													\
+		{																\
+			*OldEntry = Entry_;											\
+		}																\
+	}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*----------------------------------------------------------------------
+ *
+ * C.
+ *
+ */
+
+#define JPHT_DEFINE_TYPED_HASHTABLE( Prefix, Hash, Equals )				\
+	static __inline BOOLEAN Prefix##InitializeHashtable(				\
+		__in PJPHT_HASHTABLE Hashtable,									\
+		__in JPHT_ALLOCATE_ROUTINE Allocate,							\
+		__in JPHT_FREE_ROUTINE Free,									\
+		__in ULONG InitialBucketCount									\
+		)																\
+	{																	\
+		return JphtInitializeHashtable(									\
+			Hashtable,													\
+			Allocate,													\
+			Free,														\
+			Hash,														\
+			Equals,														\
+			InitialBucketCount );										\
+	}																	\
+																		\
+	static __inline VOID Prefix##PutEntryHashtable(					\
+		__in PJPHT_HASHTABLE Hashtable,									\
+		__in PJPHT_HASHTABLE_ENTRY Entry,								\
+		__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry						\
+		)																\
+	JPHTP_TYPED_PUT_ENTRY_BODY( Hash, Equals )							\
+																		\
+	static __inline PJPHT_HASHTABLE_ENTRY Prefix##GetEntryHashtable(	\
+		__in PJPHT_HASHTABLE Hashtable,									\
+		__in ULONG_PTR Key												\
+		)																\
+	JPHTP_TYPED_GET_ENTRY_BODY( Hash, Equals )							\
+																		\
+	static __inline VOID Prefix##RemoveEntryHashtable(					\
+		__in PJPHT_HASHTABLE Hashtable,									\
+		__in ULONG_PTR Key,												\
+		__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry						\
+		)																\
+	JPHTP_TYPED_REMOVE_ENTRY_BODY( Hash, Equals )
+
+/*----------------------------------------------------------------------
+ *
+ * C++.
+ *
+ */
+
+#ifdef __cplusplus
+
+/*++
+	Class Description:
+		Specialized hashtable routines. Traits must provide
+
+			static ULONG Hash( ULONG_PTR Key );
+			static BOOLEAN Equals( ULONG_PTR KeyLhs, ULONG_PTR KeyRhs );
+--*/
+template< class Traits >
+class JphtTypedHashtable
+{
+private:
+	JphtTypedHashtable();
+
+public:
+	static BOOLEAN InitializeHashtable(
+		__in PJPHT_HASHTABLE Hashtable,
+		__in JPHT_ALLOCATE_ROUTINE Allocate,
+		__in JPHT_FREE_ROUTINE Free,
+		__in ULONG InitialBucketCount
+		)
+	{
+		return JphtInitializeHashtable(
+			Hashtable,
+			Allocate,
+			Free,
+			Traits::Hash,
+			Traits::Equals,
+			InitialBucketCount );
+	}
+
+	static VOID PutEntryHashtable(
+		__in PJPHT_HASHTABLE Hashtable,
+		__in PJPHT_HASHTABLE_ENTRY Entry,
+		__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+		)
+	JPHTP_TYPED_PUT_ENTRY_BODY( Traits::Hash, Traits::Equals )
+
+	static PJPHT_HASHTABLE_ENTRY GetEntryHashtable(
+		__in PJPHT_HASHTABLE Hashtable,
+		__in ULONG_PTR Key
+		)
+	JPHTP_TYPED_GET_ENTRY_BODY( Traits::Hash, Traits::Equals )
+
+	static VOID RemoveEntryHashtable(
+		__in PJPHT_HASHTABLE Hashtable,
+		__in ULONG_PTR Key,
+		__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+		)
+	JPHTP_TYPED_REMOVE_ENTRY_BODY( Traits::Hash, Traits::Equals )
+};
+
+#endif
@@ -0,0 +1,397 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Concurrent hashtable implementation.
+ *
+ *		N.B. The library is linked into kernel mode components, so
+ *		only compiler intrinsics are used for synchronization.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include "stdafx.h"
+#include "concurrenthashtable.h"
+#include <windows.h>
+#include <intrin.h>
+
+#include <crtdbg.h>
+#define ASSERT _ASSERTE
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static VOID JphtsAcquireLock(
+	__in volatile LONG *Lock
+	)
+{
+	while ( _InterlockedCompareExchange( Lock, 1, 0 ) != 0 )
+	{
+		//
+		// Spin on a plain read to avoid bouncing the cache line.
+		//
+		while ( *Lock != 0 )
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+static VOID JphtsReleaseLock(
+	__in volatile LONG *Lock
+	)
+{
+	ASSERT( *Lock == 1 );
+	_InterlockedExchange( Lock, 0 );
+}
+
+/*++
+	Routine Description:
+		Get the link pointing to the next entry.
+
+		N.B. Links are read and written as volatile, which implies
+		acquire/release semantics.
+--*/
+#define JphtsNextLink( ListEntry ) \
+	( ( PLIST_ENTRY volatile * ) &( ListEntry )->Flink )
+
+static PJPHT_CONCURRENT_HASHTABLE_BUCKET JphtsGetBucket(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__out_opt volatile LONG **Lock
+	)
+{
+	ULONG BucketIndex;
+
+	BucketIndex = Hashtable->Routines.Hash( Key ) % Hashtable->Data.BucketCount;
+
+	if ( Lock != NULL )
+	{
+		*Lock = &Hashtable->Data.Stripes[
+			BucketIndex % JPHT_CONCURRENT_STRIPE_COUNT ].Lock;
+	}
+
+	return &Hashtable->Data.Buckets[ BucketIndex ];
+}
+
+/*++
+	Routine Description:
+		Find the link pointing to the entry with the given key.
+		Lock of bucket must be held.
+
+	Return Value:
+		Link, *Link is NULL if not found.
+--*/
+static PLIST_ENTRY volatile * JphtsFindLinkBucket(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in PJPHT_CONCURRENT_HASHTABLE_BUCKET Bucket,
+	__in ULONG_PTR Key
+	)
+{
+	PLIST_ENTRY volatile *Link = &Bucket->First;
+
+	while ( *Link != NULL )
+	{
+		PJPHT_HASHTABLE_ENTRY Entry = CONTAINING_RECORD(
+			*Link, JPHT_HASHTABLE_ENTRY, ListEntry );
+		if ( Hashtable->Routines.Equals( Entry->Key, Key ) )
+		{
+			break;
+		}
+
+		Link = JphtsNextLink( *Link );
+	}
+
+	return Link;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Implementation.
+ *
+ */
+
+BOOLEAN JphtInitializeConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in JPHT_HASH_ROUTINE Hash,
+	__in JPHT_EQUALS_ROUTINE Equals,
+	__in ULONG BucketCount
+	)
+{
+	ULONG Index;
+	__int64 SizeRequired;
+	PUCHAR Memory;
+
+	ASSERT( Hashtable );
+	ASSERT( Allocate );
+	ASSERT( Free );
+	ASSERT( Hash );
+	ASSERT( Equals );
+	ASSERT( BucketCount > 0 );
+
+	Hashtable->Routines.Allocate	= Allocate;
+	Hashtable->Routines.Free		= Free;
+	Hashtable->Routines.Equals		= Equals;
+	Hashtable->Routines.Hash		= Hash;
+	Hashtable->Routines.Yield		= NULL;
+
+	Hashtable->Data.BucketCount		= BucketCount;
+	Hashtable->Data.EntryCount		= 0;
+
+	JphtInitializeEpoch( &Hashtable->Reclamation );
+
+	//
+	// Allocate stripes and buckets en bloc.
+	//
+	SizeRequired =
+		JPHT_CONCURRENT_STRIPE_COUNT * sizeof( JPHT_CONCURRENT_HASHTABLE_STRIPE ) +
+		( __int64 ) BucketCount * sizeof( JPHT_CONCURRENT_HASHTABLE_BUCKET );
+	if ( SizeRequired > ( SIZE_T ) -1 )
+	{
+		//
+		// Overflow.
+		//
+		return FALSE;
+	}
+
+	Memory = ( PUCHAR ) Hashtable->Routines.Allocate( ( SIZE_T ) SizeRequired );
+	if ( Memory == NULL )
+	{
+		return FALSE;
+	}
+
+	Hashtable->Data.Stripes = ( PJPHT_CONCURRENT_HASHTABLE_STRIPE ) Memory;
+	Hashtable->Data.Buckets = ( PJPHT_CONCURRENT_HASHTABLE_BUCKET )
+		( Memory + JPHT_CONCURRENT_STRIPE_COUNT *
+			sizeof( JPHT_CONCURRENT_HASHTABLE_STRIPE ) );
+
+	for ( Index = 0; Index < JPHT_CONCURRENT_STRIPE_COUNT; Index++ )
+	{
+		Hashtable->Data.Stripes[ Index ].Lock = 0;
+	}
+
+	for ( Index = 0; Index < BucketCount; Index++ )
+	{
+		Hashtable->Data.Buckets[ Index ].First = NULL;
+	}
+
+	return TRUE;
+}
+
+VOID JphtDeleteConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	)
+{
+	ASSERT( Hashtable );
+	ASSERT( Hashtable->Data.EntryCount == 0 );
+	ASSERT( Hashtable->Reclamation.Readers[ 0 ] == 0 );
+	ASSERT( Hashtable->Reclamation.Readers[ 1 ] == 0 );
+
+	//
+	// N.B. Buckets are part of the same allocation.
+	//
+	Hashtable->Routines.Free( Hashtable->Data.Stripes );
+
+#ifdef DBG
+	Hashtable->Data.BucketCount = 0xcccccccc;
+	Hashtable->Data.EntryCount = ( LONG ) 0xcccccccc;
+	Hashtable->Data.Buckets = NULL;
+	Hashtable->Data.Stripes = NULL;
+#endif
+}
+
+ULONG JphtEnterReadConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	)
+{
+	ASSERT( Hashtable );
+
+	return JphtEnterReadEpoch( &Hashtable->Reclamation );
+}
+
+VOID JphtLeaveReadConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG Epoch
+	)
+{
+	ASSERT( Hashtable );
+
+	JphtLeaveReadEpoch( &Hashtable->Reclamation, Epoch );
+}
+
+VOID JphtSynchronizeConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable
+	)
+{
+	ASSERT( Hashtable );
+
+	JphtSynchronizeEpoch( &Hashtable->Reclamation, Hashtable->Routines.Yield );
+}
+
+VOID JphtPutEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	)
+{
+	PJPHT_CONCURRENT_HASHTABLE_BUCKET Bucket;
+	PLIST_ENTRY volatile *Link;
+	volatile LONG *Lock;
+
+	ASSERT( Hashtable );
+	ASSERT( Entry );
+	ASSERT( OldEntry );
+
+	Bucket = JphtsGetBucket( Hashtable, Entry->Key, &Lock );
+
+	JphtsAcquireLock( Lock );
+
+	Link = JphtsFindLinkBucket( Hashtable, Bucket, Entry->Key );
+	if ( *Link != NULL )
+	{
+		//
+		// Replace. The old entry's link is left intact s.t. readers
+		// currently visiting it can continue.
+		//
+		*OldEntry = CONTAINING_RECORD( *Link, JPHT_HASHTABLE_ENTRY, ListEntry );
+		*JphtsNextLink( &Entry->ListEntry ) = ( *OldEntry )->ListEntry.Flink;
+		*Link = &Entry->ListEntry;
+	}
+	else
+	{
+		//
+		// Insert at head. The entry is fully initialized before
+		// it is published.
+		//
+		*OldEntry = NULL;
+		*JphtsNextLink( &Entry->ListEntry ) = Bucket->First;
+		Bucket->First = &Entry->ListEntry;
+
+		_InterlockedIncrement( &Hashtable->Data.EntryCount );
+	}
+
+	JphtsReleaseLock( Lock );
+}
+
+PJPHT_HASHTABLE_ENTRY JphtGetEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG_PTR Key
+	)
+{
+	PJPHT_CONCURRENT_HASHTABLE_BUCKET Bucket;
+	PLIST_ENTRY ListEntry;
+
+	ASSERT( Hashtable );
+	ASSERT( Hashtable->Reclamation.Readers[ 0 ] > 0 ||
+			Hashtable->Reclamation.Readers[ 1 ] > 0 );
+
+	Bucket = JphtsGetBucket( Hashtable, Key, NULL );
+
+	//
+	// Search for key in list without taking the lock.
+	//
+	ListEntry = Bucket->First;
+	while ( ListEntry != NULL )
+	{
+		PJPHT_HASHTABLE_ENTRY Entry = CONTAINING_RECORD(
+			ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry );
+		if ( Hashtable->Routines.Equals( Entry->Key, Key ) )
+		{
+			return Entry;
+		}
+
+		ListEntry = *JphtsNextLink( ListEntry );
+	}
+
+	return NULL;
+}
+
+VOID JphtRemoveEntryConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	)
+{
+	PJPHT_CONCURRENT_HASHTABLE_BUCKET Bucket;
+	PLIST_ENTRY volatile *Link;
+	PLIST_ENTRY ListEntry;
+	volatile LONG *Lock;
+
+	ASSERT( Hashtable );
+	ASSERT( OldEntry );
+
+	Bucket = JphtsGetBucket( Hashtable, Key, &Lock );
+
+	JphtsAcquireLock( Lock );
+
+	Link = JphtsFindLinkBucket( Hashtable, Bucket, Key );
+	ListEntry = *Link;
+	if ( ListEntry != NULL )
+	{
+		//
+		// Unlink. Again, the entry's link is left intact.
+		//
+		*Link = *JphtsNextLink( ListEntry );
+		_InterlockedDecrement( &Hashtable->Data.EntryCount );
+	}
+
+	JphtsReleaseLock( Lock );
+
+	if ( OldEntry )
+	{
+		*OldEntry = ListEntry != NULL
+			? CONTAINING_RECORD( ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry )
+			: NULL;
+	}
+}
+
+VOID JphtEnumerateEntriesConcurrentHashtable(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in JPHT_CONCURRENT_ENUM_CALLBACK Callback,
+	__in_opt PVOID Context
+	)
+{
+	ULONG BucketIndex;
+
+	ASSERT( Hashtable );
+	ASSERT( Callback );
+
+	for ( BucketIndex = 0; BucketIndex < Hashtable->Data.BucketCount; BucketIndex++ )
+	{
+		PLIST_ENTRY ListEntry = Hashtable->Data.Buckets[ BucketIndex ].First;
+
+		while ( ListEntry != NULL )
+		{
+			//
+			// Callback is free to remove (and possibly free) entry,
+			// so do not touch ListEntry after callback return.
+			//
+			PLIST_ENTRY NextEntry = *JphtsNextLink( ListEntry );
+
+			( Callback )(
+				Hashtable,
+				CONTAINING_RECORD( ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ),
+				Context );
+
+			ListEntry = NextEntry;
+		}
+	}
+}
@@ -0,0 +1,129 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Epoch-based reclamation.
+ *
+ *		N.B. The library is linked into kernel mode components, so
+ *		only compiler intrinsics are used for synchronization.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include "stdafx.h"
+#include "epoch.h"
+#include <windows.h>
+#include <intrin.h>
+
+#include <crtdbg.h>
+#define ASSERT _ASSERTE
+
+static VOID JphtsWaitEpoch(
+	__in_opt JPHT_YIELD_ROUTINE Yield
+	)
+{
+	if ( Yield != NULL )
+	{
+		( Yield )();
+	}
+	else
+	{
+		YieldProcessor();
+	}
+}
+
+VOID JphtInitializeEpoch(
+	__in PJPHT_EPOCH Epoch
+	)
+{
+	ASSERT( Epoch );
+
+	Epoch->Epoch		= 0;
+	Epoch->Readers[ 0 ]	= 0;
+	Epoch->Readers[ 1 ]	= 0;
+	Epoch->Lock			= 0;
+}
+
+ULONG JphtEnterReadEpoch(
+	__in PJPHT_EPOCH Epoch
+	)
+{
+	LONG Current;
+
+	ASSERT( Epoch );
+
+	for ( ;; )
+	{
+		Current = Epoch->Epoch;
+		_InterlockedIncrement( &Epoch->Readers[ Current & 1 ] );
+
+		//
+		// If the epoch has been advanced in the meantime, a
+		// synchronizer may already have found the counter to be zero
+		// and not wait for us. Retry in the new epoch.
+		//
+		if ( Epoch->Epoch == Current )
+		{
+			return ( ULONG ) Current;
+		}
+
+		_InterlockedDecrement( &Epoch->Readers[ Current & 1 ] );
+	}
+}
+
+VOID JphtLeaveReadEpoch(
+	__in PJPHT_EPOCH Epoch,
+	__in ULONG ReaderEpoch
+	)
+{
+	ASSERT( Epoch );
+	ASSERT( Epoch->Readers[ ReaderEpoch & 1 ] > 0 );
+
+	_InterlockedDecrement( &Epoch->Readers[ ReaderEpoch & 1 ] );
+}
+
+VOID JphtSynchronizeEpoch(
+	__in PJPHT_EPOCH Epoch,
+	__in_opt JPHT_YIELD_ROUTINE Yield
+	)
+{
+	LONG Current;
+
+	ASSERT( Epoch );
+
+	while ( _InterlockedCompareExchange( &Epoch->Lock, 1, 0 ) != 0 )
+	{
+		JphtsWaitEpoch( Yield );
+	}
+
+	//
+	// All readers still referencing unpublished data have entered
+	// the current epoch. Advance the epoch s.t. new readers are
+	// accounted separately and wait for the current epoch to drain.
+	//
+	// N.B. The previous synchronization has drained the other
+	// epoch.
+	//
+	Current = Epoch->Epoch;
+	_InterlockedExchange( &Epoch->Epoch, Current + 1 );
+
+	while ( Epoch->Readers[ Current & 1 ] != 0 )
+	{
+		JphtsWaitEpoch( Yield );
+	}
+
+	_InterlockedExchange( &Epoch->Lock, 0 );
+}
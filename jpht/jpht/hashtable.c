@@ -23,12 +23,243 @@
 
 #include "stdafx.h"
 #include "hashtable.h"
+#include "typedhashtable.h"
 #include <windows.h>
 
 #include "list.h"
 #include <crtdbg.h>
 #define ASSERT _ASSERTE
 
+//
+// Number of buckets migrated per put/remove operation while an
+// incremental resize is in progress.
+//
+#define JPHT_MIGRATION_STEP 4
+
+//
+// Number of keys processed at once by JphtGetEntriesHashtableBatch.
+// Bounded by the number of outstanding cache misses a CPU can track.
+//
+#define JPHT_BATCH_SIZE 16
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static PJPHT_HASHTABLE_BUCKET JphtsAllocateBuckets(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG BucketCount
+	)
+{
+	ULONG Index;
+	PJPHT_HASHTABLE_BUCKET Buckets;
+	__int64 SizeRequired;
+
+	SizeRequired = ( __int64 ) BucketCount * sizeof( JPHT_HASHTABLE_BUCKET );
+	if ( SizeRequired > ( SIZE_T ) -1 )
+	{
+		//
+		// Overflow.
+		//
+		return NULL;
+	}
+
+	Buckets = ( PJPHT_HASHTABLE_BUCKET )
+		Hashtable->Routines.Allocate( ( SIZE_T ) SizeRequired );
+	if ( Buckets == NULL )
+	{
+		return NULL;
+	}
+
+	//
+	// Initialize all list heads.
+	//
+	for ( Index = 0; Index < BucketCount; Index++ )
+	{
+		InitializeListHead( &Buckets[ Index ].EntryListHead );
+	}
+
+	return Buckets;
+}
+
+static PJPHT_HASHTABLE_ENTRY JphtsFindEntryBucket(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_BUCKET Bucket,
+	__in ULONG_PTR Key
+	)
+{
+	PLIST_ENTRY ListEntry;
+	PJPHT_HASHTABLE_ENTRY Entry;
+
+	ListEntry = Bucket->EntryListHead.Flink;
+
+	while ( ListEntry != &Bucket->EntryListHead )
+	{
+		Entry = CONTAINING_RECORD(
+			ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry );
+		if ( Hashtable->Routines.Equals( Entry->Key, Key ) )
+		{
+			return Entry;
+		}
+		ListEntry = ListEntry->Flink;
+	}
+
+	return NULL;
+}
+
+static VOID JphtsPrefetchFirstEntryBucket(
+	__in PJPHT_HASHTABLE_BUCKET Bucket
+	)
+{
+	PLIST_ENTRY ListEntry = Bucket->EntryListHead.Flink;
+	if ( ListEntry != &Bucket->EntryListHead )
+	{
+		PreFetchCacheLine( 
+			PF_TEMPORAL_LEVEL_1, 
+			CONTAINING_RECORD( ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ) );
+	}
+}
+
+/*++
+	Routine Description:
+		Move entries of up to Steps buckets from the old to the
+		new bucket array. Keys are unique, so entries can be inserted
+		into their new bucket without checking for duplicates.
+
+		Frees the old bucket array once all buckets have been
+		migrated.
+--*/
+static VOID JphtsMigrateBuckets(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG Steps
+	)
+{
+	while ( Hashtable->Migration.Buckets != NULL && Steps-- > 0 )
+	{
+		PJPHT_HASHTABLE_BUCKET OldBucket = &Hashtable->Migration.Buckets[
+			Hashtable->Migration.NextBucket++ ];
+
+		while ( ! IsListEmpty( &OldBucket->EntryListHead ) )
+		{
+			PLIST_ENTRY ListEntry;
+			PJPHT_HASHTABLE_ENTRY Entry;
+			ULONG BucketIndex;
+
+			ListEntry = RemoveHeadList( &OldBucket->EntryListHead );
+			Entry = CONTAINING_RECORD(
+				ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry );
+
+			BucketIndex = Hashtable->Routines.Hash( Entry->Key )
+				% Hashtable->Data.BucketCount;
+			InsertHeadList(
+				&Hashtable->Data.Buckets[ BucketIndex ].EntryListHead,
+				ListEntry );
+		}
+
+		if ( Hashtable->Migration.NextBucket == Hashtable->Migration.BucketCount )
+		{
+			//
+			// Migration complete.
+			//
+			Hashtable->Routines.Free( Hashtable->Migration.Buckets );
+
+			Hashtable->Migration.Buckets		= NULL;
+			Hashtable->Migration.BucketCount	= 0;
+			Hashtable->Migration.NextBucket		= 0;
+		}
+	}
+}
+
+/*++
+	Routine Description:
+		Allocate a new bucket array and make the current one
+		the one to migrate entries from. No entries are moved.
+--*/
+static BOOLEAN JphtsStartResize(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG NewBucketCount
+	)
+{
+	PJPHT_HASHTABLE_BUCKET NewBuckets;
+
+	ASSERT( Hashtable->Migration.Buckets == NULL );
+	ASSERT( NewBucketCount > 0 );
+
+	NewBuckets = JphtsAllocateBuckets( Hashtable, NewBucketCount );
+	if ( NewBuckets == NULL )
+	{
+		return FALSE;
+	}
+
+	Hashtable->Migration.Buckets		= Hashtable->Data.Buckets;
+	Hashtable->Migration.BucketCount	= Hashtable->Data.BucketCount;
+	Hashtable->Migration.NextBucket		= 0;
+
+	Hashtable->Data.Buckets				= NewBuckets;
+	Hashtable->Data.BucketCount			= NewBucketCount;
+
+	return TRUE;
+}
+
+/*++
+	Routine Description:
+		Called before each modification. Continues a resize in
+		progress or starts a new one if the load factor is out
+		of bounds.
+
+		Also used by the specialized routines (typedhashtable.h).
+--*/
+VOID JphtpMaintainHashtable(
+	__in PJPHT_HASHTABLE Hashtable
+	)
+{
+	ULONGLONG Load;
+	ULONG BucketCount = Hashtable->Data.BucketCount;
+
+	if ( Hashtable->Data.ActiveEnumerations > 0 )
+	{
+		//
+		// Moving entries would break the enumeration.
+		//
+		return;
+	}
+
+	if ( Hashtable->Migration.Buckets != NULL )
+	{
+		JphtsMigrateBuckets( Hashtable, JPHT_MIGRATION_STEP );
+		return;
+	}
+
+	Load = ( ULONGLONG ) Hashtable->Data.EntryCount * 100;
+
+	if ( Hashtable->Policy.GrowLoadFactor > 0 &&
+		 Load > ( ULONGLONG ) BucketCount * Hashtable->Policy.GrowLoadFactor &&
+		 BucketCount < MAXULONG / 2 )
+	{
+		//
+		// Keep the bucket count odd - many keys are pointers with
+		// the lower bits cleared.
+		//
+		if ( JphtsStartResize( Hashtable, BucketCount * 2 + 1 ) )
+		{
+			JphtsMigrateBuckets( Hashtable, JPHT_MIGRATION_STEP );
+		}
+	}
+	else if ( Hashtable->Policy.ShrinkLoadFactor > 0 &&
+			  Load < ( ULONGLONG ) BucketCount * Hashtable->Policy.ShrinkLoadFactor &&
+			  BucketCount > Hashtable->Policy.MinimumBucketCount )
+	{
+		if ( JphtsStartResize(
+			Hashtable,
+			max( BucketCount / 2, Hashtable->Policy.MinimumBucketCount ) ) )
+		{
+			JphtsMigrateBuckets( Hashtable, JPHT_MIGRATION_STEP );
+		}
+	}
+}
+
 /*----------------------------------------------------------------------
  *
  * Implementation.
@@ -44,9 +275,6 @@ BOOLEAN JphtInitializeHashtable(
 	__in ULONG InitialBucketCount
 	)
 {
-	ULONG Index;
-	__int64 SizeRequired;
-
 	ASSERT( Hashtable );
 	ASSERT( Allocate );
 	ASSERT( Free );
@@ -59,40 +287,43 @@ BOOLEAN JphtInitializeHashtable(
 	Hashtable->Routines.Equals		= Equals;
 	Hashtable->Routines.Hash		= Hash;
 
-	Hashtable->Data.BucketCount		= InitialBucketCount;
-	Hashtable->Data.EntryCount		= 0;
+	Hashtable->Data.BucketCount			= InitialBucketCount;
+	Hashtable->Data.EntryCount			= 0;
+	Hashtable->Data.ActiveEnumerations	= 0;
+
+	Hashtable->Migration.BucketCount	= 0;
+	Hashtable->Migration.NextBucket		= 0;
+	Hashtable->Migration.Buckets		= NULL;
+
+	Hashtable->Policy.GrowLoadFactor		= 0;
+	Hashtable->Policy.ShrinkLoadFactor		= 0;
+	Hashtable->Policy.MinimumBucketCount	= InitialBucketCount;
 
 	//
 	// Allocate space for buckets.
 	//
-	SizeRequired = InitialBucketCount * sizeof( JPHT_HASHTABLE_BUCKET );
-	if ( SizeRequired > ( SIZE_T ) -1 )
-	{
-		//
-		// Overflow.
-		//
-		return FALSE;
-	}
-	Hashtable->Data.Buckets = 
-		Hashtable->Routines.Allocate( ( SIZE_T ) SizeRequired );
-	if ( Hashtable->Data.Buckets == NULL )
-	{
-		return FALSE;
-	}
+	Hashtable->Data.Buckets = JphtsAllocateBuckets(
+		Hashtable,
+		InitialBucketCount );
 
-	//
-	// Initialize all list heads.
-	//
-	for ( Index = 0; Index < Hashtable->Data.BucketCount; Index++ )
-	{
-		InitializeListHead( &Hashtable->Data.Buckets[ Index ].EntryListHead );
-	}
+	return ( BOOLEAN ) ( Hashtable->Data.Buckets != NULL );
+}
 
-	return TRUE;
+VOID JphtSetLoadFactorsHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG GrowLoadFactor,
+	__in ULONG ShrinkLoadFactor
+	)
+{
+	ASSERT( Hashtable );
+	ASSERT( GrowLoadFactor == 0 || ShrinkLoadFactor * 2 < GrowLoadFactor );
+
+	Hashtable->Policy.GrowLoadFactor	= GrowLoadFactor;
+	Hashtable->Policy.ShrinkLoadFactor	= ShrinkLoadFactor;
 }
 
 VOID JphtDeleteHashtable(
-	__in PJPHT_HASHTABLE Hashtable 
+	__in PJPHT_HASHTABLE Hashtable
 	)
 {
 	ASSERT( Hashtable );
@@ -100,10 +331,16 @@ VOID JphtDeleteHashtable(
 
 	Hashtable->Routines.Free( Hashtable->Data.Buckets );
 
+	if ( Hashtable->Migration.Buckets != NULL )
+	{
+		Hashtable->Routines.Free( Hashtable->Migration.Buckets );
+	}
+
 #ifdef DBG
 	Hashtable->Data.BucketCount = 0xcccccccc;
 	Hashtable->Data.EntryCount = 0xcccccccc;
 	Hashtable->Data.Buckets = NULL;
+	Hashtable->Migration.Buckets = NULL;
 #endif
 }
 
@@ -114,48 +351,43 @@ VOID JphtPutEntryHashtable(
 	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
 	)
 {
-	ULONG BucketIndex;
+	ULONG Hash;
 	PJPHT_HASHTABLE_BUCKET Bucket;
-	PLIST_ENTRY ListEntry;
 	PJPHT_HASHTABLE_ENTRY ExistingEntry;
 
 	ASSERT( Hashtable );
 	ASSERT( Entry );
 	ASSERT( OldEntry );
 
-	//
-	// Get bucket.
-	//
-	BucketIndex = Hashtable->Routines.Hash( Entry->Key ) 
-		% Hashtable->Data.BucketCount;
-	Bucket = &Hashtable->Data.Buckets[ BucketIndex ];
+	JphtpMaintainHashtable( Hashtable );
+
+	Hash = Hashtable->Routines.Hash( Entry->Key );
 
 	//
-	// Check if key is contained in list. If yes, remove the previous 
-	// entry.
+	// Check if key is contained in either the old (if not migrated
+	// yet) or the new bucket. If yes, remove the previous entry.
 	//
-	*OldEntry = NULL;
+	Bucket = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash );
+	ExistingEntry = Bucket != NULL
+		? JphtsFindEntryBucket( Hashtable, Bucket, Entry->Key )
+		: NULL;
 
-	ListEntry = Bucket->EntryListHead.Flink;
-	
-	while ( ListEntry != &Bucket->EntryListHead )
+	Bucket = &Hashtable->Data.Buckets[ Hash % Hashtable->Data.BucketCount ];
+	if ( ExistingEntry == NULL )
 	{
-		ExistingEntry = CONTAINING_RECORD( 
-			ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ); 
-		if ( Hashtable->Routines.Equals( Entry->Key, ExistingEntry->Key ) )
-		{
-			//
-			// Entry found, remove and free.
-			//
-			RemoveEntryList( &ExistingEntry->ListEntry );
-			*OldEntry = ExistingEntry;
-			Hashtable->Data.EntryCount--;
-		}
-		ListEntry = ListEntry->Flink;
+		ExistingEntry = JphtsFindEntryBucket( Hashtable, Bucket, Entry->Key );
 	}
 
+	if ( ExistingEntry != NULL )
+	{
+		RemoveEntryList( &ExistingEntry->ListEntry );
+		Hashtable->Data.EntryCount--;
+	}
+
+	*OldEntry = ExistingEntry;
+
 	//
-	// Now insert new entry.
+	// Now insert new entry. New entries always go to the new bucket.
 	//
 	InsertHeadList( &Bucket->EntryListHead, &Entry->ListEntry );
 	Hashtable->Data.EntryCount++;
@@ -163,42 +395,121 @@ VOID JphtPutEntryHashtable(
 
 PJPHT_HASHTABLE_ENTRY JphtGetEntryHashtable(
 	__in PJPHT_HASHTABLE Hashtable,
-	__in ULONG_PTR Key 
+	__in ULONG_PTR Key
 	)
 {
+	ULONG Hash;
 	PJPHT_HASHTABLE_BUCKET Bucket;
-	PLIST_ENTRY ListEntry;
-	PJPHT_HASHTABLE_ENTRY Entry = NULL;
-
+	PJPHT_HASHTABLE_ENTRY Entry;
 
 	ASSERT( Hashtable );
 
-	//
-	// Get bucket.
-	//
-	Bucket = &Hashtable->Data.Buckets[
-		Hashtable->Routines.Hash( Key ) % Hashtable->Data.BucketCount ];
+	Hash = Hashtable->Routines.Hash( Key );
 
 	//
-	// Search for key in list.
+	// N.B. Lookups must not migrate buckets as concurrent reads
+	// are allowed.
 	//
-	ListEntry = Bucket->EntryListHead.Flink;
-	
-	while ( ListEntry != &Bucket->EntryListHead )
+	Bucket = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash );
+	if ( Bucket != NULL )
 	{
-		Entry = CONTAINING_RECORD( 
-			ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ); 
-		if ( Hashtable->Routines.Equals( Entry->Key, Key ) )
+		Entry = JphtsFindEntryBucket( Hashtable, Bucket, Key );
+		if ( Entry != NULL )
 		{
-			//
-			// Entry found.
-			//
 			return Entry;
 		}
-		ListEntry = ListEntry->Flink;
 	}
 
-	return NULL;
+	return JphtsFindEntryBucket(
+		Hashtable,
+		&Hashtable->Data.Buckets[ Hash % Hashtable->Data.BucketCount ],
+		Key );
+}
+
+VOID JphtGetEntriesHashtableBatch(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in_ecount( Count ) CONST ULONG_PTR *Keys,
+	__in ULONG Count,
+	__out_ecount( Count ) PJPHT_HASHTABLE_ENTRY *Entries
+	)
+{
+	PJPHT_HASHTABLE_BUCKET Buckets[ JPHT_BATCH_SIZE ];
+	PJPHT_HASHTABLE_BUCKET UnmigratedBuckets[ JPHT_BATCH_SIZE ];
+	ULONG First;
+
+	ASSERT( Hashtable );
+	ASSERT( Keys || Count == 0 );
+	ASSERT( Entries || Count == 0 );
+
+	for ( First = 0; First < Count; First += JPHT_BATCH_SIZE )
+	{
+		ULONG GroupSize = min( ( ULONG ) JPHT_BATCH_SIZE, Count - First );
+		ULONG Index;
+
+		//
+		// Hash all keys and prefetch their buckets.
+		//
+		for ( Index = 0; Index < GroupSize; Index++ )
+		{
+			ULONG Hash = Hashtable->Routines.Hash( Keys[ First + Index ] );
+
+			Buckets[ Index ] = &Hashtable->Data.Buckets[ 
+				Hash % Hashtable->Data.BucketCount ];
+			PreFetchCacheLine( PF_TEMPORAL_LEVEL_1, Buckets[ Index ] );
+
+			UnmigratedBuckets[ Index ] = JphtpGetUnmigratedBucketHashtable( 
+				Hashtable, 
+				Hash );
+			if ( UnmigratedBuckets[ Index ] != NULL )
+			{
+				PreFetchCacheLine( 
+					PF_TEMPORAL_LEVEL_1, 
+					UnmigratedBuckets[ Index ] );
+			}
+		}
+
+		//
+		// Prefetch first entry of each bucket to be searched, in 
+		// search order. Most chains are short, so this usually 
+		// covers the entry looked for.
+		//
+		for ( Index = 0; Index < GroupSize; Index++ )
+		{
+			if ( UnmigratedBuckets[ Index ] != NULL )
+			{
+				JphtsPrefetchFirstEntryBucket( UnmigratedBuckets[ Index ] );
+			}
+
+			JphtsPrefetchFirstEntryBucket( Buckets[ Index ] );
+		}
+
+		//
+		// Resolve.
+		//
+		for ( Index = 0; Index < GroupSize; Index++ )
+		{
+			PJPHT_HASHTABLE_ENTRY Entry = NULL;
+			ULONG_PTR Key = Keys[ First + Index ];
+
+			if ( UnmigratedBuckets[ Index ] != NULL )
+			{
+				Entry = JphtsFindEntryBucket( 
+					Hashtable, 
+					UnmigratedBuckets[ Index ], 
+					Key );
+			}
+
+			if ( Entry == NULL )
+			{
+				Entry = JphtsFindEntryBucket( 
+					Hashtable, 
+					Buckets[ Index ], 
+					Key );
+			}
+
+			Entries[ First + Index ] = Entry;
+		}
+	}
 }
 
 VOID JphtRemoveEntryHashtable(
@@ -207,68 +518,60 @@ VOID JphtRemoveEntryHashtable(
 	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
 	)
 {
+	ULONG Hash;
 	PJPHT_HASHTABLE_BUCKET Bucket;
-	PLIST_ENTRY ListEntry;
 	PJPHT_HASHTABLE_ENTRY Entry = NULL;
 
 	ASSERT( Hashtable );
 	ASSERT( OldEntry );
 
-	//
-	// Get bucket.
-	//
-	Bucket = &Hashtable->Data.Buckets[
-		Hashtable->Routines.Hash( Key ) % Hashtable->Data.BucketCount ];
+	JphtpMaintainHashtable( Hashtable );
+
+	Hash = Hashtable->Routines.Hash( Key );
 
 	//
-	// Search for key in list.
+	// Search for key in old and new bucket.
 	//
-	if ( OldEntry )
+	Bucket = JphtpGetUnmigratedBucketHashtable( Hashtable, Hash );
+	if ( Bucket != NULL )
 	{
-		*OldEntry = NULL;
+		Entry = JphtsFindEntryBucket( Hashtable, Bucket, Key );
 	}
 
-	ListEntry = Bucket->EntryListHead.Flink;
-	
-	while ( ListEntry != &Bucket->EntryListHead )
+	if ( Entry == NULL )
 	{
-		Entry = CONTAINING_RECORD( 
-			ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ); 
-		if ( Hashtable->Routines.Equals( Entry->Key, Key ) )
-		{
-			//
-			// Entry found.
-			//
-			if ( OldEntry )
-			{
-				*OldEntry = Entry;
-			}
+		Entry = JphtsFindEntryBucket(
+			Hashtable,
+			&Hashtable->Data.Buckets[ Hash % Hashtable->Data.BucketCount ],
+			Key );
+	}
 
-			RemoveEntryList( ListEntry );
-			Hashtable->Data.EntryCount--;
-			break;
-		}
-		ListEntry = ListEntry->Flink;
+	if ( Entry != NULL )
+	{
+		RemoveEntryList( &Entry->ListEntry );
+		Hashtable->Data.EntryCount--;
+	}
+
+	if ( OldEntry )
+	{
+		*OldEntry = Entry;
 	}
 }
 
-VOID JphtEnumerateEntries(
+static VOID JphtsEnumerateBuckets(
 	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_BUCKET Buckets,
+	__in ULONG FirstBucket,
+	__in ULONG BucketCount,
 	__in JPHT_ENUM_CALLBACK Callback,
 	__in_opt PVOID Context
 	)
 {
 	ULONG BucketIndex;
 
-	ASSERT( Hashtable );
-	ASSERT( Callback );
-
-	//
-	// Iterate over all buckets.
-	//
-	for ( BucketIndex = 0; BucketIndex < Hashtable->Data.BucketCount; BucketIndex++ )
+	for ( BucketIndex = FirstBucket; BucketIndex < BucketCount; BucketIndex++ )
 	{
-		PJPHT_HASHTABLE_BUCKET Bucket = &Hashtable->Data.Buckets[ BucketIndex ];
+		PJPHT_HASHTABLE_BUCKET Bucket = &Buckets[ BucketIndex ];
 		PLIST_ENTRY ListEntry;
 		PJPHT_HASHTABLE_ENTRY Entry = NULL;
 
@@ -280,11 +583,11 @@ VOID JphtEnumerateEntries(
 		while ( ListEntry != &Bucket->EntryListHead )
 		{
 			PLIST_ENTRY NextEntry;
-			Entry = CONTAINING_RECORD( 
-				ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ); 
+			Entry = CONTAINING_RECORD(
+				ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry );
 
 			//
-			// Callback is free to delete entry, so do not touch 
+			// Callback is free to delete entry, so do not touch
 			// ListEntry after callback return.
 			//
 			NextEntry = ListEntry->Flink;
@@ -296,103 +599,67 @@ VOID JphtEnumerateEntries(
 	}
 }
 
-BOOLEAN JphtResize(
+VOID JphtEnumerateEntries(
 	__in PJPHT_HASHTABLE Hashtable,
-	__in ULONG NewBucketCount
+	__in JPHT_ENUM_CALLBACK Callback,
+	__in_opt PVOID Context
 	)
 {
-	ULONG OldBucketCount;
-	PJPHT_HASHTABLE_BUCKET OldBuckets;
-	SIZE_T SizeRequired;
-	PVOID AllocatedMemory;
-	ULONG BucketIndex;
-
 	ASSERT( Hashtable );
-	ASSERT( NewBucketCount );
+	ASSERT( Callback );
 
 	//
-	// Save pointer to old buckets list
+	// Suspend migration s.t. removals from within the callback
+	// do not move entries between bucket arrays.
 	//
-	OldBuckets = Hashtable->Data.Buckets;
-	OldBucketCount = Hashtable->Data.BucketCount;
+	Hashtable->Data.ActiveEnumerations++;
 
-	//
-	// Allocate space for buckets.
-	//
-	SizeRequired = NewBucketCount * sizeof( JPHT_HASHTABLE_BUCKET );
-	if ( SizeRequired > ( SIZE_T ) -1 )
+	if ( Hashtable->Migration.Buckets != NULL )
 	{
-		//
-		// Overflow.
-		//
-		return FALSE;
+		JphtsEnumerateBuckets(
+			Hashtable,
+			Hashtable->Migration.Buckets,
+			Hashtable->Migration.NextBucket,
+			Hashtable->Migration.BucketCount,
+			Callback,
+			Context );
 	}
 
-	AllocatedMemory =  Hashtable->Routines.Allocate( SizeRequired );
-	if ( AllocatedMemory == NULL )
-	{
-		return FALSE;
-	}
+	JphtsEnumerateBuckets(
+		Hashtable,
+		Hashtable->Data.Buckets,
+		0,
+		Hashtable->Data.BucketCount,
+		Callback,
+		Context );
 
-	//
-	// Now swap pointers.
-	//
-	Hashtable->Data.BucketCount = NewBucketCount;
-	Hashtable->Data.Buckets = ( PJPHT_HASHTABLE_BUCKET ) AllocatedMemory;
-	Hashtable->Data.EntryCount = 0;
+	Hashtable->Data.ActiveEnumerations--;
+}
 
+BOOLEAN JphtResize(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in ULONG NewBucketCount
+	)
+{
+	ASSERT( Hashtable );
+	ASSERT( NewBucketCount );
+	ASSERT( Hashtable->Data.ActiveEnumerations == 0 );
 
 	//
-	// Initialize all list heads of new list.
+	// Complete pending resize.
 	//
-	for ( BucketIndex = 0; BucketIndex < Hashtable->Data.BucketCount; BucketIndex++ )
-	{
-		InitializeListHead( &Hashtable->Data.Buckets[ BucketIndex ].EntryListHead );
-	}
+	JphtsMigrateBuckets( Hashtable, MAXULONG );
 
-	//
-	// Copy all entries.
-	//
-	// Iterate over all buckets - note that we use the old list.
-	//
-	for ( BucketIndex = 0; BucketIndex < OldBucketCount; BucketIndex++ )
+	if ( ! JphtsStartResize( Hashtable, NewBucketCount ) )
 	{
-		PJPHT_HASHTABLE_BUCKET Bucket = &OldBuckets[ BucketIndex ];
-		PLIST_ENTRY ListEntry;
-		PJPHT_HASHTABLE_ENTRY Entry = NULL;
-		PJPHT_HASHTABLE_ENTRY OldEntry = NULL;
-
-		//
-		// Iterate over all entries in bucket.
-		//
-		ListEntry = Bucket->EntryListHead.Flink;
-
-		while ( ListEntry != &Bucket->EntryListHead )
-		{
-			PLIST_ENTRY NextEntry = NULL;
-			Entry = CONTAINING_RECORD( 
-				ListEntry, JPHT_HASHTABLE_ENTRY, ListEntry ); 
-
-			//
-			// Insert to new list - note that this modifies
-			// Entry->ListEntry.
-			//
-			NextEntry = ListEntry->Flink;
-			JphtPutEntryHashtable(
-				Hashtable,
-				Entry,
-				&OldEntry );
-
-			ASSERT( OldEntry == NULL );
-
-			ListEntry = NextEntry;
-		}
+		return FALSE;
 	}
 
 	//
-	// Free old bucket list.
+	// Migrate all entries at once.
 	//
-	Hashtable->Routines.Free( OldBuckets );
+	JphtsMigrateBuckets( Hashtable, MAXULONG );
+	ASSERT( Hashtable->Migration.Buckets == NULL );
 
 	return TRUE;
 }
@@ -0,0 +1,502 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Open addressing hashtable implementation using Robin Hood
+ *		hashing with linear probing and backward shift deletion.
+ *
+ *		Robin Hood invariant: While probing for a key, once a slot
+ *		is encountered whose occupant is closer to its home slot
+ *		than the key would be, the key cannot be contained in the
+ *		hashtable. This bounds unsuccessful lookups.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include "stdafx.h"
+#include "oahashtable.h"
+#include <windows.h>
+
+#include <crtdbg.h>
+#define ASSERT _ASSERTE
+
+//
+// Grow if EntryCount / SlotCount would exceed 7/8.
+//
+#define JPHTP_OA_MAX_LOAD_NUMERATOR		7
+#define JPHTP_OA_MAX_LOAD_DENOMINATOR	8
+
+#define JPHTP_OA_MIN_SLOT_COUNT			8
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+static ULONG JphtsRoundUpToPowerOfTwo(
+	__in ULONG Value
+	)
+{
+	ULONG Result = JPHTP_OA_MIN_SLOT_COUNT;
+
+	while ( Result < Value && Result < 0x80000000 )
+	{
+		Result <<= 1;
+	}
+
+	return Result;
+}
+
+/*++
+	Routine Description:
+		Calculate the distance of the occupant of a slot from
+		its home slot.
+--*/
+static __inline ULONG JphtsProbeDistance(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG SlotIndex
+	)
+{
+	ULONG Mask = Hashtable->Data.SlotCount - 1;
+	return ( SlotIndex - ( Hashtable->Data.Slots[ SlotIndex ].Hash & Mask ) ) & Mask;
+}
+
+static BOOLEAN JphtsIsLoadExceeded(
+	__in ULONG EntryCount,
+	__in ULONG SlotCount
+	)
+{
+	return ( BOOLEAN ) ( ( ULONGLONG ) EntryCount * JPHTP_OA_MAX_LOAD_DENOMINATOR >
+		( ULONGLONG ) SlotCount * JPHTP_OA_MAX_LOAD_NUMERATOR );
+}
+
+static PJPHT_OA_HASHTABLE_SLOT JphtsAllocateSlots(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG SlotCount
+	)
+{
+	ULONG Index;
+	PJPHT_OA_HASHTABLE_SLOT Slots;
+	__int64 SizeRequired;
+
+	SizeRequired = ( __int64 ) SlotCount * sizeof( JPHT_OA_HASHTABLE_SLOT );
+	if ( SizeRequired > ( SIZE_T ) -1 )
+	{
+		//
+		// Overflow.
+		//
+		return NULL;
+	}
+
+	Slots = ( PJPHT_OA_HASHTABLE_SLOT )
+		Hashtable->Routines.Allocate( ( SIZE_T ) SizeRequired );
+	if ( Slots == NULL )
+	{
+		return NULL;
+	}
+
+	for ( Index = 0; Index < SlotCount; Index++ )
+	{
+		Slots[ Index ].Entry = NULL;
+	}
+
+	return Slots;
+}
+
+/*++
+	Routine Description:
+		Find the slot holding Key.
+
+	Return Value:
+		Slot index or ( ULONG ) -1 if not found.
+--*/
+static ULONG JphtsFindSlot(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__in ULONG Hash
+	)
+{
+	ULONG Distance = 0;
+	ULONG Mask = Hashtable->Data.SlotCount - 1;
+	ULONG Index = Hash & Mask;
+
+	for ( ;; )
+	{
+		PJPHT_OA_HASHTABLE_SLOT Slot = &Hashtable->Data.Slots[ Index ];
+
+		if ( Slot->Entry == NULL ||
+			 JphtsProbeDistance( Hashtable, Index ) < Distance )
+		{
+			return ( ULONG ) -1;
+		}
+
+		if ( Slot->Hash == Hash &&
+			 Hashtable->Routines.Equals( Slot->Key, Key ) )
+		{
+			return Index;
+		}
+
+		Index = ( Index + 1 ) & Mask;
+		Distance++;
+	}
+}
+
+/*++
+	Routine Description:
+		Insert an entry known not to be contained in the hashtable.
+		There must be at least one free slot.
+--*/
+static VOID JphtsInsertSlot(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in ULONG Hash
+	)
+{
+	JPHT_OA_HASHTABLE_SLOT Carry;
+	ULONG Distance = 0;
+	ULONG Mask = Hashtable->Data.SlotCount - 1;
+	ULONG Index = Hash & Mask;
+
+	ASSERT( Hashtable->Data.EntryCount < Hashtable->Data.SlotCount );
+
+	Carry.Key		= Key;
+	Carry.Entry		= Entry;
+	Carry.Hash		= Hash;
+	Carry.Reserved	= 0;
+
+	for ( ;; )
+	{
+		PJPHT_OA_HASHTABLE_SLOT Slot = &Hashtable->Data.Slots[ Index ];
+		ULONG SlotDistance;
+
+		if ( Slot->Entry == NULL )
+		{
+			*Slot = Carry;
+			Hashtable->Data.EntryCount++;
+			return;
+		}
+
+		SlotDistance = JphtsProbeDistance( Hashtable, Index );
+		if ( SlotDistance < Distance )
+		{
+			//
+			// Take from the rich: the occupant is closer to its
+			// home slot, so displace it and continue inserting it.
+			//
+			JPHT_OA_HASHTABLE_SLOT Temp = *Slot;
+			*Slot = Carry;
+			Carry = Temp;
+			Distance = SlotDistance;
+		}
+
+		Index = ( Index + 1 ) & Mask;
+		Distance++;
+	}
+}
+
+/*++
+	Routine Description:
+		Free a slot and shift subsequent displaced occupants
+		backwards by one.
+--*/
+static VOID JphtsDeleteSlot(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG Index
+	)
+{
+	ULONG Mask = Hashtable->Data.SlotCount - 1;
+	ULONG Next = ( Index + 1 ) & Mask;
+
+	while ( Hashtable->Data.Slots[ Next ].Entry != NULL &&
+			JphtsProbeDistance( Hashtable, Next ) != 0 )
+	{
+		Hashtable->Data.Slots[ Index ] = Hashtable->Data.Slots[ Next ];
+		Index = Next;
+		Next = ( Next + 1 ) & Mask;
+	}
+
+	Hashtable->Data.Slots[ Index ].Entry = NULL;
+	Hashtable->Data.EntryCount--;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Implementation.
+ *
+ */
+
+BOOLEAN JphtInitializeOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in JPHT_HASH_ROUTINE Hash,
+	__in JPHT_EQUALS_ROUTINE Equals,
+	__in ULONG InitialSlotCount
+	)
+{
+	ASSERT( Hashtable );
+	ASSERT( Allocate );
+	ASSERT( Free );
+	ASSERT( Hash );
+	ASSERT( Equals );
+	ASSERT( InitialSlotCount > 0 );
+
+	Hashtable->Routines.Allocate	= Allocate;
+	Hashtable->Routines.Free		= Free;
+	Hashtable->Routines.Equals		= Equals;
+	Hashtable->Routines.Hash		= Hash;
+
+	Hashtable->Data.SlotCount		= JphtsRoundUpToPowerOfTwo( InitialSlotCount );
+	Hashtable->Data.EntryCount		= 0;
+
+	Hashtable->Data.Slots = JphtsAllocateSlots(
+		Hashtable,
+		Hashtable->Data.SlotCount );
+
+	return ( BOOLEAN ) ( Hashtable->Data.Slots != NULL );
+}
+
+VOID JphtDeleteOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable
+	)
+{
+	ASSERT( Hashtable );
+	ASSERT( Hashtable->Data.EntryCount == 0 );
+
+	Hashtable->Routines.Free( Hashtable->Data.Slots );
+
+#ifdef DBG
+	Hashtable->Data.SlotCount = 0xcccccccc;
+	Hashtable->Data.EntryCount = 0xcccccccc;
+	Hashtable->Data.Slots = NULL;
+#endif
+}
+
+BOOLEAN JphtPutEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	)
+{
+	ULONG Hash;
+	ULONG Index;
+
+	ASSERT( Hashtable );
+	ASSERT( Entry );
+
+	if ( OldEntry )
+	{
+		*OldEntry = NULL;
+	}
+
+	Hash = Hashtable->Routines.Hash( Entry->Key );
+
+	//
+	// Replace existing entry, if any.
+	//
+	Index = JphtsFindSlot( Hashtable, Entry->Key, Hash );
+	if ( Index != ( ULONG ) -1 )
+	{
+		if ( OldEntry )
+		{
+			*OldEntry = Hashtable->Data.Slots[ Index ].Entry;
+		}
+
+		Hashtable->Data.Slots[ Index ].Key		= Entry->Key;
+		Hashtable->Data.Slots[ Index ].Entry	= Entry;
+		return TRUE;
+	}
+
+	//
+	// Grow if necessary. If growing fails, continue as long as
+	// there is at least one slot left free.
+	//
+	if ( JphtsIsLoadExceeded(
+			Hashtable->Data.EntryCount + 1,
+			Hashtable->Data.SlotCount ) &&
+		 ! JphtResizeOaHashtable( Hashtable, Hashtable->Data.SlotCount * 2 ) &&
+		 Hashtable->Data.EntryCount + 1 >= Hashtable->Data.SlotCount )
+	{
+		return FALSE;
+	}
+
+	JphtsInsertSlot( Hashtable, Entry->Key, Entry, Hash );
+	return TRUE;
+}
+
+PJPHT_HASHTABLE_ENTRY JphtGetEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key
+	)
+{
+	ULONG Index;
+
+	ASSERT( Hashtable );
+
+	Index = JphtsFindSlot(
+		Hashtable,
+		Key,
+		Hashtable->Routines.Hash( Key ) );
+
+	return Index == ( ULONG ) -1
+		? NULL
+		: Hashtable->Data.Slots[ Index ].Entry;
+}
+
+VOID JphtRemoveEntryOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG_PTR Key,
+	__out_opt PJPHT_HASHTABLE_ENTRY *OldEntry
+	)
+{
+	ULONG Index;
+
+	ASSERT( Hashtable );
+
+	if ( OldEntry )
+	{
+		*OldEntry = NULL;
+	}
+
+	Index = JphtsFindSlot(
+		Hashtable,
+		Key,
+		Hashtable->Routines.Hash( Key ) );
+	if ( Index == ( ULONG ) -1 )
+	{
+		return;
+	}
+
+	if ( OldEntry )
+	{
+		*OldEntry = Hashtable->Data.Slots[ Index ].Entry;
+	}
+
+	JphtsDeleteSlot( Hashtable, Index );
+}
+
+VOID JphtEnumerateEntriesOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in JPHT_OA_ENUM_CALLBACK Callback,
+	__in_opt PVOID Context
+	)
+{
+	ULONG Start;
+	ULONG Mask;
+	ULONG Visited;
+
+	ASSERT( Hashtable );
+	ASSERT( Callback );
+
+	Mask = Hashtable->Data.SlotCount - 1;
+
+	//
+	// Start right after a free slot. Backward shifts caused by the
+	// callback removing the current entry never cross a free slot, so
+	// they only ever move entries not visited yet into the current
+	// slot.
+	//
+	for ( Start = 0; Start < Hashtable->Data.SlotCount; Start++ )
+	{
+		if ( Hashtable->Data.Slots[ Start ].Entry == NULL )
+		{
+			break;
+		}
+	}
+
+	ASSERT( Start < Hashtable->Data.SlotCount );
+
+	for ( Visited = 1; Visited < Hashtable->Data.SlotCount; )
+	{
+		ULONG Index = ( Start + Visited ) & Mask;
+		PJPHT_HASHTABLE_ENTRY Entry = Hashtable->Data.Slots[ Index ].Entry;
+
+		if ( Entry == NULL )
+		{
+			Visited++;
+			continue;
+		}
+
+		( Callback )( Hashtable, Entry, Context );
+
+		//
+		// If the callback has removed the entry, the slot may now hold
+		// a shifted entry - revisit the slot in this case.
+		//
+		if ( Hashtable->Data.Slots[ Index ].Entry == Entry )
+		{
+			Visited++;
+		}
+	}
+}
+
+BOOLEAN JphtResizeOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in ULONG NewSlotCount
+	)
+{
+	ULONG Index;
+	ULONG OldSlotCount;
+	PJPHT_OA_HASHTABLE_SLOT OldSlots;
+	PJPHT_OA_HASHTABLE_SLOT NewSlots;
+
+	ASSERT( Hashtable );
+	ASSERT( NewSlotCount );
+
+	NewSlotCount = JphtsRoundUpToPowerOfTwo( NewSlotCount );
+	if ( JphtsIsLoadExceeded( Hashtable->Data.EntryCount, NewSlotCount ) ||
+		 Hashtable->Data.EntryCount >= NewSlotCount )
+	{
+		return FALSE;
+	}
+
+	NewSlots = JphtsAllocateSlots( Hashtable, NewSlotCount );
+	if ( NewSlots == NULL )
+	{
+		return FALSE;
+	}
+
+	//
+	// Now swap pointers.
+	//
+	OldSlots		= Hashtable->Data.Slots;
+	OldSlotCount	= Hashtable->Data.SlotCount;
+
+	Hashtable->Data.Slots		= NewSlots;
+	Hashtable->Data.SlotCount	= NewSlotCount;
+	Hashtable->Data.EntryCount	= 0;
+
+	//
+	// Reinsert all entries using the cached hashes.
+	//
+	for ( Index = 0; Index < OldSlotCount; Index++ )
+	{
+		if ( OldSlots[ Index ].Entry != NULL )
+		{
+			JphtsInsertSlot(
+				Hashtable,
+				OldSlots[ Index ].Key,
+				OldSlots[ Index ].Entry,
+				OldSlots[ Index ].Hash );
+		}
+	}
+
+	Hashtable->Routines.Free( OldSlots );
+
+	return TRUE;
+}
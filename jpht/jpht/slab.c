@@ -0,0 +1,193 @@
+/*----------------------------------------------------------------------
+ * Purpose:
+ *		Slab allocator implementation.
+ *
+ * Copyright:
+ *		Johannes Passing (johannes.passing@googlemail.com)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include "stdafx.h"
+#include "slab.h"
+#include <windows.h>
+
+#include <crtdbg.h>
+#define ASSERT _ASSERTE
+
+#define JPHTS_ALIGN_UP( Value, Alignment ) \
+	( ( ( Value ) + ( Alignment ) - 1 ) & ~( ( SIZE_T ) ( Alignment ) - 1 ) )
+
+/*----------------------------------------------------------------------
+ *
+ * Helpers.
+ *
+ */
+
+/*++
+	Routine Description:
+		Allocate a new slab and put all its objects on the free list.
+		Objects are pushed in reverse order s.t. subsequent
+		allocations proceed in ascending address order.
+--*/
+static BOOLEAN JphtsGrowSlabAllocator(
+	__in PJPHT_SLAB_ALLOCATOR Allocator
+	)
+{
+	PJPHT_SLAB_HEADER Slab;
+	ULONG Index;
+
+	Slab = ( PJPHT_SLAB_HEADER )
+		Allocator->Routines.Allocate( Allocator->Geometry.SlabSize );
+	if ( Slab == NULL )
+	{
+		return FALSE;
+	}
+
+	Slab->Next = Allocator->Data.Slabs;
+	Allocator->Data.Slabs = Slab;
+	Allocator->Data.SlabCount++;
+
+	for ( Index = Allocator->Geometry.ObjectsPerSlab; Index > 0; Index-- )
+	{
+		PJPHT_SLAB_FREE_OBJECT Object = ( PJPHT_SLAB_FREE_OBJECT )
+			( ( PUCHAR ) Slab +
+			  Allocator->Geometry.HeaderSize +
+			  ( Index - 1 ) * Allocator->Geometry.ObjectSize );
+
+		Object->Next = Allocator->Data.FreeList;
+		Allocator->Data.FreeList = Object;
+	}
+
+	return TRUE;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Implementation.
+ *
+ */
+
+VOID JphtInitializeSlabAllocator(
+	__in PJPHT_SLAB_ALLOCATOR Allocator,
+	__in JPHT_ALLOCATE_ROUTINE Allocate,
+	__in JPHT_FREE_ROUTINE Free,
+	__in SIZE_T ObjectSize,
+	__in SIZE_T SlabSize
+	)
+{
+	SIZE_T HeaderSize;
+
+	ASSERT( Allocator );
+	ASSERT( Allocate );
+	ASSERT( Free );
+	ASSERT( ObjectSize > 0 );
+
+	//
+	// Each object must be able to hold the free list link and be
+	// aligned like memory returned by the heap.
+	//
+	ObjectSize = JPHTS_ALIGN_UP(
+		max( ObjectSize, sizeof( JPHT_SLAB_FREE_OBJECT ) ),
+		MEMORY_ALLOCATION_ALIGNMENT );
+	HeaderSize = JPHTS_ALIGN_UP(
+		sizeof( JPHT_SLAB_HEADER ),
+		MEMORY_ALLOCATION_ALIGNMENT );
+
+	if ( SlabSize == 0 )
+	{
+		SlabSize = JPHT_DEFAULT_SLAB_SIZE;
+	}
+
+	if ( SlabSize < HeaderSize + ObjectSize )
+	{
+		SlabSize = HeaderSize + ObjectSize;
+	}
+
+	Allocator->Routines.Allocate		= Allocate;
+	Allocator->Routines.Free			= Free;
+
+	Allocator->Geometry.ObjectSize		= ObjectSize;
+	Allocator->Geometry.HeaderSize		= HeaderSize;
+	Allocator->Geometry.SlabSize		= SlabSize;
+	Allocator->Geometry.ObjectsPerSlab	=
+		( ULONG ) ( ( SlabSize - HeaderSize ) / ObjectSize );
+
+	Allocator->Data.Slabs				= NULL;
+	Allocator->Data.FreeList			= NULL;
+	Allocator->Data.SlabCount			= 0;
+	Allocator->Data.ObjectCount			= 0;
+}
+
+VOID JphtDeleteSlabAllocator(
+	__in PJPHT_SLAB_ALLOCATOR Allocator
+	)
+{
+	PJPHT_SLAB_HEADER Slab;
+
+	ASSERT( Allocator );
+
+	Slab = Allocator->Data.Slabs;
+	while ( Slab != NULL )
+	{
+		PJPHT_SLAB_HEADER Next = Slab->Next;
+		Allocator->Routines.Free( Slab );
+		Slab = Next;
+	}
+
+#ifdef DBG
+	Allocator->Data.Slabs		= NULL;
+	Allocator->Data.FreeList	= NULL;
+	Allocator->Data.SlabCount	= 0;
+	Allocator->Data.ObjectCount	= 0;
+#endif
+}
+
+PVOID JphtAllocateSlabObject(
+	__in PJPHT_SLAB_ALLOCATOR Allocator
+	)
+{
+	PJPHT_SLAB_FREE_OBJECT Object;
+
+	ASSERT( Allocator );
+
+	if ( Allocator->Data.FreeList == NULL &&
+		 ! JphtsGrowSlabAllocator( Allocator ) )
+	{
+		return NULL;
+	}
+
+	Object = Allocator->Data.FreeList;
+	Allocator->Data.FreeList = Object->Next;
+	Allocator->Data.ObjectCount++;
+
+	return Object;
+}
+
+VOID JphtFreeSlabObject(
+	__in PJPHT_SLAB_ALLOCATOR Allocator,
+	__in PVOID Object
+	)
+{
+	PJPHT_SLAB_FREE_OBJECT FreeObject = ( PJPHT_SLAB_FREE_OBJECT ) Object;
+
+	ASSERT( Allocator );
+	ASSERT( Object );
+	ASSERT( Allocator->Data.ObjectCount > 0 );
+
+	FreeObject->Next = Allocator->Data.FreeList;
+	Allocator->Data.FreeList = FreeObject;
+	Allocator->Data.ObjectCount--;
+}
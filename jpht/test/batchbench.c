@@ -0,0 +1,174 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include "hashtable.h"
+
+#define TEST CFIX_ASSERT
+
+//
+// Compare single-key and batched lookups for tables of 1K to 10M
+// entries. Keys are looked up in random order s.t. larger tables
+// do not fit into the caches.
+//
+#define BENCH_MIN_ENTRIES		1000
+#define BENCH_MAX_ENTRIES		10000000
+#define BENCH_LOOKUP_COUNT		( 1 << 21 )
+
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	//
+	// Multiplicative hashing - spreads consecutive keys.
+	//
+	return ( ULONG ) Key * 2654435761U;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+static PVOID Allocate(
+	__in SIZE_T Size
+	)
+{
+	return malloc( Size );
+}
+
+static VOID Free(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static double ElapsedNanoseconds(
+	__in PLARGE_INTEGER Start,
+	__in PLARGE_INTEGER Stop,
+	__in PLARGE_INTEGER Frequency
+	)
+{
+	return ( double ) ( Stop->QuadPart - Start->QuadPart ) * 1e9 /
+		( double ) Frequency->QuadPart;
+}
+
+static void BenchmarkLookups(
+	__in ULONG EntryCount,
+	__in_ecount( BENCH_LOOKUP_COUNT ) PULONG_PTR Keys,
+	__in_ecount( BENCH_LOOKUP_COUNT ) PJPHT_HASHTABLE_ENTRY *SingleResults,
+	__in_ecount( BENCH_LOOKUP_COUNT ) PJPHT_HASHTABLE_ENTRY *BatchResults
+	)
+{
+	JPHT_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Entries;
+	PJPHT_HASHTABLE_ENTRY Old;
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	double SingleNs;
+	double BatchNs;
+	ULONG Random = 0x2545f491;
+	ULONG Index;
+
+	Entries = ( PJPHT_HASHTABLE_ENTRY ) malloc(
+		( SIZE_T ) EntryCount * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	if ( Entries == NULL || ! JphtInitializeHashtable(
+		&Ht,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		EntryCount ) )
+	{
+		CFIX_LOG( L"%d entries: Skipped, insufficient memory", EntryCount );
+		free( Entries );
+		return;
+	}
+
+	for ( Index = 0; Index < EntryCount; Index++ )
+	{
+		Entries[ Index ].Key = Index;
+		JphtPutEntryHashtable( &Ht, &Entries[ Index ], &Old );
+	}
+
+	//
+	// 7/8 hits, 1/8 misses.
+	//
+	for ( Index = 0; Index < BENCH_LOOKUP_COUNT; Index++ )
+	{
+		Random ^= Random << 13;
+		Random ^= Random >> 17;
+		Random ^= Random << 5;
+
+		Keys[ Index ] = Random % ( EntryCount + EntryCount / 7 );
+	}
+
+	TEST( QueryPerformanceFrequency( &Frequency ) );
+
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < BENCH_LOOKUP_COUNT; Index++ )
+	{
+		SingleResults[ Index ] = JphtGetEntryHashtable( &Ht, Keys[ Index ] );
+	}
+	TEST( QueryPerformanceCounter( &Stop ) );
+	SingleNs = ElapsedNanoseconds( &Start, &Stop, &Frequency );
+
+	TEST( QueryPerformanceCounter( &Start ) );
+	JphtGetEntriesHashtableBatch( &Ht, Keys, BENCH_LOOKUP_COUNT, BatchResults );
+	TEST( QueryPerformanceCounter( &Stop ) );
+	BatchNs = ElapsedNanoseconds( &Start, &Stop, &Frequency );
+
+	TEST( 0 == memcmp(
+		SingleResults,
+		BatchResults,
+		BENCH_LOOKUP_COUNT * sizeof( PJPHT_HASHTABLE_ENTRY ) ) );
+
+	CFIX_LOG(
+		L"%d entries: single %.1f ns/lookup, batch %.1f ns/lookup (%.2fx)",
+		EntryCount,
+		SingleNs / BENCH_LOOKUP_COUNT,
+		BatchNs / BENCH_LOOKUP_COUNT,
+		SingleNs / BatchNs );
+
+	for ( Index = 0; Index < EntryCount; Index++ )
+	{
+		JphtRemoveEntryHashtable( &Ht, Index, &Old );
+	}
+
+	JphtDeleteHashtable( &Ht );
+	free( Entries );
+}
+
+static void BenchmarkBatchLookup()
+{
+	PULONG_PTR Keys;
+	PJPHT_HASHTABLE_ENTRY *SingleResults;
+	PJPHT_HASHTABLE_ENTRY *BatchResults;
+	ULONG EntryCount;
+
+	Keys = ( PULONG_PTR ) malloc(
+		BENCH_LOOKUP_COUNT * sizeof( ULONG_PTR ) );
+	SingleResults = ( PJPHT_HASHTABLE_ENTRY* ) malloc(
+		BENCH_LOOKUP_COUNT * sizeof( PJPHT_HASHTABLE_ENTRY ) );
+	BatchResults = ( PJPHT_HASHTABLE_ENTRY* ) malloc(
+		BENCH_LOOKUP_COUNT * sizeof( PJPHT_HASHTABLE_ENTRY ) );
+	CFIX_ASSUME( Keys != NULL && SingleResults != NULL && BatchResults != NULL );
+
+	for ( EntryCount = BENCH_MIN_ENTRIES;
+		  EntryCount <= BENCH_MAX_ENTRIES;
+		  EntryCount *= 10 )
+	{
+		BenchmarkLookups( EntryCount, Keys, SingleResults, BatchResults );
+	}
+
+	free( Keys );
+	free( SingleResults );
+	free( BatchResults );
+}
+
+CFIX_BEGIN_FIXTURE( HashtableBatchLookupBenchmark )
+	CFIX_FIXTURE_ENTRY( BenchmarkBatchLookup )
+CFIX_END_FIXTURE()
@@ -0,0 +1,375 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include <intrin.h>
+#include "hashtable.h"
+
+#define TEST CFIX_ASSERT
+
+//
+// Baseline throughput and latency of the chained hashtable for
+// table sizes of 1K to 1M entries and load factors of 50% to 400%.
+// Automatic resizing is disabled s.t. the load factor stays fixed.
+//
+// For put, get (hit/miss) and remove, throughput is measured over
+// the entire run and the latency of each operation is measured in
+// TSC cycles. The latter includes the overhead of reading the TSC
+// (roughly 20-30 cycles) and is thus only meaningful relative to
+// other runs on the same machine.
+//
+// For enumerate and resize, which operate on the entire table, the
+// cost per entry is reported.
+//
+#define BENCH_MIN_ENTRIES		1000
+#define BENCH_MAX_ENTRIES		1000000
+#define BENCH_LOOKUP_COUNT		( 1 << 18 )
+#define BENCH_BULK_ROUNDS		5
+
+static const ULONG BenchLoadFactors[] = { 50, 100, 200, 400 };
+
+typedef enum _BENCH_OPERATION
+{
+	BenchPut,
+	BenchGetHit,
+	BenchGetMiss,
+	BenchRemove
+} BENCH_OPERATION;
+
+typedef struct _BENCH_CONTEXT
+{
+	JPHT_HASHTABLE Ht;
+	ULONG EntryCount;
+	ULONG LoadFactor;
+	PJPHT_HASHTABLE_ENTRY Entries;
+
+	//
+	// Keys in the order they are used, sized for the largest run.
+	//
+	PULONG_PTR Keys;
+
+	//
+	// Latency of each operation, in cycles.
+	//
+	PULONG Samples;
+
+	LARGE_INTEGER Frequency;
+	ULONG Random;
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	return ( ULONG ) Key * 2654435761U;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+static PVOID Allocate(
+	__in SIZE_T Size
+	)
+{
+	return malloc( Size );
+}
+
+static VOID Free(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static int __cdecl CompareSamples(
+	__in const void *Lhs,
+	__in const void *Rhs
+	)
+{
+	ULONG SampleLhs = *( const ULONG* ) Lhs;
+	ULONG SampleRhs = *( const ULONG* ) Rhs;
+
+	return SampleLhs < SampleRhs ? -1 : ( SampleLhs > SampleRhs ? 1 : 0 );
+}
+
+static double ElapsedNanoseconds(
+	__in PLARGE_INTEGER Start,
+	__in PLARGE_INTEGER Stop,
+	__in PLARGE_INTEGER Frequency
+	)
+{
+	return ( double ) ( Stop->QuadPart - Start->QuadPart ) * 1e9 /
+		( double ) Frequency->QuadPart;
+}
+
+static ULONG BenchRandom(
+	__in PBENCH_CONTEXT Context
+	)
+{
+	Context->Random ^= Context->Random << 13;
+	Context->Random ^= Context->Random >> 17;
+	Context->Random ^= Context->Random << 5;
+	return Context->Random;
+}
+
+/*++
+	Routine Description:
+		Fill Keys with Count keys, shuffled or random.
+
+	Parameters:
+		Base		- Keys are drawn from [Base, Base + Range).
+		Range
+		Shuffle		- TRUE: Permutation of the entire range,
+					  Count must equal Range.
+					  FALSE: Random keys.
+--*/
+static VOID BenchPrepareKeys(
+	__in PBENCH_CONTEXT Context,
+	__in ULONG Count,
+	__in ULONG Base,
+	__in ULONG Range,
+	__in BOOLEAN Shuffle
+	)
+{
+	ULONG Index;
+
+	if ( Shuffle )
+	{
+		for ( Index = 0; Index < Count; Index++ )
+		{
+			Context->Keys[ Index ] = Base + Index;
+		}
+
+		for ( Index = Count - 1; Index > 0; Index-- )
+		{
+			ULONG Other = BenchRandom( Context ) % ( Index + 1 );
+			ULONG_PTR Temp = Context->Keys[ Index ];
+			Context->Keys[ Index ] = Context->Keys[ Other ];
+			Context->Keys[ Other ] = Temp;
+		}
+	}
+	else
+	{
+		for ( Index = 0; Index < Count; Index++ )
+		{
+			Context->Keys[ Index ] = Base + BenchRandom( Context ) % Range;
+		}
+	}
+}
+
+static VOID BenchReport(
+	__in PBENCH_CONTEXT Context,
+	__in PCWSTR Operation,
+	__in ULONG Count,
+	__in double ElapsedNs
+	)
+{
+	qsort( Context->Samples, Count, sizeof( ULONG ), CompareSamples );
+
+	CFIX_LOG(
+		L"%7d entries, load %3d%%: %-10s %7.2f Mops/s, "
+		L"p50 %5d p99 %6d p99.9 %7d max %8d cycles",
+		Context->EntryCount,
+		Context->LoadFactor,
+		Operation,
+		Count * 1e3 / ElapsedNs,
+		Context->Samples[ Count / 2 ],
+		Context->Samples[ ( ULONG ) ( Count * 0.99 ) ],
+		Context->Samples[ ( ULONG ) ( Count * 0.999 ) ],
+		Context->Samples[ Count - 1 ] );
+}
+
+static VOID BenchMeasureOperation(
+	__in PBENCH_CONTEXT Context,
+	__in BENCH_OPERATION Operation,
+	__in ULONG Count
+	)
+{
+	static const PCWSTR Names[] = { L"put", L"get/hit", L"get/miss", L"remove" };
+	PJPHT_HASHTABLE_ENTRY Old;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	ULONG Index;
+
+	TEST( QueryPerformanceCounter( &Start ) );
+	for ( Index = 0; Index < Count; Index++ )
+	{
+		ULONG_PTR Key = Context->Keys[ Index ];
+		unsigned __int64 Begin = __rdtsc();
+
+		switch ( Operation )
+		{
+		case BenchPut:
+			JphtPutEntryHashtable( &Context->Ht, &Context->Entries[ Key ], &Old );
+			break;
+
+		case BenchGetHit:
+		case BenchGetMiss:
+			Old = JphtGetEntryHashtable( &Context->Ht, Key );
+			break;
+
+		case BenchRemove:
+			JphtRemoveEntryHashtable( &Context->Ht, Key, &Old );
+			break;
+
+		default:
+			Old = NULL;
+			break;
+		}
+
+		Context->Samples[ Index ] = ( ULONG ) ( __rdtsc() - Begin );
+
+		TEST( ( Old == NULL ) ==
+			( Operation == BenchPut || Operation == BenchGetMiss ) );
+	}
+	TEST( QueryPerformanceCounter( &Stop ) );
+
+	BenchReport(
+		Context,
+		Names[ Operation ],
+		Count,
+		ElapsedNanoseconds( &Start, &Stop, &Context->Frequency ) );
+}
+
+static VOID BenchCountCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PULONG Count = ( PULONG ) Context;
+	UNREFERENCED_PARAMETER( Hashtable );
+	UNREFERENCED_PARAMETER( Entry );
+	(*Count)++;
+}
+
+static VOID BenchMeasureBulkOperations(
+	__in PBENCH_CONTEXT Context
+	)
+{
+	LARGE_INTEGER Start;
+	LARGE_INTEGER Stop;
+	double EnumerateNs = 0;
+	double ResizeNs = 0;
+	ULONG BucketCount = JphtGetBucketCountHashtable( &Context->Ht );
+	ULONG Round;
+
+	for ( Round = 0; Round < BENCH_BULK_ROUNDS; Round++ )
+	{
+		ULONG Count = 0;
+
+		TEST( QueryPerformanceCounter( &Start ) );
+		JphtEnumerateEntries( &Context->Ht, BenchCountCallback, &Count );
+		TEST( QueryPerformanceCounter( &Stop ) );
+		EnumerateNs += ElapsedNanoseconds( &Start, &Stop, &Context->Frequency );
+
+		TEST( Count == Context->EntryCount );
+
+		//
+		// Double, then restore the bucket count.
+		//
+		TEST( QueryPerformanceCounter( &Start ) );
+		TEST( JphtResize( &Context->Ht, BucketCount * 2 ) );
+		TEST( JphtResize( &Context->Ht, BucketCount ) );
+		TEST( QueryPerformanceCounter( &Stop ) );
+		ResizeNs += ElapsedNanoseconds( &Start, &Stop, &Context->Frequency ) / 2;
+	}
+
+	CFIX_LOG(
+		L"%7d entries, load %3d%%: enumerate %.1f ns/entry, resize %.1f ns/entry",
+		Context->EntryCount,
+		Context->LoadFactor,
+		EnumerateNs / BENCH_BULK_ROUNDS / Context->EntryCount,
+		ResizeNs / BENCH_BULK_ROUNDS / Context->EntryCount );
+}
+
+static VOID BenchRun(
+	__in PBENCH_CONTEXT Context,
+	__in ULONG EntryCount,
+	__in ULONG LoadFactor
+	)
+{
+	ULONG BucketCount;
+	ULONG Index;
+
+	Context->EntryCount = EntryCount;
+	Context->LoadFactor = LoadFactor;
+
+	BucketCount = ( ULONG ) ( ( ULONGLONG ) EntryCount * 100 / LoadFactor );
+	if ( ! JphtInitializeHashtable(
+		&Context->Ht,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		BucketCount ) )
+	{
+		CFIX_LOG( L"%d entries: Skipped, insufficient memory", EntryCount );
+		return;
+	}
+
+	for ( Index = 0; Index < EntryCount; Index++ )
+	{
+		Context->Entries[ Index ].Key = Index;
+	}
+
+	//
+	// Insert in random order.
+	//
+	BenchPrepareKeys( Context, EntryCount, 0, EntryCount, TRUE );
+	BenchMeasureOperation( Context, BenchPut, EntryCount );
+
+	BenchPrepareKeys( Context, BENCH_LOOKUP_COUNT, 0, EntryCount, FALSE );
+	BenchMeasureOperation( Context, BenchGetHit, BENCH_LOOKUP_COUNT );
+
+	BenchPrepareKeys( Context, BENCH_LOOKUP_COUNT, EntryCount, EntryCount, FALSE );
+	BenchMeasureOperation( Context, BenchGetMiss, BENCH_LOOKUP_COUNT );
+
+	BenchMeasureBulkOperations( Context );
+
+	BenchPrepareKeys( Context, EntryCount, 0, EntryCount, TRUE );
+	BenchMeasureOperation( Context, BenchRemove, EntryCount );
+
+	TEST( JphtGetEntryCountHashtable( &Context->Ht ) == 0 );
+	JphtDeleteHashtable( &Context->Ht );
+}
+
+static void BenchmarkHashtable()
+{
+	BENCH_CONTEXT Context;
+	ULONG MaxKeys = max( BENCH_MAX_ENTRIES, BENCH_LOOKUP_COUNT );
+	ULONG EntryCount;
+	ULONG Index;
+
+	Context.Random = 0x2545f491;
+	Context.Entries = ( PJPHT_HASHTABLE_ENTRY ) malloc(
+		BENCH_MAX_ENTRIES * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	Context.Keys = ( PULONG_PTR ) malloc( MaxKeys * sizeof( ULONG_PTR ) );
+	Context.Samples = ( PULONG ) malloc( MaxKeys * sizeof( ULONG ) );
+	CFIX_ASSUME( Context.Entries != NULL &&
+				 Context.Keys != NULL &&
+				 Context.Samples != NULL );
+
+	TEST( QueryPerformanceFrequency( &Context.Frequency ) );
+
+	for ( EntryCount = BENCH_MIN_ENTRIES;
+		  EntryCount <= BENCH_MAX_ENTRIES;
+		  EntryCount *= 10 )
+	{
+		for ( Index = 0; Index < _countof( BenchLoadFactors ); Index++ )
+		{
+			BenchRun( &Context, EntryCount, BenchLoadFactors[ Index ] );
+		}
+	}
+
+	free( Context.Entries );
+	free( Context.Keys );
+	free( Context.Samples );
+}
+
+CFIX_BEGIN_FIXTURE( HashtableBenchmark )
+	CFIX_FIXTURE_ENTRY( BenchmarkHashtable )
+CFIX_END_FIXTURE()
@@ -0,0 +1,512 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include "concurrenthashtable.h"
+
+#define TEST CFIX_ASSERT
+
+//
+// Stress test: Writers put/remove private keys (only modified by
+// a single writer) and overwrite shared keys, readers concurrently
+// look up random keys. The following properties, implied by
+// linearizability, are checked:
+//
+//  - A writer always observes the effects of its own operations on
+//    private keys (there is no other writer).
+//  - A lookup never returns an entry with a different key or an
+//    entry that has already been reclaimed.
+//  - For each shared key, a reader never observes an older version
+//    written by a writer after having observed a newer one.
+//  - After all threads have finished, the hashtable contains exactly
+//    the entries the writers expect.
+//
+#define WRITER_COUNT			4
+#define READER_COUNT			4
+#define PRIVATE_KEY_COUNT		128
+#define SHARED_KEY_COUNT		16
+#define SHARED_KEY_BASE			0x100000
+#define OPERATIONS_PER_WRITER	50000
+#define RETIRE_BATCH_SIZE		256
+
+#define ENTRY_MAGIC_LIVE		0x4c495645
+#define ENTRY_MAGIC_DEAD		0x44454144
+
+typedef struct _CC_TEST_ENTRY
+{
+	JPHT_HASHTABLE_ENTRY Base;
+	ULONG Writer;
+	ULONG Version;
+	volatile ULONG Magic;
+} CC_TEST_ENTRY, *PCC_TEST_ENTRY;
+
+typedef struct _CC_TEST_CONTEXT
+{
+	JPHT_CONCURRENT_HASHTABLE Table;
+	volatile LONG WritersRunning;
+	volatile LONG Failures;
+} CC_TEST_CONTEXT, *PCC_TEST_CONTEXT;
+
+typedef struct _CC_WRITER
+{
+	PCC_TEST_CONTEXT Context;
+	ULONG Index;
+	ULONG Random;
+
+	//
+	// Expected state of private keys.
+	//
+	PCC_TEST_ENTRY Private[ PRIVATE_KEY_COUNT ];
+
+	//
+	// Removed/replaced entries awaiting reclamation.
+	//
+	PCC_TEST_ENTRY Retired[ RETIRE_BATCH_SIZE ];
+	ULONG RetiredCount;
+} CC_WRITER, *PCC_WRITER;
+
+typedef struct _CC_READER
+{
+	PCC_TEST_CONTEXT Context;
+	ULONG Random;
+	ULONG Lookups;
+
+	//
+	// Newest version observed per shared key and writer.
+	//
+	ULONG LastSeen[ SHARED_KEY_COUNT ][ WRITER_COUNT ];
+} CC_READER, *PCC_READER;
+
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	return ( ULONG ) Key;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+static PVOID Allocate(
+	__in SIZE_T Size
+	)
+{
+	return malloc( Size );
+}
+
+static VOID Free(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static ULONG NextRandom(
+	__inout PULONG State
+	)
+{
+	//
+	// Xorshift - rand() is too slow and not independent across
+	// threads.
+	//
+	ULONG X = *State;
+	X ^= X << 13;
+	X ^= X >> 17;
+	X ^= X << 5;
+	*State = X;
+	return X;
+}
+
+static ULONG_PTR PrivateKey(
+	__in ULONG Writer,
+	__in ULONG Index
+	)
+{
+	return ( ULONG_PTR ) ( Writer * PRIVATE_KEY_COUNT + Index );
+}
+
+static VOID Fail(
+	__in PCC_TEST_CONTEXT Context
+	)
+{
+	InterlockedIncrement( &Context->Failures );
+}
+
+static PCC_TEST_ENTRY CreateEntry(
+	__in ULONG_PTR Key,
+	__in ULONG Writer,
+	__in ULONG Version
+	)
+{
+	PCC_TEST_ENTRY Entry = ( PCC_TEST_ENTRY ) malloc( sizeof( CC_TEST_ENTRY ) );
+	if ( Entry != NULL )
+	{
+		Entry->Base.Key	= Key;
+		Entry->Writer	= Writer;
+		Entry->Version	= Version;
+		Entry->Magic	= ENTRY_MAGIC_LIVE;
+	}
+	return Entry;
+}
+
+static VOID ReclaimRetiredEntries(
+	__in PCC_WRITER Writer
+	)
+{
+	ULONG Index;
+
+	JphtSynchronizeConcurrentHashtable( &Writer->Context->Table );
+
+	for ( Index = 0; Index < Writer->RetiredCount; Index++ )
+	{
+		//
+		// Poison s.t. readers referencing the entry despite
+		// reclamation notice.
+		//
+		Writer->Retired[ Index ]->Magic = ENTRY_MAGIC_DEAD;
+		free( Writer->Retired[ Index ] );
+	}
+
+	Writer->RetiredCount = 0;
+}
+
+static VOID RetireEntry(
+	__in PCC_WRITER Writer,
+	__in PJPHT_HASHTABLE_ENTRY Entry
+	)
+{
+	Writer->Retired[ Writer->RetiredCount++ ] = ( PCC_TEST_ENTRY ) Entry;
+	if ( Writer->RetiredCount == RETIRE_BATCH_SIZE )
+	{
+		ReclaimRetiredEntries( Writer );
+	}
+}
+
+static DWORD CALLBACK WriterProc(
+	__in PVOID Parameter
+	)
+{
+	PCC_WRITER Writer = ( PCC_WRITER ) Parameter;
+	PJPHT_CONCURRENT_HASHTABLE Table = &Writer->Context->Table;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	PCC_TEST_ENTRY Entry;
+	ULONG Operation;
+	ULONG Epoch;
+
+	for ( Operation = 1; Operation <= OPERATIONS_PER_WRITER; Operation++ )
+	{
+		ULONG Random = NextRandom( &Writer->Random );
+		ULONG Index;
+		ULONG_PTR Key;
+
+		if ( Random % 8 == 0 )
+		{
+			//
+			// Overwrite shared key.
+			//
+			Key = SHARED_KEY_BASE + ( Random >> 8 ) % SHARED_KEY_COUNT;
+			Entry = CreateEntry( Key, Writer->Index, Operation );
+			if ( Entry == NULL )
+			{
+				Fail( Writer->Context );
+				break;
+			}
+
+			JphtPutEntryConcurrentHashtable( Table, &Entry->Base, &OldEntry );
+			if ( OldEntry != NULL )
+			{
+				RetireEntry( Writer, OldEntry );
+			}
+
+			continue;
+		}
+
+		Index = ( Random >> 8 ) % PRIVATE_KEY_COUNT;
+		Key = PrivateKey( Writer->Index, Index );
+
+		if ( Random % 8 < 5 )
+		{
+			Entry = CreateEntry( Key, Writer->Index, Operation );
+			if ( Entry == NULL )
+			{
+				Fail( Writer->Context );
+				break;
+			}
+
+			JphtPutEntryConcurrentHashtable( Table, &Entry->Base, &OldEntry );
+		}
+		else
+		{
+			Entry = NULL;
+			JphtRemoveEntryConcurrentHashtable( Table, Key, &OldEntry );
+		}
+
+		if ( OldEntry != ( PJPHT_HASHTABLE_ENTRY ) Writer->Private[ Index ] )
+		{
+			Fail( Writer->Context );
+		}
+
+		if ( OldEntry != NULL )
+		{
+			RetireEntry( Writer, OldEntry );
+		}
+
+		Writer->Private[ Index ] = Entry;
+
+		//
+		// Read own write.
+		//
+		Epoch = JphtEnterReadConcurrentHashtable( Table );
+		if ( JphtGetEntryConcurrentHashtable( Table, Key ) !=
+			( PJPHT_HASHTABLE_ENTRY ) Entry )
+		{
+			Fail( Writer->Context );
+		}
+		JphtLeaveReadConcurrentHashtable( Table, Epoch );
+	}
+
+	ReclaimRetiredEntries( Writer );
+	InterlockedDecrement( &Writer->Context->WritersRunning );
+
+	return 0;
+}
+
+static DWORD CALLBACK ReaderProc(
+	__in PVOID Parameter
+	)
+{
+	PCC_READER Reader = ( PCC_READER ) Parameter;
+	PJPHT_CONCURRENT_HASHTABLE Table = &Reader->Context->Table;
+
+	while ( Reader->Context->WritersRunning > 0 )
+	{
+		ULONG Random = NextRandom( &Reader->Random );
+		PCC_TEST_ENTRY Entry;
+		ULONG_PTR Key;
+		ULONG Epoch;
+
+		if ( Random % 2 == 0 )
+		{
+			Key = SHARED_KEY_BASE + ( Random >> 8 ) % SHARED_KEY_COUNT;
+		}
+		else
+		{
+			Key = PrivateKey(
+				( Random >> 8 ) % WRITER_COUNT,
+				( Random >> 16 ) % PRIVATE_KEY_COUNT );
+		}
+
+		Epoch = JphtEnterReadConcurrentHashtable( Table );
+
+		Entry = ( PCC_TEST_ENTRY ) JphtGetEntryConcurrentHashtable( Table, Key );
+		if ( Entry != NULL )
+		{
+			if ( Entry->Magic != ENTRY_MAGIC_LIVE ||
+				 Entry->Base.Key != Key ||
+				 Entry->Writer >= WRITER_COUNT )
+			{
+				Fail( Reader->Context );
+			}
+			else if ( Key >= SHARED_KEY_BASE )
+			{
+				PULONG LastSeen = &Reader->LastSeen
+					[ Key - SHARED_KEY_BASE ][ Entry->Writer ];
+				if ( Entry->Version < *LastSeen )
+				{
+					Fail( Reader->Context );
+				}
+				*LastSeen = Entry->Version;
+			}
+		}
+
+		JphtLeaveReadConcurrentHashtable( Table, Epoch );
+
+		Reader->Lookups++;
+	}
+
+	return 0;
+}
+
+static VOID RemoveAndFreeCallback(
+	__in PJPHT_CONCURRENT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	PULONG Count = ( PULONG ) Context;
+
+	JphtRemoveEntryConcurrentHashtable( Hashtable, Entry->Key, &OldEntry );
+	CFIX_ASSERT( OldEntry == Entry );
+
+	( *Count )++;
+	free( Entry );
+}
+
+static void TestConcurrentHashtableSingleThreaded()
+{
+	JPHT_CONCURRENT_HASHTABLE Table;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	JPHT_HASHTABLE_ENTRY Foo;
+	JPHT_HASHTABLE_ENTRY Foo2;
+	JPHT_HASHTABLE_ENTRY Bar;
+	ULONG Epoch;
+
+	TEST( JphtInitializeConcurrentHashtable(
+		&Table,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		1 ) );
+
+	Foo.Key = 1;
+	Foo2.Key = 1;
+	Bar.Key = 2;
+
+	JphtPutEntryConcurrentHashtable( &Table, &Foo, &OldEntry );
+	TEST( OldEntry == NULL );
+	JphtPutEntryConcurrentHashtable( &Table, &Bar, &OldEntry );
+	TEST( OldEntry == NULL );
+	JphtPutEntryConcurrentHashtable( &Table, &Foo2, &OldEntry );
+	TEST( OldEntry == &Foo );
+	TEST( JphtGetEntryCountConcurrentHashtable( &Table ) == 2 );
+
+	Epoch = JphtEnterReadConcurrentHashtable( &Table );
+	TEST( JphtGetEntryConcurrentHashtable( &Table, 1 ) == &Foo2 );
+	TEST( JphtGetEntryConcurrentHashtable( &Table, 2 ) == &Bar );
+	TEST( JphtGetEntryConcurrentHashtable( &Table, 3 ) == NULL );
+	JphtLeaveReadConcurrentHashtable( &Table, Epoch );
+
+	JphtSynchronizeConcurrentHashtable( &Table );
+
+	JphtRemoveEntryConcurrentHashtable( &Table, 1, &OldEntry );
+	TEST( OldEntry == &Foo2 );
+	JphtRemoveEntryConcurrentHashtable( &Table, 1, &OldEntry );
+	TEST( OldEntry == NULL );
+	JphtRemoveEntryConcurrentHashtable( &Table, 2, &OldEntry );
+	TEST( OldEntry == &Bar );
+	TEST( JphtGetEntryCountConcurrentHashtable( &Table ) == 0 );
+
+	JphtSynchronizeConcurrentHashtable( &Table );
+	JphtDeleteConcurrentHashtable( &Table );
+}
+
+static void TestConcurrentHashtableStress()
+{
+	CC_TEST_CONTEXT Context;
+	HANDLE Threads[ WRITER_COUNT + READER_COUNT ];
+	PCC_WRITER Writers;
+	PCC_READER Readers;
+	ULONG ExpectedCount = 0;
+	ULONG Count = 0;
+	ULONG Index;
+
+	Writers = ( PCC_WRITER ) calloc( WRITER_COUNT, sizeof( CC_WRITER ) );
+	Readers = ( PCC_READER ) calloc( READER_COUNT, sizeof( CC_READER ) );
+	CFIX_ASSUME( Writers != NULL && Readers != NULL );
+
+	//
+	// Few buckets to provoke long chains and stripe contention.
+	//
+	TEST( JphtInitializeConcurrentHashtable(
+		&Context.Table,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		61 ) );
+	Context.WritersRunning	= WRITER_COUNT;
+	Context.Failures		= 0;
+
+	for ( Index = 0; Index < WRITER_COUNT; Index++ )
+	{
+		Writers[ Index ].Context	= &Context;
+		Writers[ Index ].Index		= Index;
+		Writers[ Index ].Random		= 0x9e3779b9 + Index;
+
+		Threads[ Index ] = CreateThread(
+			NULL, 0, WriterProc, &Writers[ Index ], 0, NULL );
+		CFIX_ASSUME( Threads[ Index ] != NULL );
+	}
+
+	for ( Index = 0; Index < READER_COUNT; Index++ )
+	{
+		Readers[ Index ].Context	= &Context;
+		Readers[ Index ].Random		= 0x7f4a7c15 + Index;
+
+		Threads[ WRITER_COUNT + Index ] = CreateThread(
+			NULL, 0, ReaderProc, &Readers[ Index ], 0, NULL );
+		CFIX_ASSUME( Threads[ WRITER_COUNT + Index ] != NULL );
+	}
+
+	TEST( WAIT_OBJECT_0 == WaitForMultipleObjects(
+		WRITER_COUNT + READER_COUNT,
+		Threads,
+		TRUE,
+		INFINITE ) );
+
+	for ( Index = 0; Index < WRITER_COUNT + READER_COUNT; Index++ )
+	{
+		CloseHandle( Threads[ Index ] );
+	}
+
+	TEST( Context.Failures == 0 );
+
+	for ( Index = 0; Index < READER_COUNT; Index++ )
+	{
+		CFIX_LOG( L"Reader %d: %d lookups", Index, Readers[ Index ].Lookups );
+	}
+
+	//
+	// Verify final state.
+	//
+	for ( Index = 0; Index < WRITER_COUNT; Index++ )
+	{
+		ULONG KeyIndex;
+		ULONG Epoch = JphtEnterReadConcurrentHashtable( &Context.Table );
+
+		for ( KeyIndex = 0; KeyIndex < PRIVATE_KEY_COUNT; KeyIndex++ )
+		{
+			TEST( JphtGetEntryConcurrentHashtable(
+				&Context.Table,
+				PrivateKey( Index, KeyIndex ) ) ==
+				( PJPHT_HASHTABLE_ENTRY ) Writers[ Index ].Private[ KeyIndex ] );
+
+			if ( Writers[ Index ].Private[ KeyIndex ] != NULL )
+			{
+				ExpectedCount++;
+			}
+		}
+
+		JphtLeaveReadConcurrentHashtable( &Context.Table, Epoch );
+	}
+
+	//
+	// Shared keys are overwritten frequently enough for all of
+	// them to be present.
+	//
+	ExpectedCount += SHARED_KEY_COUNT;
+
+	TEST( JphtGetEntryCountConcurrentHashtable( &Context.Table ) == ExpectedCount );
+
+	JphtEnumerateEntriesConcurrentHashtable(
+		&Context.Table,
+		RemoveAndFreeCallback,
+		&Count );
+	TEST( Count == ExpectedCount );
+	TEST( JphtGetEntryCountConcurrentHashtable( &Context.Table ) == 0 );
+
+	JphtDeleteConcurrentHashtable( &Context.Table );
+
+	free( Writers );
+	free( Readers );
+}
+
+CFIX_BEGIN_FIXTURE( ConcurrentHashtable )
+	CFIX_FIXTURE_ENTRY( TestConcurrentHashtableSingleThreaded )
+	CFIX_FIXTURE_ENTRY( TestConcurrentHashtableStress )
+CFIX_END_FIXTURE()
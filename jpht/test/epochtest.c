@@ -0,0 +1,126 @@
+#include <cfix.h>
+#include <windows.h>
+#include "epoch.h"
+
+#define TEST CFIX_ASSERT
+
+typedef struct _EPOCH_TEST_CONTEXT
+{
+	JPHT_EPOCH Epoch;
+	HANDLE ReaderEntered;
+	HANDLE ReaderMayLeave;
+} EPOCH_TEST_CONTEXT, *PEPOCH_TEST_CONTEXT;
+
+static volatile LONG YieldCount;
+
+static VOID CountingYield()
+{
+	InterlockedIncrement( &YieldCount );
+	( VOID ) SwitchToThread();
+}
+
+static DWORD CALLBACK ReaderProc(
+	__in PVOID Parameter
+	)
+{
+	PEPOCH_TEST_CONTEXT Context = ( PEPOCH_TEST_CONTEXT ) Parameter;
+	ULONG Epoch;
+
+	Epoch = JphtEnterReadEpoch( &Context->Epoch );
+
+	( VOID ) SetEvent( Context->ReaderEntered );
+	( VOID ) WaitForSingleObject( Context->ReaderMayLeave, INFINITE );
+
+	JphtLeaveReadEpoch( &Context->Epoch, Epoch );
+	return 0;
+}
+
+static DWORD CALLBACK SynchronizerProc(
+	__in PVOID Parameter
+	)
+{
+	PEPOCH_TEST_CONTEXT Context = ( PEPOCH_TEST_CONTEXT ) Parameter;
+
+	JphtSynchronizeEpoch( &Context->Epoch, CountingYield );
+	return 0;
+}
+
+static void TestEpochSingleThreaded()
+{
+	JPHT_EPOCH Epoch;
+	ULONG Outer;
+	ULONG Inner;
+
+	JphtInitializeEpoch( &Epoch );
+
+	//
+	// No readers - must not block.
+	//
+	JphtSynchronizeEpoch( &Epoch, NULL );
+	JphtSynchronizeEpoch( &Epoch, NULL );
+
+	Outer = JphtEnterReadEpoch( &Epoch );
+	Inner = JphtEnterReadEpoch( &Epoch );
+	TEST( Outer == Inner );
+	TEST( Epoch.Readers[ Outer & 1 ] == 2 );
+	JphtLeaveReadEpoch( &Epoch, Inner );
+	JphtLeaveReadEpoch( &Epoch, Outer );
+
+	TEST( Epoch.Readers[ 0 ] == 0 );
+	TEST( Epoch.Readers[ 1 ] == 0 );
+
+	JphtSynchronizeEpoch( &Epoch, NULL );
+	TEST( JphtEnterReadEpoch( &Epoch ) == Outer + 1 );
+	JphtLeaveReadEpoch( &Epoch, Outer + 1 );
+}
+
+static void TestEpochWaitsForReaders()
+{
+	EPOCH_TEST_CONTEXT Context;
+	HANDLE Reader;
+	HANDLE Synchronizer;
+	ULONG Epoch;
+
+	JphtInitializeEpoch( &Context.Epoch );
+	Context.ReaderEntered	= CreateEvent( NULL, FALSE, FALSE, NULL );
+	Context.ReaderMayLeave	= CreateEvent( NULL, TRUE, FALSE, NULL );
+	CFIX_ASSUME( Context.ReaderEntered != NULL );
+	CFIX_ASSUME( Context.ReaderMayLeave != NULL );
+
+	Reader = CreateThread( NULL, 0, ReaderProc, &Context, 0, NULL );
+	CFIX_ASSUME( Reader != NULL );
+	TEST( WAIT_OBJECT_0 == WaitForSingleObject( Context.ReaderEntered, INFINITE ) );
+
+	YieldCount = 0;
+	Synchronizer = CreateThread( NULL, 0, SynchronizerProc, &Context, 0, NULL );
+	CFIX_ASSUME( Synchronizer != NULL );
+
+	//
+	// The synchronizer must wait for the reader, yielding while
+	// doing so.
+	//
+	TEST( WAIT_TIMEOUT == WaitForSingleObject( Synchronizer, 200 ) );
+	TEST( YieldCount > 0 );
+
+	//
+	// Readers entering after the synchronization has begun must
+	// not be waited for.
+	//
+	Epoch = JphtEnterReadEpoch( &Context.Epoch );
+
+	TEST( SetEvent( Context.ReaderMayLeave ) );
+	TEST( WAIT_OBJECT_0 == WaitForSingleObject( Synchronizer, INFINITE ) );
+	TEST( WAIT_OBJECT_0 == WaitForSingleObject( Reader, INFINITE ) );
+
+	JphtLeaveReadEpoch( &Context.Epoch, Epoch );
+
+	TEST( CloseHandle( Reader ) );
+	TEST( CloseHandle( Synchronizer ) );
+	TEST( CloseHandle( Context.ReaderEntered ) );
+	TEST( CloseHandle( Context.ReaderMayLeave ) );
+}
+
+CFIX_BEGIN_FIXTURE( Epoch )
+	CFIX_FIXTURE_ENTRY( TestEpochSingleThreaded )
+	CFIX_FIXTURE_ENTRY( TestEpochWaitsForReaders )
+CFIX_END_FIXTURE()
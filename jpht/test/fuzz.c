@@ -0,0 +1,513 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include "typedhashtable.h"
+#include "oahashtable.h"
+
+#define TEST CFIX_ASSERT
+
+//
+// Differential fuzzer: Apply a random sequence of operations to both
+// a hashtable and a reference map (a plain array indexed by key) and
+// check that both always agree.
+//
+// Keys are drawn from a small range s.t. puts frequently replace
+// and removes frequently hit existing entries. Each round is run
+// with a good and a poor hash routine, the latter forcing long
+// chains/probe sequences.
+//
+// The seed is logged - to reproduce a failure, set FUZZ_SEED.
+//
+#define FUZZ_KEY_RANGE		512
+#define FUZZ_OPERATIONS		200000
+#define FUZZ_BATCH_SIZE		37
+#define FUZZ_SEED			0
+
+typedef struct _FUZZ_REFERENCE
+{
+	//
+	// Two entries per key s.t. replacing can be distinguished.
+	//
+	JPHT_HASHTABLE_ENTRY Entries[ FUZZ_KEY_RANGE ][ 2 ];
+
+	//
+	// Expected entry per key, NULL if absent.
+	//
+	PJPHT_HASHTABLE_ENTRY Expected[ FUZZ_KEY_RANGE ];
+	ULONG ExpectedCount;
+
+	ULONG Random;
+} FUZZ_REFERENCE, *PFUZZ_REFERENCE;
+
+typedef struct _FUZZ_ENUM_CONTEXT
+{
+	PFUZZ_REFERENCE Reference;
+	ULONG Count;
+	BOOLEAN Seen[ FUZZ_KEY_RANGE ];
+	BOOLEAN Remove;
+} FUZZ_ENUM_CONTEXT, *PFUZZ_ENUM_CONTEXT;
+
+static BOOLEAN FuzzUsePoorHash;
+
+static PVOID FuzzAllocate(
+	__in SIZE_T Size
+	)
+{
+	return malloc( Size );
+}
+
+static VOID FuzzFree(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static ULONG FuzzHash(
+	__in ULONG_PTR Key
+	)
+{
+	if ( FuzzUsePoorHash )
+	{
+		return ( ULONG ) Key % 7;
+	}
+	else
+	{
+		return ( ULONG ) Key * 2654435761U;
+	}
+}
+
+static BOOLEAN FuzzEquals(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+JPHT_DEFINE_TYPED_HASHTABLE( Fuzz, FuzzHash, FuzzEquals )
+
+static ULONG FuzzRandom(
+	__in PFUZZ_REFERENCE Reference
+	)
+{
+	Reference->Random ^= Reference->Random << 13;
+	Reference->Random ^= Reference->Random >> 17;
+	Reference->Random ^= Reference->Random << 5;
+	return Reference->Random;
+}
+
+static PFUZZ_REFERENCE FuzzCreateReference()
+{
+	PFUZZ_REFERENCE Reference;
+	ULONG Key;
+
+	Reference = ( PFUZZ_REFERENCE ) malloc( sizeof( FUZZ_REFERENCE ) );
+	CFIX_ASSUME( Reference != NULL );
+
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		Reference->Entries[ Key ][ 0 ].Key = Key;
+		Reference->Entries[ Key ][ 1 ].Key = Key;
+		Reference->Expected[ Key ] = NULL;
+	}
+
+	Reference->ExpectedCount = 0;
+#if FUZZ_SEED != 0
+	Reference->Random = FUZZ_SEED;
+#else
+	Reference->Random = GetTickCount() | 1;
+#endif
+
+	CFIX_LOG( L"Seed: 0x%08x", Reference->Random );
+
+	return Reference;
+}
+
+/*++
+	Routine Description:
+		Pick the entry to put for a key: the one currently not
+		in the table.
+--*/
+static PJPHT_HASHTABLE_ENTRY FuzzNextEntry(
+	__in PFUZZ_REFERENCE Reference,
+	__in ULONG Key
+	)
+{
+	return Reference->Expected[ Key ] == &Reference->Entries[ Key ][ 0 ]
+		? &Reference->Entries[ Key ][ 1 ]
+		: &Reference->Entries[ Key ][ 0 ];
+}
+
+static VOID FuzzReferencePut(
+	__in PFUZZ_REFERENCE Reference,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in PJPHT_HASHTABLE_ENTRY Old
+	)
+{
+	TEST( Old == Reference->Expected[ Entry->Key ] );
+	if ( Old == NULL )
+	{
+		Reference->ExpectedCount++;
+	}
+	Reference->Expected[ Entry->Key ] = Entry;
+}
+
+static VOID FuzzReferenceRemove(
+	__in PFUZZ_REFERENCE Reference,
+	__in ULONG Key,
+	__in PJPHT_HASHTABLE_ENTRY Old
+	)
+{
+	TEST( Old == Reference->Expected[ Key ] );
+	if ( Old != NULL )
+	{
+		Reference->ExpectedCount--;
+	}
+	Reference->Expected[ Key ] = NULL;
+}
+
+static VOID FuzzCheckEnumeratedEntry(
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in PFUZZ_ENUM_CONTEXT Context
+	)
+{
+	TEST( Entry->Key < FUZZ_KEY_RANGE );
+	TEST( Context->Reference->Expected[ Entry->Key ] == Entry );
+	TEST( ! Context->Seen[ Entry->Key ] );
+
+	Context->Seen[ Entry->Key ] = TRUE;
+	Context->Count++;
+}
+
+static VOID FuzzInitializeEnumContext(
+	__in PFUZZ_REFERENCE Reference,
+	__in BOOLEAN Remove,
+	__out PFUZZ_ENUM_CONTEXT Context
+	)
+{
+	ULONG Key;
+
+	Context->Reference = Reference;
+	Context->Count = 0;
+	Context->Remove = Remove;
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		Context->Seen[ Key ] = FALSE;
+	}
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Chained hashtable.
+ *
+ */
+
+static VOID FuzzEnumCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PFUZZ_ENUM_CONTEXT EnumContext = ( PFUZZ_ENUM_CONTEXT ) Context;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG Key = ( ULONG ) Entry->Key;
+
+	FuzzCheckEnumeratedEntry( Entry, EnumContext );
+
+	if ( EnumContext->Remove && Key % 3 == 0 )
+	{
+		JphtRemoveEntryHashtable( Hashtable, Key, &Old );
+		FuzzReferenceRemove( EnumContext->Reference, Key, Old );
+	}
+}
+
+static VOID FuzzCheckHashtable(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PFUZZ_REFERENCE Reference
+	)
+{
+	ULONG Key;
+
+	TEST( JphtGetEntryCountHashtable( Hashtable ) == Reference->ExpectedCount );
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		TEST( JphtGetEntryHashtable( Hashtable, Key ) ==
+			Reference->Expected[ Key ] );
+	}
+}
+
+static VOID FuzzHashtableRound(
+	__in PFUZZ_REFERENCE Reference
+	)
+{
+	JPHT_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG Operation;
+	ULONG Key;
+
+	TEST( FuzzInitializeHashtable( &Ht, FuzzAllocate, FuzzFree, 1 ) );
+
+	for ( Operation = 0; Operation < FUZZ_OPERATIONS; Operation++ )
+	{
+		ULONG Choice = FuzzRandom( Reference ) % 100;
+		Key = FuzzRandom( Reference ) % FUZZ_KEY_RANGE;
+
+		if ( Choice < 20 )
+		{
+			PJPHT_HASHTABLE_ENTRY Entry = FuzzNextEntry( Reference, Key );
+			JphtPutEntryHashtable( &Ht, Entry, &Old );
+			FuzzReferencePut( Reference, Entry, Old );
+		}
+		else if ( Choice < 40 )
+		{
+			PJPHT_HASHTABLE_ENTRY Entry = FuzzNextEntry( Reference, Key );
+			FuzzPutEntryHashtable( &Ht, Entry, &Old );
+			FuzzReferencePut( Reference, Entry, Old );
+		}
+		else if ( Choice < 50 )
+		{
+			JphtRemoveEntryHashtable( &Ht, Key, &Old );
+			FuzzReferenceRemove( Reference, Key, Old );
+		}
+		else if ( Choice < 60 )
+		{
+			FuzzRemoveEntryHashtable( &Ht, Key, &Old );
+			FuzzReferenceRemove( Reference, Key, Old );
+		}
+		else if ( Choice < 70 )
+		{
+			TEST( JphtGetEntryHashtable( &Ht, Key ) ==
+				Reference->Expected[ Key ] );
+		}
+		else if ( Choice < 80 )
+		{
+			TEST( FuzzGetEntryHashtable( &Ht, Key ) ==
+				Reference->Expected[ Key ] );
+		}
+		else if ( Choice < 90 )
+		{
+			ULONG_PTR Keys[ FUZZ_BATCH_SIZE ];
+			PJPHT_HASHTABLE_ENTRY Entries[ FUZZ_BATCH_SIZE ];
+			ULONG Count = FuzzRandom( Reference ) % FUZZ_BATCH_SIZE + 1;
+			ULONG Index;
+
+			for ( Index = 0; Index < Count; Index++ )
+			{
+				Keys[ Index ] = FuzzRandom( Reference ) % FUZZ_KEY_RANGE;
+			}
+
+			JphtGetEntriesHashtableBatch( &Ht, Keys, Count, Entries );
+
+			for ( Index = 0; Index < Count; Index++ )
+			{
+				TEST( Entries[ Index ] == Reference->Expected[ Keys[ Index ] ] );
+			}
+		}
+		else if ( Choice < 93 )
+		{
+			FUZZ_ENUM_CONTEXT Context;
+			BOOLEAN Remove = ( BOOLEAN ) ( FuzzRandom( Reference ) % 2 );
+			ULONG CountBefore = Reference->ExpectedCount;
+
+			FuzzInitializeEnumContext( Reference, Remove, &Context );
+			JphtEnumerateEntries( &Ht, FuzzEnumCallback, &Context );
+			TEST( Context.Count == CountBefore );
+		}
+		else if ( Choice < 96 )
+		{
+			ULONG BucketCount = FuzzRandom( Reference ) % 1024 + 1;
+			TEST( JphtResize( &Ht, BucketCount ) );
+			TEST( JphtGetBucketCountHashtable( &Ht ) == BucketCount );
+		}
+		else if ( Choice < 98 )
+		{
+			//
+			// Toggle automatic resizing.
+			//
+			if ( FuzzRandom( Reference ) % 2 )
+			{
+				JphtSetLoadFactorsHashtable(
+					&Ht,
+					JPHT_DEFAULT_GROW_LOAD_FACTOR,
+					JPHT_DEFAULT_SHRINK_LOAD_FACTOR );
+			}
+			else
+			{
+				JphtSetLoadFactorsHashtable( &Ht, 0, 0 );
+			}
+		}
+		else
+		{
+			FuzzCheckHashtable( &Ht, Reference );
+		}
+
+		TEST( JphtGetEntryCountHashtable( &Ht ) == Reference->ExpectedCount );
+	}
+
+	FuzzCheckHashtable( &Ht, Reference );
+
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		JphtRemoveEntryHashtable( &Ht, Key, &Old );
+		FuzzReferenceRemove( Reference, Key, Old );
+	}
+
+	TEST( JphtGetEntryCountHashtable( &Ht ) == 0 );
+	JphtDeleteHashtable( &Ht );
+}
+
+static void FuzzHashtable()
+{
+	PFUZZ_REFERENCE Reference = FuzzCreateReference();
+
+	FuzzUsePoorHash = FALSE;
+	FuzzHashtableRound( Reference );
+
+	FuzzUsePoorHash = TRUE;
+	FuzzHashtableRound( Reference );
+
+	free( Reference );
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Open addressing hashtable.
+ *
+ */
+
+static VOID FuzzOaEnumCallback(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PFUZZ_ENUM_CONTEXT EnumContext = ( PFUZZ_ENUM_CONTEXT ) Context;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG Key = ( ULONG ) Entry->Key;
+
+	FuzzCheckEnumeratedEntry( Entry, EnumContext );
+
+	if ( EnumContext->Remove && Key % 3 == 0 )
+	{
+		JphtRemoveEntryOaHashtable( Hashtable, Key, &Old );
+		FuzzReferenceRemove( EnumContext->Reference, Key, Old );
+	}
+}
+
+static VOID FuzzCheckOaHashtable(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PFUZZ_REFERENCE Reference
+	)
+{
+	ULONG Key;
+
+	TEST( JphtGetEntryCountOaHashtable( Hashtable ) == Reference->ExpectedCount );
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		TEST( JphtGetEntryOaHashtable( Hashtable, Key ) ==
+			Reference->Expected[ Key ] );
+	}
+}
+
+static VOID FuzzOaHashtableRound(
+	__in PFUZZ_REFERENCE Reference
+	)
+{
+	JPHT_OA_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG Operation;
+	ULONG Key;
+
+	TEST( JphtInitializeOaHashtable(
+		&Ht,
+		FuzzAllocate,
+		FuzzFree,
+		FuzzHash,
+		FuzzEquals,
+		1 ) );
+
+	for ( Operation = 0; Operation < FUZZ_OPERATIONS; Operation++ )
+	{
+		ULONG Choice = FuzzRandom( Reference ) % 100;
+		Key = FuzzRandom( Reference ) % FUZZ_KEY_RANGE;
+
+		if ( Choice < 40 )
+		{
+			PJPHT_HASHTABLE_ENTRY Entry = FuzzNextEntry( Reference, Key );
+			TEST( JphtPutEntryOaHashtable( &Ht, Entry, &Old ) );
+			FuzzReferencePut( Reference, Entry, Old );
+		}
+		else if ( Choice < 60 )
+		{
+			JphtRemoveEntryOaHashtable( &Ht, Key, &Old );
+			FuzzReferenceRemove( Reference, Key, Old );
+		}
+		else if ( Choice < 90 )
+		{
+			TEST( JphtGetEntryOaHashtable( &Ht, Key ) ==
+				Reference->Expected[ Key ] );
+		}
+		else if ( Choice < 93 )
+		{
+			FUZZ_ENUM_CONTEXT Context;
+			BOOLEAN Remove = ( BOOLEAN ) ( FuzzRandom( Reference ) % 2 );
+			ULONG CountBefore = Reference->ExpectedCount;
+
+			FuzzInitializeEnumContext( Reference, Remove, &Context );
+			JphtEnumerateEntriesOaHashtable( &Ht, FuzzOaEnumCallback, &Context );
+			TEST( Context.Count == CountBefore );
+		}
+		else if ( Choice < 98 )
+		{
+			//
+			// Resizing to fewer slots than entries must fail and
+			// leave the hashtable unchanged.
+			//
+			ULONG SlotCount = FuzzRandom( Reference ) % 2048 + 1;
+			BOOLEAN Resized = JphtResizeOaHashtable( &Ht, SlotCount );
+			if ( SlotCount >= FUZZ_KEY_RANGE * 2 )
+			{
+				TEST( Resized );
+			}
+			if ( Resized )
+			{
+				TEST( JphtGetSlotCountOaHashtable( &Ht ) >= SlotCount );
+			}
+		}
+		else
+		{
+			FuzzCheckOaHashtable( &Ht, Reference );
+		}
+
+		TEST( JphtGetEntryCountOaHashtable( &Ht ) == Reference->ExpectedCount );
+	}
+
+	FuzzCheckOaHashtable( &Ht, Reference );
+
+	for ( Key = 0; Key < FUZZ_KEY_RANGE; Key++ )
+	{
+		JphtRemoveEntryOaHashtable( &Ht, Key, &Old );
+		FuzzReferenceRemove( Reference, Key, Old );
+	}
+
+	TEST( JphtGetEntryCountOaHashtable( &Ht ) == 0 );
+	JphtDeleteOaHashtable( &Ht );
+}
+
+static void FuzzOaHashtable()
+{
+	PFUZZ_REFERENCE Reference = FuzzCreateReference();
+
+	FuzzUsePoorHash = FALSE;
+	FuzzOaHashtableRound( Reference );
+
+	FuzzUsePoorHash = TRUE;
+	FuzzOaHashtableRound( Reference );
+
+	free( Reference );
+}
+
+CFIX_BEGIN_FIXTURE( HashtableFuzz )
+	CFIX_FIXTURE_ENTRY( FuzzHashtable )
+	CFIX_FIXTURE_ENTRY( FuzzOaHashtable )
+CFIX_END_FIXTURE()
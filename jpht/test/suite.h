@@ -0,0 +1,255 @@
+//
+// Test suite shared by generic and specialized hashtable routines.
+//
+// Before including this file, define HashNumber, EqualsNumber and
+//
+//   SUITE_INITIALIZE( Ht, BucketCount )
+//   SUITE_PUT( Ht, Entry, Old )
+//   SUITE_GET( Ht, Key )
+//   SUITE_REMOVE( Ht, Key, Old )
+//
+// then add SUITE_FIXTURE_ENTRIES to a fixture.
+//
+
+#define SUITE_TEST_ENTRIES 2000
+
+static PVOID SuiteAllocate(
+	__in SIZE_T Size
+	)
+{
+	return malloc( Size );
+}
+
+static VOID SuiteFree(
+	__in PVOID Mem
+	)
+{
+	free( Mem );
+}
+
+static VOID SuiteCountCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PINT Count = ( PINT ) Context;
+	UNREFERENCED_PARAMETER( Hashtable );
+	UNREFERENCED_PARAMETER( Entry );
+	(*Count)++;
+}
+
+static VOID SuiteRemoveAndCountCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	PINT Count = ( PINT ) Context;
+	SUITE_REMOVE( Hashtable, Entry->Key, &OldEntry );
+	CFIX_ASSERT( OldEntry == Entry );
+	(*Count)++;
+}
+
+static void SuitePutGetRemove()
+{
+	JPHT_HASHTABLE Ht;
+	JPHT_HASHTABLE_ENTRY Foo;
+	JPHT_HASHTABLE_ENTRY Bar;
+	JPHT_HASHTABLE_ENTRY OtherFoo;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG HtSize;
+
+	Foo.Key = 1;
+	Bar.Key = 2;
+	OtherFoo.Key = 1;
+
+	for ( HtSize = 1; HtSize < 10; HtSize++ )
+	{
+		TEST( SUITE_INITIALIZE( &Ht, HtSize ) );
+
+		TEST( SUITE_GET( &Ht, Foo.Key ) == NULL );
+
+		SUITE_PUT( &Ht, &Foo, &Old );
+		TEST( Old == NULL );
+		SUITE_PUT( &Ht, &Bar, &Old );
+		TEST( Old == NULL );
+		TEST( JphtGetEntryCountHashtable( &Ht ) == 2 );
+
+		TEST( SUITE_GET( &Ht, Foo.Key ) == &Foo );
+		TEST( SUITE_GET( &Ht, Bar.Key ) == &Bar );
+
+		//
+		// Replace.
+		//
+		SUITE_PUT( &Ht, &OtherFoo, &Old );
+		TEST( Old == &Foo );
+		TEST( JphtGetEntryCountHashtable( &Ht ) == 2 );
+		TEST( SUITE_GET( &Ht, Foo.Key ) == &OtherFoo );
+
+		SUITE_REMOVE( &Ht, Foo.Key, &Old );
+		TEST( Old == &OtherFoo );
+		SUITE_REMOVE( &Ht, Foo.Key, &Old );
+		TEST( Old == NULL );
+		SUITE_REMOVE( &Ht, Bar.Key, &Old );
+		TEST( Old == &Bar );
+		TEST( JphtGetEntryCountHashtable( &Ht ) == 0 );
+
+		TEST( SUITE_GET( &Ht, Foo.Key ) == NULL );
+		TEST( SUITE_GET( &Ht, Bar.Key ) == NULL );
+
+		JphtDeleteHashtable( &Ht );
+	}
+}
+
+static void SuiteAutoResize()
+{
+	JPHT_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Entries;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG PeakBucketCount;
+	INT Count = 0;
+	ULONG Index;
+
+	Entries = ( PJPHT_HASHTABLE_ENTRY )
+		malloc( SUITE_TEST_ENTRIES * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	CFIX_ASSUME( Entries != NULL );
+
+	TEST( SUITE_INITIALIZE( &Ht, 3 ) );
+	JphtSetLoadFactorsHashtable(
+		&Ht,
+		JPHT_DEFAULT_GROW_LOAD_FACTOR,
+		JPHT_DEFAULT_SHRINK_LOAD_FACTOR );
+
+	//
+	// Grow. All entries must remain accessible while buckets
+	// are being migrated.
+	//
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES; Index++ )
+	{
+		Entries[ Index ].Key = Index;
+		SUITE_PUT( &Ht, &Entries[ Index ], &Old );
+		TEST( Old == NULL );
+
+		if ( Index % 97 == 0 )
+		{
+			ULONG Check;
+			for ( Check = 0; Check <= Index; Check++ )
+			{
+				TEST( SUITE_GET( &Ht, Check ) == &Entries[ Check ] );
+			}
+		}
+	}
+
+	TEST( JphtGetEntryCountHashtable( &Ht ) == SUITE_TEST_ENTRIES );
+	PeakBucketCount = JphtGetBucketCountHashtable( &Ht );
+	TEST( PeakBucketCount * JPHT_DEFAULT_GROW_LOAD_FACTOR >=
+		SUITE_TEST_ENTRIES * 100 / 2 );
+
+	//
+	// Replacing must not create duplicates.
+	//
+	SUITE_PUT( &Ht, &Entries[ 1 ], &Old );
+	TEST( Old == &Entries[ 1 ] );
+	TEST( JphtGetEntryCountHashtable( &Ht ) == SUITE_TEST_ENTRIES );
+
+	JphtEnumerateEntries( &Ht, SuiteCountCallback, &Count );
+	TEST( Count == SUITE_TEST_ENTRIES );
+
+	//
+	// Shrink.
+	//
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES - 10; Index++ )
+	{
+		SUITE_REMOVE( &Ht, Index, &Old );
+		TEST( Old == &Entries[ Index ] );
+	}
+
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES; Index++ )
+	{
+		TEST( SUITE_GET( &Ht, Index ) ==
+			( ( Index < SUITE_TEST_ENTRIES - 10 ) ? NULL : &Entries[ Index ] ) );
+	}
+
+	TEST( JphtGetBucketCountHashtable( &Ht ) < PeakBucketCount );
+	TEST( JphtGetBucketCountHashtable( &Ht ) >= 3 );
+
+	//
+	// Removing while enumerating must visit each entry exactly once.
+	//
+	Count = 0;
+	JphtEnumerateEntries( &Ht, SuiteRemoveAndCountCallback, &Count );
+	TEST( Count == 10 );
+	TEST( JphtGetEntryCountHashtable( &Ht ) == 0 );
+
+	JphtDeleteHashtable( &Ht );
+	free( Entries );
+}
+
+static void SuiteMixedAccess()
+{
+	JPHT_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Entries;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG Index;
+
+	Entries = ( PJPHT_HASHTABLE_ENTRY )
+		malloc( SUITE_TEST_ENTRIES * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	CFIX_ASSUME( Entries != NULL );
+
+	TEST( SUITE_INITIALIZE( &Ht, 3 ) );
+	JphtSetLoadFactorsHashtable(
+		&Ht,
+		JPHT_DEFAULT_GROW_LOAD_FACTOR,
+		JPHT_DEFAULT_SHRINK_LOAD_FACTOR );
+
+	//
+	// Alternate between routines under test and generic routines,
+	// both must observe the same table, also during migration.
+	//
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES; Index++ )
+	{
+		Entries[ Index ].Key = Index;
+		if ( Index % 2 )
+		{
+			SUITE_PUT( &Ht, &Entries[ Index ], &Old );
+		}
+		else
+		{
+			JphtPutEntryHashtable( &Ht, &Entries[ Index ], &Old );
+		}
+		TEST( Old == NULL );
+
+		TEST( SUITE_GET( &Ht, Index / 2 ) == &Entries[ Index / 2 ] );
+		TEST( JphtGetEntryHashtable( &Ht, Index ) == &Entries[ Index ] );
+	}
+
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES; Index++ )
+	{
+		if ( Index % 3 )
+		{
+			SUITE_REMOVE( &Ht, Index, &Old );
+		}
+		else
+		{
+			JphtRemoveEntryHashtable( &Ht, Index, &Old );
+		}
+		TEST( Old == &Entries[ Index ] );
+		TEST( JphtGetEntryHashtable( &Ht, Index ) == NULL );
+		TEST( SUITE_GET( &Ht, SUITE_TEST_ENTRIES - 1 ) ==
+			( ( Index < SUITE_TEST_ENTRIES - 1 )
+				? &Entries[ SUITE_TEST_ENTRIES - 1 ]
+				: NULL ) );
+	}
+
+	TEST( JphtGetEntryCountHashtable( &Ht ) == 0 );
+
+	JphtDeleteHashtable( &Ht );
+	free( Entries );
+}
+
+#define SUITE_FIXTURE_ENTRIES							\
+	CFIX_FIXTURE_ENTRY( SuitePutGetRemove )				\
+	CFIX_FIXTURE_ENTRY( SuiteAutoResize )				\
+	CFIX_FIXTURE_ENTRY( SuiteMixedAccess )
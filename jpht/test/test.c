@@ -1,6 +1,8 @@
 #include <cfix.h>
 #include <stdlib.h>
 #include "hashtable.h"
+#include "oahashtable.h"
+#include "slab.h"
 
 #define TEST CFIX_ASSERT
 
@@ -188,6 +190,419 @@ static void TestHashtable()
 	}
 }
 
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	return ( ULONG ) Key;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+//
+// Shared suite, run against the generic routines.
+//
+#define SUITE_INITIALIZE( Ht, BucketCount )						\
+	JphtInitializeHashtable(									\
+		Ht, SuiteAllocate, SuiteFree, HashNumber, EqualsNumber, BucketCount )
+#define SUITE_PUT( Ht, Entry, Old )	JphtPutEntryHashtable( Ht, Entry, Old )
+#define SUITE_GET( Ht, Key )		JphtGetEntryHashtable( Ht, Key )
+#define SUITE_REMOVE( Ht, Key, Old )	JphtRemoveEntryHashtable( Ht, Key, Old )
+
+#include "suite.h"
+
+static void TestHashtableBatchLookup()
+{
+	JPHT_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Entries;
+	PJPHT_HASHTABLE_ENTRY Old;
+	ULONG_PTR Keys[ 37 ];
+	PJPHT_HASHTABLE_ENTRY Results[ 37 ];
+	ULONG Round;
+	ULONG Index;
+
+	Entries = ( PJPHT_HASHTABLE_ENTRY ) 
+		malloc( SUITE_TEST_ENTRIES * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	CFIX_ASSUME( Entries != NULL );
+
+	TEST( JphtInitializeHashtable(
+		&Ht,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		7 ) );
+	JphtSetLoadFactorsHashtable( 
+		&Ht,
+		JPHT_DEFAULT_GROW_LOAD_FACTOR,
+		JPHT_DEFAULT_SHRINK_LOAD_FACTOR );
+
+	JphtGetEntriesHashtableBatch( &Ht, Keys, 0, Results );
+
+	//
+	// Odd key count to cover partial groups. Keys are looked up
+	// after each insertion s.t. some lookups happen while buckets
+	// are being migrated.
+	//
+	for ( Round = 0; Round < SUITE_TEST_ENTRIES; Round++ )
+	{
+		Entries[ Round ].Key = Round;
+		JphtPutEntryHashtable( &Ht, &Entries[ Round ], &Old );
+
+		for ( Index = 0; Index < _countof( Keys ); Index++ )
+		{
+			//
+			// Hits, misses and duplicates.
+			//
+			Keys[ Index ] = ( Round * 7 + Index * 13 ) % ( Round + 20 );
+		}
+
+		JphtGetEntriesHashtableBatch( &Ht, Keys, _countof( Keys ), Results );
+
+		for ( Index = 0; Index < _countof( Keys ); Index++ )
+		{
+			TEST( Results[ Index ] == JphtGetEntryHashtable( &Ht, Keys[ Index ] ) );
+			TEST( Results[ Index ] == 
+				( Keys[ Index ] <= Round ? &Entries[ Keys[ Index ] ] : NULL ) );
+		}
+	}
+
+	for ( Index = 0; Index < SUITE_TEST_ENTRIES; Index++ )
+	{
+		JphtRemoveEntryHashtable( &Ht, Index, &Old );
+	}
+
+	JphtDeleteHashtable( &Ht );
+	free( Entries );
+}
+
+/*----------------------------------------------------------------------
+ *
+ * Open addressing hashtable.
+ *
+ */
+
+static VOID OaEnumCallback(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PINT Count = ( PINT ) Context;
+	UNREFERENCED_PARAMETER( Hashtable );
+	UNREFERENCED_PARAMETER( Entry );
+	(*Count)++;
+}
+
+static VOID OaEnumRemoveCallback(
+	__in PJPHT_OA_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+	PINT Count = ( PINT ) Context;
+	JphtRemoveEntryOaHashtable( Hashtable, Entry->Key, &OldEntry );
+	CFIX_ASSERT( OldEntry == Entry );
+	(*Count)++;
+}
+
+static ULONG HashNumberPoorly(
+	__in ULONG_PTR Key
+	)
+{
+	//
+	// Provoke long probe sequences.
+	//
+	return ( ULONG ) ( Key % 7 );
+}
+
+static void TestOaHashtable()
+{
+	JPHT_OA_HASHTABLE Ht;
+	PTEST_ENTRY Old;
+	TEST_ENTRY Foo;
+	TEST_ENTRY Bar;
+	ULONG HtSize;
+
+	Foo.Base.Key = ( ULONG_PTR ) L"Foo";
+	Foo.Value = L"Val(Foo)";
+
+	Bar.Base.Key = ( ULONG_PTR ) L"Bar11111";
+	Bar.Value = L"Val(Bar)";
+
+	for ( HtSize = 1; HtSize < 10; HtSize++ )
+	{
+		INT Count = 0;
+		TEST( JphtInitializeOaHashtable(
+			&Ht,
+			Allocate,
+			Free,
+			HashString,
+			EqualsString,
+			HtSize ) );
+
+		TEST( JphtGetEntryOaHashtable(
+			&Ht,
+			( ULONG_PTR ) L"Baz" ) == NULL );
+
+		TEST( JphtPutEntryOaHashtable(
+			&Ht,
+			&Foo.Base,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old ) );
+		TEST( Old == NULL );
+		TEST( JphtPutEntryOaHashtable(
+			&Ht,
+			&Bar.Base,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old ) );
+		TEST( Old == NULL );
+		TEST( JphtGetEntryCountOaHashtable( &Ht ) == 2 );
+
+		JphtEnumerateEntriesOaHashtable( &Ht, OaEnumCallback, &Count );
+		TEST( Count == 2 );
+
+		TEST( JphtResizeOaHashtable( &Ht, HtSize * 16 ) );
+		TEST( JphtGetSlotCountOaHashtable( &Ht ) >= HtSize * 16 );
+
+		TEST( JphtPutEntryOaHashtable(
+			&Ht,
+			&Foo.Base,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old ) );
+		TEST( Old == &Foo );
+
+		TEST( ( PTEST_ENTRY ) JphtGetEntryOaHashtable(
+			&Ht,
+			Foo.Base.Key ) == &Foo );
+		TEST( ( PTEST_ENTRY ) JphtGetEntryOaHashtable(
+			&Ht,
+			Bar.Base.Key ) == &Bar );
+
+		JphtRemoveEntryOaHashtable(
+			&Ht,
+			Foo.Base.Key,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old );
+		TEST( Old == &Foo );
+		JphtRemoveEntryOaHashtable(
+			&Ht,
+			Bar.Base.Key,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old );
+		TEST( Old == &Bar );
+		TEST( JphtGetEntryCountOaHashtable( &Ht ) == 0 );
+
+		JphtRemoveEntryOaHashtable(
+			&Ht,
+			Foo.Base.Key,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old );
+		TEST( Old == NULL );
+
+		TEST( JphtPutEntryOaHashtable(
+			&Ht,
+			&Foo.Base,
+			( PJPHT_HASHTABLE_ENTRY* ) &Old ) );
+		Count = 0;
+		JphtEnumerateEntriesOaHashtable( &Ht, OaEnumRemoveCallback, &Count );
+		TEST( Count == 1 );
+
+		JphtDeleteOaHashtable( &Ht );
+	}
+}
+
+#define OA_TEST_ENTRIES 1000
+
+static void TestOaHashtableCollisions()
+{
+	JPHT_OA_HASHTABLE Ht;
+	PJPHT_HASHTABLE_ENTRY Entries;
+	PJPHT_HASHTABLE_ENTRY Old;
+	INT Count = 0;
+	ULONG Index;
+
+	Entries = ( PJPHT_HASHTABLE_ENTRY ) 
+		malloc( OA_TEST_ENTRIES * sizeof( JPHT_HASHTABLE_ENTRY ) );
+	CFIX_ASSUME( Entries != NULL );
+
+	TEST( JphtInitializeOaHashtable(
+		&Ht,
+		Allocate,
+		Free,
+		HashNumberPoorly,
+		EqualsNumber,
+		1 ) );
+
+	//
+	// Table grows automatically.
+	//
+	for ( Index = 0; Index < OA_TEST_ENTRIES; Index++ )
+	{
+		Entries[ Index ].Key = Index;
+		TEST( JphtPutEntryOaHashtable( &Ht, &Entries[ Index ], &Old ) );
+		TEST( Old == NULL );
+	}
+
+	TEST( JphtGetEntryCountOaHashtable( &Ht ) == OA_TEST_ENTRIES );
+
+	//
+	// Remove every other entry - backward shifting must retain
+	// all other entries.
+	//
+	for ( Index = 0; Index < OA_TEST_ENTRIES; Index += 2 )
+	{
+		JphtRemoveEntryOaHashtable( &Ht, Index, &Old );
+		TEST( Old == &Entries[ Index ] );
+	}
+
+	for ( Index = 0; Index < OA_TEST_ENTRIES; Index++ )
+	{
+		TEST( JphtGetEntryOaHashtable( &Ht, Index ) == 
+			( ( Index % 2 ) ? &Entries[ Index ] : NULL ) );
+	}
+
+	//
+	// Removing while enumerating must visit each entry exactly once.
+	//
+	JphtEnumerateEntriesOaHashtable( &Ht, OaEnumRemoveCallback, &Count );
+	TEST( Count == OA_TEST_ENTRIES / 2 );
+	TEST( JphtGetEntryCountOaHashtable( &Ht ) == 0 );
+
+	JphtDeleteOaHashtable( &Ht );
+	free( Entries );
+}
+
+static VOID SlabEnumRemoveCallback(
+	__in PJPHT_HASHTABLE Hashtable,
+	__in PJPHT_HASHTABLE_ENTRY Entry,
+	__in_opt PVOID Context
+	)
+{
+	PJPHT_SLAB_ALLOCATOR Allocator = ( PJPHT_SLAB_ALLOCATOR ) Context;
+	PJPHT_HASHTABLE_ENTRY OldEntry;
+
+	JphtRemoveEntryHashtable( Hashtable, Entry->Key, &OldEntry );
+	CFIX_ASSERT( OldEntry == Entry );
+	JphtFreeSlabObject( Allocator, CONTAINING_RECORD( Entry, TEST_ENTRY, Base ) );
+}
+
+#define SLAB_TEST_OBJECTS 1000
+
+static void TestSlabAllocator()
+{
+	JPHT_SLAB_ALLOCATOR Allocator;
+	JPHT_HASHTABLE Ht;
+	PTEST_ENTRY Entries[ SLAB_TEST_OBJECTS ];
+	PJPHT_HASHTABLE_ENTRY Old;
+	PVOID Large;
+	ULONG ExpectedSlabs;
+	ULONG Index;
+
+	JphtInitializeSlabAllocator( 
+		&Allocator, 
+		Allocate, 
+		Free, 
+		sizeof( TEST_ENTRY ), 
+		0 );
+	TEST( JphtGetSlabCountSlabAllocator( &Allocator ) == 0 );
+	TEST( JphtInitializeHashtable(
+		&Ht,
+		Allocate,
+		Free,
+		HashNumber,
+		EqualsNumber,
+		31 ) );
+
+	for ( Index = 0; Index < SLAB_TEST_OBJECTS; Index++ )
+	{
+		ULONG Other;
+
+		Entries[ Index ] = ( PTEST_ENTRY ) JphtAllocateSlabObject( &Allocator );
+		TEST( Entries[ Index ] != NULL );
+		TEST( ( ULONG_PTR ) Entries[ Index ] % MEMORY_ALLOCATION_ALIGNMENT == 0 );
+
+		//
+		// Objects must not overlap.
+		//
+		for ( Other = 0; Other < Index; Other++ )
+		{
+			TEST( ( PUCHAR ) ( Entries[ Other ] + 1 ) <= ( PUCHAR ) Entries[ Index ] ||
+				  ( PUCHAR ) ( Entries[ Index ] + 1 ) <= ( PUCHAR ) Entries[ Other ] );
+		}
+
+		Entries[ Index ]->Base.Key = Index;
+		JphtPutEntryHashtable( &Ht, &Entries[ Index ]->Base, &Old );
+		TEST( Old == NULL );
+	}
+
+	TEST( JphtGetObjectCountSlabAllocator( &Allocator ) == SLAB_TEST_OBJECTS );
+	ExpectedSlabs = 
+		( SLAB_TEST_OBJECTS + Allocator.Geometry.ObjectsPerSlab - 1 ) /
+		Allocator.Geometry.ObjectsPerSlab;
+	TEST( JphtGetSlabCountSlabAllocator( &Allocator ) == ExpectedSlabs );
+
+	//
+	// Freed objects are reused before allocating new slabs.
+	//
+	for ( Index = 0; Index < SLAB_TEST_OBJECTS; Index += 2 )
+	{
+		JphtRemoveEntryHashtable( &Ht, Index, &Old );
+		TEST( Old == &Entries[ Index ]->Base );
+		JphtFreeSlabObject( &Allocator, Entries[ Index ] );
+	}
+
+	for ( Index = 0; Index < SLAB_TEST_OBJECTS; Index += 2 )
+	{
+		Entries[ Index ] = ( PTEST_ENTRY ) JphtAllocateSlabObject( &Allocator );
+		TEST( Entries[ Index ] != NULL );
+		Entries[ Index ]->Base.Key = Index;
+		JphtPutEntryHashtable( &Ht, &Entries[ Index ]->Base, &Old );
+		TEST( Old == NULL );
+	}
+
+	TEST( JphtGetSlabCountSlabAllocator( &Allocator ) == ExpectedSlabs );
+
+	for ( Index = 0; Index < SLAB_TEST_OBJECTS; Index++ )
+	{
+		TEST( JphtGetEntryHashtable( &Ht, Index ) == &Entries[ Index ]->Base );
+	}
+
+	JphtEnumerateEntries( &Ht, SlabEnumRemoveCallback, &Allocator );
+	TEST( JphtGetEntryCountHashtable( &Ht ) == 0 );
+	TEST( JphtGetObjectCountSlabAllocator( &Allocator ) == 0 );
+
+	JphtDeleteHashtable( &Ht );
+	JphtDeleteSlabAllocator( &Allocator );
+
+	//
+	// Objects larger than the slab size get a slab each.
+	//
+	JphtInitializeSlabAllocator( &Allocator, Allocate, Free, 5000, 0 );
+	Large = JphtAllocateSlabObject( &Allocator );
+	TEST( Large != NULL );
+	memset( Large, 0, 5000 );
+	TEST( JphtAllocateSlabObject( &Allocator ) != NULL );
+	TEST( JphtGetSlabCountSlabAllocator( &Allocator ) == 2 );
+
+	//
+	// Outstanding objects are released with the allocator.
+	//
+	JphtDeleteSlabAllocator( &Allocator );
+}
+
 CFIX_BEGIN_FIXTURE( Hashtable )
 	CFIX_FIXTURE_ENTRY( TestHashtable )
+	SUITE_FIXTURE_ENTRIES
+	CFIX_FIXTURE_ENTRY( TestHashtableBatchLookup )
+CFIX_END_FIXTURE()
+
+CFIX_BEGIN_FIXTURE( OaHashtable )
+	CFIX_FIXTURE_ENTRY( TestOaHashtable )
+	CFIX_FIXTURE_ENTRY( TestOaHashtableCollisions )
+CFIX_END_FIXTURE()
+
+CFIX_BEGIN_FIXTURE( SlabAllocator )
+	CFIX_FIXTURE_ENTRY( TestSlabAllocator )
 CFIX_END_FIXTURE()
\ No newline at end of file
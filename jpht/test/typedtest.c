@@ -0,0 +1,37 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include "typedhashtable.h"
+
+#define TEST CFIX_ASSERT
+
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	return ( ULONG ) Key;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+JPHT_DEFINE_TYPED_HASHTABLE( Number, HashNumber, EqualsNumber )
+
+//
+// Shared suite, run against the macro-generated routines.
+//
+#define SUITE_INITIALIZE( Ht, BucketCount )						\
+	NumberInitializeHashtable( Ht, SuiteAllocate, SuiteFree, BucketCount )
+#define SUITE_PUT( Ht, Entry, Old )	NumberPutEntryHashtable( Ht, Entry, Old )
+#define SUITE_GET( Ht, Key )		NumberGetEntryHashtable( Ht, Key )
+#define SUITE_REMOVE( Ht, Key, Old )	NumberRemoveEntryHashtable( Ht, Key, Old )
+
+#include "suite.h"
+
+CFIX_BEGIN_FIXTURE( TypedHashtable )
+	SUITE_FIXTURE_ENTRIES
+CFIX_END_FIXTURE()
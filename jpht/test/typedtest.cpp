@@ -0,0 +1,54 @@
+#include <cfix.h>
+#include <stdlib.h>
+#include "typedhashtable.h"
+
+#define TEST CFIX_ASSERT
+
+static ULONG HashNumber(
+	__in ULONG_PTR Key
+	)
+{
+	return ( ULONG ) Key;
+}
+
+static BOOLEAN EqualsNumber(
+	__in ULONG_PTR KeyLhs,
+	__in ULONG_PTR KeyRhs
+	)
+{
+	return ( BOOLEAN ) ( KeyLhs == KeyRhs );
+}
+
+struct NumberTraits
+{
+	static ULONG Hash( __in ULONG_PTR Key )
+	{
+		return HashNumber( Key );
+	}
+
+	static BOOLEAN Equals( __in ULONG_PTR KeyLhs, __in ULONG_PTR KeyRhs )
+	{
+		return EqualsNumber( KeyLhs, KeyRhs );
+	}
+};
+
+typedef JphtTypedHashtable< NumberTraits > NumberHashtable;
+
+//
+// Shared suite, run against the template-generated routines.
+//
+#define SUITE_INITIALIZE( Ht, BucketCount )						\
+	NumberHashtable::InitializeHashtable(						\
+		Ht, SuiteAllocate, SuiteFree, BucketCount )
+#define SUITE_PUT( Ht, Entry, Old )								\
+	NumberHashtable::PutEntryHashtable( Ht, Entry, Old )
+#define SUITE_GET( Ht, Key )									\
+	NumberHashtable::GetEntryHashtable( Ht, Key )
+#define SUITE_REMOVE( Ht, Key, Old )							\
+	NumberHashtable::RemoveEntryHashtable( Ht, Key, Old )
+
+#include "suite.h"
+
+CFIX_BEGIN_FIXTURE( TypedHashtableTemplate )
+	SUITE_FIXTURE_ENTRIES
+CFIX_END_FIXTURE()